@@ -87,6 +87,7 @@
 #include <math.h>
 #include "builtin_functions.h"
 #include "util/hash_table.h"
+#include "util/set.h"
 
 #ifndef M_PIf
 #define M_PIf   ((float) M_PI)
@@ -1127,8 +1128,10 @@ namespace {
  * builtin_builder: A singleton object representing the core of the built-in
  * function module.
  *
- * It generates IR for every built-in function signature, and organizes them
- * into functions.
+ * It generates IR for the built-in function signatures, and organizes them
+ * into functions.  Functions are only generated the first time something
+ * looks them up by name, as most shaders only call a handful of the several
+ * thousand built-in signatures.
  */
 class builtin_builder {
 public:
@@ -1142,11 +1145,14 @@ public:
    ir_function_signature *find(_mesa_glsl_parse_state *state,
                                const char *name, exec_list *actual_parameters);
 
+   /** Look up a built-in function, generating it if needed. */
+   ir_function *get_function(const char *name);
+
    /**
-    * A shader to hold all the built-in signatures; created by this module.
+    * A shader to hold the built-in signatures; created by this module.
     *
-    * This includes signatures for every built-in, regardless of version or
-    * enabled extensions.  The availability predicate associated with each
+    * This includes the signatures of every built-in function generated so
+    * far, regardless of version or enabled extensions.  The availability predicate associated with each
     * signature allows matching_signature() to filter out the irrelevant ones.
     */
    gl_shader *shader;
@@ -1154,6 +1160,20 @@ public:
 private:
    void *mem_ctx;
 
+   /**
+    * Names of all the built-in functions and intrinsics, of the ones
+    * generated so far, and of the one being generated by create_intrinsics()
+    * and create_builtins().  While \c collecting is set, those only record
+    * the names into \c builtin_names.
+    */
+   struct set *builtin_names;
+   struct set *built_names;
+   const char *building;
+   bool collecting;
+
+   void build(const char *name);
+   bool wants_function(const char *name);
+
    void create_shader();
    void create_intrinsics();
    void create_builtins();
@@ -1598,6 +1618,10 @@ builtin_builder::builtin_builder()
    : shader(NULL)
 {
    mem_ctx = NULL;
+   builtin_names = NULL;
+   built_names = NULL;
+   building = NULL;
+   collecting = false;
 }
 
 builtin_builder::~builtin_builder()
@@ -1626,7 +1650,7 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
     */
    state->uses_builtin_functions = true;
 
-   ir_function *f = shader->symbols->get_function(name);
+   ir_function *f = get_function(name);
    if (f == NULL)
       return NULL;
 
@@ -1651,9 +1675,20 @@ builtin_builder::initialize()
    glsl_type_singleton_init_or_ref();
 
    mem_ctx = ralloc_context(NULL);
+   builtin_names = _mesa_set_create(mem_ctx, _mesa_hash_string,
+                                    _mesa_key_string_equal);
+   built_names = _mesa_set_create(mem_ctx, _mesa_hash_string,
+                                  _mesa_key_string_equal);
    create_shader();
+
+   /* Walk the lists once to learn which names are built-in, without
+    * generating anything, so that looking up any other name is only a
+    * set search and doesn't leave anything behind.
+    */
+   collecting = true;
    create_intrinsics();
    create_builtins();
+   collecting = false;
 }
 
 void
@@ -1661,6 +1696,8 @@ builtin_builder::release()
 {
    ralloc_free(mem_ctx);
    mem_ctx = NULL;
+   builtin_names = NULL;
+   built_names = NULL;
 
    ralloc_free(shader);
    shader = NULL;
@@ -1679,6 +1716,49 @@ builtin_builder::create_shader()
    shader->symbols = new(mem_ctx) glsl_symbol_table;
 }
 
+/**
+ * Generate the built-in function (or intrinsic) \p name, if there is one and
+ * it wasn't generated yet.
+ *
+ * This runs through the lists in create_intrinsics() and create_builtins(),
+ * only creating the signatures of the functions named \p name.  Generating
+ * a function may look up, and so generate, the intrinsics it calls.
+ */
+void
+builtin_builder::build(const char *name)
+{
+   struct set_entry *entry = _mesa_set_search(builtin_names, name);
+   if (entry == NULL || _mesa_set_search(built_names, entry->key))
+      return;
+
+   _mesa_set_add(built_names, entry->key);
+
+   const char *outer = building;
+   building = name;
+   create_intrinsics();
+   create_builtins();
+   building = outer;
+}
+
+bool
+builtin_builder::wants_function(const char *name)
+{
+   if (collecting) {
+      if (!_mesa_set_search(builtin_names, name))
+         _mesa_set_add(builtin_names, ralloc_strdup(mem_ctx, name));
+      return false;
+   }
+
+   return building != NULL && strcmp(name, building) == 0;
+}
+
+ir_function *
+builtin_builder::get_function(const char *name)
+{
+   build(name);
+   return shader->symbols->get_function(name);
+}
+
 /** @} */
 
 #define FIU(func, ...) \
@@ -1737,6 +1817,13 @@ builtin_builder::create_shader()
    func(&glsl_type_builtin_bvec3, ##__VA_ARGS__), \
    func(&glsl_type_builtin_bvec4, ##__VA_ARGS__)
 
+/**
+ * Only evaluate the signature generators of the functions build() asked
+ * for.  The arguments of the calls skipped this way are never evaluated.
+ */
+#define add_function(name, ...) \
+   if (!wants_function(name)) ; else (add_function)(name, __VA_ARGS__)
+
 /**
  * Create ir_function and ir_function_signature objects for each
  * intrinsic.
@@ -5992,6 +6079,8 @@ builtin_builder::create_builtins()
 #undef FIU2_MIXED
 }
 
+#undef add_function
+
 void
 builtin_builder::add_function(const char *name, ...)
 {
@@ -6062,6 +6151,9 @@ builtin_builder::add_image_function(const char *name,
       &glsl_type_builtin_uimage2DMSArray
    };
 
+   if (!wants_function(name))
+      return;
+
    ir_function *f = new(mem_ctx) ir_function(name);
 
    for (unsigned i = 0; i < ARRAY_SIZE(types); ++i) {
@@ -7779,7 +7871,7 @@ builtin_builder::_is_sparse_texels_resident(void)
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
    ir_function *f =
-      shader->symbols->get_function("__intrinsic_is_sparse_texels_resident");
+      get_function("__intrinsic_is_sparse_texels_resident");
 
    body.emit(call(f, retval, sig->parameters));
    body.emit(ret(retval));
@@ -8630,7 +8722,7 @@ builtin_builder::_atomic_counter_op(const char *intrinsic,
    MAKE_SIG(&glsl_type_builtin_uint, avail, 1, counter);
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_uint, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8661,7 +8753,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
       parameters.push_tail(new(mem_ctx) ir_dereference_variable(neg_data));
 
       ir_function *const func =
-         shader->symbols->get_function("__intrinsic_atomic_add");
+         get_function("__intrinsic_atomic_add");
       ir_instruction *const c = call(func, retval, parameters);
 
       assert(c != NULL);
@@ -8669,7 +8761,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
 
       body.emit(c);
    } else {
-      body.emit(call(shader->symbols->get_function(intrinsic), retval,
+      body.emit(call(get_function(intrinsic), retval,
                      sig->parameters));
    }
 
@@ -8687,7 +8779,7 @@ builtin_builder::_atomic_counter_op2(const char *intrinsic,
    MAKE_SIG(&glsl_type_builtin_uint, avail, 3, counter, compare, data);
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_uint, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8705,7 +8797,7 @@ builtin_builder::_atomic_op2(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8724,7 +8816,7 @@ builtin_builder::_atomic_op3(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8942,7 +9034,7 @@ builtin_builder::_image(image_prototype_ctr prototype,
 
    if (flags & IMAGE_FUNCTION_EMIT_STUB) {
       ir_factory body(&sig->body, mem_ctx);
-      ir_function *f = shader->symbols->get_function(intrinsic_name);
+      ir_function *f = get_function(intrinsic_name);
 
       if (flags & IMAGE_FUNCTION_RETURNS_VOID) {
          body.emit(call(f, NULL, sig->parameters));
@@ -8999,7 +9091,7 @@ builtin_builder::_memory_barrier(const char *intrinsic_name,
                                  builtin_available_predicate avail)
 {
    MAKE_SIG(&glsl_type_builtin_void, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -9020,7 +9112,7 @@ builtin_builder::_ballot(const glsl_type *type, builtin_available_predicate avai
    MAKE_SIG(type, avail, 1, value);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_ballot"),
+   body.emit(call(get_function("__intrinsic_ballot"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9042,7 +9134,7 @@ builtin_builder::_inverse_ballot()
    MAKE_SIG(&glsl_type_builtin_bool, ballot_khr, 1, value);
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_inverse_ballot"),
+   body.emit(call(get_function("__intrinsic_inverse_ballot"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9068,7 +9160,7 @@ builtin_builder::_ballot_bit_extract()
    MAKE_SIG(&glsl_type_builtin_bool, ballot_khr, 2, value, index);
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_ballot_bit_extract"),
+   body.emit(call(get_function("__intrinsic_ballot_bit_extract"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9090,7 +9182,7 @@ builtin_builder::_ballot_bit(const char *intrinsic_name)
    MAKE_SIG(&glsl_type_builtin_uint, ballot_khr, 1, value);
    ir_variable *retval = body.make_temp(&glsl_type_builtin_uint, "retval");
 
-   body.emit(call(shader->symbols->get_function(intrinsic_name), retval, sig->parameters));
+   body.emit(call(get_function(intrinsic_name), retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
 }
@@ -9113,7 +9205,7 @@ builtin_builder::_read_first_invocation(const glsl_type *type, builtin_available
    MAKE_SIG(type, avail, 1, value);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_first_invocation"),
+   body.emit(call(get_function("__intrinsic_read_first_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9139,7 +9231,7 @@ builtin_builder::_read_invocation(const glsl_type *type, builtin_available_predi
    MAKE_SIG(type, avail, 2, value, invocation);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_invocation"),
+   body.emit(call(get_function("__intrinsic_read_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9158,7 +9250,7 @@ builtin_builder::_invocation_interlock(const char *intrinsic_name,
                                        builtin_available_predicate avail)
 {
    MAKE_SIG(&glsl_type_builtin_void, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -9179,7 +9271,7 @@ builtin_builder::_shader_clock(builtin_available_predicate avail,
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_uvec2, "clock_retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shader_clock"),
+   body.emit(call(get_function("__intrinsic_shader_clock"),
                   retval, sig->parameters));
 
    if (type == &glsl_type_builtin_uint64_t) {
@@ -9212,7 +9304,7 @@ builtin_builder::_vote(const glsl_type *type,
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
 
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9233,7 +9325,7 @@ builtin_builder::_helper_invocation()
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_helper_invocation"),
+   body.emit(call(get_function("__intrinsic_helper_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
 
@@ -9253,7 +9345,7 @@ builtin_builder::_subgroup_barrier(const char *intrinsic_name,
                                    builtin_available_predicate avail)
 {
    MAKE_SIG(&glsl_type_builtin_void, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name), NULL, sig->parameters));
+   body.emit(call(get_function(intrinsic_name), NULL, sig->parameters));
    return sig;
 }
 
@@ -9271,7 +9363,7 @@ builtin_builder::_elect()
 
    ir_variable *retval = body.make_temp(&glsl_type_builtin_bool, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_elect"), retval, sig->parameters));
+   body.emit(call(get_function("__intrinsic_elect"), retval, sig->parameters));
    body.emit(ret(retval));
 
    return sig;
@@ -9299,7 +9391,7 @@ builtin_builder::_shuffle(const glsl_type *type)
 
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shuffle"), retval, sig->parameters));
+   body.emit(call(get_function("__intrinsic_shuffle"), retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
 }
@@ -9326,7 +9418,7 @@ builtin_builder::_shuffle_xor(const glsl_type *type)
 
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shuffle_xor"),
+   body.emit(call(get_function("__intrinsic_shuffle_xor"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9353,7 +9445,7 @@ builtin_builder::_shuffle_up(const glsl_type *type)
             2, value, delta);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shuffle_up"),
+   body.emit(call(get_function("__intrinsic_shuffle_up"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9380,7 +9472,7 @@ builtin_builder::_shuffle_down(const glsl_type *type)
             2, value, delta);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shuffle_down"),
+   body.emit(call(get_function("__intrinsic_shuffle_down"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9404,7 +9496,7 @@ builtin_builder::_subgroup_arithmetic(const glsl_type *type, const char *intrins
             1, value);
 
    ir_variable *retval = body.make_temp(type, "retval");
-   body.emit(call(shader->symbols->get_function(intrinsic_name), retval, sig->parameters));
+   body.emit(call(get_function(intrinsic_name), retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
 }
@@ -9433,7 +9525,7 @@ builtin_builder::_subgroup_clustered(const glsl_type *type, const char *intrinsi
             2, value, size);
 
    ir_variable *retval = body.make_temp(type, "retval");
-   body.emit(call(shader->symbols->get_function(intrinsic_name), retval, sig->parameters));
+   body.emit(call(get_function(intrinsic_name), retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
 }
@@ -9459,7 +9551,7 @@ builtin_builder::_quad_broadcast(const glsl_type *type)
             2, value, id);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_quad_broadcast"),
+   body.emit(call(get_function("__intrinsic_quad_broadcast"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -9483,7 +9575,7 @@ builtin_builder::_quad_swap(const glsl_type *type, const char *intrinsic_name)
             1, value);
 
    ir_variable *retval = body.make_temp(type, "retval");
-   body.emit(call(shader->symbols->get_function(intrinsic_name), retval, sig->parameters));
+   body.emit(call(get_function(intrinsic_name), retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
 }
@@ -9537,7 +9629,7 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    ir_function *f;
    bool ret = false;
    simple_mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   f = builtins.get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
          if (sig->is_builtin_available(state)) {
@@ -9551,10 +9643,19 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    return ret;
 }
 
-gl_shader *
-_mesa_glsl_get_builtin_function_shader()
+/**
+ * Get every signature of a built-in function, whether available to the
+ * shader or not.  The function doesn't change once it was generated.
+ */
+ir_function *
+_mesa_glsl_get_builtin_function(const char *name)
 {
-   return builtins.shader;
+   ir_function *f;
+   simple_mtx_lock(&builtins_lock);
+   f = builtins.get_function(name);
+   simple_mtx_unlock(&builtins_lock);
+
+   return f;
 }
 
 
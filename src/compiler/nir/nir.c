@@ -201,6 +201,7 @@ nir_shader_create(void *mem_ctx,
 #ifndef NDEBUG
    nir_process_debug_variable();
 #endif
+   nir_pass_profile_init();
 
    exec_list_make_empty(&shader->variables);
 
@@ -559,6 +560,7 @@ nir_function_impl_create_bare(nir_shader *shader)
    impl->num_blocks = 0;
    impl->valid_metadata = nir_metadata_none;
    impl->structured = true;
+   impl->algebraic_fixed_points = NULL;
 
    /* create start & end blocks */
    nir_block *start_block = nir_block_create(shader);
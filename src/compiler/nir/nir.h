@@ -3489,6 +3489,12 @@ typedef struct {
    bool structured;
 
    nir_metadata valid_metadata;
+
+   /**
+    * Fixed points of algebraic passes, if
+    * nir_shader_compiler_options::incremental_algebraic is set.
+    */
+   struct nir_algebraic_fixed_point *algebraic_fixed_points;
 } nir_function_impl;
 
 #define nir_foreach_function_temp_variable(var, impl) \
@@ -4384,6 +4390,20 @@ typedef struct nir_shader_compiler_options {
    /** Whether derivative intrinsics must be scalarized. */
    bool scalarize_ddx;
 
+   /**
+    * Have algebraic passes remember the last fixed point they reached on
+    * each function, so that running them again only revisits instructions
+    * which changed since then, and the ones depending on them.  This saves
+    * compile time in optimization loops on large shaders, at the cost of a
+    * word per SSA value and algebraic pass.
+    *
+    * Changes are detected with hashes of instruction and value addresses.
+    * A collision leaves an optimization unapplied, so the generated code
+    * may differ from one run to the next.  Only enable this where
+    * reproducible output doesn't matter.
+    */
+   bool incremental_algebraic;
+
    /** Options determining lowering and behavior of inputs and outputs. */
    nir_io_options io_options;
 
@@ -5330,11 +5350,53 @@ should_print_nir(UNUSED nir_shader *shader)
       }                                                                 \
    } while (0)
 
+/** Whether NIR_PASS_PROFILE is set, see nir_pass_profile.c */
+extern bool nir_pass_profile_enabled;
+
+/** State of one pass invocation being profiled */
+typedef struct {
+   int64_t start_ns;
+   unsigned num_instrs;
+   size_t mem_size;
+} nir_pass_profile_scope;
+
+void nir_pass_profile_init(void);
+void nir_pass_profile_dump(FILE *fp);
+void nir_pass_profile_begin_slow(nir_pass_profile_scope *scope,
+                                 nir_shader *shader, const char *pass);
+void nir_pass_profile_end_slow(nir_pass_profile_scope *scope,
+                               nir_shader *shader, const char *pass,
+                               const char *file, int progress);
+
+static inline void
+nir_pass_profile_begin(nir_pass_profile_scope *scope, nir_shader *shader,
+                       const char *pass)
+{
+   if (unlikely(nir_pass_profile_enabled))
+      nir_pass_profile_begin_slow(scope, shader, pass);
+}
+
+/**
+ * \param progress  whether the pass made progress, or -1 if unknown
+ */
+static inline void
+nir_pass_profile_end(nir_pass_profile_scope *scope, nir_shader *shader,
+                     const char *pass, const char *file, int progress)
+{
+   if (unlikely(nir_pass_profile_enabled))
+      nir_pass_profile_end_slow(scope, shader, pass, file, progress);
+}
+
 #define NIR_PASS(progress, nir, pass, ...) _PASS(pass, nir, {   \
+   nir_pass_profile_scope _profile;                             \
    nir_metadata_set_validation_flag(nir);                       \
    if (should_print_nir(nir))                                   \
       printf("%s\n", #pass);                                    \
-   if (pass(nir, ##__VA_ARGS__)) {                              \
+   nir_pass_profile_begin(&_profile, nir, #pass);               \
+   bool _pass_progress = pass(nir, ##__VA_ARGS__);              \
+   nir_pass_profile_end(&_profile, nir, #pass, __FILE__,        \
+                        _pass_progress);                        \
+   if (_pass_progress) {                                        \
       nir_validate_shader(nir, "after " #pass " in " __FILE__); \
       UNUSED bool _;                                            \
       progress = true;                                          \
@@ -5345,9 +5407,12 @@ should_print_nir(UNUSED nir_shader *shader)
 })
 
 #define NIR_PASS_V(nir, pass, ...) _PASS(pass, nir, {        \
+   nir_pass_profile_scope _profile;                          \
    if (should_print_nir(nir))                                \
       printf("%s\n", #pass);                                 \
+   nir_pass_profile_begin(&_profile, nir, #pass);            \
    pass(nir, ##__VA_ARGS__);                                 \
+   nir_pass_profile_end(&_profile, nir, #pass, __FILE__, -1); \
    nir_validate_shader(nir, "after " #pass " in " __FILE__); \
    if (should_print_nir(nir))                                \
       nir_print_shader(nir, stdout);                         \
@@ -6920,6 +6985,7 @@ bool nir_opt_ray_queries(nir_shader *shader);
 bool nir_opt_ray_query_ranges(nir_shader *shader);
 
 void nir_sweep(nir_shader *shader);
+void nir_compact(nir_shader *shader);
 
 void nir_remap_dual_slot_attributes(nir_shader *shader,
                                     uint64_t *dual_slot_inputs);
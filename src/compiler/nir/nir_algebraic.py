@@ -462,6 +462,11 @@ class Expression(Value):
    def c_opcode(self):
       return get_c_opcode(self.opcode)
 
+   def depth(self):
+      """Number of levels of expressions in the tree."""
+      return 1 + max((s.depth() for s in self.sources
+                      if isinstance(s, Expression)), default=0)
+
    def render(self, cache):
       srcs = "".join(src.render(cache) for src in self.sources)
       return srcs + super(Expression, self).render(cache)
@@ -1172,6 +1177,8 @@ static const nir_algebraic_table ${pass_name}_table = {
    .values = ${pass_name}_values,
    .expression_cond = ${ pass_name + "_expression_cond" if expression_cond else "NULL" },
    .variable_cond = ${ pass_name + "_variable_cond" if variable_cond else "NULL" },
+   .num_conditions = ${len(condition_list)},
+   .max_depth = ${max((xform.search.depth() for xform in xforms), default=0)},
 };
 
 bool
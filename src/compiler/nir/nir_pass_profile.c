@@ -0,0 +1,288 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Per-pass compile time profiling.
+ *
+ * With NIR_PASS_PROFILE set, every pass run through NIR_PASS or NIR_PASS_V
+ * records its wall time, the change in the number of instructions, whether
+ * it made progress and, in debug builds, the size of the shader's ralloc
+ * tree (which includes the gc context) after it ran.  The numbers are
+ * aggregated per driver (the source directory the pass was called from),
+ * shader stage and pass.
+ *
+ * NIR_PASS_PROFILE is a comma-separated list of:
+ *
+ *    perfetto  emit a trace slice per pass and a per-stage instruction count
+ *              counter through util/perf
+ *    stderr    print the aggregated numbers as JSON to stderr at exit
+ *    <path>    write the aggregated numbers as JSON to <path> at exit
+ *
+ * Times include the passes called from within the pass.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/hash_table.h"
+#include "util/os_misc.h"
+#include "util/os_time.h"
+#include "util/perf/cpu_trace.h"
+#include "util/ralloc.h"
+#include "util/simple_mtx.h"
+#include "nir.h"
+
+bool nir_pass_profile_enabled = false;
+
+struct pass_stats {
+   const char *key;
+   const char *driver;
+   const char *pass;
+   gl_shader_stage stage;
+
+   uint64_t invocations;
+   uint64_t progress;
+   uint64_t no_progress;
+   uint64_t total_ns;
+   uint64_t max_ns;
+   int64_t instr_delta;
+   size_t peak_mem;
+};
+
+static struct {
+   simple_mtx_t lock;
+   void *mem_ctx;
+   struct hash_table *stats;
+   bool perfetto;
+   char *path;
+   const char *counter_names[MESA_SHADER_KERNEL + 1];
+} profile = {
+   .lock = SIMPLE_MTX_INITIALIZER,
+};
+
+static unsigned
+count_instrs(nir_shader *shader)
+{
+   unsigned count = 0;
+
+   nir_foreach_function_impl(impl, shader) {
+      nir_foreach_block(block, impl) {
+         count += exec_list_length(&block->instr_list);
+      }
+   }
+
+   return count;
+}
+
+static size_t
+shader_mem_size(UNUSED nir_shader *shader)
+{
+#ifndef NDEBUG
+   return ralloc_total_size(shader);
+#else
+   return 0;
+#endif
+}
+
+/* The directory below src/ the pass was called from, e.g. "amd/vulkan". */
+static void
+driver_from_file(const char *file, char *driver, size_t size)
+{
+   const char *begin = file;
+   for (const char *p = strstr(file, "src/"); p; p = strstr(p + 1, "src/"))
+      begin = p + 4;
+
+   const char *end = strrchr(begin, '/');
+   if (!end) {
+      snprintf(driver, size, ".");
+      return;
+   }
+
+   snprintf(driver, size, "%.*s", (int)(end - begin), begin);
+}
+
+static int
+compare_stats(const void *a, const void *b)
+{
+   const struct pass_stats *sa = *(const struct pass_stats **)a;
+   const struct pass_stats *sb = *(const struct pass_stats **)b;
+
+   if (sa->total_ns != sb->total_ns)
+      return sa->total_ns > sb->total_ns ? -1 : 1;
+   return strcmp(sa->key, sb->key);
+}
+
+/**
+ * Print everything recorded so far as JSON, the most expensive passes
+ * first.
+ */
+void
+nir_pass_profile_dump(FILE *fp)
+{
+   simple_mtx_lock(&profile.lock);
+
+   unsigned num_stats = profile.stats ? profile.stats->entries : 0;
+   struct pass_stats **sorted = malloc(MAX2(num_stats, 1) * sizeof(*sorted));
+   if (!sorted) {
+      simple_mtx_unlock(&profile.lock);
+      return;
+   }
+
+   unsigned n = 0;
+   if (profile.stats) {
+      hash_table_foreach(profile.stats, entry)
+         sorted[n++] = entry->data;
+   }
+   qsort(sorted, n, sizeof(*sorted), compare_stats);
+
+   fprintf(fp, "{\n  \"passes\": [");
+   for (unsigned i = 0; i < n; i++) {
+      const struct pass_stats *s = sorted[i];
+
+      fprintf(fp, "%s\n    {\"driver\": \"%s\", \"stage\": \"%s\", "
+              "\"pass\": \"%s\", \"invocations\": %" PRIu64 ", "
+              "\"progress\": %" PRIu64 ", \"no_progress\": %" PRIu64 ", "
+              "\"total_us\": %.3f, \"max_us\": %.3f, "
+              "\"instr_delta\": %" PRId64,
+              i ? "," : "", s->driver, _mesa_shader_stage_to_string(s->stage),
+              s->pass, s->invocations, s->progress, s->no_progress,
+              s->total_ns / 1000.0, s->max_ns / 1000.0, s->instr_delta);
+#ifndef NDEBUG
+      fprintf(fp, ", \"peak_mem_bytes\": %zu", s->peak_mem);
+#endif
+      fprintf(fp, "}");
+   }
+   fprintf(fp, "\n  ]\n}\n");
+   fflush(fp);
+
+   free(sorted);
+   simple_mtx_unlock(&profile.lock);
+}
+
+static void
+nir_pass_profile_atexit(void)
+{
+   if (!profile.path)
+      return;
+
+   if (!strcmp(profile.path, "stderr")) {
+      nir_pass_profile_dump(stderr);
+      return;
+   }
+
+   FILE *fp = fopen(profile.path, "w");
+   if (!fp) {
+      fprintf(stderr, "NIR_PASS_PROFILE: cannot open %s\n", profile.path);
+      return;
+   }
+
+   nir_pass_profile_dump(fp);
+   fclose(fp);
+}
+
+static void
+nir_pass_profile_init_once(void)
+{
+   const char *option = os_get_option("NIR_PASS_PROFILE");
+   if (!option || !option[0])
+      return;
+
+   profile.mem_ctx = ralloc_context(NULL);
+   profile.stats = _mesa_hash_table_create(profile.mem_ctx, _mesa_hash_string,
+                                           _mesa_key_string_equal);
+
+   char *list = ralloc_strdup(profile.mem_ctx, option);
+   char *save = NULL;
+   for (char *tok = strtok_r(list, ",", &save); tok;
+        tok = strtok_r(NULL, ",", &save)) {
+      if (!strcmp(tok, "perfetto"))
+         profile.perfetto = true;
+      else
+         profile.path = ralloc_strdup(profile.mem_ctx, tok);
+   }
+
+   if (profile.perfetto) {
+      util_cpu_trace_init();
+      for (unsigned i = 0; i <= MESA_SHADER_KERNEL; i++) {
+         profile.counter_names[i] =
+            ralloc_asprintf(profile.mem_ctx, "nir %s instructions",
+                            _mesa_shader_stage_to_string(i));
+      }
+   }
+
+   if (profile.path)
+      atexit(nir_pass_profile_atexit);
+
+   nir_pass_profile_enabled = true;
+}
+
+void
+nir_pass_profile_init(void)
+{
+   static once_flag flag = ONCE_FLAG_INIT;
+   call_once(&flag, nir_pass_profile_init_once);
+}
+
+void
+nir_pass_profile_begin_slow(nir_pass_profile_scope *scope,
+                            nir_shader *shader, const char *pass)
+{
+   if (profile.perfetto) {
+      _MESA_TRACE_BEGIN(pass);
+   }
+
+   scope->num_instrs = count_instrs(shader);
+   scope->mem_size = shader_mem_size(shader);
+   scope->start_ns = os_time_get_nano();
+}
+
+void
+nir_pass_profile_end_slow(nir_pass_profile_scope *scope,
+                          nir_shader *shader, const char *pass,
+                          const char *file, int progress)
+{
+   const uint64_t ns = os_time_get_nano() - scope->start_ns;
+   const unsigned num_instrs = count_instrs(shader);
+   const size_t mem_size = shader_mem_size(shader);
+   const gl_shader_stage stage = shader->info.stage;
+
+   if (profile.perfetto) {
+      _MESA_TRACE_END();
+      if (stage >= 0 && stage <= MESA_SHADER_KERNEL) {
+         MESA_TRACE_SET_COUNTER(profile.counter_names[stage], num_instrs);
+      }
+   }
+
+   char driver[256], key[512];
+   driver_from_file(file, driver, sizeof(driver));
+   snprintf(key, sizeof(key), "%s|%d|%s", driver, stage, pass);
+
+   simple_mtx_lock(&profile.lock);
+
+   struct hash_entry *entry = _mesa_hash_table_search(profile.stats, key);
+   struct pass_stats *s;
+   if (entry) {
+      s = entry->data;
+   } else {
+      s = rzalloc(profile.mem_ctx, struct pass_stats);
+      s->key = ralloc_strdup(s, key);
+      s->driver = ralloc_strdup(s, driver);
+      s->pass = ralloc_strdup(s, pass);
+      s->stage = stage;
+      _mesa_hash_table_insert(profile.stats, s->key, s);
+   }
+
+   s->invocations++;
+   if (progress > 0)
+      s->progress++;
+   else if (progress == 0)
+      s->no_progress++;
+   s->total_ns += ns;
+   s->max_ns = MAX2(s->max_ns, ns);
+   s->instr_delta += (int64_t)num_instrs - (int64_t)scope->num_instrs;
+   s->peak_mem = MAX3(s->peak_mem, scope->mem_size, mem_size);
+
+   simple_mtx_unlock(&profile.lock);
+}
@@ -23,6 +23,7 @@
 
 #include "nir_search.h"
 #include <inttypes.h>
+#include "util/bitset.h"
 #include "util/half_float.h"
 #include "nir_builder.h"
 #include "nir_worklist.h"
@@ -876,6 +877,341 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
    return false;
 }
 
+/* Fixed point reached by an algebraic pass on a function, for
+ * nir_shader_compiler_options::incremental_algebraic.
+ *
+ * When a pass makes no progress, no instruction matches any of its
+ * patterns.  That still holds on the next run for instructions where
+ * nothing the patterns and search conditions look at changed.  Rather than
+ * tracking every change to the IR, we keep signatures of each SSA value
+ * and its uses, and compare them on the next run.  Signature collisions
+ * can only make us miss an optimization, never apply a wrong one.
+ */
+struct nir_algebraic_fixed_point {
+   struct nir_algebraic_fixed_point *next;
+
+   const nir_algebraic_table *table;
+   bool *condition_flags;
+   unsigned execution_mode;
+
+   /** Signatures indexed by SSA index, NULL if there is no fixed point. */
+   struct value_sig *sigs;
+   unsigned num_sigs;
+};
+
+struct value_sig {
+   uint32_t value;
+   uint32_t uses;
+};
+
+static inline uint64_t
+sig_add(uint64_t sig, uint64_t value)
+{
+   sig ^= value + 0x9e3779b97f4a7c15ull + (sig << 6) + (sig >> 2);
+   return sig * 0xff51afd7ed558ccdull;
+}
+
+static inline uint32_t
+sig_finish(uint64_t sig)
+{
+   /* Zero is reserved for indices without a value. */
+   return (uint32_t)(sig ^ (sig >> 32)) | 1;
+}
+
+static bool
+sig_add_src(nir_src *src, void *data)
+{
+   uint64_t *sig = data;
+   *sig = sig_add(*sig, (uintptr_t)src->ssa);
+   return true;
+}
+
+/* The value signature covers the instruction itself.  Sources are only
+ * identified by their SSA values, changes to them are picked up by
+ * propagating through the sources.
+ */
+static uint32_t
+value_signature(nir_instr *instr)
+{
+   nir_def *def = nir_instr_def(instr);
+   uint64_t sig = sig_add((uintptr_t)instr, (uintptr_t)instr->block);
+
+   sig = sig_add(sig, instr->type);
+   sig = sig_add(sig, def->num_components | def->bit_size << 8);
+
+   switch (instr->type) {
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      sig = sig_add(sig, alu->op | alu->exact << 16 |
+                         alu->no_signed_wrap << 17 |
+                         alu->no_unsigned_wrap << 18 |
+                         (uint64_t)alu->fp_fast_math << 32);
+      for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+         uint64_t swizzle[NIR_MAX_VEC_COMPONENTS / sizeof(uint64_t)];
+         memcpy(swizzle, alu->src[i].swizzle, sizeof(swizzle));
+         sig = sig_add(sig, (uintptr_t)alu->src[i].src.ssa);
+         for (unsigned j = 0; j < ARRAY_SIZE(swizzle); j++)
+            sig = sig_add(sig, swizzle[j]);
+      }
+      break;
+   }
+
+   case nir_instr_type_load_const: {
+      nir_load_const_instr *load = nir_instr_as_load_const(instr);
+      for (unsigned i = 0; i < load->def.num_components; i++)
+         sig = sig_add(sig, load->value[i].u64);
+      break;
+   }
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      sig = sig_add(sig, intrin->intrinsic);
+      for (unsigned i = 0; i < nir_intrinsic_infos[intrin->intrinsic].num_indices; i++)
+         sig = sig_add(sig, intrin->const_index[i]);
+      nir_foreach_src(instr, sig_add_src, &sig);
+      break;
+   }
+
+   case nir_instr_type_phi: {
+      /* Range analysis treats loop header phis differently. */
+      nir_phi_instr *phi = nir_instr_as_phi(instr);
+      sig = sig_add(sig, (uintptr_t)nir_cf_node_prev(&instr->block->cf_node));
+      nir_foreach_phi_src(src, phi) {
+         sig = sig_add(sig, (uintptr_t)src->src.ssa);
+         sig = sig_add(sig, (uintptr_t)src->pred);
+      }
+      break;
+   }
+
+   default:
+      nir_foreach_src(instr, sig_add_src, &sig);
+      break;
+   }
+
+   return sig_finish(sig);
+}
+
+/* The use signature covers which instructions use the value, for
+ * conditions like is_used_once and is_only_used_as_float.
+ */
+static uint32_t
+uses_signature(nir_def *def)
+{
+   /* The order of uses doesn't matter, so just sum them up. */
+   uint64_t sig = 0;
+
+   nir_foreach_use_including_if(src, def) {
+      if (nir_src_is_if(src)) {
+         sig += sig_add(1, (uintptr_t)nir_src_parent_if(src));
+      } else {
+         nir_instr *parent = nir_src_parent_instr(src);
+         uint64_t op = parent->type == nir_instr_type_alu ?
+                          nir_instr_as_alu(parent)->op :
+                       parent->type == nir_instr_type_intrinsic ?
+                          nir_instr_as_intrinsic(parent)->intrinsic : 0;
+         sig += sig_add((uintptr_t)parent, op << 8 | parent->type);
+      }
+   }
+
+   return sig_finish(sig);
+}
+
+static struct nir_algebraic_fixed_point *
+get_fixed_point(nir_function_impl *impl, const bool *condition_flags,
+                const nir_algebraic_table *table)
+{
+   const unsigned execution_mode =
+      impl->function->shader->info.float_controls_execution_mode;
+
+   for (struct nir_algebraic_fixed_point *fp = impl->algebraic_fixed_points;
+        fp; fp = fp->next) {
+      if (fp->table == table &&
+          fp->execution_mode == execution_mode &&
+          memcmp(fp->condition_flags, condition_flags,
+                 table->num_conditions * sizeof(bool)) == 0)
+         return fp;
+   }
+
+   struct nir_algebraic_fixed_point *fp =
+      rzalloc(impl, struct nir_algebraic_fixed_point);
+   if (!fp)
+      return NULL;
+
+   fp->condition_flags = ralloc_array(fp, bool, table->num_conditions);
+   if (!fp->condition_flags) {
+      ralloc_free(fp);
+      return NULL;
+   }
+
+   memcpy(fp->condition_flags, condition_flags,
+          table->num_conditions * sizeof(bool));
+   fp->table = table;
+   fp->execution_mode = execution_mode;
+   fp->next = impl->algebraic_fixed_points;
+   impl->algebraic_fixed_points = fp;
+
+   return fp;
+}
+
+struct dirty_state {
+   /* Values whose expression tree changed. */
+   BITSET_WORD *tree_changed;
+
+   /* Distance to a value whose uses changed, going from uses to sources.
+    * Patterns may look at the uses of values up to max_depth levels
+    * below their root.
+    */
+   uint8_t *uses_dist;
+};
+
+static bool
+mark_uses_changed(nir_src *src, void *data)
+{
+   struct dirty_state *state = data;
+   state->uses_dist[src->ssa->index] = 0;
+   return true;
+}
+
+/* nir_def_bits_used() also looks at the uses of uses, and at their other
+ * sources.
+ */
+static bool
+mark_uses_changed_2(nir_src *src, void *data)
+{
+   mark_uses_changed(src, data);
+   nir_foreach_src(src->ssa->parent_instr, mark_uses_changed, data);
+   return true;
+}
+
+static bool
+propagate_dirty_src(nir_src *src, void *data)
+{
+   struct dirty_state *state = data;
+   return !BITSET_TEST(state->tree_changed, src->ssa->index);
+}
+
+static bool
+is_loop_header_phi(nir_instr *instr)
+{
+   if (instr->type != nir_instr_type_phi)
+      return false;
+
+   nir_cf_node *parent = instr->block->cf_node.parent;
+   return parent->type == nir_cf_node_loop &&
+          instr->block == nir_loop_first_block(nir_cf_node_as_loop(parent));
+}
+
+static void
+fill_signatures(nir_function_impl *impl, struct value_sig *sigs)
+{
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         nir_def *def = nir_instr_def(instr);
+         if (def) {
+            sigs[def->index].value = value_signature(instr);
+            sigs[def->index].uses = uses_signature(def);
+         }
+      }
+   }
+}
+
+/* Compute the signatures of all values, and the set of ALU instructions
+ * which may match a pattern now even though they didn't at the fixed point.
+ */
+static BITSET_WORD *
+get_dirty_alus(nir_function_impl *impl,
+               const struct nir_algebraic_fixed_point *fp,
+               struct value_sig *sigs)
+{
+   const unsigned num_values = impl->ssa_alloc;
+   struct dirty_state state;
+
+   state.tree_changed = rzalloc_array(NULL, BITSET_WORD,
+                                      BITSET_WORDS(num_values));
+   state.uses_dist = ralloc_array(state.tree_changed, uint8_t, num_values);
+   if (!state.tree_changed || !state.uses_dist) {
+      ralloc_free(state.tree_changed);
+      return NULL;
+   }
+   memset(state.uses_dist, UINT8_MAX, num_values);
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         nir_def *def = nir_instr_def(instr);
+         if (!def)
+            continue;
+
+         struct value_sig *sig = &sigs[def->index];
+         const struct value_sig *old =
+            def->index < fp->num_sigs ? &fp->sigs[def->index] : NULL;
+
+         sig->value = value_signature(instr);
+         sig->uses = uses_signature(def);
+
+         if (!old || sig->value != old->value) {
+            BITSET_SET(state.tree_changed, def->index);
+            state.uses_dist[def->index] = 0;
+            nir_foreach_src(instr, mark_uses_changed_2, &state);
+         } else if (sig->uses != old->uses) {
+            state.uses_dist[def->index] = 0;
+            nir_foreach_src(instr, mark_uses_changed, &state);
+         }
+      }
+   }
+
+   /* Patterns only span ALU instructions, which have no back edges, so the
+    * distances are final after one walk.  Range analysis goes through phis
+    * though, and loop header phis only see changes coming from the back
+    * edge on the next walk.
+    */
+   bool progress, has_loops;
+   do {
+      progress = false;
+      has_loops = false;
+
+      nir_foreach_block(block, impl) {
+         nir_foreach_instr(instr, block) {
+            has_loops |= is_loop_header_phi(instr);
+
+            nir_def *def = nir_instr_def(instr);
+            if (!def)
+               continue;
+
+            if (instr->type == nir_instr_type_alu) {
+               nir_alu_instr *alu = nir_instr_as_alu(instr);
+               for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+                  uint8_t dist = state.uses_dist[alu->src[i].src.ssa->index];
+                  if (dist < UINT8_MAX && dist + 1 < state.uses_dist[def->index])
+                     state.uses_dist[def->index] = dist + 1;
+               }
+            }
+
+            if (BITSET_TEST(state.tree_changed, def->index) ||
+                nir_foreach_src(instr, propagate_dirty_src, &state))
+               continue;
+
+            BITSET_SET(state.tree_changed, def->index);
+            progress = true;
+         }
+      }
+   } while (progress && has_loops);
+
+   /* Reuse the tree bitset for the result. */
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_alu)
+            continue;
+
+         unsigned index = nir_instr_as_alu(instr)->def.index;
+         if (state.uses_dist[index] <= fp->table->max_depth)
+            BITSET_SET(state.tree_changed, index);
+      }
+   }
+
+   ralloc_free(state.uses_dist);
+   return state.tree_changed;
+}
+
 bool
 nir_algebraic_impl(nir_function_impl *impl,
                    const bool *condition_flags,
@@ -898,6 +1234,20 @@ nir_algebraic_impl(nir_function_impl *impl,
 
    struct hash_table *range_ht = _mesa_pointer_hash_table_create(NULL);
 
+   /* Only revisit what changed since the last fixed point, if any. */
+   const nir_shader_compiler_options *options = impl->function->shader->options;
+   struct nir_algebraic_fixed_point *fixed_point = NULL;
+   struct value_sig *sigs = NULL;
+   BITSET_WORD *dirty = NULL;
+
+   if (options && options->incremental_algebraic) {
+      fixed_point = get_fixed_point(impl, condition_flags, table);
+      if (fixed_point)
+         sigs = rzalloc_array(fixed_point, struct value_sig, impl->ssa_alloc);
+      if (sigs && fixed_point->sigs)
+         dirty = get_dirty_alus(impl, fixed_point, sigs);
+   }
+
    nir_instr_worklist *worklist = nir_instr_worklist_create();
 
    /* Walk top-to-bottom setting up the automaton state. */
@@ -914,7 +1264,8 @@ nir_algebraic_impl(nir_function_impl *impl,
    nir_foreach_block_reverse(block, impl) {
       nir_foreach_instr_reverse(instr, block) {
          instr->pass_flags = 0;
-         if (instr->type == nir_instr_type_alu)
+         if (instr->type == nir_instr_type_alu &&
+             (!dirty || BITSET_TEST(dirty, nir_instr_as_alu(instr)->def.index)))
             nir_instr_worklist_push_tail(worklist, instr);
       }
    }
@@ -941,6 +1292,25 @@ nir_algebraic_impl(nir_function_impl *impl,
    nir_instr_worklist_destroy(worklist);
    ralloc_free(range_ht);
    util_dynarray_fini(&states);
+   ralloc_free(dirty);
+
+   /* Without progress, nothing changed since the signatures were taken.
+    * Otherwise there is no fixed point until the next run without progress.
+    */
+   if (fixed_point) {
+      ralloc_free(fixed_point->sigs);
+      fixed_point->sigs = NULL;
+      fixed_point->num_sigs = 0;
+
+      if (sigs && !progress) {
+         if (!dirty)
+            fill_signatures(impl, sigs);
+         fixed_point->sigs = sigs;
+         fixed_point->num_sigs = impl->ssa_alloc;
+      } else {
+         ralloc_free(sigs);
+      }
+   }
 
    if (progress) {
       nir_metadata_preserve(impl, nir_metadata_control_flow);
@@ -186,6 +186,130 @@ TEST_F(nir_opt_algebraic_test, msad)
    require_one_alu(nir_op_msad_4x8);
 }
 
+TEST_F(nir_opt_algebraic_test, incremental_uses_changed)
+{
+   options.incremental_algebraic = true;
+
+   nir_def *a = nir_load_var(b, nir_local_variable_create(b->impl, glsl_uint_type(), "a"));
+   nir_def *shift = nir_ushr_imm(b, a, 4);
+   nir_store_var(b, res_var, nir_b2i32(b, nir_ieq_imm(b, shift, 0)), 0x1);
+
+   nir_variable *other = nir_local_variable_create(b->impl, glsl_uint_type(), "other");
+   nir_intrinsic_instr *store =
+      nir_build_store_deref(b, &nir_build_deref_var(b, other)->def, shift, 0x1);
+
+   /* The shift has two uses, so it is kept. */
+   while (nir_opt_algebraic(b->shader)) {
+      nir_opt_constant_folding(b->shader);
+      nir_opt_dce(b->shader);
+   }
+   ASSERT_FALSE(nir_opt_algebraic(b->shader));
+
+   /* Nothing else changed, but the shift is now used once. */
+   nir_instr_remove(&store->instr);
+   ASSERT_TRUE(nir_opt_algebraic(b->shader));
+   nir_opt_dce(b->shader);
+
+   nir_foreach_instr(instr, nir_start_block(b->impl)) {
+      if (instr->type == nir_instr_type_alu) {
+         ASSERT_NE(nir_instr_as_alu(instr)->op, nir_op_ushr);
+      }
+   }
+}
+
+TEST_F(nir_opt_algebraic_test, incremental_new_instr)
+{
+   options.incremental_algebraic = true;
+
+   nir_def *a = nir_load_var(b, nir_local_variable_create(b->impl, glsl_int_type(), "a"));
+   nir_store_var(b, res_var, nir_iadd(b, a, nir_imm_int(b, 1)), 0x1);
+
+   while (nir_opt_algebraic(b->shader)) {
+      nir_opt_constant_folding(b->shader);
+      nir_opt_dce(b->shader);
+   }
+   ASSERT_FALSE(nir_opt_algebraic(b->shader));
+
+   b->cursor = nir_after_cf_list(&b->impl->body);
+   nir_store_var(b, res_var, nir_ineg(b, nir_ineg(b, a)), 0x1);
+   ASSERT_TRUE(nir_opt_algebraic(b->shader));
+}
+
+/* Builds the sequences from the tests above a few times over. */
+static nir_shader *
+build_algebraic_corpus(const nir_shader_compiler_options *options,
+                       unsigned copies)
+{
+   nir_builder _b = nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                                   "algebraic_corpus");
+   nir_builder *b = &_b;
+
+   for (unsigned c = 0; c < copies; c++) {
+      nir_def *src0 = nir_load_var(b, nir_local_variable_create(b->impl, glsl_int_type(), "src0"));
+      nir_def *src1 = nir_load_var(b, nir_local_variable_create(b->impl, glsl_int_type(), "src1"));
+
+      nir_def *res = NULL;
+      for (unsigned i = 0; i < 4; i++) {
+         nir_def *ref = nir_ubitfield_extract(b, src0, nir_imm_int(b, i * 8), nir_imm_int(b, 8));
+         nir_def *src = nir_ubitfield_extract(b, src1, nir_imm_int(b, i * 8), nir_imm_int(b, 8));
+         nir_def *is_ref_zero = nir_ieq_imm(b, ref, 0);
+         nir_def *abs_diff = nir_iabs(b, nir_isub(b, ref, src));
+         nir_def *masked_diff = nir_bcsel(b, is_ref_zero, nir_imm_int(b, 0), abs_diff);
+         res = res ? nir_iadd(b, res, masked_diff) : masked_diff;
+      }
+
+      res = nir_iadd(b, res, nir_umod(b, src0, nir_imm_int(b, 4)));
+      res = nir_iadd(b, res, nir_imod(b, src1, nir_imm_int(b, -4)));
+      res = nir_iadd(b, res, nir_irem(b, src0, nir_imm_int(b, INT32_MIN)));
+
+      nir_store_var(b, nir_local_variable_create(b->impl, glsl_int_type(), "res"), res, 0x1);
+   }
+
+   return b->shader;
+}
+
+static unsigned
+optimize_algebraic_corpus(nir_shader *shader)
+{
+   bool progress;
+   do {
+      progress = false;
+      progress |= nir_copy_prop(shader);
+      progress |= nir_opt_dce(shader);
+      progress |= nir_opt_cse(shader);
+      progress |= nir_opt_algebraic(shader);
+      progress |= nir_opt_constant_folding(shader);
+   } while (progress);
+
+   unsigned num_alus = 0;
+   nir_foreach_block(block, nir_shader_get_entrypoint(shader)) {
+      nir_foreach_instr(instr, block)
+         num_alus += instr->type == nir_instr_type_alu;
+   }
+
+   return num_alus;
+}
+
+TEST_F(nir_opt_algebraic_test, incremental_same_result)
+{
+   nir_shader_compiler_options full_options = {};
+   full_options.lower_bitfield_extract = true;
+   full_options.has_bfe = true;
+   full_options.has_msad = true;
+
+   nir_shader_compiler_options incremental_options = full_options;
+   incremental_options.incremental_algebraic = true;
+
+   nir_shader *full = build_algebraic_corpus(&full_options, 4);
+   nir_shader *incremental = build_algebraic_corpus(&incremental_options, 4);
+
+   EXPECT_EQ(optimize_algebraic_corpus(full),
+             optimize_algebraic_corpus(incremental));
+
+   ralloc_free(full);
+   ralloc_free(incremental);
+}
+
 TEST_F(nir_opt_mqsad_test, mqsad)
 {
    options.lower_bitfield_extract = true;
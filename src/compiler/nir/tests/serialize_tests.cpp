@@ -100,6 +100,8 @@ nir_serialize_test::ASSERT_SWIZZLE_EQ(nir_alu_instr *a, nir_alu_instr *b, unsign
 
 class nir_serialize_all_test : public nir_serialize_test {};
 class nir_serialize_all_but_one_test : public nir_serialize_test {};
+class nir_serialize_compact_test : public nir_serialize_test {};
+class nir_serialize_large_test : public nir_serialize_test {};
 
 } // namespace
 
@@ -195,3 +197,101 @@ TEST_P(nir_serialize_all_but_one_test, single_channel)
 
    ASSERT_SWIZZLE_EQ(vec_alu, vec_alu_dup, 1, 0);
 }
+
+static void
+serialize_to_blob(nir_shader *nir, struct blob *blob)
+{
+   blob_init(blob);
+   nir_serialize(blob, nir, false);
+   ASSERT_FALSE(blob->out_of_memory);
+}
+
+TEST_F(nir_serialize_compact_test, compact)
+{
+   const unsigned count = 5000;
+   dup = b->shader;
+
+   /* Interleave instructions which are later removed with the ones which
+    * stay, so that the shader ends up spread over half-empty slabs like it
+    * would after running a few optimization passes.
+    */
+   nir_def *x = nir_load_local_invocation_index(b);
+   for (unsigned i = 0; i < count; i++) {
+      nir_def *y = nir_iadd_imm(b, x, i);
+      nir_imul(b, y, y);
+      if (i % 64 == 0)
+         nir_push_if(b, nir_ieq_imm(b, y, 0));
+      else if (i % 64 == 63)
+         nir_pop_if(b, NULL);
+      x = y;
+   }
+   if (count % 64 != 0)
+      nir_pop_if(b, NULL);
+   nir_store_global(b, nir_imm_int64(b, 0), 4, x, 0x1);
+
+   nir_opt_cse(b->shader);
+   nir_opt_dce(b->shader);
+   nir_sweep(b->shader);
+
+   size_t used_before, used_after;
+   size_t size_before = gc_get_usage(b->shader->gctx, &used_before);
+
+   struct blob before, after;
+   serialize_to_blob(b->shader, &before);
+
+   nir_compact(b->shader);
+   nir_validate_shader(b->shader, "compacted");
+
+   size_t size_after = gc_get_usage(b->shader->gctx, &used_after);
+
+   /* Compaction doesn't change the shader itself. */
+   serialize_to_blob(b->shader, &after);
+   ASSERT_EQ(before.size, after.size);
+   EXPECT_EQ(memcmp(before.data, after.data, before.size), 0);
+
+   EXPECT_LE(used_after, used_before);
+   EXPECT_LT(size_after, size_before);
+
+   blob_finish(&before);
+   blob_finish(&after);
+}
+
+TEST_F(nir_serialize_large_test, large_shader)
+{
+   const unsigned count = 2000;
+   dup = b->shader;
+
+   static const unsigned swizzle[] = { 1, 2, 0 };
+   nir_def *x = nir_load_local_invocation_id(b);
+   nir_def *addr = nir_load_global_invocation_id(b, 64);
+   for (unsigned i = 0; i < count; i++) {
+      nir_def *y = nir_fadd(b, nir_fmul_imm(b, x, i),
+                            nir_swizzle(b, x, swizzle, 3));
+      if (i % 32 == 0) {
+         nir_push_if(b, nir_ieq_imm(b, nir_channel(b, y, 0), i));
+         nir_store_global(b, nir_iadd_imm(b, nir_channel(b, addr, 0), i), 4,
+                          y, 0x7);
+         nir_pop_if(b, NULL);
+      }
+      x = y;
+   }
+
+   struct blob blob;
+   serialize_to_blob(b->shader, &blob);
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, blob.data, blob.size);
+   nir_shader *read = nir_deserialize(NULL, &options, &reader);
+   ASSERT_FALSE(reader.overrun);
+   ASSERT_EQ(reader.current, reader.end);
+
+   /* The shader read back serializes to the same blob. */
+   struct blob again;
+   serialize_to_blob(read, &again);
+   ASSERT_EQ(blob.size, again.size);
+   EXPECT_EQ(memcmp(blob.data, again.data, blob.size), 0);
+
+   ralloc_free(read);
+   blob_finish(&blob);
+   blob_finish(&again);
+}
@@ -0,0 +1,542 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Replays a corpus of shaders through a NIR compilation pipeline on the CPU
+ * and prints, as CSV, the compile time, peak memory and final size of each
+ * one.  This is meant to catch compile-time regressions without any GPU.
+ *
+ * Shaders are either SPIR-V modules, in which case every entry-point is
+ * compiled, or blobs written by nir_serialize().  They are compiled in
+ * parallel on worker threads; the rows are printed in the order of the
+ * input files.
+ *
+ * Drivers build it again with their own backend added to the table, such
+ * as lp_compile_bench for llvmpipe.
+ */
+
+#include "nir_compile_bench.h"
+#include "nir_serialize.h"
+#include "nir_spirv.h"
+#include "spirv.h"
+#include "vtn_private.h"
+#include "util/blob.h"
+#include "util/os_file.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_dynarray.h"
+#include "util/u_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+struct bench_shader {
+   /* Input */
+   const char *filename;
+   const char *entry_point;
+   gl_shader_stage stage;
+   const struct bench_backend *backend;
+   const nir_shader_compiler_options *options;
+
+   /* Output */
+   bool failed;
+   int64_t parse_ns;
+   int64_t compile_ns;
+   size_t peak_memory;
+   unsigned instructions;
+   unsigned blocks;
+
+   struct util_queue_fence fence;
+};
+
+static _Thread_local size_t *bench_peak_memory;
+static _Thread_local nir_shader *bench_current_shader;
+
+void
+bench_sample_memory(void)
+{
+   size_t size = gc_get_usage(bench_current_shader->gctx, NULL);
+   *bench_peak_memory = MAX2(*bench_peak_memory, size);
+}
+
+static void
+optimize_nir(nir_shader *nir, bool compact)
+{
+   bool progress;
+
+   NIR_PASS_V(nir, nir_lower_variable_initializers, nir_var_function_temp);
+   NIR_PASS_V(nir, nir_lower_returns);
+   NIR_PASS_V(nir, nir_inline_functions);
+   nir_remove_non_entrypoints(nir);
+   bench_sample_memory();
+
+   do {
+      progress = false;
+
+      NIR_PASS(progress, nir, nir_split_array_vars, nir_var_function_temp);
+      NIR_PASS(progress, nir, nir_lower_vars_to_ssa);
+      NIR_PASS(progress, nir, nir_opt_dce);
+      NIR_PASS(progress, nir, nir_opt_cse);
+      NIR_PASS(progress, nir, nir_opt_dead_cf);
+      NIR_PASS(progress, nir, nir_copy_prop);
+      NIR_PASS(progress, nir, nir_opt_deref);
+      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_PASS(progress, nir, nir_opt_copy_prop_vars);
+      NIR_PASS(progress, nir, nir_opt_dead_write_vars);
+      NIR_PASS(progress, nir, nir_opt_combine_stores, nir_var_all);
+      NIR_PASS(progress, nir, nir_remove_dead_variables,
+               nir_var_function_temp, NULL);
+      NIR_PASS(progress, nir, nir_opt_algebraic);
+      NIR_PASS(progress, nir, nir_opt_if, 0);
+      NIR_PASS(progress, nir, nir_opt_loop_unroll);
+      NIR_PASS(progress, nir, nir_opt_remove_phis);
+      NIR_PASS(progress, nir, nir_opt_undef);
+
+      bench_sample_memory();
+   } while (progress);
+
+   if (compact) {
+      nir_compact(nir);
+      bench_sample_memory();
+   }
+
+   NIR_PASS_V(nir, nir_opt_algebraic_late);
+   NIR_PASS_V(nir, nir_convert_from_ssa, true);
+   nir_sweep(nir);
+   bench_sample_memory();
+}
+
+static bool
+compile_nir(nir_shader *nir)
+{
+   optimize_nir(nir, false);
+   return true;
+}
+
+static bool
+compile_nir_compact(nir_shader *nir)
+{
+   optimize_nir(nir, true);
+   return true;
+}
+
+/**
+ * Writes the shader with nir_serialize() and reads it back, like a shader
+ * cache store followed by a load.  For blob inputs, parse_ms is the time of
+ * nir_deserialize() alone.
+ */
+static bool
+roundtrip_nir(nir_shader *nir)
+{
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, nir, false);
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, blob.data, blob.size);
+   nir_shader *copy = nir_deserialize(NULL, nir->options, &reader);
+   assert(!reader.overrun);
+
+   ralloc_free(copy);
+   blob_finish(&blob);
+   return true;
+}
+
+static const nir_shader_compiler_options nir_options = {
+   .lower_fdiv = true,
+   .lower_flrp32 = true,
+   .lower_flrp64 = true,
+   .lower_fpow = true,
+   .lower_ldexp = true,
+   .lower_fmod = true,
+   .lower_uadd_carry = true,
+   .lower_usub_borrow = true,
+   .max_unroll_iterations = 32,
+};
+
+static const nir_shader_compiler_options nir_incremental_options = {
+   .lower_fdiv = true,
+   .lower_flrp32 = true,
+   .lower_flrp64 = true,
+   .lower_fpow = true,
+   .lower_ldexp = true,
+   .lower_fmod = true,
+   .lower_uadd_carry = true,
+   .lower_usub_borrow = true,
+   .max_unroll_iterations = 32,
+   .incremental_algebraic = true,
+};
+
+static const struct bench_backend nir_backend = {
+   .name = "nir",
+   .description = "the common NIR optimization loop, out of SSA",
+   .options = &nir_options,
+   .compile = compile_nir,
+};
+
+static const struct bench_backend nir_incremental_backend = {
+   .name = "nir-incremental",
+   .description = "the same, with incremental algebraic passes",
+   .options = &nir_incremental_options,
+   .compile = compile_nir,
+};
+
+static const struct bench_backend nir_compact_backend = {
+   .name = "nir-compact",
+   .description = "the same, compacting the shader after the loop",
+   .options = &nir_options,
+   .compile = compile_nir_compact,
+};
+
+static const struct bench_backend serialize_backend = {
+   .name = "serialize",
+   .description = "nir_serialize() and nir_deserialize() round-trip",
+   .options = &nir_options,
+   .compile = roundtrip_nir,
+};
+
+/* Backends which link a driver's compiler are only built with the driver. */
+static const struct bench_backend *const backends[] = {
+   &nir_backend,
+   &nir_incremental_backend,
+   &nir_compact_backend,
+   &serialize_backend,
+#ifdef NIR_COMPILE_BENCH_LLVMPIPE
+   &lp_compile_bench_backend,
+#endif
+};
+
+static const struct bench_backend *
+find_backend(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(backends); i++) {
+      if (!strcmp(backends[i]->name, name))
+         return backends[i];
+   }
+   return NULL;
+}
+
+static void
+count_instructions(struct bench_shader *shader, nir_shader *nir)
+{
+   nir_foreach_function_impl(impl, nir) {
+      nir_foreach_block(block, impl) {
+         shader->blocks++;
+         nir_foreach_instr(instr, block)
+            shader->instructions++;
+      }
+   }
+}
+
+static nir_shader *
+parse_shader(struct bench_shader *shader, const void *data, size_t size)
+{
+   const struct bench_backend *backend = shader->backend;
+
+   if (size >= 4 && *(const uint32_t *)data == SpvMagicNumber) {
+      struct spirv_to_nir_options spirv_opts = { 0 };
+      if (backend->spirv_options)
+         spirv_opts = *backend->spirv_options;
+      spirv_opts.environment = shader->stage == MESA_SHADER_KERNEL ?
+                               NIR_SPIRV_OPENCL : NIR_SPIRV_VULKAN;
+
+      return spirv_to_nir(data, size / 4, NULL, 0, shader->stage,
+                          shader->entry_point, &spirv_opts, shader->options);
+   }
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, data, size);
+   nir_shader *nir = nir_deserialize(NULL, shader->options, &reader);
+   if (reader.overrun) {
+      ralloc_free(nir);
+      return NULL;
+   }
+
+   return nir;
+}
+
+static void
+compile_shader(void *job, void *gdata, int thread_index)
+{
+   struct bench_shader *shader = job;
+   size_t size;
+
+   char *data = os_read_file(shader->filename, &size);
+   if (!data) {
+      shader->failed = true;
+      return;
+   }
+
+   int64_t start = os_time_get_nano();
+   nir_shader *nir = parse_shader(shader, data, size);
+   int64_t parsed = os_time_get_nano();
+   free(data);
+
+   if (!nir) {
+      shader->failed = true;
+      return;
+   }
+
+   bench_current_shader = nir;
+   bench_peak_memory = &shader->peak_memory;
+   bench_sample_memory();
+
+   bool compiled = shader->backend->compile(nir);
+   int64_t end = os_time_get_nano();
+
+   shader->failed = !compiled;
+   shader->stage = nir->info.stage;
+   shader->parse_ns = parsed - start;
+   shader->compile_ns = end - parsed;
+   count_instructions(shader, nir);
+
+   bench_current_shader = NULL;
+   ralloc_free(nir);
+}
+
+/**
+ * Adds a shader to compile for each entry-point of a SPIR-V module, or a
+ * single one for serialized NIR.
+ */
+static bool
+add_shaders(struct util_dynarray *shaders, void *mem_ctx,
+            const char *filename, const struct bench_backend *backend,
+            const nir_shader_compiler_options *options)
+{
+   size_t size;
+   char *data = os_read_file(filename, &size);
+   if (!data) {
+      fprintf(stderr, "Failed to read %s\n", filename);
+      return false;
+   }
+
+   struct bench_shader shader = {
+      .filename = filename,
+      .stage = MESA_SHADER_NONE,
+      .backend = backend,
+      .options = options,
+   };
+
+   const uint32_t *words = (const uint32_t *)data;
+   if (size < 20 || size % 4 != 0 || words[0] != SpvMagicNumber) {
+      util_dynarray_append(shaders, struct bench_shader, shader);
+      free(data);
+      return true;
+   }
+
+   /* Skip the header. */
+   const uint32_t *w = words + 5;
+   const uint32_t *end = words + size / 4;
+   bool found = false;
+
+   while (w < end) {
+      SpvOp opcode = w[0] & SpvOpCodeMask;
+      unsigned count = w[0] >> SpvWordCountShift;
+      if (count == 0 || w + count > end)
+         break;
+
+      if (opcode == SpvOpEntryPoint && count > 3) {
+         /* Literal strings are nul-terminated and padded to whole words. */
+         shader.entry_point = ralloc_strndup(mem_ctx, (const char *)&w[3],
+                                             (count - 3) * 4);
+         shader.stage = vtn_stage_for_execution_model(w[1]);
+         util_dynarray_append(shaders, struct bench_shader, shader);
+         found = true;
+      } else if (found) {
+         /* Entry-points all come together. */
+         break;
+      }
+
+      w += count;
+   }
+
+   free(data);
+
+   if (!found)
+      fprintf(stderr, "No entry-points in %s\n", filename);
+   return found;
+}
+
+static void
+print_usage(const char *exec_name, FILE *f)
+{
+   fprintf(f,
+           "Usage: %s [options] file...\n"
+           "Options:\n"
+           "  -h, --help              Print this help.\n"
+           "  -b, --backend <name>    Compilation pipeline to run (default: nir).\n"
+           "  -j, --jobs <n>          Number of worker threads (default: one per CPU).\n"
+           "  -r, --repeat <n>        Compile each shader n times and report the\n"
+           "                          fastest run (default: 1).\n"
+           "\n"
+           "Files are either SPIR-V modules, whose entry-points are all compiled,\n"
+           "or blobs written by nir_serialize().  The results are printed as CSV.\n"
+           "\n"
+           "Backends:\n",
+           exec_name);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(backends); i++)
+      fprintf(f, "  %-22s  %s\n", backends[i]->name, backends[i]->description);
+}
+
+int
+main(int argc, char **argv)
+{
+   const struct bench_backend *backend = backends[0];
+   unsigned jobs = 0;
+   unsigned repeat = 1;
+   int ch;
+
+   static struct option long_options[] =
+      {
+         {"help",    no_argument,       0, 'h'},
+         {"backend", required_argument, 0, 'b'},
+         {"jobs",    required_argument, 0, 'j'},
+         {"repeat",  required_argument, 0, 'r'},
+         {0, 0,                         0, 0}
+      };
+
+   while ((ch = getopt_long(argc, argv, "hb:j:r:", long_options, NULL)) != -1) {
+      switch (ch) {
+      case 'h':
+         print_usage(argv[0], stdout);
+         return 0;
+      case 'b':
+         backend = find_backend(optarg);
+         if (!backend) {
+            fprintf(stderr, "Unknown backend \"%s\"\n", optarg);
+            print_usage(argv[0], stderr);
+            return 1;
+         }
+         break;
+      case 'j':
+         jobs = atoi(optarg);
+         break;
+      case 'r':
+         repeat = MAX2(atoi(optarg), 1);
+         break;
+      default:
+         print_usage(argv[0], stderr);
+         return 1;
+      }
+   }
+
+   if (optind >= argc) {
+      print_usage(argv[0], stderr);
+      return 1;
+   }
+
+   if (!jobs)
+      jobs = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+
+   void *mem_ctx = ralloc_context(NULL);
+   struct util_dynarray shaders;
+   util_dynarray_init(&shaders, mem_ctx);
+
+   glsl_type_singleton_init_or_ref();
+
+   const nir_shader_compiler_options *options = backend->options;
+   if (backend->init) {
+      options = backend->init();
+      if (!options) {
+         fprintf(stderr, "Failed to initialize the %s backend\n",
+                 backend->name);
+         glsl_type_singleton_decref();
+         ralloc_free(mem_ctx);
+         return 1;
+      }
+   }
+
+   for (int i = optind; i < argc; i++) {
+      if (!add_shaders(&shaders, mem_ctx, argv[i], backend, options)) {
+         if (backend->finish)
+            backend->finish();
+         glsl_type_singleton_decref();
+         ralloc_free(mem_ctx);
+         return 1;
+      }
+   }
+
+   struct util_queue queue;
+   if (!util_queue_init(&queue, "nir_bench", 64, jobs,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL)) {
+      fprintf(stderr, "Failed to create the worker threads\n");
+      return 1;
+   }
+
+   unsigned count = util_dynarray_num_elements(&shaders, struct bench_shader);
+   struct bench_shader *results = rzalloc_array(mem_ctx, struct bench_shader,
+                                                count);
+   int64_t start = os_time_get_nano();
+
+   for (unsigned r = 0; r < repeat; r++) {
+      util_dynarray_foreach(&shaders, struct bench_shader, shader) {
+         util_queue_fence_init(&shader->fence);
+         util_queue_add_job(&queue, shader, &shader->fence, compile_shader,
+                            NULL, 0);
+      }
+
+      unsigned i = 0;
+      util_dynarray_foreach(&shaders, struct bench_shader, shader) {
+         util_queue_fence_wait(&shader->fence);
+         util_queue_fence_destroy(&shader->fence);
+
+         if (r == 0 || shader->parse_ns + shader->compile_ns <
+                       results[i].parse_ns + results[i].compile_ns)
+            results[i] = *shader;
+
+         /* Reset the outputs for the next run. */
+         shader->failed = false;
+         shader->peak_memory = 0;
+         shader->instructions = 0;
+         shader->blocks = 0;
+         i++;
+      }
+   }
+
+   int64_t wall_ns = os_time_get_nano() - start;
+
+   util_queue_destroy(&queue);
+
+   if (backend->finish)
+      backend->finish();
+
+   printf("file,entry_point,stage,backend,parse_ms,compile_ms,"
+          "peak_memory_kb,instructions,blocks\n");
+
+   int64_t total_ns = 0;
+   unsigned failed = 0;
+   for (unsigned i = 0; i < count; i++) {
+      const struct bench_shader *shader = &results[i];
+
+      if (shader->failed) {
+         fprintf(stderr, "Failed to compile %s%s%s\n", shader->filename,
+                 shader->entry_point ? ":" : "",
+                 shader->entry_point ? shader->entry_point : "");
+         failed++;
+         continue;
+      }
+
+      printf("%s,%s,%s,%s,%.3f,%.3f,%zu,%u,%u\n",
+             shader->filename,
+             shader->entry_point ? shader->entry_point : "",
+             _mesa_shader_stage_to_abbrev(shader->stage),
+             shader->backend->name,
+             shader->parse_ns / 1e6, shader->compile_ns / 1e6,
+             shader->peak_memory / 1024,
+             shader->instructions, shader->blocks);
+      total_ns += shader->parse_ns + shader->compile_ns;
+   }
+
+   fprintf(stderr, "%u shaders (%u failed), %.1f ms of compile time, "
+           "%.1f ms wall time on %u threads\n",
+           count, failed, total_ns / 1e6, wall_ns / 1e6 / repeat, jobs);
+
+   glsl_type_singleton_decref();
+   ralloc_free(mem_ctx);
+
+   return failed ? 1 : 0;
+}
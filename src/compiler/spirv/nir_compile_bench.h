@@ -0,0 +1,54 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef NIR_COMPILE_BENCH_H
+#define NIR_COMPILE_BENCH_H
+
+#include "nir.h"
+#include "nir_spirv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A compilation pipeline.  The backend gets a shader fresh out of
+ * spirv_to_nir() or nir_deserialize(), created with its options, and runs
+ * whatever it would run on the way to the final code.
+ *
+ * Backends must not need any hardware and must be thread-safe, as shaders
+ * are compiled concurrently.  The peak memory is sampled by calling
+ * bench_sample_memory() between passes.
+ */
+struct bench_backend {
+   const char *name;
+   const char *description;
+   const nir_shader_compiler_options *options;
+
+   /* Optional, the spirv_to_nir() options other than the environment. */
+   const struct spirv_to_nir_options *spirv_options;
+
+   /* Optional, called once before any shader is parsed by backends which
+    * need a driver screen.  Returns the compiler options to use instead of
+    * the ones above, or NULL on failure.
+    */
+   const nir_shader_compiler_options *(*init)(void);
+   void (*finish)(void);
+
+   /* Returns false if the shader can't be compiled by this backend. */
+   bool (*compile)(nir_shader *nir);
+};
+
+void
+bench_sample_memory(void);
+
+#ifdef NIR_COMPILE_BENCH_LLVMPIPE
+extern const struct bench_backend lp_compile_bench_backend;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NIR_COMPILE_BENCH_H */
@@ -457,6 +457,17 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
       count = lp_build_intrinsic_unary(builder, popcntintr,
                                        LLVMInt32TypeInContext(context), bits);
       count = LLVMBuildZExt(builder, count, LLVMIntTypeInContext(context, 64), "");
+   }
+   else if (type.length == 16) {
+      /* An i1 vector, which AVX-512 keeps in a mask register */
+      LLVMTypeRef i16t = LLVMInt16TypeInContext(context);
+      LLVMValueRef bits = LLVMBuildBitCast(builder, maskvalue,
+                                           lp_build_int_vec_type(gallivm, type), "");
+      bits = LLVMBuildICmp(builder, LLVMIntNE, bits,
+                           LLVMConstNull(LLVMTypeOf(bits)), "");
+      bits = LLVMBuildBitCast(builder, bits, i16t, "");
+      count = lp_build_intrinsic_unary(builder, "llvm.ctpop.i16", i16t, bits);
+      count = LLVMBuildZExt(builder, count, LLVMIntTypeInContext(context, 64), "");
    } else {
       LLVMValueRef countv = LLVMBuildAnd(builder, maskvalue, countmask, "countv");
       LLVMTypeRef counttype = LLVMIntTypeInContext(context, type.length * 8);
@@ -514,6 +525,41 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Position in a linear 4x4 block of element i of a 16-wide vector, which
+ * holds four 2x2 quads in the order the fragment shader uses.
+ */
+static inline unsigned
+swizzled_pixel_index(unsigned i)
+{
+   unsigned x = (i & 1) + (i & 4) / 2;
+   unsigned y = (i & 2) / 2 + (i & 8) / 4;
+   return y * 4 + x;
+}
+
+
+/**
+ * Pointer to row \p row of the 4x4 depth/stencil block.
+ */
+static LLVMValueRef
+zs_row_ptr(struct gallivm_state *gallivm,
+           struct lp_type row_type,
+           LLVMValueRef depth_ptr,
+           LLVMValueRef depth_stride,
+           unsigned row)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef offset = LLVMBuildMul(builder, depth_stride,
+                                      lp_build_const_int32(gallivm, row), "");
+   LLVMValueRef ptr = LLVMBuildGEP2(builder,
+                                    LLVMInt8TypeInContext(gallivm->context),
+                                    depth_ptr, &offset, 1, "");
+   return LLVMBuildBitCast(builder, ptr,
+                           LLVMPointerType(lp_build_vec_type(gallivm, row_type), 0),
+                           "");
+}
+
+
 /**
  * Load depth/stencil values.
  * The stored values are linear, swizzle them.
@@ -549,56 +595,88 @@ lp_build_depth_stencil_load_swizzled(struct gallivm_state *gallivm,
 
    LLVMTypeRef zs_dst_type = lp_build_vec_type(gallivm, zs_load_type);
 
-   if (z_src_type.length == 4) {
-      LLVMValueRef looplsb = LLVMBuildAnd(builder, loop_counter,
-                                          lp_build_const_int32(gallivm, 1), "");
-      LLVMValueRef loopmsb = LLVMBuildAnd(builder, loop_counter,
-                                          lp_build_const_int32(gallivm, 2), "");
-      LLVMValueRef offset2 = LLVMBuildMul(builder, loopmsb,
-                                          depth_stride, "");
-      depth_offset1 = LLVMBuildMul(builder, looplsb,
-                                   lp_build_const_int32(gallivm, depth_bytes * 2), "");
-      depth_offset1 = LLVMBuildAdd(builder, depth_offset1, offset2, "");
+   if (z_src_type.length == 16) {
+      /*
+       * The whole 4x4 block at once (512-bit vectors): load the four
+       * rows and swizzle them into four 2x2 quads.
+       */
+      struct lp_type zs_row_type = zs_type;
+      LLVMValueRef rows[4];
+
+      zs_row_type.length = 4;
 
-      /* just concatenate the loaded 2x2 values into 4-wide vector */
       for (unsigned i = 0; i < 4; i++) {
-         shuffles[i] = lp_build_const_int32(gallivm, i);
+         if (is_1d && i > 0) {
+            rows[i] = lp_build_undef(gallivm, zs_row_type);
+         } else {
+            rows[i] = LLVMBuildLoad2(builder,
+                                     lp_build_vec_type(gallivm, zs_row_type),
+                                     zs_row_ptr(gallivm, zs_row_type, depth_ptr,
+                                                depth_stride, i), "");
+         }
       }
+
+      LLVMValueRef zs_dst = lp_build_concat(gallivm, rows, zs_row_type, 4);
+
+      for (unsigned i = 0; i < 16; i++) {
+         shuffles[i] = lp_build_const_int32(gallivm, swizzled_pixel_index(i));
+      }
+
+      *z_fb = LLVMBuildShuffleVector(builder, zs_dst, zs_dst,
+                                     LLVMConstVector(shuffles, 16), "");
    } else {
-      unsigned i;
-      LLVMValueRef loopx2 = LLVMBuildShl(builder, loop_counter,
-                                         lp_build_const_int32(gallivm, 1), "");
-      assert(z_src_type.length == 8);
-      depth_offset1 = LLVMBuildMul(builder, loopx2, depth_stride, "");
-      /*
-       * We load 2x4 values, and need to swizzle them (order
-       * 0,1,4,5,2,3,6,7) - not so hot with avx unfortunately.
-       */
-      for (i = 0; i < 8; i++) {
-         shuffles[i] = lp_build_const_int32(gallivm, (i&1) + (i&2) * 2 + (i&4) / 2);
+      if (z_src_type.length == 4) {
+         LLVMValueRef looplsb = LLVMBuildAnd(builder, loop_counter,
+                                             lp_build_const_int32(gallivm, 1), "");
+         LLVMValueRef loopmsb = LLVMBuildAnd(builder, loop_counter,
+                                             lp_build_const_int32(gallivm, 2), "");
+         LLVMValueRef offset2 = LLVMBuildMul(builder, loopmsb,
+                                             depth_stride, "");
+         depth_offset1 = LLVMBuildMul(builder, looplsb,
+                                      lp_build_const_int32(gallivm, depth_bytes * 2), "");
+         depth_offset1 = LLVMBuildAdd(builder, depth_offset1, offset2, "");
+
+         /* just concatenate the loaded 2x2 values into 4-wide vector */
+         for (unsigned i = 0; i < 4; i++) {
+            shuffles[i] = lp_build_const_int32(gallivm, i);
+         }
+      } else {
+         unsigned i;
+         LLVMValueRef loopx2 = LLVMBuildShl(builder, loop_counter,
+                                            lp_build_const_int32(gallivm, 1), "");
+         assert(z_src_type.length == 8);
+         depth_offset1 = LLVMBuildMul(builder, loopx2, depth_stride, "");
+         /*
+          * We load 2x4 values, and need to swizzle them (order
+          * 0,1,4,5,2,3,6,7) - not so hot with avx unfortunately.
+          */
+         for (i = 0; i < 8; i++) {
+            shuffles[i] = lp_build_const_int32(gallivm, (i&1) + (i&2) * 2 + (i&4) / 2);
+         }
       }
-   }
 
-   depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
+      depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
 
-   /* Load current z/stencil values from z/stencil buffer */
-   LLVMTypeRef load_ptr_type = LLVMPointerType(zs_dst_type, 0);
-   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
-   LLVMValueRef zs_dst_ptr =
-      LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset1, 1, "");
-   zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
-   LLVMValueRef zs_dst1 = LLVMBuildLoad2(builder, zs_dst_type, zs_dst_ptr, "");
-   LLVMValueRef zs_dst2;
-   if (is_1d) {
-      zs_dst2 = lp_build_undef(gallivm, zs_load_type);
-   } else {
-      zs_dst_ptr = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset2, 1, "");
+      /* Load current z/stencil values from z/stencil buffer */
+      LLVMTypeRef load_ptr_type = LLVMPointerType(zs_dst_type, 0);
+      LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
+      LLVMValueRef zs_dst_ptr =
+         LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset1, 1, "");
       zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
-      zs_dst2 = LLVMBuildLoad2(builder, zs_dst_type, zs_dst_ptr, "");
+      LLVMValueRef zs_dst1 = LLVMBuildLoad2(builder, zs_dst_type, zs_dst_ptr, "");
+      LLVMValueRef zs_dst2;
+      if (is_1d) {
+         zs_dst2 = lp_build_undef(gallivm, zs_load_type);
+      } else {
+         zs_dst_ptr = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset2, 1, "");
+         zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
+         zs_dst2 = LLVMBuildLoad2(builder, zs_dst_type, zs_dst_ptr, "");
+      }
+
+      *z_fb = LLVMBuildShuffleVector(builder, zs_dst1, zs_dst2,
+                                     LLVMConstVector(shuffles, zs_type.length), "");
    }
 
-   *z_fb = LLVMBuildShuffleVector(builder, zs_dst1, zs_dst2,
-                                  LLVMConstVector(shuffles, zs_type.length), "");
    *s_fb = *z_fb;
 
    if (format_desc->block.bits == 8) {
@@ -702,7 +780,10 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
     * This is far from ideal, at least for late depth write we should do this
     * outside the fs loop to avoid all the swizzle stuff.
     */
-   if (z_src_type.length == 4) {
+   if (z_src_type.length == 16) {
+      /* Whole 4x4 block, see lp_build_depth_stencil_load_swizzled(). */
+      depth_offset1 = NULL;
+   } else if (z_src_type.length == 4) {
       LLVMValueRef looplsb = LLVMBuildAnd(builder, loop_counter,
                                           lp_build_const_int32(gallivm, 1), "");
       LLVMValueRef loopmsb = LLVMBuildAnd(builder, loop_counter,
@@ -726,14 +807,6 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
       }
    }
 
-   depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
-
-   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
-   zs_dst_ptr1 = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset1, 1, "");
-   zs_dst_ptr1 = LLVMBuildBitCast(builder, zs_dst_ptr1, load_ptr_type, "");
-   zs_dst_ptr2 = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset2, 1, "");
-   zs_dst_ptr2 = LLVMBuildBitCast(builder, zs_dst_ptr2, load_ptr_type, "");
-
    if (format_desc->block.bits > 32) {
       s_value = LLVMBuildBitCast(builder, s_value, z_bld.vec_type, "");
    }
@@ -752,6 +825,54 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
                                lp_build_int_vec_type(gallivm, zs_type), "");
    }
 
+   if (z_src_type.length == 16) {
+      struct lp_type zs_row_type = zs_type;
+      unsigned char row_pixels[16];
+
+      zs_row_type.length = 4;
+
+      for (unsigned i = 0; i < 16; i++) {
+         row_pixels[swizzled_pixel_index(i)] = i;
+      }
+
+      for (unsigned row = 0; row < (is_1d ? 1 : 4); row++) {
+         LLVMValueRef zs_row;
+
+         if (format_desc->block.bits <= 32) {
+            for (unsigned i = 0; i < 4; i++) {
+               shuffles[i] = lp_build_const_int32(gallivm,
+                                                  row_pixels[row * 4 + i]);
+            }
+            zs_row = LLVMBuildShuffleVector(builder, z_value, z_value,
+                                            LLVMConstVector(shuffles, 4), "");
+         } else {
+            /* Interleave z and s */
+            for (unsigned i = 0; i < 4; i++) {
+               unsigned pixel = row_pixels[row * 4 + i];
+               shuffles[i * 2] = lp_build_const_int32(gallivm, pixel);
+               shuffles[i * 2 + 1] = lp_build_const_int32(gallivm, pixel + 16);
+            }
+            zs_row = LLVMBuildShuffleVector(builder, z_value, s_value,
+                                            LLVMConstVector(shuffles, 8), "");
+            zs_row = LLVMBuildBitCast(builder, zs_row,
+                                      lp_build_vec_type(gallivm, zs_row_type), "");
+         }
+
+         LLVMBuildStore(builder, zs_row,
+                        zs_row_ptr(gallivm, zs_row_type, depth_ptr,
+                                   depth_stride, row));
+      }
+      return;
+   }
+
+   depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
+
+   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
+   zs_dst_ptr1 = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset1, 1, "");
+   zs_dst_ptr1 = LLVMBuildBitCast(builder, zs_dst_ptr1, load_ptr_type, "");
+   zs_dst_ptr2 = LLVMBuildGEP2(builder, int8_type, depth_ptr, &depth_offset2, 1, "");
+   zs_dst_ptr2 = LLVMBuildBitCast(builder, zs_dst_ptr2, load_ptr_type, "");
+
    if (format_desc->block.bits <= 32) {
       if (z_src_type.length == 4) {
          zs_dst1 = lp_build_extract_range(gallivm, z_value, 0, 2);
@@ -0,0 +1,348 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * The llvmpipe backend of nir_compile_bench.
+ *
+ * Compute shaders are lowered the way lavapipe lowers them, with a flat
+ * descriptor layout where each binding is its own descriptor, and compiled
+ * to a llvmpipe variant through the gallium interface.  Launching an empty
+ * grid generates the variant without running it.
+ */
+
+#include <stdlib.h>
+
+#include "nir_builder.h"
+#include "nir_compile_bench.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "util/simple_mtx.h"
+#include "util/u_dynarray.h"
+
+#include "frontend/sw_winsys.h"
+
+#include "lp_public.h"
+
+
+static struct sw_winsys lp_bench_winsys;
+static struct pipe_screen *lp_bench_screen;
+
+/* llvmpipe contexts aren't thread-safe, each worker thread creates one. */
+static simple_mtx_t lp_bench_mutex = SIMPLE_MTX_INITIALIZER;
+static struct util_dynarray lp_bench_contexts;
+static _Thread_local struct pipe_context *lp_bench_pipe;
+
+
+static void
+lp_bench_winsys_destroy(struct sw_winsys *ws)
+{
+}
+
+
+static struct pipe_context *
+lp_bench_get_context(void)
+{
+   if (lp_bench_pipe)
+      return lp_bench_pipe;
+
+   lp_bench_pipe = lp_bench_screen->context_create(lp_bench_screen, NULL, 0);
+   if (!lp_bench_pipe)
+      return NULL;
+
+   simple_mtx_lock(&lp_bench_mutex);
+   util_dynarray_append(&lp_bench_contexts, struct pipe_context *,
+                        lp_bench_pipe);
+   simple_mtx_unlock(&lp_bench_mutex);
+
+   return lp_bench_pipe;
+}
+
+
+static const nir_shader_compiler_options *
+lp_bench_init(void)
+{
+   /* Measure the compiler rather than the shader cache. */
+   setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+
+   lp_bench_winsys.destroy = lp_bench_winsys_destroy;
+   lp_bench_screen = llvmpipe_create_screen(&lp_bench_winsys);
+   if (!lp_bench_screen)
+      return NULL;
+
+   util_dynarray_init(&lp_bench_contexts, NULL);
+
+   return lp_bench_screen->get_compiler_options(lp_bench_screen,
+                                                PIPE_SHADER_IR_NIR,
+                                                PIPE_SHADER_COMPUTE);
+}
+
+
+static void
+lp_bench_finish(void)
+{
+   util_dynarray_foreach(&lp_bench_contexts, struct pipe_context *, pipe)
+      (*pipe)->destroy(*pipe);
+   util_dynarray_fini(&lp_bench_contexts);
+
+   lp_bench_screen->destroy(lp_bench_screen);
+   lp_bench_screen = NULL;
+}
+
+
+static void
+lp_bench_optimize(nir_shader *nir)
+{
+   bool progress;
+
+   do {
+      progress = false;
+
+      NIR_PASS(progress, nir, nir_lower_flrp, 32|64, true);
+      NIR_PASS(progress, nir, nir_split_array_vars, nir_var_function_temp);
+      NIR_PASS(progress, nir, nir_shrink_vec_array_vars, nir_var_function_temp);
+      NIR_PASS(progress, nir, nir_opt_deref);
+      NIR_PASS(progress, nir, nir_lower_vars_to_ssa);
+      NIR_PASS(progress, nir, nir_opt_copy_prop_vars);
+      NIR_PASS(progress, nir, nir_copy_prop);
+      NIR_PASS(progress, nir, nir_opt_dce);
+      NIR_PASS(progress, nir, nir_opt_peephole_select, 8, true, true);
+      NIR_PASS(progress, nir, nir_opt_algebraic);
+      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_PASS(progress, nir, nir_opt_remove_phis);
+      NIR_PASS(progress, nir, nir_opt_loop);
+      NIR_PASS(progress, nir, nir_opt_if, nir_opt_if_optimize_phi_true_false);
+      NIR_PASS(progress, nir, nir_opt_dead_cf);
+      NIR_PASS(progress, nir, nir_opt_cse);
+      NIR_PASS(progress, nir, nir_opt_undef);
+      NIR_PASS(progress, nir, nir_lower_alu_to_scalar, NULL, NULL);
+      NIR_PASS(progress, nir, nir_opt_loop_unroll);
+
+      bench_sample_memory();
+   } while (progress);
+
+   NIR_PASS_V(nir, nir_lower_var_copies);
+   NIR_PASS_V(nir, nir_remove_dead_variables, nir_var_function_temp, NULL);
+   NIR_PASS_V(nir, nir_opt_dce);
+   nir_sweep(nir);
+}
+
+
+/**
+ * Returns the (set + 1, index, 0) resource of lavapipe for an array of
+ * derefs, with binding n at descriptor n of its set.
+ */
+static nir_def *
+lp_bench_resource_from_deref(nir_builder *b, nir_deref_instr *deref)
+{
+   nir_def *index = nir_imm_int(b, 0);
+
+   while (deref->deref_type != nir_deref_type_var) {
+      assert(deref->deref_type == nir_deref_type_array);
+      unsigned array_size = MAX2(glsl_get_aoa_size(deref->type), 1);
+
+      index = nir_iadd(b, index,
+                       nir_imul_imm(b, deref->arr.index.ssa, array_size));
+      deref = nir_deref_instr_parent(deref);
+   }
+
+   nir_variable *var = deref->var;
+   return nir_vec3(b, nir_imm_int(b, var->data.descriptor_set + 1),
+                   nir_iadd_imm(b, index, var->data.binding),
+                   nir_imm_int(b, 0));
+}
+
+
+static bool
+lp_bench_lower_descriptors_instr(nir_builder *b, nir_instr *instr, void *data)
+{
+   b->cursor = nir_before_instr(instr);
+
+   if (instr->type == nir_instr_type_tex) {
+      nir_tex_instr *tex = nir_instr_as_tex(instr);
+      bool progress = false;
+
+      for (unsigned i = 0; i < tex->num_srcs; i++) {
+         switch (tex->src[i].src_type) {
+         case nir_tex_src_texture_deref:
+            tex->src[i].src_type = nir_tex_src_texture_handle;
+            break;
+         case nir_tex_src_sampler_deref:
+            tex->src[i].src_type = nir_tex_src_sampler_handle;
+            break;
+         default:
+            continue;
+         }
+
+         nir_deref_instr *deref = nir_src_as_deref(tex->src[i].src);
+         nir_src_rewrite(&tex->src[i].src,
+                         lp_bench_resource_from_deref(b, deref));
+         progress = true;
+      }
+      return progress;
+   }
+
+   if (instr->type != nir_instr_type_intrinsic)
+      return false;
+
+   nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+   nir_def *def;
+
+   switch (intrin->intrinsic) {
+   case nir_intrinsic_vulkan_resource_index:
+      def = nir_vec3(b, nir_imm_int(b, nir_intrinsic_desc_set(intrin) + 1),
+                     nir_iadd_imm(b, intrin->src[0].ssa,
+                                  nir_intrinsic_binding(intrin)),
+                     nir_imm_int(b, 0));
+      break;
+
+   case nir_intrinsic_vulkan_resource_reindex:
+      def = nir_vec3(b, nir_channel(b, intrin->src[0].ssa, 0),
+                     nir_iadd(b, nir_channel(b, intrin->src[0].ssa, 1),
+                              intrin->src[1].ssa),
+                     nir_channel(b, intrin->src[0].ssa, 2));
+      break;
+
+   case nir_intrinsic_load_vulkan_descriptor:
+      def = intrin->src[0].ssa;
+      break;
+
+   case nir_intrinsic_image_deref_sparse_load:
+   case nir_intrinsic_image_deref_load:
+   case nir_intrinsic_image_deref_store:
+   case nir_intrinsic_image_deref_atomic:
+   case nir_intrinsic_image_deref_atomic_swap:
+   case nir_intrinsic_image_deref_size:
+   case nir_intrinsic_image_deref_samples: {
+      nir_deref_instr *deref = nir_src_as_deref(intrin->src[0]);
+      nir_rewrite_image_intrinsic(intrin,
+                                  lp_bench_resource_from_deref(b, deref),
+                                  true);
+      return true;
+   }
+
+   default:
+      return false;
+   }
+
+   nir_def_replace(&intrin->def, def);
+   return true;
+}
+
+
+static void
+lp_bench_lower(nir_shader *nir)
+{
+   NIR_PASS_V(nir, nir_lower_variable_initializers, nir_var_function_temp);
+   NIR_PASS_V(nir, nir_lower_returns);
+   NIR_PASS_V(nir, nir_inline_functions);
+   nir_remove_non_entrypoints(nir);
+
+   const struct nir_lower_subgroups_options subgroup_opts = {
+      .lower_quad = true,
+      .ballot_components = 1,
+      .ballot_bit_size = 32,
+      .lower_inverse_ballot = true,
+      .lower_rotate_to_shuffle = true,
+   };
+   NIR_PASS_V(nir, nir_lower_subgroups, &subgroup_opts);
+
+   NIR_PASS_V(nir, nir_lower_system_values);
+   const struct nir_lower_compute_system_values_options compute_system_values = {0};
+   NIR_PASS_V(nir, nir_lower_compute_system_values, &compute_system_values);
+
+   lp_bench_optimize(nir);
+   nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+
+   NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+   NIR_PASS_V(nir, nir_lower_explicit_io, nir_var_mem_push_const,
+              nir_address_format_32bit_offset);
+   NIR_PASS_V(nir, nir_lower_explicit_io,
+              nir_var_mem_ubo | nir_var_mem_ssbo,
+              nir_address_format_vec2_index_32bit_offset);
+   NIR_PASS_V(nir, nir_lower_explicit_io,
+              nir_var_mem_global | nir_var_mem_constant,
+              nir_address_format_64bit_global);
+
+   const nir_lower_non_uniform_access_options non_uniform_opts = {
+      .types = nir_lower_non_uniform_ubo_access |
+               nir_lower_non_uniform_texture_access |
+               nir_lower_non_uniform_image_access,
+   };
+   NIR_PASS_V(nir, nir_lower_non_uniform_access, &non_uniform_opts);
+   NIR_PASS_V(nir, nir_shader_instructions_pass,
+              lp_bench_lower_descriptors_instr, nir_metadata_control_flow,
+              NULL);
+
+   NIR_PASS_V(nir, nir_lower_vars_to_explicit_types, nir_var_mem_shared,
+              glsl_get_natural_size_align_bytes);
+   NIR_PASS_V(nir, nir_lower_explicit_io, nir_var_mem_shared,
+              nir_address_format_32bit_offset);
+   NIR_PASS_V(nir, nir_remove_dead_variables, nir_var_shader_temp, NULL);
+
+   const nir_lower_tex_options tex_options = {
+      .lower_tg4_offsets = true,
+      .lower_txd = true,
+   };
+   NIR_PASS_V(nir, nir_lower_tex, &tex_options);
+
+   lp_bench_optimize(nir);
+}
+
+
+static bool
+lp_bench_compile(nir_shader *nir)
+{
+   if (nir->info.stage != MESA_SHADER_COMPUTE)
+      return false;
+
+   struct pipe_context *pipe = lp_bench_get_context();
+   if (!pipe)
+      return false;
+
+   lp_bench_lower(nir);
+   lp_bench_screen->finalize_nir(lp_bench_screen, nir);
+   bench_sample_memory();
+
+   /* The compute state takes ownership of its shader. */
+   struct pipe_compute_state state = {
+      .ir_type = PIPE_SHADER_IR_NIR,
+      .prog = nir_shader_clone(NULL, nir),
+      .static_shared_mem = nir->info.shared_size,
+   };
+   void *cs = pipe->create_compute_state(pipe, &state);
+   if (!cs)
+      return false;
+
+   const struct pipe_grid_info info = {
+      .block = { 1, 1, 1 },
+      .work_dim = 3,
+   };
+   pipe->bind_compute_state(pipe, cs);
+   pipe->launch_grid(pipe, &info);
+   pipe->bind_compute_state(pipe, NULL);
+   pipe->delete_compute_state(pipe, cs);
+
+   return true;
+}
+
+
+static const struct spirv_to_nir_options lp_bench_spirv_options = {
+   .ubo_addr_format = nir_address_format_vec2_index_32bit_offset,
+   .ssbo_addr_format = nir_address_format_vec2_index_32bit_offset,
+   .phys_ssbo_addr_format = nir_address_format_64bit_global,
+   .push_const_addr_format = nir_address_format_logical,
+   .shared_addr_format = nir_address_format_32bit_offset,
+   .constant_addr_format = nir_address_format_64bit_global,
+};
+
+
+const struct bench_backend lp_compile_bench_backend = {
+   .name = "llvmpipe",
+   .description = "lavapipe's lowering and a llvmpipe compute variant",
+   .spirv_options = &lp_bench_spirv_options,
+   .init = lp_bench_init,
+   .finish = lp_bench_finish,
+   .compile = lp_bench_compile,
+};
@@ -165,6 +165,9 @@ struct llvmpipe_context {
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** The fragment shader variant bound by llvmpipe_update_fs() */
+   struct lp_fragment_shader_variant *fs_variant;
+
    bool permit_linear_rasterizer;
    bool single_vp;
 
@@ -28,14 +28,137 @@
  * based on threadpool.c but modified heavily to be compute shader tuned.
  */
 
+
+#include "util/u_atomic.h"
 #include "util/u_thread.h"
+#include "util/u_math.h"
 #include "util/u_memory.h"
 #include "lp_cs_tpool.h"
 
+
+static inline uint64_t
+range_bounds(unsigned next, unsigned end)
+{
+   return ((uint64_t)end << 32) | next;
+}
+
+
+/**
+ * Take up to \p max iterations from the front of a range.
+ */
+static bool
+range_take_front(struct lp_cs_tpool_range *range, unsigned max,
+                 unsigned *begin, unsigned *end)
+{
+   uint64_t old = p_atomic_read(&range->bounds);
+
+   while (true) {
+      unsigned next = (uint32_t)old;
+      unsigned last = old >> 32;
+
+      if (next >= last)
+         return false;
+
+      unsigned count = MIN2(max, last - next);
+      uint64_t prev = p_atomic_cmpxchg(&range->bounds, old,
+                                       range_bounds(next + count, last));
+      if (prev == old) {
+         *begin = next;
+         *end = next + count;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+
+/**
+ * Take the back half of a range, or its last iteration.
+ */
+static bool
+range_steal_back(struct lp_cs_tpool_range *range,
+                 unsigned *begin, unsigned *end)
+{
+   uint64_t old = p_atomic_read(&range->bounds);
+
+   while (true) {
+      unsigned next = (uint32_t)old;
+      unsigned last = old >> 32;
+
+      if (next >= last)
+         return false;
+
+      unsigned mid = next + (last - next) / 2;
+      uint64_t prev = p_atomic_cmpxchg(&range->bounds, old,
+                                       range_bounds(next, mid));
+      if (prev == old) {
+         *begin = mid;
+         *end = last;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+
+/**
+ * Run iterations of a task until none are left to take.  Only the
+ * worker owning a range ever refills it, and only once it is empty, so
+ * a stolen range can be published there for others to steal from in
+ * turn.
+ */
+static void
+lp_cs_tpool_run_task(struct lp_cs_tpool *pool, struct lp_cs_tpool_task *task,
+                     unsigned index, struct lp_cs_local_mem *lmem)
+{
+   struct lp_cs_tpool_range *own = &task->ranges[index];
+
+   while (true) {
+      unsigned begin, end;
+
+      if (!range_take_front(own, task->chunk_size, &begin, &end)) {
+         bool stolen = false;
+
+         for (unsigned i = 1; i < pool->num_threads && !stolen; i++) {
+            unsigned victim = (index + i) % pool->num_threads;
+            stolen = range_steal_back(&task->ranges[victim], &begin, &end);
+         }
+         if (!stolen)
+            return;
+
+         /* Keep one chunk and offer the rest to the other workers. */
+         if (end - begin > task->chunk_size) {
+            p_atomic_xchg(&own->bounds,
+                          range_bounds(begin + task->chunk_size, end));
+            end = begin + task->chunk_size;
+         }
+      }
+
+      for (unsigned i = begin; i < end; i++)
+         task->work(task->data, i, lmem);
+
+      if (p_atomic_add_return(&task->iter_finished, end - begin) ==
+          task->iter_total)
+         util_queue_fence_signal(&task->finish);
+   }
+}
+
+
+static void
+lp_cs_tpool_task_unref(struct lp_cs_tpool_task *task)
+{
+   if (--task->refcount == 0) {
+      util_queue_fence_destroy(&task->finish);
+      align_free(task);
+   }
+}
+
+
 static int
 lp_cs_tpool_worker(void *data)
 {
-   struct lp_cs_tpool *pool = data;
+   struct lp_cs_tpool_thread *thread = data;
+   struct lp_cs_tpool *pool = thread->pool;
    struct lp_cs_local_mem lmem;
 
    memset(&lmem, 0, sizeof(lmem));
@@ -43,7 +166,6 @@ lp_cs_tpool_worker(void *data)
 
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
 
       while (list_is_empty(&pool->workqueue) && !pool->shutdown)
          cnd_wait(&pool->new_work, &pool->m);
@@ -53,30 +175,20 @@ lp_cs_tpool_worker(void *data)
 
       task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
                               list);
-
-      unsigned this_iter = task->iter_start;
-
-      iter_per_thread = task->iter_per_thread;
-
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
-      }
-
-      task->iter_start += iter_per_thread;
-
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
-
+      task->refcount++;
       mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
 
+      lp_cs_tpool_run_task(pool, task, thread->index, &lmem);
+
+      /* Nothing is left to take, let the workers move on to the next
+       * task while the last chunks of this one are still running.
+       */
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
-         cnd_broadcast(&task->finish);
+      if (task->queued) {
+         list_del(&task->list);
+         task->queued = false;
+      }
+      lp_cs_tpool_task_unref(task);
    }
    mtx_unlock(&pool->m);
    FREE(lmem.local_mem_ptr);
@@ -96,8 +208,17 @@ lp_cs_tpool_create(unsigned num_threads)
 
    list_inithead(&pool->workqueue);
    assert (num_threads <= LP_MAX_THREADS);
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(struct lp_cs_tpool_thread));
+      if (!pool->threads)
+         num_threads = 0;
+   }
    for (unsigned i = 0; i < num_threads; i++) {
-      if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker, pool)) {
+      pool->threads[i].pool = pool;
+      pool->threads[i].index = i;
+      if (thrd_success != u_thread_create(&pool->threads[i].thread,
+                                          lp_cs_tpool_worker,
+                                          &pool->threads[i])) {
          num_threads = i;  /* previous thread is max */
          break;
       }
@@ -118,11 +239,12 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
    mtx_unlock(&pool->m);
 
    for (unsigned i = 0; i < pool->num_threads; i++) {
-      thrd_join(pool->threads[i], NULL);
+      thrd_join(pool->threads[i].thread, NULL);
    }
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -132,17 +254,19 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
 {
    struct lp_cs_tpool_task *task;
 
-   if (pool->num_threads == 0) {
+   if (pool->num_threads == 0 || num_iters <= 0) {
       struct lp_cs_local_mem lmem;
 
       memset(&lmem, 0, sizeof(lmem));
-      for (unsigned t = 0; t < num_iters; t++) {
+      for (int t = 0; t < num_iters; t++) {
          work(data, t, &lmem);
       }
       FREE(lmem.local_mem_ptr);
       return NULL;
    }
-   task = CALLOC_STRUCT(lp_cs_tpool_task);
+   task = align_calloc(sizeof(*task) +
+                       pool->num_threads * sizeof(struct lp_cs_tpool_range),
+                       CACHE_LINE_SIZE);
    if (!task) {
       return NULL;
    }
@@ -151,16 +275,35 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    task->data = data;
    task->iter_total = num_iters;
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
+   /* Contiguous ranges keep neighbouring blocks on the same thread.
+    * Chunks are small enough to leave something to steal.
+    */
+   unsigned iter_per_thread = num_iters / pool->num_threads;
+   unsigned iter_remainder = num_iters % pool->num_threads;
+   unsigned begin = 0;
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      unsigned count = iter_per_thread + (i < iter_remainder);
+      task->ranges[i].bounds = range_bounds(begin, begin + count);
+      begin += count;
+   }
+   task->chunk_size = MAX2(1, iter_per_thread / 8);
 
-   cnd_init(&task->finish);
+   util_queue_fence_init(&task->finish);
+   util_queue_fence_reset(&task->finish);
 
    mtx_lock(&pool->m);
 
+   task->refcount = 1;
+   task->queued = true;
    list_addtail(&task->list, &pool->workqueue);
 
-   cnd_broadcast(&pool->new_work);
+   /* Only wake as many workers as there are iterations. */
+   if ((unsigned)num_iters >= pool->num_threads) {
+      cnd_broadcast(&pool->new_work);
+   } else {
+      for (unsigned i = 0; i < num_iters; i++)
+         cnd_signal(&pool->new_work);
+   }
    mtx_unlock(&pool->m);
    return task;
 }
@@ -174,12 +317,16 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
    if (!pool || !task)
       return;
 
+   util_queue_fence_wait(&task->finish);
+
+   /* Workers may still be looking for chunks to steal. */
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
-      cnd_wait(&task->finish, &pool->m);
+   if (task->queued) {
+      list_del(&task->list);
+      task->queued = false;
+   }
+   lp_cs_tpool_task_unref(task);
    mtx_unlock(&pool->m);
 
-   cnd_destroy(&task->finish);
-   FREE(task);
    *task_handle = NULL;
 }
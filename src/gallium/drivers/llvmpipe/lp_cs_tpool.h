@@ -30,6 +30,12 @@
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ *
+ * The iterations of a task are split into one range per worker thread.
+ * A worker takes chunks from the front of its own range and, once that
+ * is empty, steals the back half of another worker's range, so the
+ * pool lock is only taken once per task and worker rather than once per
+ * chunk.  Several queued tasks may run at the same time.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
@@ -37,15 +43,24 @@
 #include "util/compiler.h"
 
 #include "util/u_thread.h"
+#include "util/u_queue.h"
 #include "util/list.h"
 
 #include "lp_limits.h"
 
+struct lp_cs_tpool;
+
+struct lp_cs_tpool_thread {
+   struct lp_cs_tpool *pool;
+   thrd_t thread;
+   unsigned index;
+};
+
 struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   struct lp_cs_tpool_thread *threads;
    unsigned num_threads;
    struct list_head workqueue;
    bool shutdown;
@@ -58,16 +73,27 @@ struct lp_cs_local_mem {
 
 typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
 
+/* Iterations still to run in one worker's range: the next iteration in
+ * the low 32 bits and the end of the range in the high 32 bits, so both
+ * ends can be updated with a single compare-and-swap.  Padded to keep
+ * workers off each other's cache lines.
+ */
+struct lp_cs_tpool_range {
+   uint64_t bounds;
+   uint8_t pad[56];
+};
+
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
    struct list_head list;
-   cnd_t finish;
+   struct util_queue_fence finish;
    unsigned iter_total;
-   unsigned iter_start;
    unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   unsigned chunk_size;
+   unsigned refcount;      /* waiter plus joined workers, under pool->m */
+   bool queued;            /* still in pool->workqueue */
+   struct lp_cs_tpool_range ranges[];
 };
 
 struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
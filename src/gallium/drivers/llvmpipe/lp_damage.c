@@ -0,0 +1,344 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Per-tile damage tracking of display targets.
+ *
+ * When a scene is done binning, its bins tell which 64x64 tiles of each
+ * color buffer it changes.  A tile whose bin only clears it to the value
+ * the whole tile already holds is left alone: the bin is dropped and the
+ * tile isn't damaged.  Every other changed tile is marked damaged until
+ * the next present.
+ *
+ * With LP_PRESENT_DAMAGE=true, presents which don't come with damage
+ * from the application only copy the damaged tiles.  This assumes the
+ * window kept what was presented to it before, so it is off by default.
+ *
+ * CPU writes mark the whole resource as damaged.  Resources which may be
+ * written without going through a scene, like ones bound as writable
+ * images, are not tracked any more.  Disabled with LP_PERF=no_damage.
+ */
+
+#include "util/format/u_format.h"
+#include "util/box.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+#include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_rast.h"
+#include "lp_scene.h"
+#include "lp_screen.h"
+#include "lp_texture.h"
+
+
+/**
+ * Start tracking the damage of a display target.  Everything needs to be
+ * presented at first.
+ */
+void
+llvmpipe_resource_damage_init(struct llvmpipe_resource *lpr)
+{
+   const struct pipe_resource *pt = &lpr->base;
+
+   if ((LP_PERF & PERF_NO_DAMAGE) ||
+       pt->target != PIPE_TEXTURE_2D ||
+       pt->nr_samples > 1 ||
+       (pt->bind & PIPE_BIND_SHARED))
+      return;
+
+   unsigned tiles_x = DIV_ROUND_UP(pt->width0, TILE_SIZE);
+   unsigned tiles_y = DIV_ROUND_UP(pt->height0, TILE_SIZE);
+
+   lpr->damage = CALLOC(tiles_x * tiles_y, sizeof(*lpr->damage));
+   if (!lpr->damage)
+      return;
+
+   lpr->damage_stride = tiles_x;
+   lpr->damage_drawable = NULL;
+   for (unsigned i = 0; i < tiles_x * tiles_y; i++)
+      lpr->damage[i].damaged = true;
+}
+
+
+/**
+ * Mark all of a display target as changed, after it was written by
+ * something other than the rasterizer.
+ * \param disable  stop tracking it, as it may be written again unnoticed
+ */
+void
+llvmpipe_resource_damage_all(struct llvmpipe_resource *lpr, bool disable)
+{
+   if (!lpr->damage)
+      return;
+
+   mtx_lock(&lpr->screen->damage_mutex);
+
+   unsigned num_tiles = lpr->damage_stride *
+                        DIV_ROUND_UP(lpr->base.height0, TILE_SIZE);
+   for (unsigned i = 0; i < num_tiles; i++) {
+      lpr->damage[i].damaged = true;
+      lpr->damage[i].cleared = false;
+   }
+
+   if (disable)
+      p_atomic_set(&lpr->damage_disabled, true);
+
+   mtx_unlock(&lpr->screen->damage_mutex);
+}
+
+
+enum damage_bin_type {
+   DAMAGE_BIN_UNTOUCHED,
+   DAMAGE_BIN_CLEARED,
+   DAMAGE_BIN_DRAWN,
+};
+
+
+/**
+ * Work out what a bin does to one color buffer.
+ * \param clear  returns the last clear value, for DAMAGE_BIN_CLEARED
+ */
+static enum damage_bin_type
+characterize_bin(const struct cmd_bin *bin, unsigned cbuf,
+                 const union util_color **clear)
+{
+   enum damage_bin_type type = DAMAGE_BIN_UNTOUCHED;
+
+   for (const struct cmd_block *block = bin->head; block; block = block->next) {
+      for (unsigned k = 0; k < block->count; k++) {
+         switch (block->cmd[k]) {
+         case LP_RAST_OP_CLEAR_COLOR:
+            /* Clears always cover the whole tile. */
+            if (block->arg[k].clear_rb->cbuf == cbuf) {
+               *clear = &block->arg[k].clear_rb->color_val;
+               type = DAMAGE_BIN_CLEARED;
+            }
+            break;
+         case LP_RAST_OP_CLEAR_ZSTENCIL:
+         case LP_RAST_OP_BEGIN_QUERY:
+         case LP_RAST_OP_END_QUERY:
+         case LP_RAST_OP_SET_STATE:
+            break;
+         default:
+            type = DAMAGE_BIN_DRAWN;
+            break;
+         }
+      }
+   }
+
+   return type;
+}
+
+
+/**
+ * Get the mask of color buffers a bin clears, or zero if it does anything
+ * but clearing color buffers.
+ */
+static unsigned
+bin_color_clears(const struct cmd_bin *bin)
+{
+   unsigned mask = 0;
+
+   for (const struct cmd_block *block = bin->head; block; block = block->next) {
+      for (unsigned k = 0; k < block->count; k++) {
+         if (block->cmd[k] == LP_RAST_OP_CLEAR_COLOR)
+            mask |= 1u << block->arg[k].clear_rb->cbuf;
+         else if (block->cmd[k] != LP_RAST_OP_SET_STATE)
+            return 0;
+      }
+   }
+
+   return mask;
+}
+
+
+/**
+ * Record which tiles of the display targets a scene changes, and drop
+ * the bins which would only clear tiles to the value they already have.
+ * Called once all commands are binned.
+ *
+ * Scenes which don't render to a display target with damage tracking,
+ * like offscreen and compute work, return before walking the bins or
+ * taking the screen's damage_mutex.
+ */
+void
+lp_scene_update_damage(struct lp_scene *scene)
+{
+   struct llvmpipe_resource *tracked[PIPE_MAX_COLOR_BUFS];
+   unsigned cbufs[PIPE_MAX_COLOR_BUFS];
+   unsigned num_tracked = 0;
+   struct llvmpipe_screen *screen = NULL;
+
+   for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
+      const struct pipe_surface *psurf = scene->fb.cbufs[i];
+      if (!psurf || !llvmpipe_resource_is_texture(psurf->texture))
+         continue;
+
+      /* Only display targets have damage.  Once disabled, it stays
+       * disabled, so an unlocked read can only miss the latest change.
+       */
+      struct llvmpipe_resource *lpr = llvmpipe_resource(psurf->texture);
+      if (!lpr->damage || p_atomic_read(&lpr->damage_disabled))
+         continue;
+
+      tracked[num_tracked] = lpr;
+      cbufs[num_tracked] = i;
+      num_tracked++;
+      screen = lpr->screen;
+   }
+
+   if (!num_tracked)
+      return;
+
+   mtx_lock(&screen->damage_mutex);
+
+   for (unsigned y = 0; y < scene->tiles_y; y++) {
+      for (unsigned x = 0; x < scene->tiles_x; x++) {
+         const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+         unsigned redundant_mask = 0;
+
+         if (!bin->head)
+            continue;
+
+         for (unsigned i = 0; i < num_tracked; i++) {
+            struct llvmpipe_resource *lpr = tracked[i];
+            const struct pipe_surface *psurf = scene->fb.cbufs[cbufs[i]];
+            const union util_color *clear = NULL;
+
+            if (lpr->damage_disabled)
+               continue;
+
+            enum damage_bin_type type = characterize_bin(bin, cbufs[i], &clear);
+            if (type == DAMAGE_BIN_UNTOUCHED)
+               continue;
+
+            struct lp_damage_tile *tile =
+               &lpr->damage[y * lpr->damage_stride + x];
+
+            if (type == DAMAGE_BIN_DRAWN) {
+               tile->damaged = true;
+               tile->cleared = false;
+               continue;
+            }
+
+            /* Tiles on the right and bottom edges are only known to be
+             * cleared as a whole if the framebuffer covers them.
+             */
+            const bool whole_tile =
+               psurf->u.tex.level == 0 &&
+               psurf->u.tex.first_layer == 0 &&
+               scene->fb.width == lpr->base.width0 &&
+               scene->fb.height == lpr->base.height0;
+            const unsigned size = util_format_get_blocksize(psurf->format);
+
+            if (whole_tile && tile->cleared &&
+                memcmp(&tile->clear_value, clear, size) == 0) {
+               redundant_mask |= 1u << cbufs[i];
+               continue;
+            }
+
+            tile->damaged = true;
+            tile->cleared = whole_tile;
+            memcpy(&tile->clear_value, clear, sizeof(*clear));
+         }
+
+         /* Every color buffer the bin clears already holds the value, and
+          * there is nothing else to do.
+          */
+         if (redundant_mask) {
+            const unsigned clear_mask = bin_color_clears(bin);
+            if (clear_mask && (clear_mask & ~redundant_mask) == 0) {
+               lp_scene_bin_reset(scene, x, y);
+               LP_COUNT(nr_redundant_clear_64);
+            }
+         }
+      }
+   }
+
+   mtx_unlock(&screen->damage_mutex);
+}
+
+
+/**
+ * Get the regions of a display target changed since it was last presented
+ * to the given drawable, and start over.
+ * \param boxes  returns up to max_boxes boxes, in pixels
+ * \return false if all of it should be presented
+ */
+bool
+llvmpipe_resource_get_damage(struct llvmpipe_resource *lpr,
+                             void *drawable,
+                             struct pipe_box *boxes,
+                             unsigned max_boxes,
+                             unsigned *nboxes)
+{
+   const unsigned tiles_x = lpr->damage_stride;
+   const unsigned tiles_y = DIV_ROUND_UP(lpr->base.height0, TILE_SIZE);
+   bool partial;
+
+   if (!lpr->damage)
+      return false;
+
+   mtx_lock(&lpr->screen->damage_mutex);
+
+   partial = !lpr->damage_disabled && lpr->damage_drawable == drawable;
+   *nboxes = 0;
+
+   /* Runs of damaged tiles in a row, merged with the box right above when
+    * they span the same columns.  Once there are too many, fall back to
+    * their bounding box.
+    */
+   for (unsigned y = 0; y < tiles_y && partial; y++) {
+      for (unsigned x = 0; x < tiles_x; x++) {
+         if (!lpr->damage[y * tiles_x + x].damaged)
+            continue;
+
+         unsigned x1 = x + 1;
+         while (x1 < tiles_x && lpr->damage[y * tiles_x + x1].damaged)
+            x1++;
+
+         struct pipe_box box;
+         u_box_2d(x * TILE_SIZE, y * TILE_SIZE,
+                  MIN2(x1 * TILE_SIZE, lpr->base.width0) - x * TILE_SIZE,
+                  MIN2((y + 1) * TILE_SIZE, lpr->base.height0) - y * TILE_SIZE,
+                  &box);
+         x = x1;
+
+         bool merged = false;
+         for (unsigned i = 0; i < *nboxes; i++) {
+            if (boxes[i].x == box.x && boxes[i].width == box.width &&
+                boxes[i].y + boxes[i].height == box.y) {
+               boxes[i].height += box.height;
+               merged = true;
+               break;
+            }
+         }
+
+         if (merged)
+            continue;
+
+         if (*nboxes < max_boxes) {
+            boxes[(*nboxes)++] = box;
+         } else {
+            for (unsigned i = 1; i < *nboxes; i++)
+               u_box_union_2d(&boxes[0], &boxes[0], &boxes[i]);
+            u_box_union_2d(&boxes[0], &boxes[0], &box);
+            *nboxes = 1;
+         }
+      }
+   }
+
+   const unsigned num_tiles = tiles_x * tiles_y;
+   for (unsigned i = 0; i < num_tiles; i++) {
+      if (lpr->damage[i].damaged)
+         LP_COUNT(nr_damaged_64);
+      lpr->damage[i].damaged = false;
+   }
+
+   lpr->damage_drawable = drawable;
+
+   mtx_unlock(&lpr->screen->damage_mutex);
+
+   return partial;
+}
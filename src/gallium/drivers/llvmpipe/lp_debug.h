@@ -65,6 +65,8 @@
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
 #define PERF_NO_RAST_LINEAR 0x100  	/* disable linear rast */
 #define PERF_NO_SHADE       0x200  	/* disable fragment shaders */
+#define PERF_NO_HIZ         0x400  	/* disable per-tile depth bounds */
+#define PERF_NO_DAMAGE      0x800  	/* disable display target damage tracking */
 
 
 extern int LP_PERF;
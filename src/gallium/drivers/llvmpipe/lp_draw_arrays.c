@@ -37,6 +37,7 @@
 #include "util/u_prim.h"
 
 #include "lp_context.h"
+#include "lp_perf.h"
 #include "lp_state.h"
 #include "lp_query.h"
 
@@ -76,6 +77,10 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
    if (lp->dirty)
       llvmpipe_update_derived(lp);
 
+   if (lp->fs_variant &&
+       !util_queue_fence_is_signalled(&lp->fs_variant->ready))
+      LP_COUNT(nr_async_pending_draws);
+
    /*
     * Map vertex buffers
     */
@@ -39,6 +39,7 @@
 #include "lp_context.h"
 #include "lp_setup.h"
 #include "lp_fence.h"
+#include "lp_perf.h"
 #include "lp_screen.h"
 #include "lp_rast.h"
 
@@ -121,18 +122,45 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
                         const char *reason)
 {
    unsigned referenced = 0;
+   unsigned referenced_elsewhere = 0;
    struct llvmpipe_screen *lp_screen = llvmpipe_screen(pipe->screen);
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
 
    mtx_lock(&lp_screen->ctx_mutex);
    list_for_each_entry(struct llvmpipe_context, ctx, &lp_screen->ctx_list, list) {
-      referenced |=
+      unsigned ref =
          llvmpipe_is_resource_referenced((struct pipe_context *)ctx,
                                          resource, level);
+      referenced |= ref;
+      if (ctx != llvmpipe)
+         referenced_elsewhere |= ref;
    }
    mtx_unlock(&lp_screen->ctx_mutex);
 
    if ((referenced & LP_REFERENCED_FOR_WRITE) ||
        ((referenced & LP_REFERENCED_FOR_READ) && !read_only)) {
+      struct lp_fence *fence;
+
+      /*
+       * If only scenes already queued for rasterization use the resource,
+       * wait for the newest of those and keep the scene being built, so
+       * binning can carry on ahead of rasterization.
+       */
+      if (!(referenced_elsewhere & LP_REFERENCED_FOR_WRITE) &&
+          !((referenced_elsewhere & LP_REFERENCED_FOR_READ) && !read_only) &&
+          lp_setup_get_resource_fence(llvmpipe->setup, resource, read_only,
+                                      &fence)) {
+         if (fence) {
+            if (cpu_access && do_not_block && !lp_fence_signalled(fence)) {
+               lp_fence_reference(&fence, NULL);
+               return false;
+            }
+            lp_fence_wait(fence);
+            lp_fence_reference(&fence, NULL);
+         }
+         LP_COUNT(nr_flushes_avoided);
+         return true;
+      }
 
       if (cpu_access)
          if (do_not_block)
@@ -66,7 +66,23 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 32
+/**
+ * Upper bound for LP_NUM_THREADS.  Per-thread state is allocated for the
+ * number of threads actually in use, so this is only a sanity limit.
+ */
+#define LP_MAX_THREADS 1024
+
+/**
+ * Max number of memory domains (NUMA nodes) the rasterizer threads and
+ * bins are split between.
+ */
+#define LP_MAX_BIN_DOMAINS 8
+
+/**
+ * Max number of boxes the damage of a display target is presented as.
+ * More damage is merged into its bounding box.
+ */
+#define LP_MAX_DAMAGE_BOXES 64
 
 
 /**
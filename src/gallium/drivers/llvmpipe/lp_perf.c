@@ -113,14 +113,34 @@ lp_print_counters(void)
       debug_printf("llvmpipe:   nr_rect_full_4x4:           %9u (%3.0f%% of %u)\n", lp_count.nr_rect_fully_covered_4, p1, total_4);
       debug_printf("llvmpipe:   nr_rect_part_4x4:           %9u (%3.0f%% of %u)\n", lp_count.nr_rect_partially_covered_4, p2, total_4);
 
+      p1 = 100.0 * (float) lp_count.nr_hiz_culled_64 / (float) lp_count.nr_hiz_tested_64;
+      p2 = 100.0 * (float) lp_count.nr_hiz_culled_16 / (float) lp_count.nr_hiz_tested_16;
+
+      debug_printf("llvmpipe: nr_hiz_tested_64x64:          %9u\n", lp_count.nr_hiz_tested_64);
+      debug_printf("llvmpipe:   nr_hiz_culled_64x64:        %9u (%3.0f%% of %u)\n", lp_count.nr_hiz_culled_64, p1, lp_count.nr_hiz_tested_64);
+      debug_printf("llvmpipe: nr_hiz_tested_16x16:          %9u\n", lp_count.nr_hiz_tested_16);
+      debug_printf("llvmpipe:   nr_hiz_culled_16x16:        %9u (%3.0f%% of %u)\n", lp_count.nr_hiz_culled_16, p2, lp_count.nr_hiz_tested_16);
+
 
       debug_printf("llvmpipe: nr_color_tile_clear:          %9u\n", lp_count.nr_color_tile_clear);
       debug_printf("llvmpipe: nr_color_tile_load:           %9u\n", lp_count.nr_color_tile_load);
       debug_printf("llvmpipe: nr_color_tile_store:          %9u\n", lp_count.nr_color_tile_store);
+      debug_printf("llvmpipe: nr_redundant_clear_64x64:     %9u\n", lp_count.nr_redundant_clear_64);
+      debug_printf("llvmpipe: nr_damaged_64x64:             %9u\n", lp_count.nr_damaged_64);
+
+      debug_printf("llvmpipe: nr_parallel_binned_tris:      %9u\n", lp_count.nr_parallel_binned_tris);
+      debug_printf("llvmpipe: nr_scenes:                    %9u\n", lp_count.nr_scenes);
+      debug_printf("llvmpipe: nr_flushes_avoided:           %9u\n", lp_count.nr_flushes_avoided);
+      debug_printf("llvmpipe: total rast thread idle time:  %.2f sec\n", lp_count.rast_idle_time / 1000000.0);
 
       debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
+      debug_printf("llvmpipe: nr_jit_cache_hits:            %u\n", lp_count.nr_jit_cache_hits);
+      debug_printf("llvmpipe: nr_jit_cache_misses:          %u\n", lp_count.nr_jit_cache_misses);
+      debug_printf("llvmpipe: nr_async_compiles:            %u\n", lp_count.nr_async_compiles);
+      debug_printf("llvmpipe: nr_async_pending_draws:       %u\n", lp_count.nr_async_pending_draws);
+      debug_printf("llvmpipe: nr_async_compile_stalls:      %u\n", lp_count.nr_async_compile_stalls);
 
    }
 }
@@ -34,6 +34,7 @@
 #define LP_PERF_H
 
 #include "util/compiler.h"
+#include "util/u_atomic.h"
 
 /**
  * Various counters
@@ -62,22 +63,41 @@ struct lp_counters
    unsigned nr_rect_fully_covered_4;
    unsigned nr_rect_partially_covered_4;
    unsigned nr_non_empty_4;
+   unsigned nr_hiz_tested_64;    /**< tile depth bounds checks */
+   unsigned nr_hiz_culled_64;
+   unsigned nr_hiz_tested_16;
+   unsigned nr_hiz_culled_16;
+   unsigned nr_redundant_clear_64;  /**< clear-only bins dropped */
+   unsigned nr_damaged_64;          /**< display target tiles presented */
    unsigned nr_llvm_compiles;
+   unsigned nr_jit_cache_hits;    /**< variants loaded from the disk cache */
+   unsigned nr_jit_cache_misses;
+   unsigned nr_async_compiles;       /**< fs variants compiled in the background */
+   unsigned nr_async_pending_draws;  /**< draws binned before their fs code was ready */
+   unsigned nr_async_compile_stalls; /**< rasterizer waits for fs code */
    int64_t llvm_compile_time;  /**< total, in microseconds */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
    unsigned nr_color_tile_store;
+
+   unsigned nr_parallel_binned_tris;
+   unsigned nr_scenes;
+   unsigned nr_flushes_avoided;  /**< resource waits on queued scenes only */
+   int64_t rast_idle_time;  /**< total, in microseconds */
 };
 
 
 extern struct lp_counters lp_count;
 
 
-/** Increment the named counter (only for debug builds) */
+/**
+ * Increment the named counter (only for debug builds).  Atomic, as the
+ * counters are updated from the rasterizer, binning and compile threads.
+ */
 #if MESA_DEBUG && !THREAD_SANITIZER
-#define LP_COUNT(counter) lp_count.counter++
-#define LP_COUNT_ADD(counter, incr)  lp_count.counter += (incr)
+#define LP_COUNT(counter) p_atomic_inc(&lp_count.counter)
+#define LP_COUNT_ADD(counter, incr) p_atomic_add(&lp_count.counter, (incr))
 #define LP_COUNT_GET(counter) (lp_count.counter)
 #else
 #define LP_COUNT(counter) do {} while (0)
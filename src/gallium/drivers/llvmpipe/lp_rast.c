@@ -35,6 +35,8 @@
 #include "util/u_thread.h"
 #include "util/u_memset.h"
 #include "util/os_time.h"
+#include "util/os_file.h"
+#include "util/detect_os.h"
 
 #include "lp_scene_queue.h"
 #include "lp_context.h"
@@ -54,6 +56,10 @@
 #include <windows.h>
 #endif
 
+#if DETECT_OS_LINUX
+#include <sched.h>
+#endif
+
 #if MESA_DEBUG
 int jit_line = 0;
 const struct lp_rast_state *jit_state = NULL;
@@ -78,13 +84,40 @@ lp_rast_begin(struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __func__);
 
    lp_scene_begin_rasterization(scene);
+   lp_rast_hiz_begin_scene(scene);
    lp_scene_bin_iter_begin(scene);
 }
 
 
+/**
+ * Finish rasterizing a scene.
+ * Called once per scene by one thread, after all threads are done.
+ */
 static void
 lp_rast_end(struct lp_rasterizer *rast)
 {
+   struct lp_scene *scene = rast->curr_scene;
+
+   /* Sum up how long each thread sat waiting for the last one to finish.
+    */
+   if (scene && rast->num_threads > 1) {
+      int64_t last_done = 0;
+      int64_t idle = 0;
+
+      for (unsigned i = 0; i < rast->num_threads; i++)
+         last_done = MAX2(last_done, rast->tasks[i].scene_done_time);
+      for (unsigned i = 0; i < rast->num_threads; i++)
+         idle += last_done - rast->tasks[i].scene_done_time;
+
+      scene->rast_idle_time = idle;
+      LP_COUNT(nr_scenes);
+      LP_COUNT_ADD(rast_idle_time, idle / 1000);
+
+      LP_DBG(DEBUG_SCENE, "scene %p: rasterizer threads idle %.3f ms "
+             "(%.3f ms per thread) at end of scene\n", (void *) scene,
+             idle / 1000000.0, idle / 1000000.0 / rast->num_threads);
+   }
+
    rast->curr_scene = NULL;
 }
 
@@ -126,6 +159,9 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
                          scene->zsbuf.stride * task->y +
                          scene->zsbuf.format_bytes * task->x;
    }
+
+   task->hiz = scene->hiz ? &scene->hiz[y * scene->hiz_stride + x] : NULL;
+   task->hiz_test = LP_HIZ_TEST_NONE;
 }
 
 
@@ -286,6 +322,10 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
          }
       }
    }
+
+   if (task->hiz)
+      lp_rast_hiz_clear(task, arg.clear_zstencil.value,
+                        arg.clear_zstencil.mask);
 }
 
 
@@ -685,6 +725,13 @@ lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    task->state = arg.set_state;
+
+   /* The variant's code may still be compiling in the background. */
+   struct lp_fragment_shader_variant *variant = task->state->variant;
+   if (unlikely(!util_queue_fence_is_signalled(&variant->ready))) {
+      LP_COUNT(nr_async_compile_stalls);
+      util_queue_fence_wait(&variant->ready);
+   }
 }
 
 
@@ -957,6 +1004,9 @@ tri_rasterize_bin(struct lp_rasterizer_task *task,
 
    for (const struct cmd_block *block = bin->head; block; block = block->next) {
       for (unsigned k = 0; k < block->count; k++) {
+         if (task->hiz &&
+             !lp_rast_hiz_begin_cmd(task, block->cmd[k], block->arg[k]))
+            continue;
          dispatch_tri[block->cmd[k]](task, block->arg[k]);
       }
    }
@@ -971,6 +1021,9 @@ debug_rasterize_bin(struct lp_rasterizer_task *task,
 
    for (const struct cmd_block *block = bin->head; block; block = block->next) {
       for (unsigned k = 0; k < block->count; k++) {
+         if (task->hiz &&
+             !lp_rast_hiz_begin_cmd(task, block->cmd[k], block->arg[k]))
+            continue;
          dispatch_tri_debug[block->cmd[k]](task, block->arg[k]);
       }
    }
@@ -1062,12 +1115,15 @@ rasterize_scene(struct lp_rasterizer_task *task,
       int i, j;
 
       assert(scene);
-      while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
+      while ((bin = lp_scene_bin_iter_next(scene, task->domain,
+                                           &i, &j))) {
          if (!is_empty_bin(bin))
             rasterize_bin(task, bin, i, j);
       }
    }
 
+   task->scene_done_time = os_time_get_nano();
+
 #if LP_BUILD_FORMAT_CACHE_DEBUG
    {
       uint64_t total, miss;
@@ -1149,6 +1205,31 @@ lp_rast_finish(struct lp_rasterizer *rast)
 }
 
 
+/**
+ * Pin a rasterizer thread to the CPUs of its memory domain and move its
+ * per-thread data there.  Pages end up on the node of the thread which
+ * first touches them, so the data is re-allocated and cleared here rather
+ * than used as allocated by lp_rast_create() on the main thread.
+ */
+static void
+bind_task_to_domain(struct lp_rasterizer_task *task)
+{
+   struct lp_rasterizer *rast = task->rast;
+
+   if (!util_set_current_thread_affinity(rast->domain_masks[task->domain],
+                                         NULL, UTIL_MAX_CPUS))
+      return;
+
+   struct lp_build_format_cache *cache =
+      align_malloc(sizeof(struct lp_build_format_cache), 16);
+   if (cache) {
+      memset(cache, 0, sizeof(*cache));
+      align_free(task->thread_data.cache);
+      task->thread_data.cache = cache;
+   }
+}
+
+
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
@@ -1167,6 +1248,9 @@ thread_function(void *init_data)
    snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
 
+   if (rast->num_domains > 1)
+      bind_task_to_domain(task);
+
    /* Make sure that denorms are treated like zeros. This is
     * the behavior required by D3D10. OpenGL doesn't care.
     */
@@ -1225,6 +1309,157 @@ thread_function(void *init_data)
 }
 
 
+#if DETECT_OS_LINUX
+/**
+ * Parse a sysfs list such as "0-15,32-47" into a bit mask.
+ * \return true if any bit was set
+ */
+static bool
+parse_sysfs_list(const char *list, util_affinity_mask mask)
+{
+   const char *p = list;
+   bool any = false;
+
+   memset(mask, 0, sizeof(util_affinity_mask));
+
+   while (*p) {
+      char *end;
+      unsigned long first = strtoul(p, &end, 10);
+      unsigned long last = first;
+
+      if (end == p)
+         break;
+      p = end;
+      if (*p == '-') {
+         last = strtoul(p + 1, &end, 10);
+         p = end;
+      }
+
+      for (unsigned long i = first; i <= last && i < UTIL_MAX_CPUS; i++) {
+         mask[i / 32] |= 1u << (i % 32);
+         any = true;
+      }
+
+      if (*p != ',')
+         break;
+      p++;
+   }
+
+   return any;
+}
+
+
+static bool
+read_sysfs_list(const char *path, util_affinity_mask mask)
+{
+   char *list = os_read_file(path, NULL);
+   if (!list)
+      return false;
+
+   bool any = parse_sysfs_list(list, mask);
+   free(list);
+   return any;
+}
+
+
+/**
+ * Get the CPUs of each NUMA node this process is allowed to run on.
+ * Nodes beyond LP_MAX_BIN_DOMAINS are folded into the earlier ones.
+ * \return the number of domains found
+ */
+static unsigned
+get_numa_domains(util_affinity_mask *masks)
+{
+   util_affinity_mask nodes;
+   cpu_set_t allowed;
+   unsigned num_domains = 0;
+
+   if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return 0;
+
+   if (!read_sysfs_list("/sys/devices/system/node/online", nodes))
+      return 0;
+
+   for (unsigned node = 0; node < UTIL_MAX_CPUS; node++) {
+      util_affinity_mask cpus;
+      char path[64];
+      bool any = false;
+
+      if (!(nodes[node / 32] & (1u << (node % 32))))
+         continue;
+
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+               node);
+      if (!read_sysfs_list(path, cpus))
+         continue;
+
+      for (unsigned cpu = 0; cpu < UTIL_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+         if (!CPU_ISSET(cpu, &allowed))
+            cpus[cpu / 32] &= ~(1u << (cpu % 32));
+         else if (cpus[cpu / 32] & (1u << (cpu % 32)))
+            any = true;
+      }
+      if (!any)
+         continue;
+
+      unsigned d = num_domains % LP_MAX_BIN_DOMAINS;
+      if (num_domains < LP_MAX_BIN_DOMAINS)
+         memcpy(masks[d], cpus, sizeof(util_affinity_mask));
+      else
+         for (unsigned i = 0; i < ARRAY_SIZE(cpus); i++)
+            masks[d][i] |= cpus[i];
+      num_domains++;
+   }
+
+   return MIN2(num_domains, LP_MAX_BIN_DOMAINS);
+}
+#endif
+
+
+/**
+ * Spread the threads over the NUMA nodes, in contiguous runs of thread
+ * indices.  Each node's threads preferably rasterize their own band of
+ * tiles, see lp_scene_bin_iter_next().  Disabled with LP_NUMA=false.
+ */
+static void
+init_domains(struct lp_rasterizer *rast)
+{
+   rast->num_domains = 1;
+
+#if DETECT_OS_LINUX
+   util_affinity_mask masks[LP_MAX_BIN_DOMAINS];
+   unsigned num_domains;
+
+   if (rast->num_threads < 2 || !debug_get_bool_option("LP_NUMA", true))
+      return;
+
+   num_domains = MIN2(get_numa_domains(masks), rast->num_threads);
+   if (num_domains < 2)
+      return;
+
+   rast->domain_masks = MALLOC(num_domains * sizeof(util_affinity_mask));
+   if (!rast->domain_masks)
+      return;
+
+   memcpy(rast->domain_masks, masks, num_domains * sizeof(util_affinity_mask));
+   rast->num_domains = num_domains;
+
+   for (unsigned i = 0; i < rast->num_threads; i++)
+      rast->tasks[i].domain = i * num_domains / rast->num_threads;
+#endif
+}
+
+
+/**
+ * Number of memory domains bins are split between in lp_scene_end_binning().
+ */
+unsigned
+lp_rast_num_bin_domains(const struct lp_rasterizer *rast)
+{
+   return rast->num_domains;
+}
+
+
 /**
  * Initialize semaphores and spawn the threads.
  */
@@ -1265,7 +1500,20 @@ lp_rast_create(unsigned num_threads)
       goto no_full_scenes;
    }
 
-   for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
+   rast->num_tasks = MAX2(1, num_threads);
+   rast->tasks = CALLOC(rast->num_tasks, sizeof(struct lp_rasterizer_task));
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads > 0) {
+      rast->threads = CALLOC(num_threads, sizeof(thrd_t));
+      if (!rast->threads) {
+         goto no_thread_data_cache;
+      }
+   }
+
+   for (unsigned i = 0; i < rast->num_tasks; i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
@@ -1280,6 +1528,8 @@ lp_rast_create(unsigned num_threads)
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", false);
 
+   init_domains(rast);
+
    create_rast_threads(rast);
 
    /* for synchronizing rasterization threads */
@@ -1292,12 +1542,14 @@ lp_rast_create(unsigned num_threads)
    return rast;
 
 no_thread_data_cache:
-   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (unsigned i = 0; i < rast->num_tasks; i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
-
+   FREE(rast->threads);
+   FREE(rast->tasks);
+no_tasks:
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
    FREE(rast);
@@ -1346,9 +1598,12 @@ lp_rast_destroy(struct lp_rasterizer *rast)
       util_semaphore_destroy(&rast->tasks[i].exited);
 #endif
    }
-   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (unsigned i = 0; i < rast->num_tasks; i++) {
       align_free(rast->tasks[i].thread_data.cache);
    }
+   FREE(rast->domain_masks);
+   FREE(rast->threads);
+   FREE(rast->tasks);
 
    lp_fence_reference(&rast->last_fence, NULL);
 
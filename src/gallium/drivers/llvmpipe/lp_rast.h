@@ -243,6 +243,9 @@ lp_rast_queue_scene(struct lp_rasterizer *rast,
 void
 lp_rast_finish(struct lp_rasterizer *rast);
 
+unsigned
+lp_rast_num_bin_domains(const struct lp_rasterizer *rast);
+
 
 union lp_rast_cmd_arg {
    const struct lp_rast_shader_inputs *shade_tile;
@@ -0,0 +1,366 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Hierarchical z: per-tile depth bounds.
+ *
+ * For tracked depth buffers every 64x64 tile has a range [zmin, zmax]
+ * which contains all the depth values stored in it.  Before a command is
+ * rasterized into a tile, the range of depth values its z plane can
+ * produce over the tile is checked against the tile's range.  When all of
+ * them fail the depth test, the command is skipped for the tile.
+ * Otherwise the same check is repeated for every 16x16 block of a
+ * triangle, before the fragment shader runs on it.
+ *
+ * Clears set the range.  Commands writing depth widen it, or only move
+ * one end when the depth test means values can only get smaller or
+ * larger.  A tile is only touched by the thread rasterizing it and scenes
+ * are rasterized in order, so this needs no locking.  Any other write to
+ * the depth buffer resets its ranges, see llvmpipe_resource_hiz_invalidate.
+ *
+ * Only level 0 of 2D depth textures as large as the framebuffer is
+ * tracked.  Disabled with LP_PERF=no_hiz.
+ */
+
+#include <math.h>
+
+#include "util/format/u_format.h"
+#include "util/u_math.h"
+#include "util/u_pack_color.h"
+#include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_rast_priv.h"
+#include "lp_texture.h"
+
+
+/* Relative error of the fragment shader's evaluation of the z plane,
+ * a few float ulps.
+ */
+#define HIZ_PLANE_EPS (1.0f / (1 << 20))
+
+
+static void
+hiz_reset_tile(struct lp_hiz_tile *tile)
+{
+   tile->zmin = -INFINITY;
+   tile->zmax = INFINITY;
+}
+
+
+static bool
+hiz_surface_supported(const struct lp_scene *scene)
+{
+   const struct pipe_surface *zsbuf = scene->fb.zsbuf;
+   const struct pipe_resource *pt = zsbuf->texture;
+
+   return zsbuf->u.tex.level == 0 &&
+          zsbuf->u.tex.first_layer == 0 &&
+          zsbuf->u.tex.last_layer == 0 &&
+          scene->fb_max_layer == 0 &&
+          zsbuf->format == pt->format &&
+          scene->fb.width == pt->width0 &&
+          scene->fb.height == pt->height0;
+}
+
+
+/**
+ * Decide whether the depth bounds are used for a scene.
+ * Called once per scene, before rasterization starts.
+ */
+void
+lp_rast_hiz_begin_scene(struct lp_scene *scene)
+{
+   scene->hiz = NULL;
+
+   if (!scene->fb.zsbuf || !scene->zsbuf.map ||
+       !llvmpipe_resource_is_texture(scene->fb.zsbuf->texture))
+      return;
+
+   struct llvmpipe_resource *lpr = llvmpipe_resource(scene->fb.zsbuf->texture);
+   if (!lpr->hiz)
+      return;
+
+   if ((LP_PERF & PERF_NO_HIZ) || !hiz_surface_supported(scene)) {
+      /* Level 0 may be written without keeping the bounds up to date. */
+      if (scene->fb.zsbuf->u.tex.level == 0)
+         llvmpipe_resource_hiz_invalidate(lpr);
+      return;
+   }
+
+   /* Depth values are compared after conversion to the buffer's format,
+    * which may round them by up to one unit.
+    */
+   const struct util_format_description *desc =
+      util_format_description(scene->fb.zsbuf->format);
+   const int z_chan = desc->swizzle[0];
+   assert(z_chan <= PIPE_SWIZZLE_W);
+   if (desc->channel[z_chan].type == UTIL_FORMAT_TYPE_FLOAT) {
+      scene->hiz_quantum = 0.0f;
+   } else {
+      const unsigned bits = desc->channel[z_chan].size;
+      scene->hiz_quantum = (float)(1.0 / (double)((1ull << bits) - 1));
+   }
+
+   scene->hiz = lpr->hiz;
+   scene->hiz_stride = lpr->hiz_stride;
+}
+
+
+/**
+ * Compute the range of depth values a command can produce, before the
+ * depth test, in the box [x0, x0 + size] x [y0, y0 + size].
+ * \return false if nothing useful is known
+ */
+static bool
+hiz_plane_bounds(const struct lp_fragment_shader_variant *variant,
+                 const struct lp_rast_shader_inputs *inputs,
+                 int x0, int y0, unsigned size,
+                 float *zlo, float *zhi)
+{
+   /* Position is the first input, the polygon offset is stored in a0.x.
+    * See lp_state_setup.c and lp_bld_interp.c.
+    */
+   const float a0 = GET_A0(inputs)[0][2] + GET_A0(inputs)[0][0];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+
+   /* Give the pixel center and sample positions a pixel of slack. */
+   const float zx0 = dzdx * (float)(x0 - 1);
+   const float zx1 = dzdx * (float)(x0 + (int)size + 1);
+   const float zy0 = dzdy * (float)(y0 - 1);
+   const float zy1 = dzdy * (float)(y0 + (int)size + 1);
+
+   const float err = (fabsf(a0) +
+                      MAX2(fabsf(zx0), fabsf(zx1)) +
+                      MAX2(fabsf(zy0), fabsf(zy1))) * HIZ_PLANE_EPS;
+
+   float lo = a0 + MIN2(zx0, zx1) + MIN2(zy0, zy1) - err;
+   float hi = a0 + MAX2(zx0, zx1) + MAX2(zy0, zy1) + err;
+
+   /* This is false for NaNs as well. */
+   if (!(lo <= hi))
+      return false;
+
+   if (variant->hiz_clamp) {
+      lo = CLAMP(lo, 0.0f, 1.0f);
+      hi = CLAMP(hi, 0.0f, 1.0f);
+   }
+
+   *zlo = lo;
+   *zhi = hi;
+   return true;
+}
+
+
+/**
+ * Whether all depth values in [zlo, zhi] fail the depth test against all
+ * the values in the tile.
+ */
+static inline bool
+hiz_test_fails(enum lp_hiz_test test, const struct lp_hiz_tile *tile,
+               float quantum, float zlo, float zhi)
+{
+   switch (test) {
+   case LP_HIZ_TEST_LESS:
+      return zlo - quantum >= tile->zmax;
+   case LP_HIZ_TEST_LEQUAL:
+      return zlo - quantum > tile->zmax;
+   case LP_HIZ_TEST_GREATER:
+      return zhi + quantum <= tile->zmin;
+   case LP_HIZ_TEST_GEQUAL:
+      return zhi + quantum < tile->zmin;
+   default:
+      return false;
+   }
+}
+
+
+/**
+ * Check a command against the current tile's depth bounds, and account
+ * for the depth values it may write.
+ * Called for each command of a tracked tile, before it is executed.
+ * \return false if the command can be skipped for this tile
+ */
+bool
+lp_rast_hiz_begin_cmd(struct lp_rasterizer_task *task,
+                      unsigned cmd,
+                      const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_shader_inputs *inputs;
+   int x0 = task->x, y0 = task->y;
+   unsigned size = TILE_SIZE;
+
+   task->hiz_test = LP_HIZ_TEST_NONE;
+
+   switch (cmd) {
+   case LP_RAST_OP_CLEAR_COLOR:
+   case LP_RAST_OP_CLEAR_ZSTENCIL:
+   case LP_RAST_OP_BEGIN_QUERY:
+   case LP_RAST_OP_END_QUERY:
+   case LP_RAST_OP_SET_STATE:
+      return true;
+   case LP_RAST_OP_TRIANGLE_3_4:
+   case LP_RAST_OP_TRIANGLE_32_3_4:
+   case LP_RAST_OP_MS_TRIANGLE_3_4:
+      /* Contained in the 4x4 block at the position in plane_mask */
+      size = 4;
+      x0 += arg.triangle.plane_mask & 0xff;
+      y0 += arg.triangle.plane_mask >> 8;
+      inputs = &arg.triangle.tri->inputs;
+      break;
+   case LP_RAST_OP_TRIANGLE_3_16:
+   case LP_RAST_OP_TRIANGLE_4_16:
+   case LP_RAST_OP_TRIANGLE_32_3_16:
+   case LP_RAST_OP_TRIANGLE_32_4_16:
+   case LP_RAST_OP_MS_TRIANGLE_3_16:
+   case LP_RAST_OP_MS_TRIANGLE_4_16:
+      size = 16;
+      x0 += arg.triangle.plane_mask & 0xff;
+      y0 += arg.triangle.plane_mask >> 8;
+      inputs = &arg.triangle.tri->inputs;
+      break;
+   case LP_RAST_OP_TRIANGLE_1:
+   case LP_RAST_OP_TRIANGLE_2:
+   case LP_RAST_OP_TRIANGLE_3:
+   case LP_RAST_OP_TRIANGLE_4:
+   case LP_RAST_OP_TRIANGLE_5:
+   case LP_RAST_OP_TRIANGLE_6:
+   case LP_RAST_OP_TRIANGLE_7:
+   case LP_RAST_OP_TRIANGLE_8:
+   case LP_RAST_OP_TRIANGLE_32_1:
+   case LP_RAST_OP_TRIANGLE_32_2:
+   case LP_RAST_OP_TRIANGLE_32_3:
+   case LP_RAST_OP_TRIANGLE_32_4:
+   case LP_RAST_OP_TRIANGLE_32_5:
+   case LP_RAST_OP_TRIANGLE_32_6:
+   case LP_RAST_OP_TRIANGLE_32_7:
+   case LP_RAST_OP_TRIANGLE_32_8:
+   case LP_RAST_OP_MS_TRIANGLE_1:
+   case LP_RAST_OP_MS_TRIANGLE_2:
+   case LP_RAST_OP_MS_TRIANGLE_3:
+   case LP_RAST_OP_MS_TRIANGLE_4:
+   case LP_RAST_OP_MS_TRIANGLE_5:
+   case LP_RAST_OP_MS_TRIANGLE_6:
+   case LP_RAST_OP_MS_TRIANGLE_7:
+   case LP_RAST_OP_MS_TRIANGLE_8:
+      inputs = &arg.triangle.tri->inputs;
+      break;
+   case LP_RAST_OP_SHADE_TILE:
+   case LP_RAST_OP_SHADE_TILE_OPAQUE:
+   case LP_RAST_OP_BLIT:
+      inputs = arg.shade_tile;
+      break;
+   case LP_RAST_OP_RECTANGLE:
+      inputs = &arg.rectangle->inputs;
+      break;
+   default:
+      inputs = NULL;
+      break;
+   }
+
+   const struct lp_rast_state *state = task->state;
+   if (!state || (inputs && inputs->disable))
+      return true;
+
+   const struct lp_fragment_shader_variant *variant = state->variant;
+   struct lp_hiz_tile *tile = task->hiz;
+   float zlo, zhi;
+
+   if (variant->hiz_test == LP_HIZ_TEST_NONE &&
+       variant->hiz_write == LP_HIZ_WRITE_NONE)
+      return true;
+
+   if (!inputs || variant->hiz_write == LP_HIZ_WRITE_UNKNOWN ||
+       !hiz_plane_bounds(variant, inputs, x0, y0, size, &zlo, &zhi)) {
+      if (variant->hiz_write != LP_HIZ_WRITE_NONE)
+         hiz_reset_tile(tile);
+      return true;
+   }
+
+   const float quantum = task->scene->hiz_quantum;
+
+   if (variant->hiz_test != LP_HIZ_TEST_NONE) {
+      LP_COUNT(nr_hiz_tested_64);
+      if (hiz_test_fails(variant->hiz_test, tile, quantum, zlo, zhi)) {
+         LP_COUNT(nr_hiz_culled_64);
+         return false;
+      }
+      task->hiz_test = variant->hiz_test;
+   }
+
+   /* Written values are within [zlo, zhi] up to the format's rounding. */
+   switch (variant->hiz_write) {
+   case LP_HIZ_WRITE_LOWER:
+      tile->zmin = MIN2(tile->zmin, zlo - quantum);
+      break;
+   case LP_HIZ_WRITE_RAISE:
+      tile->zmax = MAX2(tile->zmax, zhi + quantum);
+      break;
+   case LP_HIZ_WRITE_ANY:
+      tile->zmin = MIN2(tile->zmin, zlo - quantum);
+      tile->zmax = MAX2(tile->zmax, zhi + quantum);
+      break;
+   default:
+      break;
+   }
+
+   return true;
+}
+
+
+/**
+ * Check a 16x16 block of the current command against the tile's bounds.
+ * \param x, y location of the block in window coords
+ * \return true if the block can be skipped
+ */
+bool
+lp_rast_hiz_cull_block(struct lp_rasterizer_task *task,
+                       const struct lp_rast_shader_inputs *inputs,
+                       int x, int y)
+{
+   const struct lp_fragment_shader_variant *variant = task->state->variant;
+   float zlo, zhi;
+
+   if (!hiz_plane_bounds(variant, inputs, x, y, 16, &zlo, &zhi))
+      return false;
+
+   LP_COUNT(nr_hiz_tested_16);
+   if (hiz_test_fails(task->hiz_test, task->hiz, task->scene->hiz_quantum,
+                      zlo, zhi)) {
+      LP_COUNT(nr_hiz_culled_16);
+      return true;
+   }
+
+   return false;
+}
+
+
+/**
+ * Set the current tile's bounds after a clear of the depth buffer.
+ */
+void
+lp_rast_hiz_clear(struct lp_rasterizer_task *task,
+                  uint64_t clear_value,
+                  uint64_t clear_mask)
+{
+   const enum pipe_format format = task->scene->fb.zsbuf->format;
+   const uint64_t z_mask = util_pack64_mask_z(format, 0xffffffff);
+   struct lp_hiz_tile *tile = task->hiz;
+
+   if ((clear_mask & z_mask) == 0)
+      return;
+
+   if ((clear_mask & z_mask) != z_mask) {
+      hiz_reset_tile(tile);
+      return;
+   }
+
+   /* The packed value is what ends up in memory, so unpacking it gives
+    * exactly the depth of every pixel.
+    */
+   float z;
+   util_format_unpack_z_float(format, &z, &clear_value, 1);
+   tile->zmin = z;
+   tile->zmax = z;
+}
@@ -29,6 +29,7 @@
 #define LP_RAST_PRIV_H
 
 #include "util/format/u_format.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_thread.h"
 #include "gallivm/lp_bld_debug.h"
 #include "lp_memory.h"
@@ -91,15 +92,26 @@ struct lp_rasterizer_task
    uint8_t *color_tiles[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth_tile;
 
+   /** Depth bounds of this tile, NULL if not tracked */
+   struct lp_hiz_tile *hiz;
+   /** Depth test 16x16 blocks of the current command are culled with */
+   enum lp_hiz_test hiz_test;
+
    /** "back" pointer */
    struct lp_rasterizer *rast;
 
    /** "my" index */
    unsigned thread_index;
 
+   /** Memory domain (NUMA node) this thread runs on */
+   unsigned domain;
+
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
+   /** When this thread ran out of bins in the current scene */
+   int64_t scene_done_time;
+
    util_semaphore work_ready;
    util_semaphore work_done;
 #ifdef _WIN32
@@ -125,10 +137,15 @@ struct lp_rasterizer
    struct lp_scene *curr_scene;
 
    /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   struct lp_rasterizer_task *tasks;
+   unsigned num_tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
+
+   /** CPUs of each memory domain the threads are spread over */
+   unsigned num_domains;
+   util_affinity_mask *domain_masks;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -473,4 +490,39 @@ lp_rast_linear_rect_fallback(struct lp_rasterizer_task *task,
                              const struct lp_rast_shader_inputs *inputs,
                              const struct u_rect *box);
 
+void
+lp_rast_hiz_begin_scene(struct lp_scene *scene);
+
+bool
+lp_rast_hiz_begin_cmd(struct lp_rasterizer_task *task,
+                      unsigned cmd,
+                      const union lp_rast_cmd_arg arg);
+
+void
+lp_rast_hiz_clear(struct lp_rasterizer_task *task,
+                  uint64_t clear_value,
+                  uint64_t clear_mask);
+
+bool
+lp_rast_hiz_cull_block(struct lp_rasterizer_task *task,
+                       const struct lp_rast_shader_inputs *inputs,
+                       int x, int y);
+
+
+/**
+ * Whether a 16x16 block of the current command can be skipped because
+ * all its fragments fail the depth test.
+ * \param x, y location of the block in window coords
+ */
+static inline bool
+lp_rast_hiz_cull_16(struct lp_rasterizer_task *task,
+                    const struct lp_rast_shader_inputs *inputs,
+                    int x, int y)
+{
+   if (likely(task->hiz_test == LP_HIZ_TEST_NONE))
+      return false;
+
+   return lp_rast_hiz_cull_block(task, inputs, x, y);
+}
+
 #endif
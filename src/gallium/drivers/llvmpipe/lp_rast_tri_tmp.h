@@ -322,6 +322,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       partial_mask &= ~(1 << i);
 
+      if (lp_rast_hiz_cull_16(task, &tri->inputs, px, py))
+         continue;
+
       LP_COUNT(nr_partially_covered_16);
       TAG(do_block_16)(task, tri, plane, px, py, cx);
    }
@@ -337,6 +340,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       inmask &= ~(1 << i);
 
+      if (lp_rast_hiz_cull_16(task, &tri->inputs, px, py))
+         continue;
+
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
    }
@@ -25,6 +25,7 @@
  *
  **************************************************************************/
 
+#include "util/u_atomic.h"
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
@@ -57,6 +58,20 @@ struct shader_ref {
 };
 
 
+/* Entries of lp_scene::bin_order are sort keys with the bin index in the
+ * low bits, the inverted cost bucket above it and the memory domain in
+ * the top bits.
+ */
+#define LP_BIN_ORDER_COST_SHIFT 24
+#define LP_BIN_ORDER_DOMAIN_SHIFT 29
+#define LP_BIN_ORDER_INDEX_MASK ((1u << LP_BIN_ORDER_COST_SHIFT) - 1)
+
+
+/* Flags for lp_scene::priv.bin_flags */
+#define LP_PRIVATE_BIN_TOUCHED 0x1
+#define LP_PRIVATE_BIN_RESET   0x2
+
+
 /**
  * Create a new scene object.
  * \param queue  the queue to put newly rendered/emptied scenes into
@@ -103,6 +118,7 @@ lp_scene_destroy(struct lp_scene *scene)
    lp_scene_end_rasterization(scene);
    mtx_destroy(&scene->mutex);
    free(scene->tiles);
+   free(scene->bin_order);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -138,6 +154,21 @@ lp_scene_is_oom(struct lp_scene *scene)
 }
 
 
+/* Remember which bins of a private scene need merging.
+ */
+static inline void
+mark_private_bin(struct lp_scene *scene, const struct cmd_bin *bin,
+                 uint8_t flag)
+{
+   if (scene->priv.bin_flags) {
+      unsigned idx = bin - scene->tiles;
+      if (!scene->priv.bin_flags[idx])
+         scene->priv.touched_bins[scene->priv.num_touched_bins++] = idx;
+      scene->priv.bin_flags[idx] |= flag;
+   }
+}
+
+
 /* Remove all commands from a bin.  Tries to reuse some of the memory
  * allocated to the bin, however.
  */
@@ -146,6 +177,8 @@ lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
 {
    struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
 
+   mark_private_bin(scene, bin, LP_PRIVATE_BIN_RESET);
+
    bin->last_state = NULL;
    bin->head = bin->tail;
    if (bin->tail) {
@@ -337,6 +370,7 @@ lp_scene_new_cmd_block(struct lp_scene *scene,
 {
    struct cmd_block *block = lp_scene_alloc(scene, sizeof(struct cmd_block));
    if (block) {
+      mark_private_bin(scene, bin, LP_PRIVATE_BIN_TOUCHED);
       if (bin->tail) {
          bin->tail->next = block;
          bin->tail = block;
@@ -547,60 +581,207 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
-/** advance curr_x,y to the next bin */
-static bool
-next_bin(struct lp_scene *scene)
+/**
+ * Create a private scene, which a parallel binning thread fills with the
+ * commands for a slice of a draw's primitives.
+ */
+struct lp_scene *
+lp_scene_create_private(struct lp_setup_context *setup)
+{
+   struct lp_scene *priv = CALLOC_STRUCT(lp_scene);
+   if (!priv)
+      return NULL;
+
+   priv->pipe = setup->pipe;
+   priv->setup = setup;
+
+   /* All data blocks end up owned by a real scene, so the embedded first
+    * block is never used.
+    */
+   priv->data.head = NULL;
+
+   return priv;
+}
+
+
+void
+lp_scene_destroy_private(struct lp_scene *priv)
+{
+   free(priv->tiles);
+   free(priv->priv.bin_flags);
+   free(priv->priv.touched_bins);
+   FREE(priv);
+}
+
+
+/**
+ * Prepare a private scene for binning on behalf of the given scene.
+ * The private scene shares the framebuffer state but gets its own empty
+ * bins, and may allocate at most budget bytes of new data.
+ * \return false if the private scene can't be used
+ */
+bool
+lp_scene_begin_private_binning(struct lp_scene *priv,
+                               const struct lp_scene *scene,
+                               unsigned budget)
+{
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+
+   if (priv->num_alloced_tiles < num_bins) {
+      free(priv->tiles);
+      free(priv->priv.bin_flags);
+      free(priv->priv.touched_bins);
+      priv->tiles = calloc(num_bins, sizeof(struct cmd_bin));
+      priv->priv.bin_flags = calloc(num_bins, sizeof(uint8_t));
+      priv->priv.touched_bins = calloc(num_bins, sizeof(uint32_t));
+      priv->num_alloced_tiles = num_bins;
+
+      if (!priv->tiles || !priv->priv.bin_flags || !priv->priv.touched_bins) {
+         free(priv->tiles);
+         free(priv->priv.bin_flags);
+         free(priv->priv.touched_bins);
+         priv->tiles = NULL;
+         priv->priv.bin_flags = NULL;
+         priv->priv.touched_bins = NULL;
+         priv->num_alloced_tiles = 0;
+         return false;
+      }
+   }
+
+   /* Not referenced, the private scene never outlives the real one. */
+   priv->fb = scene->fb;
+   priv->fb_max_layer = scene->fb_max_layer;
+   priv->fb_max_samples = scene->fb_max_samples;
+   priv->tiles_x = scene->tiles_x;
+   priv->tiles_y = scene->tiles_y;
+   priv->had_queries = scene->had_queries;
+   priv->permit_linear_rasterizer = scene->permit_linear_rasterizer;
+
+   assert(priv->priv.num_touched_bins == 0);
+   priv->alloc_failed = false;
+   priv->scene_size = LP_SCENE_MAX_SIZE - MIN2(budget, LP_SCENE_MAX_SIZE);
+   priv->priv.start_size = priv->scene_size;
+
+   if (!priv->data.head)
+      lp_scene_new_data_block(priv);
+
+   return priv->tiles && priv->data.head;
+}
+
+
+/**
+ * Append the commands of a private scene's bins to the scene's bins, and
+ * hand over the private scene's new data blocks.  Private scenes must be
+ * merged in primitive order.
+ * \param discard_bins  drop the binned commands instead of merging them
+ */
+void
+lp_scene_merge_private(struct lp_scene *scene,
+                       struct lp_scene *priv,
+                       bool discard_bins)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
+   for (unsigned i = 0; i < priv->priv.num_touched_bins; i++) {
+      unsigned idx = priv->priv.touched_bins[i];
+      struct cmd_bin *src = &priv->tiles[idx];
+      struct cmd_bin *dst = &scene->tiles[idx];
+
+      if (!discard_bins) {
+         /* An opaque whole-tile command on the binning thread reset its
+          * private bin, so whatever was binned before is dead as well.
+          */
+         if (priv->priv.bin_flags[idx] & LP_PRIVATE_BIN_RESET)
+            lp_scene_bin_reset(scene, idx % scene->tiles_x,
+                               idx / scene->tiles_x);
+
+         if (src->head) {
+            if (dst->tail)
+               dst->tail->next = src->head;
+            else
+               dst->head = src->head;
+            dst->tail = src->tail;
+            dst->last_state = src->last_state;
+         }
+      }
+
+      memset(src, 0, sizeof *src);
+      priv->priv.bin_flags[idx] = 0;
    }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return false;
+   priv->priv.num_touched_bins = 0;
+
+   /* New blocks are pushed at the head of the private list, so everything
+    * up to the block handed over last time is new.  They are inserted
+    * after the scene's current block, which it keeps allocating from.
+    */
+   struct data_block *first = priv->data.head;
+   struct data_block *last = NULL;
+   for (struct data_block *block = first; block != priv->priv.merged_data;
+        block = block->next)
+      last = block;
+
+   if (last) {
+      last->next = scene->data.head->next;
+      scene->data.head->next = first;
+      priv->priv.merged_data = first;
    }
-   return true;
+
+   scene->scene_size += priv->scene_size - priv->priv.start_size;
+}
+
+
+/**
+ * Forget the data blocks handed over to a scene which is about to be
+ * rasterized.
+ */
+void
+lp_scene_reset_private(struct lp_scene *priv)
+{
+   assert(priv->priv.num_touched_bins == 0);
+   priv->data.head = NULL;
+   priv->priv.merged_data = NULL;
 }
 
 
 void
 lp_scene_bin_iter_begin(struct lp_scene *scene)
 {
-   scene->curr_x = scene->curr_y = -1;
+   for (unsigned d = 0; d < scene->num_bin_domains; d++)
+      scene->bin_domain[d].curr = scene->bin_domain[d].begin;
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Bins are handed out in the order computed
+ * by lp_scene_end_binning(), with a single atomic increment per bin.
+ * A thread takes bins from its own memory domain first and from the
+ * other domains once its own has run dry.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned domain,
+                       int *x, int *y)
 {
-   struct cmd_bin *bin = NULL;
+   for (unsigned n = 0; n < scene->num_bin_domains; n++) {
+      unsigned d = (domain + n) % scene->num_bin_domains;
 
-   mtx_lock(&scene->mutex);
+      /* Don't keep bumping the cursor of a drained domain. */
+      if (p_atomic_read(&scene->bin_domain[d].curr) >= scene->bin_domain[d].end)
+         continue;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   } else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
+      unsigned i = p_atomic_inc_return(&scene->bin_domain[d].curr) - 1;
+      if (i >= scene->bin_domain[d].end)
+         continue;
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+      unsigned idx = scene->bin_order[i] & LP_BIN_ORDER_INDEX_MASK;
+      *x = idx % scene->tiles_x;
+      *y = idx / scene->tiles_x;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+      /*printf("return bin %u at %d, %d\n", idx, *x, *y);*/
+      return &scene->tiles[idx];
+   }
+
+   /* no more bins left */
+   return NULL;
 }
 
 
@@ -623,6 +804,10 @@ lp_scene_begin_binning(struct lp_scene *scene,
                                   sizeof(struct cmd_bin));
       if (!scene->tiles)
          return;
+      scene->bin_order = reallocarray(scene->bin_order, num_required_tiles,
+                                      sizeof(uint32_t));
+      if (!scene->bin_order)
+         return;
       memset(scene->tiles, 0, sizeof(struct cmd_bin) * num_required_tiles);
       scene->num_alloced_tiles = num_required_tiles;
    }
@@ -662,15 +847,92 @@ lp_scene_begin_binning(struct lp_scene *scene,
 }
 
 
+static int
+compare_bin_order(const void *a, const void *b)
+{
+   const uint32_t ka = *(const uint32_t *)a;
+   const uint32_t kb = *(const uint32_t *)b;
+   return ka < kb ? -1 : ka > kb;
+}
+
+
+/**
+ * Sort the non-empty bins so the most expensive ones get rasterized
+ * first.  Otherwise a few heavy tiles late in raster order can leave
+ * all but one thread idle at the end of the scene.
+ *
+ * The cost estimate is the log2 of the command count, so bins of similar
+ * cost stay in raster order, which keeps neighbouring tiles on nearby
+ * threads.  Bins which can take the blit or linear paths are much
+ * cheaper per command and are weighted down accordingly.
+ */
+static void
+order_bins(struct lp_scene *scene)
+{
+   const unsigned num_bins = lp_scene_get_num_bins(scene);
+   const unsigned num_domains = scene->num_bin_domains;
+   unsigned domain_bins[LP_MAX_BIN_DOMAINS] = {0};
+   unsigned n = 0;
+
+   STATIC_ASSERT(TILES_X * TILES_Y <= LP_BIN_ORDER_INDEX_MASK + 1);
+   STATIC_ASSERT(LP_MAX_BIN_DOMAINS <= 1u << (32 - LP_BIN_ORDER_DOMAIN_SHIFT));
+
+   for (unsigned idx = 0; idx < num_bins; idx++) {
+      const struct cmd_bin *bin = &scene->tiles[idx];
+      if (!bin->head || (!bin->head->count && !bin->head->next))
+         continue;
+
+      struct lp_bin_info info = lp_characterize_bin(bin);
+      unsigned cost = info.count;
+      if (info.type & (LP_RAST_FLAGS_BLIT | LP_RAST_FLAGS_RECT))
+         cost = DIV_ROUND_UP(cost, 4);
+
+      /* Domains own horizontal bands of tiles, which keeps the rows of a
+       * linear color or depth buffer they write mostly in one piece.
+       */
+      unsigned domain = (idx / scene->tiles_x) * num_domains / scene->tiles_y;
+      domain_bins[domain]++;
+
+      unsigned bucket = util_logbase2(MAX2(cost, 1));
+      scene->bin_order[n++] = (domain << LP_BIN_ORDER_DOMAIN_SHIFT) |
+                              ((31 - bucket) << LP_BIN_ORDER_COST_SHIFT) | idx;
+   }
+
+   qsort(scene->bin_order, n, sizeof(uint32_t), compare_bin_order);
+   scene->num_ordered_bins = n;
+
+   unsigned begin = 0;
+   for (unsigned d = 0; d < num_domains; d++) {
+      scene->bin_domain[d].begin = begin;
+      scene->bin_domain[d].end = begin + domain_bins[d];
+      begin += domain_bins[d];
+   }
+}
+
+
 void
-lp_scene_end_binning(struct lp_scene *scene)
+lp_scene_end_binning(struct lp_scene *scene, unsigned num_bin_domains)
 {
+   scene->num_bin_domains = CLAMP(num_bin_domains, 1, LP_MAX_BIN_DOMAINS);
+
+   lp_scene_update_damage(scene);
+
+   if (scene->bin_order) {
+      order_bins(scene);
+   } else {
+      scene->num_ordered_bins = 0;
+      for (unsigned d = 0; d < scene->num_bin_domains; d++)
+         scene->bin_domain[d].begin = scene->bin_domain[d].end = 0;
+   }
+
    if (LP_DEBUG & DEBUG_SCENE) {
       debug_printf("rasterize scene:\n");
       debug_printf("  scene_size: %u\n",
                    scene->scene_size);
       debug_printf("  data size: %u\n",
                    lp_scene_data_size(scene));
+      debug_printf("  non-empty bins: %u of %u\n",
+                   scene->num_ordered_bins, lp_scene_get_num_bins(scene));
 
       if (0)
          lp_debug_bins(scene);
@@ -36,6 +36,7 @@
 #define LP_SCENE_H
 
 #include "util/u_thread.h"
+#include "lp_limits.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
 
@@ -163,6 +164,13 @@ struct lp_scene {
    /* max samples for bound framebuffer */
    unsigned fb_max_samples;
 
+   /* Per-tile depth bounds of the z/stencil buffer, NULL if they are not
+    * tracked for this scene.  See lp_rast_hiz.c.
+    */
+   struct lp_hiz_tile *hiz;
+   unsigned hiz_stride;
+   float hiz_quantum;  /**< resolution of the depth format */
+
    /** the framebuffer to render the scene into */
    struct pipe_framebuffer_state fb;
 
@@ -195,11 +203,46 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
    mtx_t mutex;
 
    unsigned num_alloced_tiles;
    struct cmd_bin *tiles;
+
+   /**
+    * Non-empty bins in the order the rasterizer threads should pick them
+    * up, most expensive first.  Built by lp_scene_end_binning() and
+    * consumed lock-free through the per-domain cursors.
+    *
+    * With several memory domains, each one owns a band of tile rows and
+    * its bins form a contiguous range of bin_order.  Threads drain their
+    * own domain's range before helping out with the others, so a tile's
+    * color and depth memory is mostly touched from the same NUMA node.
+    */
+   uint32_t *bin_order;
+   unsigned num_ordered_bins;
+
+   unsigned num_bin_domains;
+   struct {
+      unsigned begin, end;   /**< range of bin_order */
+      unsigned curr;         /**< next entry to hand out */
+   } bin_domain[LP_MAX_BIN_DOMAINS];
+
+   /** Time rasterizer threads spent idle waiting for the slowest thread
+    * to finish this scene, summed over all threads (in nanoseconds).
+    */
+   int64_t rast_idle_time;
+
+   /**
+    * Only used by the private scenes of parallel binning threads,
+    * see lp_scene_begin_private_binning().
+    */
+   struct {
+      uint8_t *bin_flags;          /**< LP_PRIVATE_BIN_x per bin */
+      uint32_t *touched_bins;      /**< bins with nonzero bin_flags */
+      unsigned num_touched_bins;
+      unsigned start_size;         /**< scene_size at start of binning */
+      struct data_block *merged_data; /**< newest block handed over */
+   } priv;
    struct data_block_list data;
 };
 
@@ -395,11 +438,34 @@ lp_scene_get_num_bins(const struct lp_scene *scene)
 }
 
 
+/* Private scenes for binning on multiple threads
+ */
+struct lp_scene *
+lp_scene_create_private(struct lp_setup_context *setup);
+
+void
+lp_scene_destroy_private(struct lp_scene *priv);
+
+bool
+lp_scene_begin_private_binning(struct lp_scene *priv,
+                               const struct lp_scene *scene,
+                               unsigned budget);
+
+void
+lp_scene_merge_private(struct lp_scene *scene,
+                       struct lp_scene *priv,
+                       bool discard_bins);
+
+void
+lp_scene_reset_private(struct lp_scene *priv);
+
+
 void
 lp_scene_bin_iter_begin(struct lp_scene *scene);
 
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene, int *x, int *y);
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned domain,
+                       int *x, int *y);
 
 
 
@@ -410,7 +476,10 @@ lp_scene_begin_binning(struct lp_scene *scene,
                        struct pipe_framebuffer_state *fb);
 
 void
-lp_scene_end_binning(struct lp_scene *scene);
+lp_scene_end_binning(struct lp_scene *scene, unsigned num_bin_domains);
+
+void
+lp_scene_update_damage(struct lp_scene *scene);
 
 
 /* Begin/end rasterization of a scene
@@ -55,6 +55,7 @@
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
 #include "lp_flush.h"
+#include "lp_perf.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -101,6 +102,8 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
    { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    { "no_shade",       PERF_NO_SHADE, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
+   { "no_damage",      PERF_NO_DAMAGE, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -913,9 +916,25 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    assert(texture->dt);
 
    if (texture->dt) {
+      struct pipe_box damage[LP_MAX_DAMAGE_BOXES];
+      unsigned ndamage;
+
       if (_pipe)
          llvmpipe_flush_resource(_pipe, resource, 0, true, true,
                                  false, "frontbuffer");
+
+      /* Without damage from the caller, only present what changed since
+       * the last time.
+       */
+      if (!nboxes && screen->present_damage &&
+          llvmpipe_resource_get_damage(texture, context_private, damage,
+                                       ARRAY_SIZE(damage), &ndamage)) {
+         if (!ndamage)
+            return;
+         nboxes = ndamage;
+         sub_box = damage;
+      }
+
       winsys->displaytarget_display(winsys, texture->dt,
                                     context_private, nboxes, sub_box);
    }
@@ -930,6 +949,9 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
+   if (screen->late_init_done && screen->async_compile)
+      util_queue_destroy(&screen->fs_compile_queue);
+
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
@@ -952,6 +974,7 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
 #endif
    mtx_destroy(&screen->rast_mutex);
    mtx_destroy(&screen->cs_mutex);
+   mtx_destroy(&screen->damage_mutex);
    FREE(screen);
 }
 
@@ -1069,10 +1092,12 @@ lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                                     sha1, &binary_size);
    if (!buffer) {
       cache->data_size = 0;
+      LP_COUNT(nr_jit_cache_misses);
       return;
    }
    cache->data_size = binary_size;
    cache->data = buffer;
+   LP_COUNT(nr_jit_cache_hits);
 }
 
 
@@ -1121,6 +1146,15 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
 
    lp_build_init(); /* get lp_native_vector_width initialised */
 
+   /* Leave most of the CPUs to the rasterizer, which is waiting for the
+    * compiled code.
+    */
+   if (screen->async_compile &&
+       !util_queue_init(&screen->fs_compile_queue, "lpfs", 64,
+                        CLAMP(util_get_cpu_caps()->nr_cpus / 2, 1, 4),
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, screen))
+      screen->async_compile = false;
+
    lp_disk_cache_create(screen);
    screen->late_init_done = true;
 out:
@@ -1186,6 +1220,10 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS",
                                               screen->num_threads);
    screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+   screen->parallel_binning = debug_get_bool_option("LP_PARALLEL_BINNING",
+                                                    false);
+   screen->async_compile = debug_get_bool_option("LP_ASYNC_COMPILE", false);
+   screen->present_damage = debug_get_bool_option("LP_PRESENT_DAMAGE", false);
 
 #if defined(HAVE_LIBDRM) && defined(HAVE_LINUX_UDMABUF_H)
    screen->udmabuf_fd = open("/dev/udmabuf", O_RDWR);
@@ -1212,6 +1250,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    (void) mtx_init(&screen->ctx_mutex, mtx_plain);
    (void) mtx_init(&screen->cs_mutex, mtx_plain);
    (void) mtx_init(&screen->rast_mutex, mtx_plain);
+   (void) mtx_init(&screen->damage_mutex, mtx_plain);
 
    (void) mtx_init(&screen->late_mutex, mtx_plain);
 
@@ -37,6 +37,7 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "util/u_thread.h"
+#include "util/u_queue.h"
 #include "util/list.h"
 #include "util/vma.h"
 #include "gallivm/lp_bld.h"
@@ -52,6 +53,11 @@ struct llvmpipe_screen
    struct sw_winsys *winsys;
 
    unsigned num_threads;
+   bool parallel_binning;
+
+   /** Fragment shader variants compiled in the background */
+   bool async_compile;
+   struct util_queue fs_compile_queue;
 
    /* Increments whenever textures are modified.  Contexts can track this.
     */
@@ -63,6 +69,11 @@ struct llvmpipe_screen
    struct lp_cs_tpool *cs_tpool;
    mtx_t cs_mutex;
 
+   /** Protects the damage of all display targets */
+   mtx_t damage_mutex;
+   /** Present only the damaged parts of display targets */
+   bool present_damage;
+
    bool allow_cl;
 
    mtx_t late_mutex;
@@ -181,6 +181,7 @@ lp_setup_reset(struct lp_setup_context *setup)
 
    /* no current bin */
    setup->scene = NULL;
+   lp_setup_parallel_reset(setup);
 
    /* Reset some state:
     */
@@ -207,7 +208,7 @@ lp_setup_rasterize_scene(struct lp_setup_context *setup)
    memcpy(scene->active_queries, setup->active_queries,
           scene->num_active_queries * sizeof(scene->active_queries[0]));
 
-   lp_scene_end_binning(scene);
+   lp_scene_end_binning(scene, lp_rast_num_bin_domains(screen->rast));
 
    mtx_lock(&screen->rast_mutex);
    lp_rast_queue_scene(screen->rast, scene);
@@ -973,6 +974,72 @@ lp_setup_is_resource_referenced(const struct lp_setup_context *setup,
 }
 
 
+static inline bool
+resource_access_conflicts(unsigned ref, bool read_only)
+{
+   return (ref & LP_REFERENCED_FOR_WRITE) ||
+          ((ref & LP_REFERENCED_FOR_READ) && !read_only);
+}
+
+
+/**
+ * Find out what has to complete before the resource may be accessed,
+ * without flushing the scene being built.
+ *
+ * \param read_only  whether the access only reads the resource
+ * \param fence  returns a reference to the fence of the newest queued
+ *               scene which conflicts with the access, or NULL if none
+ * \return false if the scene being built (or its pending clears) uses
+ *         the resource, in which case it has to be flushed first
+ */
+bool
+lp_setup_get_resource_fence(const struct lp_setup_context *setup,
+                            const struct pipe_resource *texture,
+                            bool read_only,
+                            struct lp_fence **fence)
+{
+   struct lp_fence *newest = NULL;
+
+   *fence = NULL;
+
+   /* The bound framebuffer only matters if something is pending for it */
+   if (setup->state != SETUP_FLUSHED) {
+      for (unsigned i = 0; i < setup->fb.nr_cbufs; i++) {
+         if (setup->fb.cbufs[i] && setup->fb.cbufs[i]->texture == texture)
+            return false;
+      }
+      if (setup->fb.zsbuf && setup->fb.zsbuf->texture == texture)
+         return false;
+   }
+
+   /* Scenes are rasterized in the order they are queued, so waiting for
+    * the newest one using the resource covers all the older ones.
+    */
+   for (unsigned i = 0; i < setup->num_active_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+
+      mtx_lock(&scene->mutex);
+      unsigned ref = lp_scene_is_resource_referenced(scene, texture);
+      mtx_unlock(&scene->mutex);
+
+      if (!resource_access_conflicts(ref, read_only))
+         continue;
+
+      if (scene == setup->scene || !scene->fence ||
+          !lp_fence_issued(scene->fence))
+         return false;
+
+      if (!newest || scene->fence->id > newest->id)
+         newest = scene->fence;
+   }
+
+   if (newest && !lp_fence_signalled(newest))
+      lp_fence_reference(fence, newest);
+
+   return true;
+}
+
+
 /**
  * Called by vbuf code when we're about to draw something.
  *
@@ -1316,6 +1383,8 @@ lp_setup_destroy(struct lp_setup_context *setup)
    LP_DBG(DEBUG_SETUP, "number of scenes used: %d\n", setup->num_active_scenes);
    slab_destroy(&setup->scene_slab);
 
+   lp_setup_parallel_destroy(setup);
+
    FREE(setup);
 }
 
@@ -1347,6 +1416,11 @@ lp_setup_create(struct pipe_context *pipe,
    setup->pipe = pipe;
 
    setup->num_threads = screen->num_threads;
+   if (screen->parallel_binning && screen->num_threads > 1) {
+      if (!lp_setup_parallel_init(setup, screen->num_threads))
+         goto no_vbuf;
+   }
+
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1386,6 +1460,7 @@ no_scenes:
 
    setup->vbuf->destroy(setup->vbuf);
 no_vbuf:
+   lp_setup_parallel_destroy(setup);
    FREE(setup);
 no_setup:
    return NULL;
@@ -55,6 +55,17 @@
 struct lp_setup_variant;
 
 
+/**
+ * Per-thread state for parallel binning, see lp_setup_parallel.c.
+ */
+struct lp_setup_bin_worker {
+   struct lp_scene *scene;     /**< private scene for this thread */
+   unsigned begin, end;        /**< slice of triangles to bin */
+   unsigned failed_at;         /**< first triangle which didn't fit */
+   bool ready;
+};
+
+
 /** Max number of scenes */
 #define INITIAL_SCENES 4
 #define MAX_SCENES 64
@@ -96,6 +107,10 @@ struct lp_setup_context
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
+   /** for LP_PARALLEL_BINNING, NULL otherwise */
+   struct lp_setup_bin_worker *bin_workers;
+   unsigned num_bin_workers;
+
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned active_binned_queries;
 
@@ -244,6 +259,7 @@ lp_setup_flush_and_restart(struct lp_setup_context *setup);
 
 bool
 lp_setup_whole_tile(struct lp_setup_context *setup,
+                    struct lp_scene *scene,
                     const struct lp_rast_shader_inputs *inputs,
                     int tx, int ty, bool opaque);
 
@@ -293,6 +309,7 @@ lp_setup_analyse_triangles(struct lp_setup_context *setup,
 
 bool
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_scene *scene,
                       struct lp_rast_triangle *tri,
                       bool use_32bits,
                       bool opaque,
@@ -300,6 +317,29 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       int nr_planes,
                       unsigned scissor_index);
 
+bool
+lp_setup_triangle_private(struct lp_setup_context *setup,
+                          struct lp_scene *scene,
+                          const float (*v0)[4],
+                          const float (*v1)[4],
+                          const float (*v2)[4]);
+
+bool
+lp_setup_bin_triangles_parallel(struct lp_setup_context *setup,
+                                const void *vertex_buffer,
+                                unsigned stride,
+                                const uint16_t *indices,
+                                unsigned nr_tris);
+
+bool
+lp_setup_parallel_init(struct lp_setup_context *setup, unsigned num_threads);
+
+void
+lp_setup_parallel_reset(struct lp_setup_context *setup);
+
+void
+lp_setup_parallel_destroy(struct lp_setup_context *setup);
+
 bool
 lp_setup_bin_rectangle(struct lp_setup_context *setup,
                        struct lp_rast_rectangle *rect,
@@ -0,0 +1,221 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Parallel binning of triangle lists.
+ *
+ * A batch of triangles from the draw module is split into contiguous
+ * slices, one per worker thread.  Each worker sets up and bins its slice
+ * into a private scene with its own bins and data blocks.  The private
+ * bins are then appended to the real scene's bins in slice order, so the
+ * commands in every bin stay in API primitive order.
+ *
+ * Enabled with LP_PARALLEL_BINNING=true.  The workers run on the
+ * screen's compute thread pool.
+ */
+
+
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "lp_context.h"
+#include "lp_cs_tpool.h"
+#include "lp_perf.h"
+#include "lp_scene.h"
+#include "lp_screen.h"
+#include "lp_setup_context.h"
+
+
+/* Below this many triangles per thread, the hand-off costs more than
+ * it gains.
+ */
+#define LP_SETUP_MIN_TRIS_PER_WORKER 32
+
+
+struct lp_setup_bin_job {
+   struct lp_setup_context *setup;
+   const void *vertex_buffer;
+   const uint16_t *indices;      /**< NULL for non-indexed draws */
+   unsigned stride;
+   unsigned nr_tris;
+};
+
+
+static inline const float (*
+get_tri_vert(const struct lp_setup_bin_job *job, unsigned i))[4]
+{
+   unsigned index = job->indices ? job->indices[i] : i;
+   return (const float (*)[4])((const char *)job->vertex_buffer +
+                               index * job->stride);
+}
+
+
+static void
+bin_triangles_worker(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct lp_setup_bin_job *job = data;
+   struct lp_setup_context *setup = job->setup;
+   struct lp_setup_bin_worker *worker = &setup->bin_workers[iter_idx];
+
+   if (!worker->ready)
+      return;
+
+   for (unsigned t = worker->begin; t < worker->end; t++) {
+      if (!lp_setup_triangle_private(setup, worker->scene,
+                                     get_tri_vert(job, 3 * t + 0),
+                                     get_tri_vert(job, 3 * t + 1),
+                                     get_tri_vert(job, 3 * t + 2))) {
+         worker->failed_at = t;
+         return;
+      }
+   }
+
+   worker->failed_at = worker->end;
+}
+
+
+/**
+ * Set up and bin a list of independent triangles on several threads.
+ * \param indices  triangle vertex indices, or NULL for sequential vertices
+ * \return false if the triangles should be binned serially instead
+ */
+bool
+lp_setup_bin_triangles_parallel(struct lp_setup_context *setup,
+                                const void *vertex_buffer,
+                                unsigned stride,
+                                const uint16_t *indices,
+                                unsigned nr_tris)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   struct llvmpipe_context *lp_context = llvmpipe_context(setup->pipe);
+   struct lp_scene *scene = setup->scene;
+
+   unsigned num_workers = MIN2(setup->num_bin_workers,
+                               nr_tris / LP_SETUP_MIN_TRIS_PER_WORKER);
+   if (num_workers < 2)
+      return false;
+
+   /* Everything is culled with PIPE_FACE_FRONT_AND_BACK, which the serial
+    * path does for free, without counting primitives.
+    */
+   if (setup->state != SETUP_ACTIVE || !scene ||
+       setup->rasterizer_discard ||
+       setup->cullmode == PIPE_FACE_FRONT_AND_BACK ||
+       lp_setup_zero_sample_mask(setup))
+      return false;
+
+   /* Split what is left of the scene's memory between the workers. */
+   unsigned budget =
+      (LP_SCENE_MAX_SIZE - MIN2(scene->scene_size, LP_SCENE_MAX_SIZE)) /
+      num_workers;
+   unsigned tris_per_worker = DIV_ROUND_UP(nr_tris, num_workers);
+
+   for (unsigned w = 0; w < num_workers; w++) {
+      struct lp_setup_bin_worker *worker = &setup->bin_workers[w];
+
+      if (!worker->scene) {
+         worker->scene = lp_scene_create_private(setup);
+         if (!worker->scene) {
+            num_workers = w;
+            break;
+         }
+      }
+
+      worker->begin = MIN2(w * tris_per_worker, nr_tris);
+      worker->end = MIN2(worker->begin + tris_per_worker, nr_tris);
+      worker->failed_at = worker->begin;
+      worker->ready = lp_scene_begin_private_binning(worker->scene, scene,
+                                                     budget);
+   }
+
+   if (num_workers == 0)
+      return false;
+
+   struct lp_setup_bin_job job = {
+      .setup = setup,
+      .vertex_buffer = vertex_buffer,
+      .indices = indices,
+      .stride = stride,
+      .nr_tris = nr_tris,
+   };
+
+   struct lp_cs_tpool_task *task;
+   mtx_lock(&screen->cs_mutex);
+   task = lp_cs_tpool_queue_task(screen->cs_tpool, bin_triangles_worker,
+                                 &job, num_workers);
+   mtx_unlock(&screen->cs_mutex);
+   lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+
+   /* Merge in primitive order.  Everything after the first triangle a
+    * worker failed to bin is dropped and redone serially below, which
+    * flushes the scene as needed.
+    */
+   unsigned resume = nr_tris;
+   for (unsigned w = 0; w < num_workers; w++) {
+      struct lp_setup_bin_worker *worker = &setup->bin_workers[w];
+      bool discard = resume != nr_tris;
+
+      lp_scene_merge_private(scene, worker->scene, discard);
+
+      if (!discard && worker->failed_at < worker->end)
+         resume = worker->failed_at;
+   }
+
+   LP_COUNT_ADD(nr_parallel_binned_tris, resume);
+
+   /* Like triangle_both/ccw/cw(), which count the triangles binned
+    * serially below.
+    */
+   if (lp_context->active_statistics_queries)
+      lp_context->pipeline_statistics.c_primitives += resume;
+
+   for (unsigned t = resume; t < nr_tris; t++) {
+      setup->triangle(setup,
+                      get_tri_vert(&job, 3 * t + 0),
+                      get_tri_vert(&job, 3 * t + 1),
+                      get_tri_vert(&job, 3 * t + 2));
+   }
+
+   return true;
+}
+
+
+/**
+ * The current scene is going away, so the data blocks the workers handed
+ * over to it must not be allocated from any more.
+ */
+void
+lp_setup_parallel_reset(struct lp_setup_context *setup)
+{
+   for (unsigned w = 0; w < setup->num_bin_workers; w++) {
+      if (setup->bin_workers[w].scene)
+         lp_scene_reset_private(setup->bin_workers[w].scene);
+   }
+}
+
+
+bool
+lp_setup_parallel_init(struct lp_setup_context *setup, unsigned num_threads)
+{
+   setup->bin_workers = CALLOC(num_threads,
+                               sizeof(struct lp_setup_bin_worker));
+   if (!setup->bin_workers)
+      return false;
+
+   setup->num_bin_workers = num_threads;
+   return true;
+}
+
+
+void
+lp_setup_parallel_destroy(struct lp_setup_context *setup)
+{
+   for (unsigned w = 0; w < setup->num_bin_workers; w++) {
+      if (setup->bin_workers[w].scene)
+         lp_scene_destroy_private(setup->bin_workers[w].scene);
+   }
+
+   FREE(setup->bin_workers);
+   setup->bin_workers = NULL;
+   setup->num_bin_workers = 0;
+}
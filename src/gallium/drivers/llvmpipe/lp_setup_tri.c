@@ -273,14 +273,13 @@ check_opaque(const struct lp_setup_context *setup,
  */
 static bool
 do_triangle_ccw(struct lp_setup_context *setup,
+                struct lp_scene *scene,
                 struct fixed_position *position,
                 const float (*v0)[4],
                 const float (*v1)[4],
                 const float (*v2)[4],
                 bool frontfacing)
 {
-   struct lp_scene *scene = setup->scene;
-
    const float (*pv)[4];
    if (setup->flatshade_first) {
       pv = v0;
@@ -744,7 +743,7 @@ do_triangle_ccw(struct lp_setup_context *setup,
                                   s_planes, setup->multisample);
    }
 
-   return lp_setup_bin_triangle(setup, tri, use_32bits,
+   return lp_setup_bin_triangle(setup, scene, tri, use_32bits,
                                 check_opaque(setup, v0, v1, v2),
                                 &bbox, nr_planes, viewport_index);
 }
@@ -779,6 +778,7 @@ floor_pot(uint32_t n)
 
 bool
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_scene *scene,
                       struct lp_rast_triangle *tri,
                       bool use_32bits,
                       bool opaque,
@@ -786,7 +786,6 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       int nr_planes,
                       unsigned viewport_index)
 {
-   struct lp_scene *scene = setup->scene;
    unsigned cmd;
 
    /* What is the largest power-of-two boundary this triangle crosses:
@@ -970,7 +969,7 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                /* triangle covers the whole tile- shade whole tile */
                LP_COUNT(nr_fully_covered_64);
                in = true;
-               if (!lp_setup_whole_tile(setup, &tri->inputs, x, y, opaque))
+               if (!lp_setup_whole_tile(setup, scene, &tri->inputs, x, y, opaque))
                   goto fail;
             }
 
@@ -1017,11 +1016,11 @@ retry_triangle_ccw(struct lp_setup_context *setup,
       return;
    }
 
-   if (!do_triangle_ccw(setup, position, v0, v1, v2, front)) {
+   if (!do_triangle_ccw(setup, setup->scene, position, v0, v1, v2, front)) {
       if (!lp_setup_flush_and_restart(setup))
          return;
 
-      if (!do_triangle_ccw(setup, position, v0, v1, v2, front))
+      if (!do_triangle_ccw(setup, setup->scene, position, v0, v1, v2, front))
          return;
    }
 }
@@ -1243,6 +1242,59 @@ triangle_both(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Cull and bin a triangle into a private scene, for parallel binning.
+ * Unlike the setup->triangle() functions this never flushes the scene.
+ * Pipeline statistics and the sample mask are handled by the caller.
+ * \return false if the private scene ran out of memory
+ */
+bool
+lp_setup_triangle_private(struct lp_setup_context *setup,
+                          struct lp_scene *scene,
+                          const float (*v0)[4],
+                          const float (*v1)[4],
+                          const float (*v2)[4])
+{
+   alignas(16) struct fixed_position position;
+   bool draw_ccw, draw_cw;
+
+   switch (setup->cullmode) {
+   case PIPE_FACE_NONE:
+      draw_ccw = draw_cw = true;
+      break;
+   case PIPE_FACE_BACK:
+      draw_ccw = setup->ccw_is_frontface;
+      draw_cw = !draw_ccw;
+      break;
+   case PIPE_FACE_FRONT:
+      draw_ccw = !setup->ccw_is_frontface;
+      draw_cw = !draw_ccw;
+      break;
+   default:
+      return true;
+   }
+
+   int8_t area_sign = calc_fixed_position(setup, &position, v0, v1, v2);
+
+   if (area_sign > 0 && draw_ccw) {
+      return do_triangle_ccw(setup, scene, &position, v0, v1, v2,
+                             setup->ccw_is_frontface);
+   } else if (area_sign < 0 && draw_cw) {
+      if (setup->flatshade_first) {
+         rotate_fixed_position_12(&position);
+         return do_triangle_ccw(setup, scene, &position, v0, v2, v1,
+                                !setup->ccw_is_frontface);
+      } else {
+         rotate_fixed_position_01(&position);
+         return do_triangle_ccw(setup, scene, &position, v1, v0, v2,
+                                !setup->ccw_is_frontface);
+      }
+   }
+
+   return true;
+}
+
+
 static void
 triangle_noop(struct lp_setup_context *setup,
               const float (*v0)[4],
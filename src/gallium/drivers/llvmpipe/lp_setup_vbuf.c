@@ -165,6 +165,20 @@ rect(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Whether a triangle list goes through the parallel binner.  Lists which
+ * may be turned into rectangles for the linear rasterizer don't.
+ */
+static inline bool
+use_parallel_binning(const struct lp_setup_context *setup,
+                     unsigned nr, bool uses_constant_interp)
+{
+   return setup->num_bin_workers &&
+          (!setup->permit_linear_rasterizer ||
+           nr % 6 != 0 || uses_constant_interp);
+}
+
+
 /**
  * draw elements / indexed primitives
  */
@@ -223,6 +237,11 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const uint16_t *indices, uint nr
       break;
 
    case MESA_PRIM_TRIANGLES:
+      if (use_parallel_binning(setup, nr, uses_constant_interp) &&
+          lp_setup_bin_triangles_parallel(setup, vertex_buffer, stride,
+                                          indices, nr / 3)) {
+         break;
+      }
       if (nr % 6 == 0 && !uses_constant_interp) {
          for (i = 5; i < nr; i += 6) {
             rect(setup,
@@ -431,6 +450,11 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       break;
 
    case MESA_PRIM_TRIANGLES:
+      if (use_parallel_binning(setup, nr, uses_constant_interp) &&
+          lp_setup_bin_triangles_parallel(setup, vertex_buffer, stride,
+                                          NULL, nr / 3)) {
+         break;
+      }
       if (nr % 6 == 0 && !uses_constant_interp) {
          for (i = 5; i < nr; i += 6) {
             rect(setup,
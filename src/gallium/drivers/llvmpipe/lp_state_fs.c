@@ -675,6 +675,7 @@ fs_fb_fetch(const struct lp_build_fs_iface *iface,
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
                  const struct lp_fragment_shader_variant_key *key,
                  LLVMBuilderRef builder,
                  struct lp_type type,
@@ -710,7 +711,6 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef z_out = NULL, s_out = NULL;
    struct lp_build_for_loop_state loop_state, sample_loop_state = {0};
    struct lp_build_mask_context mask;
-   struct nir_shader *nir = shader->base.ir.nir;
    const bool dual_source_blend = key->blend.rt[0].blend_enable &&
                                   util_blend_state_is_dual(&key->blend, 0);
    const bool post_depth_coverage = nir->info.fs.post_depth_coverage;
@@ -2539,8 +2539,9 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    LLVMValueRef undef_src_val = lp_build_undef(gallivm, fs_type);
 
    row_type.length = fs_type.length;
+   /* Blending is done with at most 256-bit vectors, see generate_fragment() */
    unsigned vector_width =
-      dst_type.floating ? lp_native_vector_width : lp_integer_vector_width;
+      dst_type.floating ? MIN2(lp_native_vector_width, 256) : lp_integer_vector_width;
 
    /* Compute correct swizzle and count channels */
    memset(swizzle, LP_BLD_SWIZZLE_DONTCARE, TGSI_NUM_CHANNELS);
@@ -3149,15 +3150,14 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
  * 2x2 pixels.
  */
 static void
-generate_fragment(struct llvmpipe_context *lp,
-                  struct lp_fragment_shader *shader,
+generate_fragment(struct lp_fragment_shader *shader,
                   struct lp_fragment_shader_variant *variant,
                   unsigned partial_mask)
 {
    assert(partial_mask == RAST_WHOLE ||
           partial_mask == RAST_EDGE_TEST);
 
-   struct nir_shader *nir = shader->base.ir.nir;
+   struct nir_shader *nir = variant->nir;
    struct gallivm_state *gallivm = variant->gallivm;
    struct lp_fragment_shader_variant_key *key = &variant->key;
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
@@ -3332,7 +3332,21 @@ generate_fragment(struct llvmpipe_context *lp,
    unsigned num_fs = 16 / fs_type.length; /* number of loops per 4x4 stamp */
    /* for 1d resources only run "upper half" of stamp */
    if (key->resource_1d)
-      num_fs /= 2;
+      num_fs = DIV_ROUND_UP(num_fs, 2);
+
+   /*
+    * With 512-bit vectors the shader runs on the whole stamp at once, but
+    * blending still works on 8 pixels at a time.  A 16-wide vector holds
+    * the same pixels in the same order as two 8-wide ones, so the outputs
+    * are simply reinterpreted.
+    */
+   struct lp_type blend_fs_type = fs_type;
+   blend_fs_type.length = MIN2(fs_type.length, 8);
+   unsigned num_blend_fs = 16 / blend_fs_type.length;
+   if (key->resource_1d)
+      num_blend_fs /= 2;
+   /* distance between the samples' outputs, in blend_fs_type vectors */
+   unsigned blend_sample_stride = num_fs * fs_type.length / blend_fs_type.length;
 
    {
       LLVMValueRef num_loop = lp_build_const_int32(gallivm, num_fs);
@@ -3342,6 +3356,15 @@ generate_fragment(struct llvmpipe_context *lp,
       LLVMValueRef mask_store =
          lp_build_array_alloca(gallivm, mask_type,
                                num_loop_samp, "mask_store");
+
+      /* A 16-wide 1d stamp only has its upper half. */
+      LLVMValueRef stamp_mask = NULL;
+      if (key->resource_1d && fs_type.length == 16) {
+         LLVMValueRef lanes[16];
+         for (unsigned i = 0; i < 16; i++)
+            lanes[i] = lp_build_const_int32(gallivm, i < 8 ? ~0 : 0);
+         stamp_mask = LLVMConstVector(lanes, 16);
+      }
       LLVMTypeRef flt_type = LLVMFloatTypeInContext(gallivm->context);
       LLVMValueRef glob_sample_pos =
          LLVMAddGlobal(gallivm->module,
@@ -3424,6 +3447,8 @@ generate_fragment(struct llvmpipe_context *lp,
                smask_bit = lp_build_broadcast(gallivm, mask_type, smask_bit);
 
                s_mask = LLVMBuildAnd(builder, s_mask, smask_bit, "");
+               if (stamp_mask)
+                  s_mask = LLVMBuildAnd(builder, s_mask, stamp_mask, "");
                LLVMBuildStore(builder, s_mask, sample_mask_ptr);
             }
          } else {
@@ -3438,12 +3463,14 @@ generate_fragment(struct llvmpipe_context *lp,
             } else {
                mask = lp_build_const_int_vec(gallivm, fs_type, ~0);
             }
+            if (stamp_mask)
+               mask = LLVMBuildAnd(builder, mask, stamp_mask, "");
             LLVMBuildStore(builder, mask, mask_ptr);
          }
       }
 
       generate_fs_loop(gallivm,
-                       shader, key,
+                       shader, nir, key,
                        builder,
                        fs_type,
                        variant->jit_context_type,
@@ -3469,25 +3496,32 @@ generate_fragment(struct llvmpipe_context *lp,
                        variant->jit_thread_data_type,
                        thread_data_ptr);
 
-      LLVMTypeRef fs_vec_type = lp_build_vec_type(gallivm, fs_type);
-      for (unsigned i = 0; i < num_fs; i++) {
+      LLVMTypeRef fs_vec_type = lp_build_vec_type(gallivm, blend_fs_type);
+      LLVMTypeRef blend_mask_type = lp_build_int_vec_type(gallivm, blend_fs_type);
+      LLVMValueRef blend_mask_store =
+         LLVMBuildBitCast(builder, mask_store,
+                          LLVMPointerType(blend_mask_type, 0), "");
+      for (unsigned i = 0; i < num_blend_fs; i++) {
          LLVMValueRef ptr;
          for (unsigned s = 0; s < key->coverage_samples; s++) {
-            int idx = (i + (s * num_fs));
-            LLVMValueRef sindexi = lp_build_const_int32(gallivm, idx);
-            ptr = LLVMBuildGEP2(builder, mask_type, mask_store, &sindexi, 1, "");
+            int idx = (i + (s * num_blend_fs));
+            LLVMValueRef sindexi =
+               lp_build_const_int32(gallivm, i + s * blend_sample_stride);
+            ptr = LLVMBuildGEP2(builder, blend_mask_type, blend_mask_store,
+                                &sindexi, 1, "");
 
-            fs_mask[idx] = LLVMBuildLoad2(builder, mask_type, ptr, "smask");
+            fs_mask[idx] = LLVMBuildLoad2(builder, blend_mask_type, ptr, "smask");
          }
 
          for (unsigned s = 0; s < key->min_samples; s++) {
             /* This is fucked up need to reorganize things */
-            int idx = s * num_fs + i;
+            int idx = s * blend_sample_stride + i;
             LLVMValueRef sindexi = lp_build_const_int32(gallivm, idx);
             for (unsigned cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
                for (unsigned chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
-                  ptr = LLVMBuildGEP2(builder, fs_vec_type,
-                                      color_store[cbuf][chan],
+                  ptr = LLVMBuildBitCast(builder, color_store[cbuf][chan],
+                                         LLVMPointerType(fs_vec_type, 0), "");
+                  ptr = LLVMBuildGEP2(builder, fs_vec_type, ptr,
                                       &sindexi, 1, "");
                   fs_out_color[s][cbuf][chan][i] = ptr;
                }
@@ -3497,8 +3531,9 @@ generate_fragment(struct llvmpipe_context *lp,
                 * output 1
                 */
                for (unsigned chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
-                  ptr = LLVMBuildGEP2(builder, fs_vec_type,
-                                      color_store[1][chan],
+                  ptr = LLVMBuildBitCast(builder, color_store[1][chan],
+                                         LLVMPointerType(fs_vec_type, 0), "");
+                  ptr = LLVMBuildGEP2(builder, fs_vec_type, ptr,
                                       &sindexi, 1, "");
                   fs_out_color[s][1][chan][i] = ptr;
                }
@@ -3543,7 +3578,7 @@ generate_fragment(struct llvmpipe_context *lp,
                                                          &index, 1, ""), "");
 
          for (unsigned s = 0; s < key->cbuf_nr_samples[cbuf]; s++) {
-            unsigned mask_idx = num_fs * (key->multisample ? s : 0);
+            unsigned mask_idx = num_blend_fs * (key->multisample ? s : 0);
             unsigned out_idx = key->min_samples == 1 ? 0 : s;
             LLVMValueRef out_ptr = color_ptr;
 
@@ -3560,7 +3595,8 @@ generate_fragment(struct llvmpipe_context *lp,
 
             generate_unswizzled_blend(gallivm, cbuf, variant,
                                       key->cbuf_format[cbuf],
-                                      num_fs, fs_type, &fs_mask[mask_idx],
+                                      num_blend_fs, blend_fs_type,
+                                      &fs_mask[mask_idx],
                                       fs_out_color[out_idx],
                                       variant->jit_context_type,
                                       context_ptr, blend_vec_type, out_ptr, stride,
@@ -3741,7 +3777,7 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
    void *ir_binary;
 
    blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
+   nir_serialize(&blob, variant->nir, true);
    ir_binary = blob.data;
    ir_size = blob.size;
 
@@ -3755,9 +3791,253 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
 }
 
 
+/**
+ * Generate the LLVM code of a fragment shader variant whose key-derived
+ * state has already been set up by generate_variant().
+ * This may run on a compiler thread, so it must not touch any context
+ * state.
+ */
+static bool
+compile_variant(struct llvmpipe_screen *screen,
+                lp_context_ref *context,
+                struct lp_fragment_shader_variant *variant)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+
+   int64_t t0 = os_time_get();
+
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1_cache_key[20];
+   bool needs_caching = false;
+   if (variant->nir) {
+      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
+
+      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = true;
+   }
+
+   char module_name[64];
+   snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
+            shader->no, variant->no);
+   variant->gallivm = gallivm_create(module_name, context, &cached);
+   if (!variant->gallivm)
+      return false;
+
+   lp_jit_init_types(variant);
+
+   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
+      generate_fragment(shader, variant, RAST_EDGE_TEST);
+
+   if (variant->jit_function[RAST_WHOLE] == NULL) {
+      if (variant->opaque) {
+         /* Specialized shader, which doesn't need to read the color buffer. */
+         generate_fragment(shader, variant, RAST_WHOLE);
+      }
+   }
+
+   /* If the original fastpath doesn't cover this variant, try the new
+    * linear code:
+    */
+   if (variant->linear_pipeline && variant->jit_linear == NULL) {
+      if (shader->kind == LP_FS_KIND_BLIT_RGBA ||
+          shader->kind == LP_FS_KIND_BLIT_RGB1 ||
+          shader->kind == LP_FS_KIND_LLVM_LINEAR) {
+         llvmpipe_fs_variant_linear_llvm(shader, variant);
+      }
+   }
+
+   /*
+    * Compile everything
+    */
+
+#if GALLIVM_USE_ORCJIT
+/* module has been moved into ORCJIT after gallivm_compile_module */
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   gallivm_compile_module(variant->gallivm);
+#else
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+#endif
+
+   if (variant->function[RAST_EDGE_TEST]) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+            gallivm_jit_function(variant->gallivm,
+                                 variant->function[RAST_EDGE_TEST],
+                                 variant->function_name[RAST_EDGE_TEST]);
+   }
+
+   if (variant->function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+         gallivm_jit_function(variant->gallivm,
+                              variant->function[RAST_WHOLE],
+                              variant->function_name[RAST_WHOLE]);
+   } else if (!variant->jit_function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+         variant->jit_function[RAST_EDGE_TEST];
+   }
+
+   if (!variant->jit_function[RAST_EDGE_TEST] ||
+       !variant->jit_function[RAST_WHOLE])
+      return false;
+
+   if (variant->linear_pipeline) {
+      if (variant->linear_function) {
+         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
+            gallivm_jit_function(variant->gallivm, variant->linear_function,
+                                 variant->linear_function_name);
+      }
+
+      /*
+       * This must be done after LLVM compilation, as it will call the JIT'ed
+       * code to determine active inputs.
+       */
+      lp_linear_check_variant(variant);
+   }
+
+   if (needs_caching) {
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+   }
+
+   gallivm_free_ir(variant->gallivm);
+
+   LP_COUNT_ADD(llvm_compile_time, os_time_get() - t0);
+   LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+
+   return true;
+}
+
+
+/**
+ * Fragment function of a variant which failed to compile in the
+ * background, see compile_variant_job().
+ */
+static void
+skip_fragments(const struct lp_jit_context *context,
+               const struct lp_jit_resources *resources,
+               uint32_t x,
+               uint32_t y,
+               uint32_t facing,
+               const void *a0,
+               const void *dadx,
+               const void *dady,
+               uint8_t **cbufs,
+               uint8_t *depth,
+               uint64_t mask,
+               struct lp_jit_thread_data *thread_data,
+               unsigned *strides,
+               unsigned depth_stride,
+               unsigned *color_sample_stride,
+               unsigned depth_sample_stride)
+{
+}
+
+
+static void
+compile_variant_job(void *data, void *gdata, int thread_index)
+{
+   struct lp_fragment_shader_variant *variant = data;
+   struct llvmpipe_screen *screen = gdata;
+
+   if (!compile_variant(screen, &variant->context, variant)) {
+      /* Draws may already be binned with this variant, and the rasterizer
+       * runs them once ready is signalled.  Unlike a failed synchronous
+       * compile, the variant can't be dropped any more, so its draws are
+       * skipped instead.
+       */
+      for (unsigned i = 0; i < ARRAY_SIZE(variant->jit_function); i++) {
+         if (!variant->jit_function[i])
+            variant->jit_function[i] = skip_fragments;
+      }
+      variant->compile_failed = true;
+   }
+
+   ralloc_free(variant->nir);
+   variant->nir = NULL;
+}
+
+
+/**
+ * Work out how draws with this variant use and change the per-tile depth
+ * bounds kept by the rasterizer.
+ */
+static void
+init_variant_hiz(struct lp_fragment_shader_variant *variant,
+                 const struct lp_fragment_shader_variant_key *key,
+                 const struct nir_shader *nir)
+{
+   const bool writes_z =
+      nir->info.outputs_written & BITFIELD64_BIT(FRAG_RESULT_DEPTH);
+
+   variant->hiz_test = LP_HIZ_TEST_NONE;
+   variant->hiz_write = LP_HIZ_WRITE_NONE;
+   variant->hiz_clamp = key->restrict_depth_values;
+
+   if (!key->depth.enabled)
+      return;
+
+   if (key->depth.writemask) {
+      if (writes_z || key->depth_clamp) {
+         variant->hiz_write = LP_HIZ_WRITE_UNKNOWN;
+      } else {
+         switch (key->depth.func) {
+         case PIPE_FUNC_LESS:
+         case PIPE_FUNC_LEQUAL:
+            variant->hiz_write = LP_HIZ_WRITE_LOWER;
+            break;
+         case PIPE_FUNC_GREATER:
+         case PIPE_FUNC_GEQUAL:
+            variant->hiz_write = LP_HIZ_WRITE_RAISE;
+            break;
+         case PIPE_FUNC_NOTEQUAL:
+         case PIPE_FUNC_ALWAYS:
+            variant->hiz_write = LP_HIZ_WRITE_ANY;
+            break;
+         default:
+            break;
+         }
+      }
+   }
+
+   /* Fragments failing the depth test may only be skipped if they would
+    * not have done anything else: no stencil updates, no stores.
+    */
+   if (writes_z || key->depth_clamp ||
+       (nir->info.writes_memory && !nir->info.fs.early_fragment_tests) ||
+       (key->stencil[0].enabled && (key->stencil[0].writemask ||
+                                    (key->stencil[1].enabled &&
+                                     key->stencil[1].writemask))))
+      return;
+
+   switch (key->depth.func) {
+   case PIPE_FUNC_LESS:
+      variant->hiz_test = LP_HIZ_TEST_LESS;
+      break;
+   case PIPE_FUNC_LEQUAL:
+      variant->hiz_test = LP_HIZ_TEST_LEQUAL;
+      break;
+   case PIPE_FUNC_GREATER:
+      variant->hiz_test = LP_HIZ_TEST_GREATER;
+      break;
+   case PIPE_FUNC_GEQUAL:
+      variant->hiz_test = LP_HIZ_TEST_GEQUAL;
+      break;
+   default:
+      break;
+   }
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * With LP_ASYNC_COMPILE the LLVM code is generated on the screen's
+ * compiler queue, in a private LLVM context.  Everything setup needs for
+ * binning is derived from the key here, so draws can be binned right
+ * away and only the rasterizer has to wait for the code.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
@@ -3778,25 +4058,8 @@ generate_variant(struct llvmpipe_context *lp,
    memcpy(&variant->key, key, shader->variant_key_size);
 
    struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
-   struct lp_cached_code cached = { 0 };
-   unsigned char ir_sha1_cache_key[20];
-   bool needs_caching = false;
-   if (shader->base.ir.nir) {
-      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
 
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
-      if (!cached.data_size)
-         needs_caching = true;
-   }
-
-   char module_name[64];
-   snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-            shader->no, shader->variants_created);
-   variant->gallivm = gallivm_create(module_name, &lp->context, &cached);
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
-   }
+   util_queue_fence_init(&variant->ready);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -3900,6 +4163,8 @@ generate_variant(struct llvmpipe_context *lp,
           key->cbuf_format[0] == PIPE_FORMAT_R8G8B8A8_UNORM ||
           key->cbuf_format[0] == PIPE_FORMAT_R8G8B8X8_UNORM);
 
+   init_variant_hiz(variant, key, nir);
+
    memcpy(&variant->key, key, sizeof *key);
 
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
@@ -3908,17 +4173,7 @@ generate_variant(struct llvmpipe_context *lp,
 
    llvmpipe_fs_variant_fastpath(variant);
 
-   lp_jit_init_types(variant);
-
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
-
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
-      }
-   }
+   variant->linear_pipeline = linear_pipeline;
 
    if (linear_pipeline) {
       /* Currently keeping both the old fastpaths and new linear path
@@ -3932,17 +4187,6 @@ generate_variant(struct llvmpipe_context *lp,
           !key->blend.alpha_to_coverage) {
          llvmpipe_fs_variant_linear_fastpath(variant);
       }
-
-      /* If the original fastpath doesn't cover this variant, try the new
-       * code:
-       */
-      if (variant->jit_linear == NULL) {
-         if (shader->kind == LP_FS_KIND_BLIT_RGBA ||
-             shader->kind == LP_FS_KIND_BLIT_RGB1 ||
-             shader->kind == LP_FS_KIND_LLVM_LINEAR) {
-            llvmpipe_fs_variant_linear_llvm(lp, shader, variant);
-         }
-      }
    } else {
       if (LP_DEBUG & DEBUG_LINEAR) {
          lp_debug_fs_variant(variant);
@@ -3950,57 +4194,25 @@ generate_variant(struct llvmpipe_context *lp,
       }
    }
 
-   /*
-    * Compile everything
-    */
-
-#if GALLIVM_USE_ORCJIT
-/* module has been moved into ORCJIT after gallivm_compile_module */
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
-
-   gallivm_compile_module(variant->gallivm);
-#else
-   gallivm_compile_module(variant->gallivm);
-
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
-#endif
-
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST],
-                                 variant->function_name[RAST_EDGE_TEST]);
-   }
-
-   if (variant->function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-         gallivm_jit_function(variant->gallivm,
-                              variant->function[RAST_WHOLE],
-                              variant->function_name[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-         variant->jit_function[RAST_EDGE_TEST];
-   }
-
-   if (linear_pipeline) {
-      if (variant->linear_function) {
-         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
-            gallivm_jit_function(variant->gallivm, variant->linear_function,
-                                 variant->linear_function_name);
+   if (screen->async_compile) {
+      lp_context_create(&variant->context);
+      if (variant->context.ref) {
+         variant->nir = nir_shader_clone(NULL, nir);
+         util_queue_add_job(&screen->fs_compile_queue, variant,
+                            &variant->ready, compile_variant_job, NULL, 0);
+         LP_COUNT(nr_async_compiles);
+         return variant;
       }
-
-      /*
-       * This must be done after LLVM compilation, as it will call the JIT'ed
-       * code to determine active inputs.
-       */
-      lp_linear_check_variant(variant);
    }
 
-   if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
-   }
+   variant->nir = nir;
+   bool compiled = compile_variant(screen, &lp->context, variant);
+   variant->nir = NULL;
 
-   gallivm_free_ir(variant->gallivm);
+   if (!compiled) {
+      llvmpipe_destroy_shader_variant(lp, variant);
+      return NULL;
+   }
 
    return variant;
 }
@@ -4152,7 +4364,24 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
    /* remove from context's list */
    list_del(&variant->list_item_global.list);
    lp->nr_fs_variants--;
-   lp->nr_fs_instrs -= variant->nr_instrs;
+   if (variant->nr_instrs_counted)
+      lp->nr_fs_instrs -= variant->nr_instrs;
+}
+
+
+/**
+ * Count the instructions of a variant against the context's limit, once
+ * they are known.
+ */
+static void
+llvmpipe_count_shader_variant_instrs(struct llvmpipe_context *lp,
+                                     struct lp_fragment_shader_variant *variant)
+{
+   if (!variant->nr_instrs_counted &&
+       util_queue_fence_is_signalled(&variant->ready)) {
+      lp->nr_fs_instrs += variant->nr_instrs;
+      variant->nr_instrs_counted = true;
+   }
 }
 
 
@@ -4160,7 +4389,20 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant)
 {
-   gallivm_destroy(variant->gallivm);
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   /* No scene uses the variant anymore, so a compile that hasn't started
+    * yet can simply be skipped.  The NIR clone is left to free then.
+    */
+   if (variant->context.ref) {
+      util_queue_drop_job(&screen->fs_compile_queue, &variant->ready);
+      ralloc_free(variant->nir);
+   }
+   util_queue_fence_destroy(&variant->ready);
+
+   if (variant->gallivm)
+      gallivm_destroy(variant->gallivm);
+   lp_context_destroy(&variant->context);
    lp_fs_reference(lp, &variant->shader, NULL);
    if (variant->function_name[RAST_EDGE_TEST])
       FREE(variant->function_name[RAST_EDGE_TEST]);
@@ -4350,6 +4592,11 @@ llvmpipe_set_shader_images(struct pipe_context *pipe,
          bool read_only = !(image->access & PIPE_IMAGE_ACCESS_WRITE);
          llvmpipe_flush_resource(pipe, image->resource, 0, read_only, false,
                                  false, "image");
+
+         /* Image stores bypass the display target damage tracking. */
+         if (!read_only && llvmpipe_resource_is_texture(image->resource))
+            llvmpipe_resource_damage_all(llvmpipe_resource(image->resource),
+                                         true);
       }
    }
 
@@ -4695,11 +4942,21 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
    }
 
+   /* Give a variant which failed to compile in the background another
+    * chance, instead of skipping its draws from now on.
+    */
+   if (variant && util_queue_fence_is_signalled(&variant->ready) &&
+       variant->compile_failed) {
+      llvmpipe_remove_shader_variant(lp, variant);
+      lp_fs_variant_reference(lp, &variant, NULL);
+   }
+
    if (variant) {
       /* Move this variant to the head of the list to implement LRU
        * deletion of shader's when we have too many.
        */
       list_move_to(&variant->list_item_global.list, &lp->fs_variants_list.list);
+      llvmpipe_count_shader_variant_instrs(lp, variant);
    } else {
       /* variant not found, create it now */
 
@@ -4754,24 +5011,20 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       /*
        * Generate the new variant.
        */
-      int64_t t0 = os_time_get();
       variant = generate_variant(lp, shader, key);
-      int64_t t1 = os_time_get();
-      int64_t dt = t1 - t0;
-      LP_COUNT_ADD(llvm_compile_time, dt);
-      LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
 
       /* Put the new variant into the list */
       if (variant) {
          list_add(&variant->list_item_local.list, &shader->variants.list);
          list_add(&variant->list_item_global.list, &lp->fs_variants_list.list);
          lp->nr_fs_variants++;
-         lp->nr_fs_instrs += variant->nr_instrs;
+         llvmpipe_count_shader_variant_instrs(lp, variant);
          shader->variants_cached++;
       }
    }
 
    /* Bind this variant */
+   lp->fs_variant = variant;
    lp_setup_set_fs_variant(lp->setup, variant);
 }
 
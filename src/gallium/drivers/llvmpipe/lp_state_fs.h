@@ -38,6 +38,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct lp_fragment_shader;
@@ -58,6 +59,33 @@ enum lp_fs_kind
 };
 
 
+/**
+ * How the depth test of a variant can be checked against the per-tile
+ * depth bounds, see lp_rast_hiz.c.
+ */
+enum lp_hiz_test
+{
+   LP_HIZ_TEST_NONE = 0,
+   LP_HIZ_TEST_LESS,
+   LP_HIZ_TEST_LEQUAL,
+   LP_HIZ_TEST_GREATER,
+   LP_HIZ_TEST_GEQUAL,
+};
+
+
+/**
+ * How the depth writes of a variant change the per-tile depth bounds.
+ */
+enum lp_hiz_write
+{
+   LP_HIZ_WRITE_NONE = 0,
+   LP_HIZ_WRITE_LOWER,     /**< values only ever get smaller */
+   LP_HIZ_WRITE_RAISE,     /**< values only ever get larger */
+   LP_HIZ_WRITE_ANY,       /**< values come from the interpolated z */
+   LP_HIZ_WRITE_UNKNOWN,   /**< shader output, or clamped to the viewport */
+};
+
+
 struct lp_depth_state
 {
    unsigned enabled:1;         /**< depth test enabled? */
@@ -150,9 +178,47 @@ struct lp_fragment_shader_variant
 
    unsigned opaque:1;
    unsigned blit:1;
-   unsigned linear_input_mask:16;
+   unsigned linear_pipeline:1;
+
+   /* Not a bitfield, it may be written by a compiler thread while the
+    * bits above are read.
+    */
+   uint16_t linear_input_mask;
+
+   /* Hierarchical z behaviour, derived from the key (enum lp_hiz_test,
+    * enum lp_hiz_write) and whether depth is clamped to [0,1].
+    */
+   uint8_t hiz_test;
+   uint8_t hiz_write;
+   bool hiz_clamp;
+
    struct pipe_reference reference;
 
+   /*
+    * Signalled once the code below has been generated.  Variants compiled
+    * in the background (LP_ASYNC_COMPILE) can be bound and binned against
+    * before that, the rasterizer waits for it.
+    */
+   struct util_queue_fence ready;
+
+   /*
+    * Set before signalling ready when the background compile failed.  The
+    * fragment functions are then no-ops, so the draws already binned with
+    * the variant draw nothing.
+    */
+   bool compile_failed;
+
+   /* LLVM context owned by a variant compiled in the background */
+   lp_context_ref context;
+
+   /*
+    * The NIR the code is generated from, which modifies it: the shader's
+    * own, or a private clone for a variant compiled in the background, as
+    * other variants of the shader may be compiled at the same time.
+    * NULL once the code has been generated.
+    */
+   struct nir_shader *nir;
+
    struct gallivm_state *gallivm;
 
    LLVMTypeRef jit_context_type;
@@ -186,6 +252,7 @@ struct lp_fragment_shader_variant
 
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
+   bool nr_instrs_counted;  /**< included in the context's nr_fs_instrs */
 
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
@@ -234,8 +301,7 @@ void
 llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant);
 
 void
-llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
-                                struct lp_fragment_shader *shader,
+llvmpipe_fs_variant_linear_llvm(struct lp_fragment_shader *shader,
                                 struct lp_fragment_shader_variant *variant);
 
 void
@@ -144,7 +144,7 @@ llvm_fragment_body(struct lp_build_context *bld,
    LLVMValueRef result = NULL;
    bool rgba_order = (variant->key.cbuf_format[0] == PIPE_FORMAT_R8G8B8A8_UNORM ||
                       variant->key.cbuf_format[0] == PIPE_FORMAT_R8G8B8X8_UNORM);
-   struct nir_shader *nir = shader->base.ir.nir;
+   struct nir_shader *nir = variant->nir;
    sampler->instance = 0;
 
    /*
@@ -236,15 +236,14 @@ llvm_fragment_body(struct lp_build_context *bld,
  * See lp_state_fs_analysis for the "linear" conditions.
  */
 void
-llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
-                                struct lp_fragment_shader *shader,
+llvmpipe_fs_variant_linear_llvm(struct lp_fragment_shader *shader,
                                 struct lp_fragment_shader_variant *variant)
 {
    assert(shader->kind == LP_FS_KIND_BLIT_RGBA ||
           shader->kind == LP_FS_KIND_BLIT_RGB1 ||
           shader->kind == LP_FS_KIND_LLVM_LINEAR);
 
-   struct nir_shader *nir = shader->base.ir.nir;
+   struct nir_shader *nir = variant->nir;
    struct gallivm_state *gallivm = variant->gallivm;
    LLVMTypeRef int8t = LLVMInt8TypeInContext(gallivm->context);
    LLVMTypeRef int32t = LLVMInt32TypeInContext(gallivm->context);
@@ -261,9 +260,7 @@ llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
    fs_type.length = 16;
 
    if (LP_DEBUG & DEBUG_TGSI) {
-      if (shader->base.ir.nir) {
-         nir_print_shader(shader->base.ir.nir, stderr);
-      }
+      nir_print_shader(nir, stderr);
    }
 
    /*
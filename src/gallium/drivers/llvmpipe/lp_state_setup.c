@@ -29,6 +29,7 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "gallivm/lp_bld_arit.h"
 #include "gallivm/lp_bld_bitarit.h"
 #include "gallivm/lp_bld_const.h"
@@ -53,6 +54,15 @@
 /** Setup shader number (for debugging) */
 static unsigned setup_no = 0;
 
+/**
+ * Version of the setup code generator, mixed into the disk cache key of
+ * each setup function with its variant key.  It keeps the setup functions
+ * apart from the other llvmpipe shaders in the cache.  It must be changed
+ * whenever the code generated for a given variant key changes, like the
+ * *_function_base_hash constants of lp_texture_handle.c.
+ */
+static const char *setup_function_base_hash = "a2a2b5f79dc5e48674a19f6c0b689ca8e954e3b16716a1c8ee970b7b6851fe99";
+
 
 /* currently organized to interpolate full float[4] attributes even
  * when some elements are unused.  Later, can pack vertex data more
@@ -628,14 +638,34 @@ init_args(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * The generated code only depends on the key, so that is all the disk
+ * cache key needs.
+ */
+static void
+lp_setup_get_ir_cache_key(const struct lp_setup_variant_key *key,
+                          unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, setup_function_base_hash,
+                     strlen(setup_function_base_hash));
+   _mesa_sha1_update(&ctx, key, key->size);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
 /**
  * Generate the runtime callable function for the coefficient calculation.
  *
  */
-static struct lp_setup_variant *
-generate_setup_variant(struct lp_setup_variant_key *key,
-                       struct llvmpipe_context *lp)
+struct lp_setup_variant *
+lp_generate_setup_variant(struct lp_setup_variant_key *key,
+                          struct llvmpipe_context *lp)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1_cache_key[20];
    int64_t t0 = 0, t1;
 
    if (0)
@@ -647,12 +677,23 @@ generate_setup_variant(struct lp_setup_variant_key *key,
 
    variant->no = setup_no++;
 
-   char func_name[64];
-   snprintf(func_name, sizeof(func_name), "setup_variant_%u",
+   char module_name[64];
+   snprintf(module_name, sizeof(module_name), "setup_variant_%u",
             variant->no);
 
+   /* The function name ends up in the cached object code, so it must not
+    * depend on the variant number.
+    */
+   const char *func_name = "setup_variant";
+
+   lp_setup_get_ir_cache_key(key, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   bool needs_caching = !cached.data_size;
+   variant->cached = !needs_caching;
+
    struct gallivm_state *gallivm;
-   variant->gallivm = gallivm = gallivm_create(func_name, &lp->context, NULL);
+   variant->gallivm = gallivm = gallivm_create(module_name, &lp->context,
+                                               &cached);
    if (!variant->gallivm) {
       goto fail;
    }
@@ -738,6 +779,9 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    if (!variant->jit_function)
       goto fail;
 
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
    gallivm_free_ir(variant->gallivm);
 
    /*
@@ -819,6 +863,18 @@ lp_make_setup_variant_key(const struct llvmpipe_context *lp,
 }
 
 
+void
+lp_destroy_setup_variant(struct lp_setup_variant *variant)
+{
+   if (variant->gallivm) {
+      gallivm_destroy(variant->gallivm);
+   }
+
+   FREE(variant->function_name);
+   FREE(variant);
+}
+
+
 static void
 remove_setup_variant(struct llvmpipe_context *lp,
                      struct lp_setup_variant *variant)
@@ -828,14 +884,9 @@ remove_setup_variant(struct llvmpipe_context *lp,
                    variant->no, lp->nr_setup_variants);
    }
 
-   if (variant->gallivm) {
-      gallivm_destroy(variant->gallivm);
-   }
-
    list_del(&variant->list_item_global.list);
    lp->nr_setup_variants--;
-   FREE(variant->function_name);
-   FREE(variant);
+   lp_destroy_setup_variant(variant);
 }
 
 
@@ -897,7 +948,7 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
          cull_setup_variants(lp);
       }
 
-      variant = generate_setup_variant(key, lp);
+      variant = lp_generate_setup_variant(key, lp);
       if (variant) {
          list_add(&variant->list_item_global.list, &lp->setup_variants_list.list);
          lp->nr_setup_variants++;
@@ -73,9 +73,19 @@ struct lp_setup_variant {
    lp_jit_setup_triangle jit_function;
 
    unsigned no;
+
+   /** whether the code was loaded from the disk cache */
+   bool cached;
 };
 
 
+struct lp_setup_variant *
+lp_generate_setup_variant(struct lp_setup_variant_key *key,
+                          struct llvmpipe_context *lp);
+
+void
+lp_destroy_setup_variant(struct lp_setup_variant *variant);
+
 void
 lp_delete_setup_variants(struct llvmpipe_context *lp);
 
@@ -36,6 +36,7 @@
  * @author Brian Paul <brian@vmware.com>
  */
 
+#include "util/u_cpu_detect.h"
 #include "util/u_memory.h"
 
 #include "gallivm/lp_bld_init.h"
@@ -448,6 +449,10 @@ test_one(unsigned verbose,
    unsigned i, j;
    const unsigned stride = lp_type_width(type)/8;
 
+   /* No point in testing vectors wider than the CPU's registers. */
+   if (lp_type_width(type) > util_get_cpu_caps()->max_vector_bits)
+      return true;
+
    if (verbose >= 1)
       dump_blend_type(stdout, blend, type);
 
@@ -625,6 +630,8 @@ const struct lp_type blend_types[] = {
    /* float, fixed,  sign,  norm, width, len */
    {   true, false,  true, false,    32,   4 }, /* f32 x 4 */
    {  false, false, false,  true,     8,  16 }, /* u8n x 16 */
+   {   true, false,  true, false,    32,  16 }, /* f32 x 16 */
+   {  false, false, false,  true,     8,  64 }, /* u8n x 64 */
 };
 
 
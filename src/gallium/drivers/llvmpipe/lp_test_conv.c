@@ -34,6 +34,7 @@
  */
 
 
+#include "util/u_cpu_detect.h"
 #include "util/u_pointer.h"
 #include "gallivm/lp_bld_init.h"
 #include "gallivm/lp_bld_type.h"
@@ -193,6 +194,15 @@ test_one(unsigned verbose,
       return true;
    }
 
+   /* The 512-bit types are only tested where the CPU has such vectors,
+    * 256-bit ones are emulated with narrower vectors if needed.
+    */
+   if ((lp_type_width(src_type) > 256 || lp_type_width(dst_type) > 256) &&
+       (lp_type_width(src_type) > util_get_cpu_caps()->max_vector_bits ||
+        lp_type_width(dst_type) > util_get_cpu_caps()->max_vector_bits)) {
+      return true;
+   }
+
    if (verbose >= 1)
       dump_conv_types(stderr, src_type, dst_type);
 
@@ -354,6 +364,12 @@ const struct lp_type conv_types[] = {
    {   true, false, false,  true,    32,   8 },
    {   true, false, false, false,    32,   8 },
 
+   /* 512-bit, only tested where the CPU has such vectors */
+   {   true, false,  true,  true,    32,  16 },
+   {   true, false,  true, false,    32,  16 },
+   {   true, false, false,  true,    32,  16 },
+   {   true, false, false, false,    32,  16 },
+
    /* Fixed */
    {  false,  true,  true,  true,    32,   4 },
    {  false,  true,  true, false,    32,   4 },
@@ -376,6 +392,11 @@ const struct lp_type conv_types[] = {
    {  false, false, false,  true,    32,   8 },
    {  false, false, false, false,    32,   8 },
 
+   {  false, false,  true,  true,    32,  16 },
+   {  false, false,  true, false,    32,  16 },
+   {  false, false, false,  true,    32,  16 },
+   {  false, false, false, false,    32,  16 },
+
    {  false, false,  true,  true,    16,   8 },
    {  false, false,  true, false,    16,   8 },
    {  false, false, false,  true,    16,   8 },
@@ -386,6 +407,11 @@ const struct lp_type conv_types[] = {
    {  false, false, false,  true,     8,  16 },
    {  false, false, false, false,     8,  16 },
 
+   {  false, false,  true,  true,    16,  32 },
+   {  false, false, false,  true,    16,  32 },
+   {  false, false,  true,  true,     8,  64 },
+   {  false, false, false,  true,     8,  64 },
+
    {  false, false,  true,  true,     8,   4 },
    {  false, false,  true, false,     8,   4 },
    {  false, false, false,  true,     8,   4 },
@@ -0,0 +1,218 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Tests for the compute shader thread pool: every iteration of a task
+ * must run exactly once, also with several tasks in flight, plus a
+ * measurement of the per-dispatch overhead of tiny grids.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_memory.h"
+#include "util/u_thread.h"
+
+#include "lp_cs_tpool.h"
+#include "lp_test.h"
+
+
+struct tpool_test_job {
+   unsigned *counts;
+};
+
+
+static void
+count_iteration(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct tpool_test_job *job = data;
+   p_atomic_inc(&job->counts[iter_idx]);
+}
+
+
+static void
+empty_iteration(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+}
+
+
+static bool
+run_and_check(struct lp_cs_tpool *pool, unsigned num_iters)
+{
+   struct tpool_test_job job;
+   bool success = true;
+
+   job.counts = CALLOC(MAX2(num_iters, 1), sizeof(unsigned));
+   if (!job.counts)
+      return false;
+
+   struct lp_cs_tpool_task *task =
+      lp_cs_tpool_queue_task(pool, count_iteration, &job, num_iters);
+   lp_cs_tpool_wait_for_task(pool, &task);
+
+   for (unsigned i = 0; i < num_iters; i++) {
+      if (job.counts[i] != 1) {
+         success = false;
+         break;
+      }
+   }
+
+   FREE(job.counts);
+   return success;
+}
+
+
+struct tpool_test_submitter {
+   struct lp_cs_tpool *pool;
+   unsigned num_dispatches;
+   bool success;
+};
+
+
+static int
+submit_thread(void *data)
+{
+   struct tpool_test_submitter *submitter = data;
+
+   for (unsigned i = 0; i < submitter->num_dispatches; i++) {
+      if (!run_and_check(submitter->pool, 1 + i % 97))
+         submitter->success = false;
+   }
+
+   return 0;
+}
+
+
+/**
+ * Dispatch from several application threads at once, as separate
+ * contexts do, so tasks overlap in the pool.
+ */
+static bool
+test_concurrent(struct lp_cs_tpool *pool, unsigned verbose)
+{
+   struct tpool_test_submitter submitters[4];
+   thrd_t threads[4];
+   unsigned num_threads = 0;
+   bool success = true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(submitters); i++) {
+      submitters[i].pool = pool;
+      submitters[i].num_dispatches = 500;
+      submitters[i].success = true;
+      if (u_thread_create(&threads[i], submit_thread, &submitters[i]) !=
+          thrd_success)
+         break;
+      num_threads++;
+   }
+
+   for (unsigned i = 0; i < num_threads; i++) {
+      thrd_join(threads[i], NULL);
+      success = success && submitters[i].success;
+   }
+
+   if (verbose || !success)
+      printf("concurrent dispatches from %u threads: %s\n", num_threads,
+             success ? "PASS" : "FAIL");
+
+   return success;
+}
+
+
+/**
+ * Time back-to-back dispatches of a grid which does no work.
+ */
+static void
+bench_dispatch(struct lp_cs_tpool *pool, unsigned verbose, FILE *fp,
+               unsigned num_iters, unsigned num_dispatches)
+{
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_dispatches; i++) {
+      struct lp_cs_tpool_task *task =
+         lp_cs_tpool_queue_task(pool, empty_iteration, NULL, num_iters);
+      lp_cs_tpool_wait_for_task(pool, &task);
+   }
+
+   double ns = (double)(os_time_get_nano() - start) / num_dispatches;
+
+   if (verbose)
+      printf("grid %5u, %u threads: %8.0f ns per dispatch\n",
+             num_iters, pool->num_threads, ns);
+
+   if (fp) {
+      fprintf(fp, "%u\t%u\t%.0f\n", num_iters, pool->num_threads, ns);
+      fflush(fp);
+   }
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "grid\t"
+           "threads\t"
+           "ns_per_dispatch\n");
+
+   fflush(fp);
+}
+
+
+static bool
+test_tpool(unsigned verbose, FILE *fp, unsigned num_dispatches)
+{
+   static const unsigned grids[] = { 1, 2, 3, 7, 64, 1000, 100000 };
+   static const unsigned tiny_grids[] = { 1, 2, 4, 8, 16, 64 };
+   unsigned num_threads = MIN2(MAX2(util_get_cpu_caps()->nr_cpus, 2),
+                               LP_MAX_THREADS);
+   bool success = true;
+
+   struct lp_cs_tpool *pool = lp_cs_tpool_create(num_threads);
+   if (!pool)
+      return false;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(grids); i++) {
+      bool ok = run_and_check(pool, grids[i]);
+      if (verbose || !ok)
+         printf("grid %u: %s\n", grids[i], ok ? "PASS" : "FAIL");
+      success = success && ok;
+   }
+
+   success = test_concurrent(pool, verbose) && success;
+
+   if (verbose || fp) {
+      for (unsigned i = 0; i < ARRAY_SIZE(tiny_grids); i++)
+         bench_dispatch(pool, verbose, fp, tiny_grids[i], num_dispatches);
+   }
+
+   lp_cs_tpool_destroy(pool);
+
+   return success;
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_tpool(verbose, fp, 10000);
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_tpool(verbose, fp, MAX2(n, 1));
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return true;
+}
@@ -0,0 +1,383 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Startup latency of JIT'ed code with and without the object cache.
+ *
+ * A function is compiled once from scratch, capturing the object code
+ * like the disk cache does for shader variants, and then again from the
+ * captured object.  Both versions must compute the same results.
+ *
+ * Also checks that a setup variant generated a second time is loaded
+ * from the screen's disk cache.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/detect_os.h"
+#include "util/disk_cache.h"
+#include "util/os_time.h"
+#include "util/u_memory.h"
+#include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_arit.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_misc.h"
+#include "gallivm/lp_bld_type.h"
+
+#include "frontend/sw_winsys.h"
+
+#include "lp_context.h"
+#include "lp_public.h"
+#include "lp_screen.h"
+#include "lp_state_setup.h"
+#include "lp_test.h"
+
+#if !DETECT_OS_WINDOWS
+#include <ftw.h>
+#include <unistd.h>
+#endif
+
+
+typedef void (*jit_cache_test_t)(const float *in, float *out);
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "ops\t"
+           "cold_us\t"
+           "cached_us\t"
+           "object_bytes\n");
+
+   fflush(fp);
+}
+
+
+/**
+ * A chain of transcendental functions, which expand to a fair amount of
+ * IR much like the math in a real shader.
+ */
+static LLVMValueRef
+add_jit_cache_test(struct gallivm_state *gallivm, unsigned num_ops)
+{
+   LLVMContextRef context = gallivm->context;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type type = lp_type_float_vec(32, 128);
+   struct lp_build_context bld;
+
+   LLVMTypeRef vec_type = lp_build_vec_type(gallivm, type);
+   LLVMTypeRef args[2] = { LLVMPointerType(vec_type, 0),
+                           LLVMPointerType(vec_type, 0) };
+   LLVMValueRef func =
+      LLVMAddFunction(gallivm->module, "test",
+                      LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                       args, ARRAY_SIZE(args), 0));
+   LLVMSetFunctionCallConv(func, LLVMCCallConv);
+
+   LLVMBasicBlockRef block =
+      LLVMAppendBasicBlockInContext(context, func, "entry");
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   lp_build_context_init(&bld, gallivm, type);
+
+   LLVMValueRef half = lp_build_const_vec(gallivm, type, 0.5);
+   LLVMValueRef x = LLVMBuildLoad2(builder, vec_type,
+                                   LLVMGetParam(func, 0), "");
+
+   for (unsigned i = 0; i < num_ops; i++) {
+      switch (i % 3) {
+      case 0:
+         x = lp_build_sin(&bld, x);
+         break;
+      case 1:
+         x = lp_build_exp2(&bld, lp_build_mul(&bld, x, half));
+         break;
+      default:
+         x = lp_build_log2(&bld, lp_build_add(&bld, lp_build_mul(&bld, x, x),
+                                              bld.one));
+         break;
+      }
+   }
+
+   LLVMBuildStore(builder, x, LLVMGetParam(func, 1));
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, func);
+
+   return func;
+}
+
+
+/**
+ * Build, compile and run the test function.
+ * \param cached  object code to load, or empty to compile and capture it
+ * \return the time taken from creating the gallivm to having a callable
+ *         function, in microseconds, or a negative value on failure
+ */
+UTIL_ALIGN_STACK
+static int64_t
+run_jit_cache_test(struct lp_cached_code *cached, unsigned num_ops,
+                   void **object, size_t *object_size,
+                   float result[4])
+{
+   static const float input[4] = { 0.25f, -0.5f, 1.0f, 2.0f };
+   lp_context_ref context;
+   struct gallivm_state *gallivm;
+
+   lp_context_create(&context);
+
+   int64_t start = os_time_get_nano();
+
+   gallivm = gallivm_create("jit_cache_test", &context, cached);
+   if (!gallivm) {
+      lp_context_destroy(&context);
+      return -1;
+   }
+
+   LLVMValueRef func = add_jit_cache_test(gallivm, num_ops);
+
+   gallivm_compile_module(gallivm);
+
+   jit_cache_test_t test_func =
+      (jit_cache_test_t)gallivm_jit_function(gallivm, func, "test");
+
+   int64_t elapsed = os_time_get_nano() - start;
+
+   /* gallivm_free_ir() frees the object code, keep a copy of it. */
+   if (object && cached->data_size) {
+      *object = malloc(cached->data_size);
+      if (*object) {
+         memcpy(*object, cached->data, cached->data_size);
+         *object_size = cached->data_size;
+      }
+   }
+
+   gallivm_free_ir(gallivm);
+
+   alignas(16) float in[4], out[4];
+   memcpy(in, input, sizeof(in));
+   test_func(in, out);
+   memcpy(result, out, sizeof(out));
+
+   gallivm_destroy(gallivm);
+   lp_context_destroy(&context);
+
+   return elapsed / 1000;
+}
+
+
+static bool
+test_jit_cache(unsigned verbose, FILE *fp, unsigned num_ops,
+               unsigned num_runs)
+{
+   struct lp_cached_code cached = { 0 };
+   void *object = NULL;
+   size_t object_size = 0;
+   float expected[4], result[4];
+   bool success = true;
+
+   int64_t cold = run_jit_cache_test(&cached, num_ops, &object,
+                                     &object_size, expected);
+   if (cold < 0 || !object) {
+      if (verbose || fp)
+         printf("%u ops: no object code captured\n", num_ops);
+      free(object);
+      return cold >= 0;
+   }
+
+   int64_t best = INT64_MAX;
+   for (unsigned i = 0; i < num_runs; i++) {
+      /* The gallivm takes ownership of the data. */
+      struct lp_cached_code warm = { 0 };
+      warm.data = malloc(object_size);
+      if (!warm.data) {
+         success = false;
+         break;
+      }
+      memcpy(warm.data, object, object_size);
+      warm.data_size = object_size;
+
+      int64_t t = run_jit_cache_test(&warm, num_ops, NULL, NULL, result);
+      if (t < 0 || memcmp(result, expected, sizeof(result)) != 0) {
+         success = false;
+         break;
+      }
+      best = MIN2(best, t);
+   }
+
+   if (verbose || !success)
+      printf("%4u ops: cold %8.3f ms, cached %8.3f ms, %zu bytes: %s\n",
+             num_ops, cold / 1000.0, best / 1000.0, object_size,
+             success ? "PASS" : "FAIL");
+
+   if (fp && success) {
+      fprintf(fp, "%u\t%" PRId64 "\t%" PRId64 "\t%zu\n",
+              num_ops, cold, best, object_size);
+      fflush(fp);
+   }
+
+   free(object);
+   return success;
+}
+
+
+#if defined(ENABLE_SHADER_CACHE) && !DETECT_OS_WINDOWS
+
+static void
+dummy_winsys_destroy(struct sw_winsys *ws)
+{
+}
+
+
+static int
+remove_cache_file(const char *path, const struct stat *sb, int typeflag,
+                  struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+
+static bool
+run_setup_variant(struct lp_setup_variant_key *key,
+                  struct llvmpipe_context *lp, bool *cached,
+                  float a0[2][4], float dadx[2][4], float dady[2][4])
+{
+   alignas(16) static const float v[3][2][4] = {
+      { { 1.0f, 2.0f, 0.5f, 1.0f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+      { { 9.0f, 3.0f, 0.25f, 2.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+      { { 4.0f, 7.0f, 0.75f, 4.0f }, { 0.0f, 0.0f, 1.0f, 1.0f } },
+   };
+
+   struct lp_setup_variant *variant = lp_generate_setup_variant(key, lp);
+   if (!variant)
+      return false;
+
+   variant->jit_function(v[0], v[1], v[2], true, a0, dadx, dady, key);
+   *cached = variant->cached;
+
+   lp_destroy_setup_variant(variant);
+   return true;
+}
+
+
+/**
+ * Generate the same setup variant twice: the first one is compiled and
+ * stored in the disk cache, the second one must be loaded from it and
+ * compute the same coefficients.
+ */
+static bool
+test_setup_variant_cache(unsigned verbose)
+{
+   char dir[] = "/tmp/lp_test_jit_cache_XXXXXX";
+   bool success = false;
+
+   if (!mkdtemp(dir))
+      return false;
+
+   setenv("MESA_SHADER_CACHE_DIR", dir, 1);
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+
+   struct sw_winsys winsys = { .destroy = dummy_winsys_destroy };
+   struct pipe_screen *screen = llvmpipe_create_screen(&winsys);
+   struct pipe_context *pipe =
+      screen ? screen->context_create(screen, NULL, 0) : NULL;
+   if (!pipe)
+      goto out;
+
+   struct disk_cache *cache = llvmpipe_screen(screen)->disk_shader_cache;
+   if (!cache) {
+      if (verbose)
+         printf("setup variant cache: no disk cache, skipped\n");
+      success = true;
+      goto out;
+   }
+
+   struct lp_setup_variant_key key;
+   memset(&key, 0, sizeof(key));
+   key.num_inputs = 1;
+   key.pixel_center_half = 1;
+   key.inputs[0].interp = LP_INTERP_PERSPECTIVE;
+   key.inputs[0].usage_mask = 0xf;
+   key.inputs[0].src_index = 1;
+   key.size = offsetof(struct lp_setup_variant_key, inputs[1]);
+
+   alignas(16) float a0[2][2][4], dadx[2][2][4], dady[2][2][4];
+   bool cached[2];
+
+   if (!run_setup_variant(&key, llvmpipe_context(pipe), &cached[0],
+                          a0[0], dadx[0], dady[0]))
+      goto out;
+
+   /* The first variant is written to the cache asynchronously. */
+   disk_cache_wait_for_idle(cache);
+
+   if (!run_setup_variant(&key, llvmpipe_context(pipe), &cached[1],
+                          a0[1], dadx[1], dady[1]))
+      goto out;
+
+   success = !cached[0] && cached[1] &&
+             memcmp(a0[0], a0[1], sizeof(a0[0])) == 0 &&
+             memcmp(dadx[0], dadx[1], sizeof(dadx[0])) == 0 &&
+             memcmp(dady[0], dady[1], sizeof(dady[0])) == 0;
+
+   if (verbose || !success)
+      printf("setup variant cache: first %s, second %s: %s\n",
+             cached[0] ? "hit" : "miss", cached[1] ? "hit" : "miss",
+             success ? "PASS" : "FAIL");
+
+out:
+   if (pipe)
+      pipe->destroy(pipe);
+   if (screen)
+      screen->destroy(screen);
+
+   nftw(dir, remove_cache_file, 16, FTW_DEPTH | FTW_PHYS);
+   return success;
+}
+
+#else
+
+static bool
+test_setup_variant_cache(unsigned verbose)
+{
+   return true;
+}
+
+#endif
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   static const unsigned ops[] = { 3, 30, 300 };
+   bool success = true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(ops); i++)
+      success = test_jit_cache(verbose, fp, ops[i], 5) && success;
+
+   success = test_setup_variant_cache(verbose) && success;
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_jit_cache(verbose, fp, 30, 1) &&
+          test_setup_variant_cache(verbose);
+}
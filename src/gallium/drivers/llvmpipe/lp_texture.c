@@ -287,6 +287,51 @@ llvmpipe_displaytarget_layout(struct llvmpipe_screen *screen,
 }
 
 
+/**
+ * Allocate the per-tile depth bounds for a depth buffer.  This is just a
+ * hint to the rasterizer, so failing to is not an error.
+ */
+static void
+llvmpipe_resource_hiz_init(struct llvmpipe_resource *lpr)
+{
+   const struct pipe_resource *pt = &lpr->base;
+
+   if (!(pt->bind & PIPE_BIND_DEPTH_STENCIL) ||
+       !util_format_has_depth(util_format_description(pt->format)) ||
+       (pt->target != PIPE_TEXTURE_2D && pt->target != PIPE_TEXTURE_RECT))
+      return;
+
+   unsigned tiles_x = DIV_ROUND_UP(pt->width0, TILE_SIZE);
+   unsigned tiles_y = DIV_ROUND_UP(pt->height0, TILE_SIZE);
+
+   lpr->hiz = MALLOC(tiles_x * tiles_y * sizeof(*lpr->hiz));
+   if (!lpr->hiz)
+      return;
+
+   lpr->hiz_stride = tiles_x;
+   llvmpipe_resource_hiz_invalidate(lpr);
+}
+
+
+/**
+ * Forget what is known about the depth values of a depth buffer, after it
+ * was written by something other than the rasterizer.
+ */
+void
+llvmpipe_resource_hiz_invalidate(struct llvmpipe_resource *lpr)
+{
+   if (!lpr->hiz)
+      return;
+
+   unsigned num_tiles = lpr->hiz_stride *
+                        DIV_ROUND_UP(lpr->base.height0, TILE_SIZE);
+   for (unsigned i = 0; i < num_tiles; i++) {
+      lpr->hiz[i].zmin = -INFINITY;
+      lpr->hiz[i].zmax = INFINITY;
+   }
+}
+
+
 static struct pipe_resource *
 llvmpipe_resource_create_all(struct pipe_screen *_screen,
                              const struct pipe_resource *templat,
@@ -316,6 +361,9 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
          /* displayable surface */
          if (!llvmpipe_displaytarget_layout(screen, lpr, map_front_private))
             goto fail;
+
+         if (lpr->base.bind & PIPE_BIND_DISPLAY_TARGET)
+            llvmpipe_resource_damage_init(lpr);
       } else {
          /* texture map */
          if (!llvmpipe_texture_layout(screen, lpr, alloc_backing))
@@ -329,6 +377,8 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
 #endif
 
             lpr->residency = calloc(DIV_ROUND_UP(lpr->size_required, 64 * 1024 * sizeof(uint32_t) * 8), sizeof(uint32_t));
+         } else if (alloc_backing) {
+            llvmpipe_resource_hiz_init(lpr);
          }
       }
    } else {
@@ -598,6 +648,8 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
    }
 
    free(lpr->residency);
+   FREE(lpr->hiz);
+   FREE(lpr->damage);
 
 #if MESA_DEBUG
    simple_mtx_lock(&resource_list_mutex);
@@ -857,6 +909,9 @@ llvmpipe_resource_get_handle(struct pipe_screen *_screen,
    if (!lpr->dt)
       return false;
 
+   /* Others may write it from now on. */
+   llvmpipe_resource_damage_all(lpr, true);
+
    return winsys->displaytarget_get_handle(winsys, lpr->dt, whandle);
 }
 
@@ -940,6 +995,11 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
       }
    }
 
+   if ((usage & PIPE_MAP_WRITE) && level == 0) {
+      llvmpipe_resource_hiz_invalidate(lpr);
+      llvmpipe_resource_damage_all(lpr, false);
+   }
+
    /* Check if we're mapping a current constant buffer */
    if ((usage & PIPE_MAP_WRITE) &&
        (resource->bind & PIPE_BIND_CONSTANT_BUFFER)) {
@@ -31,6 +31,7 @@
 
 #include "pipe/p_state.h"
 #include "util/u_debug.h"
+#include "util/u_pack_color.h"
 #include "lp_limits.h"
 #include "util/bitset.h"
 #if MESA_DEBUG
@@ -59,6 +60,28 @@ struct llvmpipe_screen;
 
 struct sw_displaytarget;
 
+
+/**
+ * Conservative range of the depth values stored in one tile of a depth
+ * buffer, as floats in the units of the fragment depth.
+ */
+struct lp_hiz_tile
+{
+   float zmin, zmax;
+};
+
+
+/**
+ * What is known about one tile of a display target, see lp_damage.c.
+ */
+struct lp_damage_tile
+{
+   bool damaged;   /**< changed since it was last presented */
+   bool cleared;   /**< every pixel holds clear_value */
+   union util_color clear_value;
+};
+
+
 /**
  * llvmpipe subclass of pipe_resource.  A texture, drawing surface,
  * vertex buffer, const buffer, etc.
@@ -96,6 +119,22 @@ struct llvmpipe_resource
 
    BITSET_WORD *residency;
 
+   /**
+    * Per-tile depth bounds of level 0 of depth buffers, see lp_rast_hiz.c.
+    * NULL if not tracked.
+    */
+   struct lp_hiz_tile *hiz;
+   unsigned hiz_stride;  /**< tiles per row */
+
+   /**
+    * Per-tile damage of display targets, protected by the screen's
+    * damage_mutex.  NULL if not tracked.
+    */
+   struct lp_damage_tile *damage;
+   unsigned damage_stride;   /**< tiles per row */
+   bool damage_disabled;     /**< written behind the rasterizer's back */
+   void *damage_drawable;    /**< where it was last presented */
+
    /**
     * Data for non-texture resources.
     */
@@ -306,6 +345,22 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
                          const struct pipe_box *box,
                          struct pipe_transfer **transfer);
 
+void
+llvmpipe_resource_hiz_invalidate(struct llvmpipe_resource *lpr);
+
+void
+llvmpipe_resource_damage_init(struct llvmpipe_resource *lpr);
+
+void
+llvmpipe_resource_damage_all(struct llvmpipe_resource *lpr, bool disable);
+
+bool
+llvmpipe_resource_get_damage(struct llvmpipe_resource *lpr,
+                             void *drawable,
+                             struct pipe_box *boxes,
+                             unsigned max_boxes,
+                             unsigned *nboxes);
+
 uint32_t
 llvmpipe_get_texel_offset(struct pipe_resource *resource,
                           uint32_t level, uint32_t x,
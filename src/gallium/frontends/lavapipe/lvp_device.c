@@ -40,6 +40,7 @@
 #include "util/os_time.h"
 #include "util/u_thread.h"
 #include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
 #include "util/timespec.h"
 #include "util/ptralloc.h"
 #include "nir.h"
@@ -1750,6 +1751,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
    device->queue.state = device + 1;
    device->poison_mem = debug_get_bool_option("LVP_POISON_MEMORY", false);
    device->print_cmds = debug_get_bool_option("LVP_CMD_DEBUG", false);
+   device->serial_compile = debug_get_bool_option("LVP_SERIAL_COMPILE", false);
 
    struct vk_device_dispatch_table dispatch_table;
    vk_device_dispatch_table_from_entrypoints(&dispatch_table,
@@ -1790,6 +1792,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
    device->noop_fs = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
    _mesa_hash_table_init(&device->bda, NULL, _mesa_hash_pointer, _mesa_key_pointer_equal);
    simple_mtx_init(&device->bda_lock, mtx_plain);
+   simple_mtx_init(&device->compile_queue_lock, mtx_plain);
 
    uint32_t zero = 0;
    device->zero_buffer = pipe_buffer_create_with_data(device->queue.ctx, 0, PIPE_USAGE_IMMUTABLE, sizeof(uint32_t), &zero);
@@ -1810,6 +1813,34 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
 }
 
+/**
+ * Returns the queue on which independent shaders of a pipeline can be
+ * compiled, or NULL if they should be compiled on the calling thread.
+ */
+struct util_queue *
+lvp_device_get_compile_queue(struct lvp_device *device)
+{
+   if (device->serial_compile || util_get_cpu_caps()->nr_cpus <= 1)
+      return NULL;
+
+   struct util_queue *queue = &device->compile_queue;
+
+   simple_mtx_lock(&device->compile_queue_lock);
+   if (!util_queue_is_initialized(queue)) {
+      /* The calling thread compiles one of the shaders too. */
+      unsigned num_threads = MIN2(util_get_cpu_caps()->nr_cpus - 1, 8);
+
+      if (!util_queue_init(queue, "lvp_compile", 32, num_threads,
+                           UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                           UTIL_QUEUE_INIT_SHARED |
+                           UTIL_QUEUE_INIT_INTERACTIVE, NULL))
+         queue = NULL;
+   }
+   simple_mtx_unlock(&device->compile_queue_lock);
+
+   return queue;
+}
+
 VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
    VkDevice                                    _device,
    const VkAllocationCallbacks*                pAllocator)
@@ -1837,6 +1868,10 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
    simple_mtx_destroy(&device->bda_lock);
    pipe_resource_reference(&device->zero_buffer, NULL);
 
+   if (util_queue_is_initialized(&device->compile_queue))
+      util_queue_destroy(&device->compile_queue);
+   simple_mtx_destroy(&device->compile_queue_lock);
+
    lvp_queue_finish(&device->queue);
    vk_device_finish(&device->vk);
    vk_free(&device->vk.alloc, device);
@@ -277,6 +277,15 @@ lvp_shader_optimize(nir_shader *nir)
    NIR_PASS_V(nir, nir_remove_dead_variables, nir_var_function_temp, NULL);
    NIR_PASS_V(nir, nir_opt_dce);
    nir_sweep(nir);
+
+   /* The optimization loops leave large shaders spread over mostly empty
+    * slabs.  The shader is kept for as long as the pipeline and compiled
+    * again for each variant, so move it to fresh memory in program order.
+    */
+   size_t used;
+   size_t size = gc_get_usage(nir->gctx, &used);
+   if (size - used >= 1024 * 1024 && size > 2 * used)
+      nir_compact(nir);
 }
 
 struct lvp_pipeline_nir *
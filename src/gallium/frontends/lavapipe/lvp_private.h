@@ -223,9 +223,18 @@ struct lvp_device {
    struct util_dynarray bda_image_handles;
 
    uint32_t group_handle_alloc;
+
+   /**
+    * Queue compiling the independent stages of ray tracing pipelines on the
+    * threads shared by the process, created on first use.
+    */
+   simple_mtx_t compile_queue_lock;
+   struct util_queue compile_queue;
+   bool serial_compile;
 };
 
 void lvp_device_get_cache_uuid(void *uuid);
+struct util_queue *lvp_device_get_compile_queue(struct lvp_device *device);
 
 enum lvp_device_memory_type {
    LVP_DEVICE_MEMORY_TYPE_DEFAULT,
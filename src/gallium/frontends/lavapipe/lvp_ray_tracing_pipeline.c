@@ -160,47 +160,106 @@ lvp_move_ray_tracing_intrinsic(nir_builder *b, nir_intrinsic_instr *instr, void
    }
 }
 
+static VkResult
+lvp_compile_ray_tracing_stage(struct lvp_pipeline *pipeline,
+                              const VkPipelineShaderStageCreateInfo *sinfo,
+                              struct lvp_pipeline_nir **out)
+{
+   nir_shader *nir;
+   VkResult result = lvp_spirv_to_nir(pipeline, sinfo, &nir);
+   if (result != VK_SUCCESS)
+      return result;
+
+   assert(!nir->scratch_size);
+   if (nir->info.stage == MESA_SHADER_ANY_HIT ||
+       nir->info.stage == MESA_SHADER_CLOSEST_HIT ||
+       nir->info.stage == MESA_SHADER_INTERSECTION)
+      nir->scratch_size = LVP_RAY_HIT_ATTRIBS_SIZE;
+
+   NIR_PASS(_, nir, nir_lower_vars_to_explicit_types,
+            nir_var_function_temp | nir_var_shader_call_data | nir_var_ray_hit_attrib,
+            glsl_get_natural_size_align_bytes);
+
+   NIR_PASS(_, nir, lvp_lower_ray_tracing_derefs);
+
+   NIR_PASS(_, nir, nir_lower_explicit_io, nir_var_function_temp, nir_address_format_32bit_offset);
+
+   NIR_PASS(_, nir, nir_shader_intrinsics_pass, lvp_move_ray_tracing_intrinsic,
+            nir_metadata_control_flow, NULL);
+
+   *out = lvp_create_pipeline_nir(nir);
+   if (!*out) {
+      ralloc_free(nir);
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   return VK_SUCCESS;
+}
+
+struct lvp_ray_tracing_stage_job {
+   struct lvp_pipeline *pipeline;
+   const VkPipelineShaderStageCreateInfo *sinfo;
+   struct lvp_pipeline_nir **out;
+   VkResult result;
+   struct util_queue_fence fence;
+};
+
+static void
+lvp_ray_tracing_stage_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct lvp_ray_tracing_stage_job *job = data;
+   job->result = lvp_compile_ray_tracing_stage(job->pipeline, job->sinfo, job->out);
+}
+
 static VkResult
 lvp_compile_ray_tracing_stages(struct lvp_pipeline *pipeline,
                                const VkRayTracingPipelineCreateInfoKHR *create_info)
 {
    VkResult result = VK_SUCCESS;
+   uint32_t stage_count = create_info->stageCount;
 
-   uint32_t i = 0;
-   for (; i < create_info->stageCount; i++) {
-      nir_shader *nir;
-      result = lvp_spirv_to_nir(pipeline, create_info->pStages + i, &nir);
-      if (result != VK_SUCCESS)
-         return result;
-
-      assert(!nir->scratch_size);
-      if (nir->info.stage == MESA_SHADER_ANY_HIT ||
-          nir->info.stage == MESA_SHADER_CLOSEST_HIT ||
-          nir->info.stage == MESA_SHADER_INTERSECTION)
-         nir->scratch_size = LVP_RAY_HIT_ATTRIBS_SIZE;
-
-      NIR_PASS(_, nir, nir_lower_vars_to_explicit_types,
-               nir_var_function_temp | nir_var_shader_call_data | nir_var_ray_hit_attrib,
-               glsl_get_natural_size_align_bytes);
-
-      NIR_PASS(_, nir, lvp_lower_ray_tracing_derefs);
-
-      NIR_PASS(_, nir, nir_lower_explicit_io, nir_var_function_temp, nir_address_format_32bit_offset);
-
-      NIR_PASS(_, nir, nir_shader_intrinsics_pass, lvp_move_ray_tracing_intrinsic,
-               nir_metadata_control_flow, NULL);
-
-      pipeline->rt.stages[i] = lvp_create_pipeline_nir(nir);
-      if (!pipeline->rt.stages[i]) {
-         result = VK_ERROR_OUT_OF_HOST_MEMORY;
-         ralloc_free(nir);
-         return result;
+   struct lvp_ray_tracing_stage_job *jobs = calloc(stage_count, sizeof(*jobs));
+   if (stage_count && !jobs)
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+   /* The stages are independent shaders until they are inlined into the
+    * traversal shader, so they can be compiled in parallel.  The last one is
+    * compiled on this thread while waiting for the others.
+    */
+   struct util_queue *queue = stage_count > 1 ?
+      lvp_device_get_compile_queue(pipeline->device) : NULL;
+
+   for (uint32_t i = 0; i < stage_count; i++) {
+      struct lvp_ray_tracing_stage_job *job = &jobs[i];
+
+      job->pipeline = pipeline;
+      job->sinfo = create_info->pStages + i;
+      job->out = pipeline->rt.stages + i;
+      util_queue_fence_init(&job->fence);
+
+      if (queue && i < stage_count - 1) {
+         util_queue_add_job(queue, job, &job->fence,
+                            lvp_ray_tracing_stage_job_execute, NULL, 0);
+      } else {
+         lvp_ray_tracing_stage_job_execute(job, NULL, 0);
       }
    }
 
-   if (!create_info->pLibraryInfo)
+   for (uint32_t i = 0; i < stage_count; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+
+      if (result == VK_SUCCESS)
+         result = jobs[i].result;
+   }
+
+   free(jobs);
+
+   if (result != VK_SUCCESS || !create_info->pLibraryInfo)
       return result;
 
+   uint32_t i = stage_count;
+
    for (uint32_t library_index = 0; library_index < create_info->pLibraryInfo->libraryCount; library_index++) {
       VK_FROM_HANDLE(lvp_pipeline, library, create_info->pLibraryInfo->pLibraries[library_index]);
       for (uint32_t stage_index = 0; stage_index < library->rt.stage_count; stage_index++) {
@@ -366,11 +366,31 @@ dri_sw_displaytarget_display(struct sw_winsys *ws,
     */
    width = dri_sw_dt->stride / blsize;
    height = dri_sw_dt->height;
-   if (is_shm)
-      dri_sw_ws->lf->put_image_shm(dri_drawable, dri_sw_dt->shmid, dri_sw_dt->data, 0, 0,
-            0, 0, width, height, dri_sw_dt->stride);
-   else
-      dri_sw_ws->lf->put_image(dri_drawable, dri_sw_dt->data, width, height);
+
+   if (!nboxes) {
+      if (is_shm)
+         dri_sw_ws->lf->put_image_shm(dri_drawable, dri_sw_dt->shmid, dri_sw_dt->data, 0, 0,
+               0, 0, width, height, dri_sw_dt->stride);
+      else
+         dri_sw_ws->lf->put_image(dri_drawable, dri_sw_dt->data, width, height);
+      return;
+   }
+
+   for (unsigned i = 0; i < nboxes; i++) {
+      unsigned offset = dri_sw_dt->stride * box[i].y;
+      unsigned offset_x = box[i].x * blsize;
+
+      /* put_image_shm applies the x offset itself */
+      if (is_shm)
+         dri_sw_ws->lf->put_image_shm(dri_drawable, dri_sw_dt->shmid, dri_sw_dt->data,
+                                      offset, offset_x, box[i].x, box[i].y,
+                                      box[i].width, box[i].height, dri_sw_dt->stride);
+      else
+         dri_sw_ws->lf->put_image2(dri_drawable,
+                                   (char *)dri_sw_dt->data + offset + offset_x,
+                                   box[i].x, box[i].y, box[i].width, box[i].height,
+                                   dri_sw_dt->stride);
+   }
    return;
 }
 
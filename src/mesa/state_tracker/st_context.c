@@ -351,6 +351,9 @@ st_destroy_context_priv(struct st_context *st, bool destroy_pipe)
    st_invalidate_readpix_cache(st);
    util_throttle_deinit(st->screen, &st->throttle);
 
+   if (util_queue_is_initialized(&st->link_queue))
+      util_queue_destroy(&st->link_queue);
+
    cso_destroy_context(st->cso_context);
 
    if (st->pipe && destroy_pipe)
@@ -36,6 +36,7 @@
 #include "util/u_helpers.h"
 #include "util/u_inlines.h"
 #include "util/list.h"
+#include "util/u_queue.h"
 #include "vbo/vbo.h"
 #include "util/list.h"
 #include "cso_cache/cso_context.h"
@@ -398,6 +399,12 @@ struct st_context
       simple_mtx_t mutex;
    } zombie_shaders;
 
+   /**
+    * Threads running the per-stage part of GLSL program linking, created
+    * on the first link of a program with more than one stage.
+    */
+   struct util_queue link_queue;
+
    struct hash_table *hw_select_shaders;
 };
 
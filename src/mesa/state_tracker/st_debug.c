@@ -52,6 +52,7 @@ static const struct debug_named_value st_debug_flags[] = {
    { "wf",       DEBUG_WIREFRAME, NULL },
    { "gremedy",  DEBUG_GREMEDY, "Enable GREMEDY debug extensions" },
    { "noreadpixcache", DEBUG_NOREADPIXCACHE, NULL },
+   { "seriallink", DEBUG_SERIAL_LINK, "Run the per-stage part of GLSL linking on the calling thread" },
    DEBUG_NAMED_VALUE_END
 };
 
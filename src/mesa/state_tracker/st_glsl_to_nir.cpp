@@ -39,6 +39,7 @@
 
 #include "main/shaderobj.h"
 #include "st_context.h"
+#include "st_debug.h"
 #include "st_program.h"
 #include "st_shader_cache.h"
 
@@ -56,6 +57,7 @@
 #include "compiler/glsl/string_to_uint_map.h"
 
 #include "util/log.h"
+#include "util/u_cpu_detect.h"
 
 static int
 type_size(const struct glsl_type *type)
@@ -269,15 +271,15 @@ filter_64_bit_instr(const nir_instr *const_instr, UNUSED const void *data)
    return lower;
 }
 
-/* Second third of converting glsl_to_nir. This creates uniforms, gathers
- * info on varyings, etc after NIR link time opts have been applied.
+/* Add the parameters of the uniforms of a linked program, and attach them to
+ * the uniform storage of the shader program.  The uniform storage is shared
+ * by all stages, so this has to be done one stage at a time.
  */
-static char *
-st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
-                         struct gl_shader_program *shader_program)
+static void
+st_glsl_to_nir_add_uniforms(struct st_context *st, struct gl_program *prog,
+                            struct gl_shader_program *shader_program)
 {
    nir_shader *nir = prog->nir;
-   struct pipe_screen *screen = st->screen;
 
    /* Make a pass over the IR to add state references for any built-in
     * uniforms that are used.  This has to be done now (during linking).
@@ -315,6 +317,22 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
     * This should be enough for Bitmap and DrawPixels constants.
     */
    _mesa_ensure_and_associate_uniform_storage(st->ctx, shader_program, prog, 28);
+}
+
+/* Second third of converting glsl_to_nir. This lowers uniforms, gathers
+ * info on varyings, etc after NIR link time opts have been applied.
+ *
+ * This only changes the given stage, so it may run on the link queue
+ * concurrently with the other stages of the program.
+ */
+static char *
+st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
+                         struct gl_shader_program *shader_program)
+{
+   nir_shader *nir = prog->nir;
+   struct pipe_screen *screen = st->screen;
+
+   MESA_TRACE_FUNC();
 
    /* None of the builtins being lowered here can be produced by SPIR-V.  See
     * _mesa_builtin_uniform_desc. Also drivers that support packed uniform
@@ -392,16 +410,72 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
       msg = st_finalize_nir(st, prog, shader_program, nir, true, true, false);
    }
 
-   if (st->ctx->_Shader->Flags & GLSL_DUMP) {
-      _mesa_log("\n");
-      _mesa_log("NIR IR for linked %s program %d:\n",
-             _mesa_shader_stage_to_string(prog->info.stage),
-             shader_program->Name);
-      nir_print_shader(nir, mesa_log_get_file());
-      _mesa_log("\n\n");
+   return msg;
+}
+
+struct st_link_job {
+   struct st_context *st;
+   struct gl_program *prog;
+   struct gl_shader_program *shader_program;
+   struct util_queue_fence fence;
+   char *msg;
+};
+
+static void
+st_link_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct st_link_job *job = (struct st_link_job *)data;
+
+   job->msg = st_glsl_to_nir_post_opts(job->st, job->prog,
+                                       job->shader_program);
+}
+
+/* Run st_glsl_to_nir_post_opts for all stages of a program.  All stages but
+ * the last one are handed to the link queue, the last one runs on the
+ * calling thread.
+ */
+static void
+st_glsl_to_nir_post_opts_all(struct st_context *st,
+                             struct gl_shader_program *shader_program,
+                             struct gl_linked_shader **linked_shader,
+                             unsigned num_shaders,
+                             struct st_link_job *jobs)
+{
+   struct gl_context *ctx = st->ctx;
+   bool parallel = num_shaders > 1 &&
+                   ctx->Hint.MaxShaderCompilerThreads > 0 &&
+                   util_get_cpu_caps()->nr_cpus > 1 &&
+                   !(ST_DEBUG & DEBUG_SERIAL_LINK);
+
+   if (parallel && !util_queue_is_initialized(&st->link_queue)) {
+      /* A program has at most 5 graphics stages. */
+      unsigned num_threads = MIN2(util_get_cpu_caps()->nr_cpus - 1, 4);
+
+      parallel = util_queue_init(&st->link_queue, "gllink", 8, num_threads,
+                                 UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL);
+   }
+
+   for (unsigned i = 0; i < num_shaders; i++) {
+      struct st_link_job *job = &jobs[i];
+
+      job->st = st;
+      job->prog = linked_shader[i]->Program;
+      job->shader_program = shader_program;
+      job->msg = NULL;
+      util_queue_fence_init(&job->fence);
+
+      if (parallel && i < num_shaders - 1) {
+         util_queue_add_job(&st->link_queue, job, &job->fence,
+                            st_link_job_execute, NULL, 0);
+      } else {
+         st_link_job_execute(job, NULL, 0);
+      }
    }
 
-   return msg;
+   for (unsigned i = 0; i < num_shaders; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
 }
 
 static void
@@ -675,18 +749,44 @@ st_link_glsl_to_nir(struct gl_context *ctx,
       }
    }
 
+   for (unsigned i = 0; i < num_shaders; i++) {
+      st_glsl_to_nir_add_uniforms(st, linked_shader[i]->Program,
+                                  shader_program);
+   }
+
+   /* The stages are independent from here on until their interfaces are
+    * unified below.
+    */
+   struct st_link_job jobs[MESA_SHADER_STAGES];
+   st_glsl_to_nir_post_opts_all(st, shader_program, linked_shader,
+                                num_shaders, jobs);
+
+   for (unsigned i = 0; i < num_shaders; i++) {
+      if (jobs[i].msg) {
+         linker_error(shader_program, jobs[i].msg);
+         return false;
+      }
+   }
+
+   if (ctx->_Shader->Flags & GLSL_DUMP) {
+      for (unsigned i = 0; i < num_shaders; i++) {
+         struct gl_program *prog = linked_shader[i]->Program;
+
+         _mesa_log("\n");
+         _mesa_log("NIR IR for linked %s program %d:\n",
+                _mesa_shader_stage_to_string(prog->info.stage),
+                shader_program->Name);
+         nir_print_shader(prog->nir, mesa_log_get_file());
+         _mesa_log("\n\n");
+      }
+   }
+
    struct shader_info *prev_info = NULL;
 
    for (unsigned i = 0; i < num_shaders; i++) {
       struct gl_linked_shader *shader = linked_shader[i];
       struct shader_info *info = &shader->Program->nir->info;
 
-      char *msg = st_glsl_to_nir_post_opts(st, shader->Program, shader_program);
-      if (msg) {
-         linker_error(shader_program, msg);
-         return false;
-      }
-
       if (prev_info &&
           ctx->Const.ShaderCompilerOptions[shader->Stage].NirOptions->unify_interfaces) {
          prev_info->outputs_written |= info->inputs_read &
@@ -308,14 +308,32 @@ blob_skip_bytes(struct blob_reader *blob, size_t size)
       blob->current += size;
 }
 
+/* Reads a power-of-two sized value from the current location aligned to its
+ * size.  The fixed-size readers are called for almost every field of a
+ * serialized shader, so this does it all in one place instead of going
+ * through blob_reader_align() and blob_copy_bytes().
+ */
+static inline void
+blob_read_fixed(struct blob_reader *blob, void *dest, size_t size)
+{
+   blob->current = blob->data + align_uintptr(blob->current - blob->data, size);
+
+   if (likely(!blob->overrun && blob->current <= blob->end &&
+              blob->end - blob->current >= size)) {
+      memcpy(dest, blob->current, size);
+      blob->current += size;
+   } else {
+      blob->overrun = true;
+   }
+}
+
 #define BLOB_READ_TYPE(name, type)         \
 type                                       \
 name(struct blob_reader *blob)             \
 {                                          \
    type ret = 0;                           \
    int size = sizeof(ret);                 \
-   blob_reader_align(blob, size);          \
-   blob_copy_bytes(blob, &ret, size);      \
+   blob_read_fixed(blob, &ret, size);      \
    return ret;                             \
 }
 
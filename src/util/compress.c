@@ -36,8 +36,11 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
+#include <stdlib.h>
+
 #include "util/compress.h"
 #include "util/perf/cpu_trace.h"
 #include "macros.h"
@@ -45,6 +48,24 @@
 /* 3 is the recomended level, with 22 as the absolute maximum */
 #define ZSTD_COMPRESSION_LEVEL 3
 
+#ifdef HAVE_ZSTD
+struct util_compress_dict {
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+   unsigned id;
+};
+
+static int
+zstd_compression_level(int level)
+{
+   if (!level)
+      return ZSTD_COMPRESSION_LEVEL;
+
+   /* Negative levels trade the compression ratio for speed. */
+   return CLAMP(level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+}
+#endif
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size)
 {
@@ -70,15 +91,112 @@ util_compress_max_compressed_len(size_t in_data_size)
 #endif
 }
 
+/**
+ * Creates a dictionary for compressing similar data, e.g. one trained with
+ * util_compress_dict_train(). The data is compressed at the given level,
+ * 0 selects the default one.
+ *
+ * Returns NULL if dictionaries aren't supported.
+ */
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size, int level)
+{
+#ifdef HAVE_ZSTD
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (!dict)
+      return NULL;
+
+   /* The ID is stored in the compressed frames, which is how the data is
+    * matched with its dictionary when inflating. Raw content dictionaries
+    * don't have one.
+    */
+   dict->id = ZSTD_getDictID_fromDict(dict_data, dict_size);
+   dict->cdict = ZSTD_createCDict(dict_data, dict_size,
+                                  zstd_compression_level(level));
+   dict->ddict = ZSTD_createDDict(dict_data, dict_size);
+
+   if (!dict->id || !dict->cdict || !dict->ddict) {
+      util_compress_dict_destroy(dict);
+      return NULL;
+   }
+
+   return dict;
+#else
+   return NULL;
+#endif
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+#ifdef HAVE_ZSTD
+   if (!dict)
+      return;
+
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+   free(dict);
+#endif
+}
+
+/**
+ * Trains a dictionary from the samples, which are stored back to back.
+ * Returns the size of the dictionary, or 0 on failure.
+ */
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_capacity,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples)
+{
+   MESA_TRACE_FUNC();
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict_data, dict_capacity, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#else
+   return 0;
+#endif
+}
+
 /* Compress data and return the size of the compressed data */
 size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size)
+{
+   return util_compress_deflate_dict(NULL, 0, in_data, in_data_size,
+                                     out_data, out_buff_size);
+}
+
+/**
+ * Compresses data with the dictionary, or without one at the given level
+ * (0 selects the default level) if dict is NULL. Returns the size of the
+ * compressed data.
+ */
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict, int level,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size)
 {
    MESA_TRACE_FUNC();
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
-                              ZSTD_COMPRESSION_LEVEL);
+   size_t ret;
+
+   if (dict) {
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      if (!cctx)
+         return 0;
+
+      ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size,
+                                     in_data, in_data_size, dict->cdict);
+      ZSTD_freeCCtx(cctx);
+   } else {
+      ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
+                          zstd_compression_level(level));
+   }
+
    if (ZSTD_isError(ret))
       return 0;
 
@@ -96,7 +214,7 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
    strm.avail_in = in_data_size;
    strm.avail_out = out_buff_size;
 
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
+   int ret = deflateInit(&strm, level ? CLAMP(level, 1, 9) : Z_BEST_COMPRESSION);
    if (ret != Z_OK) {
        (void) deflateEnd(&strm);
        return 0;
@@ -125,10 +243,41 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
 bool
 util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_data_size)
+{
+   return util_compress_inflate_dict(NULL, in_data, in_data_size,
+                                     out_data, out_data_size);
+}
+
+/**
+ * Decompresses data that may have been compressed with the dictionary,
+ * returns true if successful. Fails if the data was compressed with another
+ * dictionary.
+ */
+bool
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size)
 {
    MESA_TRACE_FUNC();
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   unsigned dict_id = ZSTD_getDictID_fromFrame(in_data, in_data_size);
+   size_t ret;
+
+   if (dict_id) {
+      if (!dict || dict->id != dict_id)
+         return false;
+
+      ZSTD_DCtx *dctx = ZSTD_createDCtx();
+      if (!dctx)
+         return false;
+
+      ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size,
+                                       in_data, in_data_size, dict->ddict);
+      ZSTD_freeDCtx(dctx);
+   } else {
+      ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   }
+
    return !ZSTD_isError(ret);
 #elif defined(HAVE_ZLIB)
    z_stream strm;
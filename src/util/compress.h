@@ -26,6 +26,10 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size);
 
@@ -37,4 +41,31 @@ size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size);
 
+struct util_compress_dict;
+
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size, int level);
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict);
+
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_capacity,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples);
+
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict, int level,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size);
+
+bool
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
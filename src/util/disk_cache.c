@@ -39,12 +39,16 @@
 
 #include "util/compress.h"
 #include "util/crc32.h"
+#include "util/hash_table.h"
 #include "util/u_debug.h"
 #include "util/rand_xor.h"
 #include "util/u_atomic.h"
 #include "util/mesa-sha1.h"
+#include "util/os_time.h"
 #include "util/perf/cpu_trace.h"
 #include "util/ralloc.h"
+#include "util/set.h"
+#include "util/u_process.h"
 #include "util/compiler.h"
 
 #include "disk_cache.h"
@@ -83,6 +87,9 @@ disk_cache_init_queue(struct disk_cache *cache)
     * up in the queue. Since we set the UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY
     * flag this should have little negative impact on low core systems.
     *
+    * The queue keeps threads of its own rather than using the shared ones,
+    * which run at normal priority.
+    *
     * The queue will resize automatically when it's full, so adding new jobs
     * doesn't stall.
     */
@@ -92,6 +99,37 @@ disk_cache_init_queue(struct disk_cache *cache)
                           UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY, NULL);
 }
 
+/* Parse a size optionally followed by K, M or G, in units of \p unit
+ * without a suffix.
+ */
+static uint64_t
+disk_cache_parse_size(const char *str, uint64_t unit)
+{
+   uint64_t size;
+   char *end;
+
+   if (!str)
+      return 0;
+
+   size = strtoul(str, &end, 10);
+   if (end == str)
+      return 0;
+
+   switch (*end) {
+   case 'K':
+   case 'k':
+      return size * 1024;
+   case 'M':
+   case 'm':
+      return size * 1024*1024;
+   case 'G':
+   case 'g':
+      return size * 1024*1024*1024;
+   default:
+      return size * unit;
+   }
+}
+
 static struct disk_cache *
 disk_cache_type_create(const char *gpu_name,
                        const char *driver_id,
@@ -175,30 +213,7 @@ disk_cache_type_create(const char *gpu_name,
    }
    #endif
 
-   if (max_size_str) {
-      char *end;
-      max_size = strtoul(max_size_str, &end, 10);
-      if (end == max_size_str) {
-         max_size = 0;
-      } else {
-         switch (*end) {
-         case 'K':
-         case 'k':
-            max_size *= 1024;
-            break;
-         case 'M':
-         case 'm':
-            max_size *= 1024*1024;
-            break;
-         case '\0':
-         case 'G':
-         case 'g':
-         default:
-            max_size *= 1024*1024*1024;
-            break;
-         }
-      }
-   }
+   max_size = disk_cache_parse_size(max_size_str, 1024*1024*1024);
 
    /* Default to 1GB for maximum cache size. */
    if (max_size == 0) {
@@ -250,6 +265,8 @@ disk_cache_type_create(const char *gpu_name,
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
+   disk_cache_compression_init(cache);
+
    ralloc_free(local);
 
    return cache;
@@ -262,6 +279,172 @@ disk_cache_type_create(const char *gpu_name,
    return NULL;
 }
 
+/* In-memory front cache
+ *
+ * Loading an entry reads it from the disk and inflates it, even when another
+ * context of the process just loaded the same one. The last loaded entries
+ * are kept uncompressed in a size-bounded LRU list to avoid that.
+ */
+
+struct disk_cache_mem_entry {
+   struct list_head link;
+   cache_key key;
+   size_t size;
+   bool prefetched;      /* not used since it was prefetched */
+   uint8_t data[];
+};
+
+static uint32_t
+mem_entry_hash(const void *key)
+{
+   /* The keys are SHA-1 hashes already. */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+mem_entry_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+static void
+disk_cache_mem_init(struct disk_cache *cache)
+{
+   cache->mem.max_size =
+      disk_cache_parse_size(getenv("MESA_SHADER_CACHE_MEMORY_SIZE"),
+                            1024*1024);
+   if (!cache->mem.max_size)
+      return;
+
+   cache->mem.entries = _mesa_hash_table_create(cache, mem_entry_hash,
+                                                mem_entry_equal);
+   if (!cache->mem.entries) {
+      cache->mem.max_size = 0;
+      return;
+   }
+
+   simple_mtx_init(&cache->mem.lock, mtx_plain);
+   list_inithead(&cache->mem.lru);
+}
+
+static void
+disk_cache_mem_finish(struct disk_cache *cache)
+{
+   if (!cache->mem.max_size)
+      return;
+
+   list_for_each_entry_safe(struct disk_cache_mem_entry, entry,
+                            &cache->mem.lru, link)
+      free(entry);
+
+   simple_mtx_destroy(&cache->mem.lock);
+}
+
+static void
+disk_cache_mem_evict_locked(struct disk_cache *cache,
+                            struct disk_cache_mem_entry *entry)
+{
+   _mesa_hash_table_remove_key(cache->mem.entries, entry->key);
+   list_del(&entry->link);
+   cache->mem.size -= sizeof(*entry) + entry->size;
+   free(entry);
+}
+
+static void *
+disk_cache_mem_get(struct disk_cache *cache, const cache_key key,
+                   size_t *size)
+{
+   void *data = NULL;
+
+   simple_mtx_lock(&cache->mem.lock);
+
+   struct hash_entry *he = _mesa_hash_table_search(cache->mem.entries, key);
+   if (he) {
+      struct disk_cache_mem_entry *entry = he->data;
+
+      data = malloc(entry->size);
+      if (data) {
+         memcpy(data, entry->data, entry->size);
+         *size = entry->size;
+         list_move_to(&entry->link, &cache->mem.lru);
+
+         if (entry->prefetched) {
+            entry->prefetched = false;
+            cache->stats.prefetch_hits++;
+         }
+      }
+   }
+
+   simple_mtx_unlock(&cache->mem.lock);
+
+   return data;
+}
+
+static void
+disk_cache_mem_put(struct disk_cache *cache, const cache_key key,
+                   const void *data, size_t size, bool prefetched)
+{
+   uint64_t entry_size = sizeof(struct disk_cache_mem_entry) + size;
+
+   /* Don't let a single entry evict most of the others. */
+   if (entry_size > cache->mem.max_size / 4)
+      return;
+
+   struct disk_cache_mem_entry *entry = malloc(entry_size);
+   if (!entry)
+      return;
+
+   memcpy(entry->key, key, CACHE_KEY_SIZE);
+   entry->size = size;
+   entry->prefetched = prefetched;
+   memcpy(entry->data, data, size);
+
+   simple_mtx_lock(&cache->mem.lock);
+
+   /* Another thread may have loaded it too. */
+   uint32_t hash = mem_entry_hash(key);
+   if (_mesa_hash_table_search_pre_hashed(cache->mem.entries, hash, key)) {
+      simple_mtx_unlock(&cache->mem.lock);
+      free(entry);
+      return;
+   }
+
+   while (cache->mem.size + entry_size > cache->mem.max_size) {
+      disk_cache_mem_evict_locked(cache,
+                                  list_last_entry(&cache->mem.lru,
+                                                  struct disk_cache_mem_entry,
+                                                  link));
+      cache->stats.mem_evictions++;
+   }
+
+   _mesa_hash_table_insert_pre_hashed(cache->mem.entries, hash, entry->key,
+                                      entry);
+   list_add(&entry->link, &cache->mem.lru);
+   cache->mem.size += entry_size;
+
+   simple_mtx_unlock(&cache->mem.lock);
+}
+
+static void
+disk_cache_mem_remove(struct disk_cache *cache, const cache_key key)
+{
+   simple_mtx_lock(&cache->mem.lock);
+
+   struct hash_entry *he = _mesa_hash_table_search(cache->mem.entries, key);
+   if (he)
+      disk_cache_mem_evict_locked(cache, he->data);
+
+   simple_mtx_unlock(&cache->mem.lock);
+}
+
+static void
+disk_cache_prefetch_init(struct disk_cache *cache);
+
+static void
+disk_cache_prefetch_finish(struct disk_cache *cache);
+
 struct disk_cache *
 disk_cache_create(const char *gpu_name, const char *driver_id,
                   uint64_t driver_flags)
@@ -305,16 +488,42 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
                                                    DISK_CACHE_SINGLE_FILE);
    }
 
+   disk_cache_mem_init(cache);
+   disk_cache_prefetch_init(cache);
+
    return cache;
 }
 
 void
 disk_cache_destroy(struct disk_cache *cache)
 {
+   if (cache)
+      disk_cache_prefetch_finish(cache);
+
    if (unlikely(cache && cache->stats.enabled)) {
-      printf("disk shader cache:  hits = %u, misses = %u\n",
+      printf("disk shader cache:  hits = %u, misses = %u, "
+             "time in disk_cache_get = %.1f ms\n",
              cache->stats.hits,
-             cache->stats.misses);
+             cache->stats.misses,
+             cache->stats.get_ns / 1000000.0);
+
+      if (cache->mem.max_size) {
+         unsigned gets = cache->stats.hits + cache->stats.misses;
+         printf("disk shader cache:  memory hits = %u (%.1f%%), "
+                "memory size = %"PRIu64" / %"PRIu64" KB, evictions = %u\n",
+                cache->stats.mem_hits,
+                gets ? 100.0 * cache->stats.mem_hits / gets : 0.0,
+                cache->mem.size / 1024, cache->mem.max_size / 1024,
+                cache->stats.mem_evictions);
+      }
+
+      if (cache->prefetch.enabled) {
+         printf("disk shader cache:  prefetched %u entries in %.1f ms, "
+                "%u used from memory\n",
+                cache->stats.prefetched,
+                cache->stats.prefetch_ns / 1000000.0,
+                cache->stats.prefetch_hits);
+      }
    }
 
    if (cache && util_queue_is_initialized(&cache->cache_queue)) {
@@ -333,6 +542,14 @@ disk_cache_destroy(struct disk_cache *cache)
       disk_cache_destroy_mmap(cache);
    }
 
+   if (unlikely(cache && cache->stats.enabled))
+      disk_cache_print_compression_stats(cache);
+
+   if (cache) {
+      disk_cache_mem_finish(cache);
+      disk_cache_compression_finish(cache);
+   }
+
    ralloc_free(cache);
 }
 
@@ -340,11 +557,17 @@ void
 disk_cache_wait_for_idle(struct disk_cache *cache)
 {
    util_queue_finish(&cache->cache_queue);
+
+   /* The last entries written may have queued the dictionary training. */
+   util_queue_fence_wait(&cache->compression.train_fence);
 }
 
 void
 disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
+   if (cache->mem.max_size)
+      disk_cache_mem_remove(cache, key);
+
    if (cache->type == DISK_CACHE_DATABASE) {
       mesa_cache_db_multipart_entry_remove(&cache->cache_db, key);
       return;
@@ -483,7 +706,8 @@ blob_put_compressed(struct disk_cache *cache, const cache_key key,
    entry->uncompressed_size = size;
 
    size_t compressed_size =
-         util_compress_deflate(data, size, entry->compressed_data, max_buf);
+         disk_cache_deflate(cache, cache->compression.blob_level,
+                            data, size, entry->compressed_data, max_buf);
    if (!compressed_size)
       goto out;
 
@@ -531,8 +755,8 @@ blob_get_compressed(struct disk_cache *cache, const cache_key key,
    }
 
    unsigned compressed_size = entry_size - sizeof(*entry);
-   bool ret = util_compress_inflate(entry->compressed_data, compressed_size,
-                                    data, entry->uncompressed_size);
+   bool ret = disk_cache_inflate(cache, entry->compressed_data, compressed_size,
+                                 data, entry->uncompressed_size);
    if (!ret) {
       free(data);
       free(entry);
@@ -585,14 +809,12 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
    }
 }
 
-void *
-disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+/* Load an entry from the backend, bypassing the memory cache. */
+static void *
+disk_cache_load(struct disk_cache *cache, const cache_key key, size_t *size)
 {
    void *buf = NULL;
 
-   if (size)
-      *size = 0;
-
    if (cache->foz_ro_cache)
       buf = disk_cache_load_item_foz(cache->foz_ro_cache, key, size);
 
@@ -610,11 +832,262 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       }
    }
 
+   return buf;
+}
+
+/* Access order recording and prefetch
+ *
+ * Applications usually load the same entries in the same order on every
+ * start, each of them with a synchronous read. The keys loaded by the
+ * process are recorded per driver and application, and stored in the cache
+ * directory when the cache is destroyed. On the next start, a job on the
+ * cache queue loads the recorded entries in that order into the memory
+ * cache, until it's full.
+ */
+
+#define CACHE_PREFETCH_MAX_KEYS 16384
+
+static void
+disk_cache_prefetch_read_order(struct disk_cache *cache)
+{
+   FILE *f = fopen(cache->prefetch.path, "rb");
+   if (!f)
+      return;
+
+   cache_key key;
+   while (util_dynarray_num_elements(&cache->prefetch.previous, cache_key) <
+          CACHE_PREFETCH_MAX_KEYS &&
+          fread(key, CACHE_KEY_SIZE, 1, f) == 1) {
+      memcpy(util_dynarray_grow_bytes(&cache->prefetch.previous, 1,
+                                      CACHE_KEY_SIZE),
+             key, CACHE_KEY_SIZE);
+   }
+
+   fclose(f);
+}
+
+static bool
+disk_cache_mem_contains(struct disk_cache *cache, const cache_key key)
+{
+   simple_mtx_lock(&cache->mem.lock);
+   bool found = _mesa_hash_table_search(cache->mem.entries, key) != NULL;
+   simple_mtx_unlock(&cache->mem.lock);
+
+   return found;
+}
+
+static void
+disk_cache_prefetch_job(void *data, void *gdata, int thread_index)
+{
+   struct disk_cache *cache = data;
+   int64_t start = os_time_get_nano();
+   uint64_t loaded_size = 0;
+
+   disk_cache_prefetch_read_order(cache);
+
+   unsigned num_keys =
+      util_dynarray_num_elements(&cache->prefetch.previous, cache_key);
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      const uint8_t *key = (const uint8_t *)cache->prefetch.previous.data +
+                           i * CACHE_KEY_SIZE;
+      size_t size;
+
+      if (p_atomic_read(&cache->prefetch.cancel))
+         break;
+
+      /* Loading more than fits would evict the first prefetched entries. */
+      if (loaded_size >= cache->mem.max_size)
+         break;
+
+      if (disk_cache_mem_contains(cache, key))
+         continue;
+
+      void *buf = disk_cache_load(cache, key, &size);
+      if (!buf)
+         continue;
+
+      disk_cache_mem_put(cache, key, buf, size, true);
+      free(buf);
+
+      loaded_size += size;
+      cache->stats.prefetched++;
+   }
+
+   cache->stats.prefetch_ns = os_time_get_nano() - start;
+}
+
+static void
+disk_cache_prefetch_init(struct disk_cache *cache)
+{
+   /* Entries are read, checked and inflated like by disk_cache_get(), so
+    * prefetching is only worth it if they are kept in memory afterwards.
+    */
+   if (cache->path_init_failed || !cache->mem.max_size ||
+       !debug_get_bool_option("MESA_SHADER_CACHE_PREFETCH", false))
+      return;
+
+   /* The order is per driver, like the entries, and per application. */
+   const char *process_name = util_get_process_name();
+   struct mesa_sha1 ctx;
+   uint8_t sha1[20];
+   char sha1_str[41];
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, cache->driver_keys_blob,
+                     cache->driver_keys_blob_size);
+   if (process_name)
+      _mesa_sha1_update(&ctx, process_name, strlen(process_name));
+   _mesa_sha1_final(&ctx, sha1);
+   _mesa_sha1_format(sha1_str, sha1);
+
+   cache->prefetch.path = ralloc_asprintf(cache, "%s/access_order_%s",
+                                          cache->path, sha1_str);
+   cache->prefetch.seen = _mesa_set_create(cache, mem_entry_hash,
+                                           mem_entry_equal);
+   if (!cache->prefetch.path || !cache->prefetch.seen)
+      return;
+
+   simple_mtx_init(&cache->prefetch.lock, mtx_plain);
+   util_dynarray_init(&cache->prefetch.order, cache);
+   util_dynarray_init(&cache->prefetch.previous, cache);
+   util_queue_fence_init(&cache->prefetch.fence);
+   cache->prefetch.enabled = true;
+
+   util_queue_add_job(&cache->cache_queue, cache, &cache->prefetch.fence,
+                      disk_cache_prefetch_job, NULL, 0);
+}
+
+static void
+disk_cache_record_access(struct disk_cache *cache, const cache_key key)
+{
+   uint32_t hash = mem_entry_hash(key);
+
+   simple_mtx_lock(&cache->prefetch.lock);
+
+   if (util_dynarray_num_elements(&cache->prefetch.order, uint8_t *) <
+       CACHE_PREFETCH_MAX_KEYS &&
+       !_mesa_set_search_pre_hashed(cache->prefetch.seen, hash, key)) {
+      uint8_t *copy = ralloc_memdup(cache->prefetch.seen, key, CACHE_KEY_SIZE);
+      if (copy) {
+         _mesa_set_add_pre_hashed(cache->prefetch.seen, hash, copy);
+         util_dynarray_append(&cache->prefetch.order, uint8_t *, copy);
+      }
+   }
+
+   simple_mtx_unlock(&cache->prefetch.lock);
+}
+
+/* Store the keys in the order they were loaded by this process, followed by
+ * the keys of the previous run it didn't load, which keeps a short run from
+ * dropping them.
+ */
+static void
+disk_cache_prefetch_write_order(struct disk_cache *cache)
+{
+   unsigned num_keys = 0;
+   char *filename_tmp;
+
+   if (!util_dynarray_num_elements(&cache->prefetch.order, uint8_t *))
+      return;
+
+   if (asprintf(&filename_tmp, "%s.%d.tmp", cache->prefetch.path,
+                (int)getpid()) == -1)
+      return;
+
+   FILE *f = fopen(filename_tmp, "wb");
+   if (!f) {
+      free(filename_tmp);
+      return;
+   }
+
+   bool written = true;
+
+   util_dynarray_foreach(&cache->prefetch.order, uint8_t *, key) {
+      written &= fwrite(*key, CACHE_KEY_SIZE, 1, f) == 1;
+      num_keys++;
+   }
+
+   unsigned num_previous =
+      util_dynarray_num_elements(&cache->prefetch.previous, cache_key);
+
+   for (unsigned i = 0; i < num_previous && num_keys < CACHE_PREFETCH_MAX_KEYS; i++) {
+      const uint8_t *key = (const uint8_t *)cache->prefetch.previous.data +
+                           i * CACHE_KEY_SIZE;
+
+      if (_mesa_set_search(cache->prefetch.seen, key))
+         continue;
+
+      written &= fwrite(key, CACHE_KEY_SIZE, 1, f) == 1;
+      num_keys++;
+   }
+
+   written &= fclose(f) == 0;
+
+   /* Readers must never see a partially written file. */
+   if (!written || rename(filename_tmp, cache->prefetch.path) != 0)
+      unlink(filename_tmp);
+
+   free(filename_tmp);
+}
+
+static void
+disk_cache_prefetch_finish(struct disk_cache *cache)
+{
+   if (!cache->prefetch.enabled)
+      return;
+
+   /* Don't make the application wait for the rest of the prefetch. */
+   p_atomic_set(&cache->prefetch.cancel, true);
+   util_queue_fence_wait(&cache->prefetch.fence);
+   util_queue_fence_destroy(&cache->prefetch.fence);
+
+   disk_cache_prefetch_write_order(cache);
+
+   simple_mtx_destroy(&cache->prefetch.lock);
+}
+
+void *
+disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   void *buf = NULL;
+   size_t buf_size = 0;
+   int64_t start = 0;
+
+   if (size)
+      *size = 0;
+   else
+      size = &buf_size;
+
+   if (unlikely(cache->stats.enabled))
+      start = os_time_get_nano();
+
+   if (cache->prefetch.enabled)
+      disk_cache_record_access(cache, key);
+
+   if (cache->mem.max_size) {
+      buf = disk_cache_mem_get(cache, key, size);
+      if (buf) {
+         if (unlikely(cache->stats.enabled)) {
+            p_atomic_inc(&cache->stats.hits);
+            p_atomic_inc(&cache->stats.mem_hits);
+            p_atomic_add(&cache->stats.get_ns, os_time_get_nano() - start);
+         }
+         return buf;
+      }
+   }
+
+   buf = disk_cache_load(cache, key, size);
+
+   if (buf && cache->mem.max_size)
+      disk_cache_mem_put(cache, key, buf, *size, false);
+
    if (unlikely(cache->stats.enabled)) {
       if (buf)
          p_atomic_inc(&cache->stats.hits);
       else
          p_atomic_inc(&cache->stats.misses);
+      p_atomic_add(&cache->stats.get_ns, os_time_get_nano() - start);
    }
 
    return buf;
@@ -100,6 +100,8 @@ disk_cache_get_function_identifier(void *ptr, struct mesa_sha1 *ctx)
 
 #include "util/blob.h"
 #include "util/crc32.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
 #include "util/u_debug.h"
 #include "util/ralloc.h"
 #include "util/rand_xor.h"
@@ -540,6 +542,372 @@ disk_cache_evict_item(struct disk_cache *cache, char *filename)
       p_atomic_add(&cache->size->value, - (uint64_t)sb.st_blocks * 512);
 }
 
+/* Compression dictionary
+ *
+ * Cache entries are small and similar to each other, hence they compress
+ * much better with a dictionary. With MESA_SHADER_CACHE_DICTIONARY, the
+ * first entries written by the process are kept as samples, then a
+ * dictionary is trained from them and stored in the cache directory. The
+ * dictionary is per driver build, like the cache keys, and it's never
+ * replaced: entries are matched with it by the ID stored in the compressed
+ * data, and they become unreadable without it.
+ */
+
+#define CACHE_DICT_SIZE (64 * 1024)
+#define CACHE_DICT_NUM_SAMPLES 512
+#define CACHE_DICT_SAMPLES_SIZE (2 * 1024 * 1024)
+#define CACHE_DICT_MAX_SAMPLE_SIZE (16 * 1024)
+
+static void
+stop_dict_sampling_locked(struct disk_cache *cache)
+{
+   cache->compression.sampling = false;
+   util_dynarray_fini(&cache->compression.samples);
+   util_dynarray_fini(&cache->compression.sample_sizes);
+}
+
+static void
+load_dict_locked(struct disk_cache *cache)
+{
+   struct util_compress_dict *dict = NULL;
+   void *data = NULL;
+   struct stat sb;
+
+   if (cache->compression.dict || !cache->compression.dict_path)
+      return;
+
+   int fd = open(cache->compression.dict_path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return;
+
+   if (fstat(fd, &sb) == 0 && sb.st_size > 0 && sb.st_size <= CACHE_DICT_SIZE) {
+      data = malloc(sb.st_size);
+      if (data && read_all(fd, data, sb.st_size) != -1) {
+         dict = util_compress_dict_create(data, sb.st_size,
+                                          cache->compression.level);
+      }
+   }
+
+   free(data);
+   close(fd);
+
+   if (dict) {
+      p_atomic_set(&cache->compression.dict, dict);
+      stop_dict_sampling_locked(cache);
+   }
+}
+
+/* Store the dictionary in the cache directory. If another process stored
+ * one first, then that one is used instead, so that the entries written by
+ * the other process stay readable.
+ */
+static void
+store_dict_locked(struct disk_cache *cache, const void *data, size_t size)
+{
+   struct util_compress_dict *dict;
+   char *filename_tmp;
+   bool stored = false;
+
+   dict = util_compress_dict_create(data, size, cache->compression.level);
+   if (dict && asprintf(&filename_tmp, "%s.%d.tmp",
+                        cache->compression.dict_path, (int)getpid()) != -1) {
+      int fd = open(filename_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC,
+                    0644);
+      if (fd != -1) {
+         bool written = write_all(fd, data, size) != -1;
+         close(fd);
+
+         /* Unlike rename(), link() doesn't replace an existing file. */
+         stored = written && link(filename_tmp,
+                                  cache->compression.dict_path) == 0;
+         unlink(filename_tmp);
+      }
+      free(filename_tmp);
+   }
+
+   if (stored) {
+      p_atomic_set(&cache->compression.dict, dict);
+   } else {
+      util_compress_dict_destroy(dict);
+      load_dict_locked(cache);
+   }
+}
+
+struct dict_train_job {
+   struct disk_cache *cache;
+   struct util_dynarray samples;
+   struct util_dynarray sample_sizes;
+};
+
+static void
+train_dict(void *data, void *gdata, int thread_index)
+{
+   struct dict_train_job *job = data;
+   struct disk_cache *cache = job->cache;
+   unsigned num_samples =
+      util_dynarray_num_elements(&job->sample_sizes, size_t);
+   void *dict_data = malloc(CACHE_DICT_SIZE);
+   size_t dict_size = 0;
+
+   if (dict_data) {
+      dict_size = util_compress_dict_train(dict_data, CACHE_DICT_SIZE,
+                                           job->samples.data,
+                                           job->sample_sizes.data,
+                                           num_samples);
+   }
+
+   if (dict_size) {
+      simple_mtx_lock(&cache->compression.lock);
+      store_dict_locked(cache, dict_data, dict_size);
+      simple_mtx_unlock(&cache->compression.lock);
+   }
+
+   free(dict_data);
+}
+
+static void
+destroy_dict_train_job(void *data, void *gdata, int thread_index)
+{
+   struct dict_train_job *job = data;
+
+   util_dynarray_fini(&job->samples);
+   util_dynarray_fini(&job->sample_sizes);
+   free(job);
+}
+
+/* Hand the samples over to a job on the cache queue, so that the training
+ * doesn't run on the thread compressing the entry, which may be the
+ * application's. The training is only attempted once, even if it fails.
+ */
+static void
+queue_dict_training_locked(struct disk_cache *cache)
+{
+   struct dict_train_job *job = malloc(sizeof(*job));
+
+   if (job && util_queue_is_initialized(&cache->cache_queue)) {
+      job->cache = cache;
+      job->samples = cache->compression.samples;
+      job->sample_sizes = cache->compression.sample_sizes;
+      util_dynarray_init(&cache->compression.samples, NULL);
+      util_dynarray_init(&cache->compression.sample_sizes, NULL);
+
+      util_queue_add_job(&cache->cache_queue, job,
+                         &cache->compression.train_fence, train_dict,
+                         destroy_dict_train_job, 0);
+   } else {
+      free(job);
+   }
+
+   stop_dict_sampling_locked(cache);
+}
+
+/* Return the dictionary to compress an entry with, the entry is kept as a
+ * training sample while there is no dictionary yet.
+ */
+static const struct util_compress_dict *
+get_deflate_dict(struct disk_cache *cache, const uint8_t *data, size_t size)
+{
+   struct util_compress_dict *dict = p_atomic_read(&cache->compression.dict);
+   if (dict)
+      return dict;
+
+   simple_mtx_lock(&cache->compression.lock);
+
+   if (cache->compression.sampling) {
+      size = MIN2(size, CACHE_DICT_MAX_SAMPLE_SIZE);
+      memcpy(util_dynarray_grow_bytes(&cache->compression.samples, size, 1),
+             data, size);
+      util_dynarray_append(&cache->compression.sample_sizes, size_t, size);
+
+      if (cache->compression.samples.size >= CACHE_DICT_SAMPLES_SIZE ||
+          util_dynarray_num_elements(&cache->compression.sample_sizes,
+                                     size_t) >= CACHE_DICT_NUM_SAMPLES)
+         queue_dict_training_locked(cache);
+   }
+
+   dict = cache->compression.dict;
+
+   simple_mtx_unlock(&cache->compression.lock);
+
+   return dict;
+}
+
+/* Parse MESA_SHADER_CACHE_COMPRESSION_LEVEL, a comma separated list of
+ * levels optionally prefixed by the backend name, e.g. "database:9,1". The
+ * level without a prefix applies to the other backends, 0 selects the
+ * default level.
+ */
+static int
+parse_compression_level(const char *str, const char *backend)
+{
+   size_t backend_len = strlen(backend);
+   int level = 0;
+
+   while (str && *str) {
+      const char *colon = strchr(str, ':');
+      const char *comma = strchr(str, ',');
+
+      if (colon && (!comma || colon < comma)) {
+         if (colon - str == backend_len && !strncmp(str, backend, backend_len))
+            return strtol(colon + 1, NULL, 10);
+      } else {
+         level = strtol(str, NULL, 10);
+      }
+
+      str = comma ? comma + 1 : NULL;
+   }
+
+   return level;
+}
+
+static const char *
+cache_type_name(enum disk_cache_type type)
+{
+   switch (type) {
+   case DISK_CACHE_MULTI_FILE:
+      return "multi_file";
+   case DISK_CACHE_SINGLE_FILE:
+      return "single_file";
+   case DISK_CACHE_DATABASE:
+      return "database";
+   default:
+      return "none";
+   }
+}
+
+void
+disk_cache_compression_init(struct disk_cache *cache)
+{
+   const char *levels = getenv("MESA_SHADER_CACHE_COMPRESSION_LEVEL");
+   uint8_t sha1[20];
+   char sha1_str[41];
+
+   cache->compression.level =
+      parse_compression_level(levels, cache_type_name(cache->type));
+   cache->compression.blob_level = parse_compression_level(levels, "blob");
+
+   simple_mtx_init(&cache->compression.lock, mtx_plain);
+   util_dynarray_init(&cache->compression.samples, NULL);
+   util_dynarray_init(&cache->compression.sample_sizes, NULL);
+   util_queue_fence_init(&cache->compression.train_fence);
+
+   if (cache->path_init_failed || cache->compression_disabled)
+      return;
+
+   /* The cache directory may be shared by the drivers. */
+   _mesa_sha1_compute(cache->driver_keys_blob, cache->driver_keys_blob_size,
+                      sha1);
+   _mesa_sha1_format(sha1_str, sha1);
+   cache->compression.dict_path =
+      ralloc_asprintf(cache, "%s/zstd_dict_%s", cache->path, sha1_str);
+
+   /* An existing dictionary is loaded even if it's not used for compressing,
+    * it's needed to read the entries of the processes that use it.
+    */
+   load_dict_locked(cache);
+
+   cache->compression.use_dict =
+      debug_get_bool_option("MESA_SHADER_CACHE_DICTIONARY", false);
+   cache->compression.sampling =
+      cache->compression.use_dict && !cache->compression.dict;
+}
+
+void
+disk_cache_compression_finish(struct disk_cache *cache)
+{
+   util_compress_dict_destroy(cache->compression.dict);
+   util_dynarray_fini(&cache->compression.samples);
+   util_dynarray_fini(&cache->compression.sample_sizes);
+   util_queue_fence_destroy(&cache->compression.train_fence);
+   simple_mtx_destroy(&cache->compression.lock);
+}
+
+size_t
+disk_cache_deflate(struct disk_cache *cache, int level,
+                   const uint8_t *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_buff_size)
+{
+   const struct util_compress_dict *dict = NULL;
+   int64_t start = 0;
+
+   if (cache->compression.use_dict)
+      dict = get_deflate_dict(cache, in_data, in_data_size);
+
+   if (unlikely(cache->stats.enabled))
+      start = os_time_get_nano();
+
+   size_t compressed_size =
+      util_compress_deflate_dict(dict, level, in_data, in_data_size,
+                                 out_data, out_buff_size);
+
+   if (unlikely(cache->stats.enabled) && compressed_size) {
+      p_atomic_add(&cache->stats.deflate_in_bytes, in_data_size);
+      p_atomic_add(&cache->stats.deflate_out_bytes, compressed_size);
+      p_atomic_add(&cache->stats.deflate_ns, os_time_get_nano() - start);
+   }
+
+   return compressed_size;
+}
+
+bool
+disk_cache_inflate(struct disk_cache *cache,
+                   const uint8_t *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_data_size)
+{
+   struct util_compress_dict *dict = p_atomic_read(&cache->compression.dict);
+   int64_t start = 0;
+
+   if (unlikely(cache->stats.enabled))
+      start = os_time_get_nano();
+
+   bool ret = util_compress_inflate_dict(dict, in_data, in_data_size,
+                                         out_data, out_data_size);
+
+   /* The entry may use a dictionary that another process has stored since
+    * this one looked for it.
+    */
+   if (!ret && !dict && cache->compression.dict_path) {
+      simple_mtx_lock(&cache->compression.lock);
+      load_dict_locked(cache);
+      dict = cache->compression.dict;
+      simple_mtx_unlock(&cache->compression.lock);
+
+      if (dict) {
+         ret = util_compress_inflate_dict(dict, in_data, in_data_size,
+                                          out_data, out_data_size);
+      }
+   }
+
+   if (unlikely(cache->stats.enabled) && ret) {
+      p_atomic_add(&cache->stats.inflate_out_bytes, out_data_size);
+      p_atomic_add(&cache->stats.inflate_ns, os_time_get_nano() - start);
+   }
+
+   return ret;
+}
+
+void
+disk_cache_print_compression_stats(struct disk_cache *cache)
+{
+   uint64_t in = cache->stats.deflate_in_bytes;
+   uint64_t out = cache->stats.deflate_out_bytes;
+
+   if (!in && !cache->stats.inflate_out_bytes)
+      return;
+
+   /* Bytes per nanosecond times 1000 is MB/s. */
+   printf("disk shader cache:  compression level = %d, dictionary = %s, "
+          "ratio = %.2f (%"PRIu64" -> %"PRIu64" KB), "
+          "deflate = %.1f MB/s, inflate = %.1f MB/s\n",
+          cache->compression.level,
+          cache->compression.dict ? "yes" : "no",
+          out ? (double)in / out : 0.0, in / 1024, out / 1024,
+          cache->stats.deflate_ns ?
+             1000.0 * in / cache->stats.deflate_ns : 0.0,
+          cache->stats.inflate_ns ?
+             1000.0 * cache->stats.inflate_out_bytes / cache->stats.inflate_ns : 0.0);
+}
+
 static void *
 parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
                               size_t cache_item_size, size_t *size)
@@ -606,8 +974,8 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
       memcpy(uncompressed_data, data, cache_data_size);
    } else {
-      if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                                 cf_data->uncompressed_size))
+      if (!disk_cache_inflate(cache, data, cache_data_size, uncompressed_data,
+                              cf_data->uncompressed_size))
          goto fail;
    }
 
@@ -706,8 +1074,9 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
       if (compressed_data == NULL)
          return false;
       compressed_size =
-         util_compress_deflate(dc_job->data, dc_job->size,
-                              compressed_data, max_buf);
+         disk_cache_deflate(dc_job->cache, dc_job->cache->compression.level,
+                            dc_job->data, dc_job->size,
+                            compressed_data, max_buf);
       if (compressed_size == 0)
          goto fail;
    }
@@ -24,6 +24,9 @@
 #ifndef DISK_CACHE_OS_H
 #define DISK_CACHE_OS_H
 
+#include "util/list.h"
+#include "util/simple_mtx.h"
+#include "util/u_dynarray.h"
 #include "util/u_queue.h"
 
 #if DETECT_OS_WINDOWS
@@ -40,6 +43,8 @@
 extern "C" {
 #endif
 
+struct util_compress_dict;
+
 /* Number of bits to mask off from a cache key to get an index. */
 #define CACHE_INDEX_KEY_BITS 16
 
@@ -96,10 +101,64 @@ struct disk_cache {
    /* Don't compress cached data. This is for testing purposes only. */
    bool compression_disabled;
 
+   /* Compression policy of the backend, see
+    * MESA_SHADER_CACHE_COMPRESSION_LEVEL and MESA_SHADER_CACHE_DICTIONARY.
+    */
+   struct {
+      int level;
+      int blob_level;       /* for the blob cache callbacks */
+      bool use_dict;
+      char *dict_path;      /* NULL if the cache has no directory */
+      struct util_compress_dict *dict;
+
+      /* Entries kept for training the dictionary, protected by the lock. */
+      simple_mtx_t lock;
+      bool sampling;
+      struct util_dynarray samples;
+      struct util_dynarray sample_sizes;
+      struct util_queue_fence train_fence;  /* of the training job */
+   } compression;
+
+   /* Recently loaded entries kept uncompressed in memory, in front of the
+    * other caches, see MESA_SHADER_CACHE_MEMORY_SIZE.
+    */
+   struct {
+      simple_mtx_t lock;
+      struct hash_table *entries;
+      struct list_head lru; /* most recently used first */
+      uint64_t size;
+      uint64_t max_size;    /* 0 if disabled */
+   } mem;
+
+   /* Keys loaded by the application in order, which are prefetched in the
+    * background on its next start, see MESA_SHADER_CACHE_PREFETCH.
+    */
+   struct {
+      bool enabled;
+      char *path;                     /* the access order file */
+      simple_mtx_t lock;
+      struct set *seen;               /* keys recorded by this process */
+      struct util_dynarray order;     /* recorded keys, in order */
+      struct util_dynarray previous;  /* cache_key of the previous run */
+      struct util_queue_fence fence;  /* of the prefetch job */
+      bool cancel;
+   } prefetch;
+
    struct {
       bool enabled;
       unsigned hits;
       unsigned misses;
+      unsigned mem_hits;
+      unsigned mem_evictions;
+      uint64_t deflate_in_bytes;
+      uint64_t deflate_out_bytes;
+      uint64_t deflate_ns;
+      uint64_t inflate_out_bytes;
+      uint64_t inflate_ns;
+      uint64_t get_ns;
+      unsigned prefetched;
+      unsigned prefetch_hits;
+      uint64_t prefetch_ns;
    } stats;
 
    /* Internal RO FOZ cache for combined use of RO and RW caches. */
@@ -184,6 +243,25 @@ disk_cache_db_load_cache_index(void *mem_ctx, struct disk_cache *cache);
 void
 disk_cache_delete_old_cache(void);
 
+void
+disk_cache_compression_init(struct disk_cache *cache);
+
+void
+disk_cache_compression_finish(struct disk_cache *cache);
+
+size_t
+disk_cache_deflate(struct disk_cache *cache, int level,
+                   const uint8_t *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_buff_size);
+
+bool
+disk_cache_inflate(struct disk_cache *cache,
+                   const uint8_t *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_data_size);
+
+void
+disk_cache_print_compression_stats(struct disk_cache *cache);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,9 @@
  * IN THE SOFTWARE.
  */
 
+#ifndef FAST_UREM_BY_CONST_H
+#define FAST_UREM_BY_CONST_H
+
 #include <stdint.h>
 
 /*
@@ -74,3 +77,4 @@ util_fast_urem32(uint32_t n, uint32_t d, uint64_t magic)
    return result;
 }
 
+#endif /* FAST_UREM_BY_CONST_H */
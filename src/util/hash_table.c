@@ -35,6 +35,10 @@
 /**
  * Implements an open-addressing, linear-reprobing hash table.
  *
+ * When built with HASH_TABLE_GROUPS, the entries are probed a group at a
+ * time through a separate array of control bytes instead, see
+ * hash_table_group.h.
+ *
  * For more information, see:
  *
  * http://cgit.freedesktop.org/~anholt/hash_table/tree/README
@@ -45,6 +49,9 @@
 #include <assert.h>
 
 #include "hash_table.h"
+#ifdef HASH_TABLE_GROUPS
+#include "hash_table_group.h"
+#endif
 #include "ralloc.h"
 #include "macros.h"
 #include "u_memory.h"
@@ -127,6 +134,7 @@ key_pointer_is_reserved(const struct hash_table *ht, const void *key)
    return key == NULL || key == ht->deleted_key;
 }
 
+#ifndef HASH_TABLE_GROUPS
 static int
 entry_is_free(const struct hash_entry *entry)
 {
@@ -138,6 +146,7 @@ entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
 {
    return entry->key == ht->deleted_key;
 }
+#endif
 
 static int
 entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
@@ -145,6 +154,28 @@ entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
    return entry->key != NULL && entry->key != ht->deleted_key;
 }
 
+#ifdef HASH_TABLE_GROUPS
+/**
+ * Allocates the entries of a table of the given size, followed by their
+ * control bytes.
+ */
+static struct hash_entry *
+hash_table_alloc(void *mem_ctx, uint32_t size, uint8_t **ctrl)
+{
+   struct hash_entry *table =
+      ralloc_size(mem_ctx, size * sizeof(struct hash_entry) +
+                           hash_ctrl_size(size));
+   if (table == NULL)
+      return NULL;
+
+   memset(table, 0, size * sizeof(struct hash_entry));
+   *ctrl = (uint8_t *)(table + size);
+   hash_ctrl_reset(*ctrl, size);
+
+   return table;
+}
+#endif
+
 bool
 _mesa_hash_table_init(struct hash_table *ht,
                       void *mem_ctx,
@@ -160,7 +191,11 @@ _mesa_hash_table_init(struct hash_table *ht,
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
+#ifdef HASH_TABLE_GROUPS
+   ht->table = hash_table_alloc(mem_ctx, ht->size, &ht->ctrl);
+#else
    ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
+#endif
    ht->entries = 0;
    ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
@@ -222,13 +257,22 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+#ifdef HASH_TABLE_GROUPS
+   const size_t table_size = ht->size * sizeof(struct hash_entry) +
+                             hash_ctrl_size(ht->size);
+#else
+   const size_t table_size = ht->size * sizeof(struct hash_entry);
+#endif
+   ht->table = ralloc_size(ht, table_size);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, table_size);
+#ifdef HASH_TABLE_GROUPS
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
+#endif
 
    return ht;
 }
@@ -258,6 +302,9 @@ static void
 hash_table_clear_fast(struct hash_table *ht)
 {
    memset(ht->table, 0, sizeof(struct hash_entry) * hash_sizes[ht->size_index].size);
+#ifdef HASH_TABLE_GROUPS
+   hash_ctrl_reset(ht->ctrl, ht->size);
+#endif
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -283,6 +330,9 @@ _mesa_hash_table_clear(struct hash_table *ht,
 
          entry->key = NULL;
       }
+#ifdef HASH_TABLE_GROUPS
+      hash_ctrl_reset(ht->ctrl, ht->size);
+#endif
       ht->entries = 0;
       ht->deleted_entries = 0;
    } else
@@ -305,6 +355,38 @@ _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
    ht->deleted_key = deleted_key;
 }
 
+#ifdef HASH_TABLE_GROUPS
+static struct hash_entry *
+hash_table_search(const struct hash_table *ht, uint32_t hash, const void *key)
+{
+   assert(!key_pointer_is_reserved(ht, key));
+
+   const uint32_t size = ht->size;
+   const uint8_t tag = hash_ctrl_tag(hash);
+   uint32_t group = hash_ctrl_start(hash, size, ht->size_magic);
+
+   for (uint32_t i = 0; i < size; i += HASH_GROUP_WIDTH) {
+      const uint8_t *ctrl = ht->ctrl + group;
+
+      for (hash_group_mask match = hash_group_match(ctrl, tag); match;
+           match &= match - 1) {
+         struct hash_entry *entry =
+            ht->table + hash_ctrl_wrap(group + hash_group_first(match), size);
+
+         if (entry->hash == hash && entry_is_present(ht, entry) &&
+             ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      if (hash_group_match_empty(ctrl))
+         return NULL;
+
+      group = hash_ctrl_wrap(group + HASH_GROUP_WIDTH, size);
+   }
+
+   return NULL;
+}
+#else
 static struct hash_entry *
 hash_table_search(const struct hash_table *ht, uint32_t hash, const void *key)
 {
@@ -334,6 +416,7 @@ hash_table_search(const struct hash_table *ht, uint32_t hash, const void *key)
 
    return NULL;
 }
+#endif
 
 /**
  * Finds a hash table entry with the given key and hash of that key.
@@ -360,6 +443,23 @@ static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
                   const void *key, void *data);
 
+#ifdef HASH_TABLE_GROUPS
+static void
+hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
+                         const void *key, void *data)
+{
+   const uint32_t size = ht->size;
+   const uint32_t index =
+      hash_ctrl_find_empty(ht->ctrl, size,
+                           hash_ctrl_start(hash, size, ht->size_magic));
+   struct hash_entry *entry = ht->table + index;
+
+   hash_ctrl_set(ht->ctrl, size, index, hash_ctrl_tag(hash));
+   entry->hash = hash;
+   entry->key = key;
+   entry->data = data;
+}
+#else
 static void
 hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
                          const void *key, void *data)
@@ -384,6 +484,7 @@ hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
          hash_address -= size;
    } while (true);
 }
+#endif
 
 static void
 _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
@@ -400,14 +501,23 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
+#ifdef HASH_TABLE_GROUPS
+   uint8_t *ctrl;
+   table = hash_table_alloc(ralloc_parent(ht->table),
+                            hash_sizes[new_size_index].size, &ctrl);
+#else
    table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
                          hash_sizes[new_size_index].size);
+#endif
    if (table == NULL)
       return;
 
    old_ht = *ht;
 
    ht->table = table;
+#ifdef HASH_TABLE_GROUPS
+   ht->ctrl = ctrl;
+#endif
    ht->size_index = new_size_index;
    ht->size = hash_sizes[ht->size_index].size;
    ht->rehash = hash_sizes[ht->size_index].rehash;
@@ -426,6 +536,95 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    ralloc_free(old_ht.table);
 }
 
+#ifdef HASH_TABLE_GROUPS
+/* Claims the available entry at index for a new key with the given hash. */
+static struct hash_entry *
+hash_table_use_entry(struct hash_table *ht, uint32_t index, uint32_t hash,
+                     uint8_t tag)
+{
+   struct hash_entry *entry = ht->table + index;
+
+   if (ht->ctrl[index] == HASH_CTRL_DELETED)
+      ht->deleted_entries--;
+   hash_ctrl_set(ht->ctrl, ht->size, index, tag);
+   entry->hash = hash;
+   ht->entries++;
+   return entry;
+}
+
+static struct hash_entry *
+hash_table_get_entry(struct hash_table *ht, uint32_t hash, const void *key)
+{
+   struct hash_entry *available_entry = NULL;
+
+   assert(!key_pointer_is_reserved(ht, key));
+
+   if (ht->entries >= ht->max_entries) {
+      _mesa_hash_table_rehash(ht, ht->size_index + 1);
+   } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
+      _mesa_hash_table_rehash(ht, ht->size_index);
+   }
+
+   const uint32_t size = ht->size;
+   const uint8_t tag = hash_ctrl_tag(hash);
+   uint32_t group = hash_ctrl_start(hash, size, ht->size_magic);
+
+   /* A key with this hash would have been put at the start of its probe
+    * sequence if that entry was empty then, and it still is.  Checking that
+    * byte alone also avoids reloading a group of control bytes which the
+    * previous insertion may have just written to.
+    */
+   if (ht->ctrl[group] == HASH_CTRL_EMPTY)
+      return hash_table_use_entry(ht, group, hash, tag);
+
+   for (uint32_t i = 0; i < size; i += HASH_GROUP_WIDTH) {
+      const uint8_t *ctrl = ht->ctrl + group;
+
+      /* Implement replacement when another insert happens
+       * with a matching key.  This is a relatively common
+       * feature of hash tables, with the alternative
+       * generally being "insert the new value as well, and
+       * return it first when the key is searched for".
+       *
+       * Note that the hash table doesn't have a delete
+       * callback.  If freeing of old data pointers is
+       * required to avoid memory leaks, perform a search
+       * before inserting.
+       */
+      for (hash_group_mask match = hash_group_match(ctrl, tag); match;
+           match &= match - 1) {
+         struct hash_entry *entry =
+            ht->table + hash_ctrl_wrap(group + hash_group_first(match), size);
+
+         if (entry->hash == hash && entry_is_present(ht, entry) &&
+             ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         hash_group_mask available = hash_group_match_available(ctrl);
+         if (available) {
+            available_entry = ht->table +
+               hash_ctrl_wrap(group + hash_group_first(available), size);
+         }
+      }
+
+      if (hash_group_match_empty(ctrl))
+         break;
+
+      group = hash_ctrl_wrap(group + HASH_GROUP_WIDTH, size);
+   }
+
+   if (available_entry)
+      return hash_table_use_entry(ht, available_entry - ht->table, hash, tag);
+
+   /* We could hit here if a required resize failed. An unchecked-malloc
+    * application could ignore this result.
+    */
+   return NULL;
+}
+#else
 static struct hash_entry *
 hash_table_get_entry(struct hash_table *ht, uint32_t hash, const void *key)
 {
@@ -489,6 +688,7 @@ hash_table_get_entry(struct hash_table *ht, uint32_t hash, const void *key)
     */
    return NULL;
 }
+#endif
 
 static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
@@ -539,6 +739,9 @@ _mesa_hash_table_remove(struct hash_table *ht,
       return;
 
    entry->key = ht->deleted_key;
+#ifdef HASH_TABLE_GROUPS
+   hash_ctrl_set(ht->ctrl, ht->size, entry - ht->table, HASH_CTRL_DELETED);
+#endif
    ht->entries--;
    ht->deleted_entries++;
 }
@@ -552,6 +755,24 @@ void _mesa_hash_table_remove_key(struct hash_table *ht,
    _mesa_hash_table_remove(ht, _mesa_hash_table_search(ht, key));
 }
 
+#ifdef HASH_TABLE_GROUPS
+/**
+ * Empties an entry without leaving a deleted entry behind, for
+ * hash_table_foreach_remove.  This breaks the probing of the entries which
+ * are left, so it can only be used to remove all of them.
+ */
+void
+_mesa_hash_table_clear_entry_unsafe(struct hash_table *ht,
+                                    struct hash_entry *entry)
+{
+   entry->hash = 0;
+   entry->key = NULL;
+   entry->data = NULL;
+   hash_ctrl_set(ht->ctrl, ht->size, entry - ht->table, HASH_CTRL_EMPTY);
+   ht->entries--;
+}
+#endif
+
 /**
  * This function is an iterator over the hash_table when no deleted entries are present.
  *
@@ -579,6 +800,21 @@ _mesa_hash_table_next_entry_unsafe(const struct hash_table *ht, struct hash_entr
  * Pass in NULL for the first entry, as in the start of a for loop.  Note that
  * an iteration over the table is O(table_size) not O(entries).
  */
+#ifdef HASH_TABLE_GROUPS
+struct hash_entry *
+_mesa_hash_table_next_entry(struct hash_table *ht,
+                            struct hash_entry *entry)
+{
+   uint32_t index = entry ? entry - ht->table + 1 : 0;
+
+   index = hash_ctrl_next_full(ht->ctrl, ht->size, index);
+   if (index == ht->size)
+      return NULL;
+
+   assert(entry_is_present(ht, ht->table + index));
+   return ht->table + index;
+}
+#else
 struct hash_entry *
 _mesa_hash_table_next_entry(struct hash_table *ht,
                             struct hash_entry *entry)
@@ -596,6 +832,7 @@ _mesa_hash_table_next_entry(struct hash_table *ht,
 
    return NULL;
 }
+#endif
 
 /**
  * Returns a random entry from the hash table.
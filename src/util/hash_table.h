@@ -45,6 +45,9 @@ struct hash_entry {
 
 struct hash_table {
    struct hash_entry *table;
+#ifdef HASH_TABLE_GROUPS
+   uint8_t *ctrl;
+#endif
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    const void *deleted_key;
@@ -107,6 +110,10 @@ struct hash_entry *_mesa_hash_table_next_entry(struct hash_table *ht,
                                                struct hash_entry *entry);
 struct hash_entry *_mesa_hash_table_next_entry_unsafe(const struct hash_table *ht,
                                                struct hash_entry *entry);
+#ifdef HASH_TABLE_GROUPS
+void _mesa_hash_table_clear_entry_unsafe(struct hash_table *ht,
+                                         struct hash_entry *entry);
+#endif
 struct hash_entry *
 _mesa_hash_table_random_entry(struct hash_table *ht,
                               bool (*predicate)(struct hash_entry *entry));
@@ -152,11 +159,19 @@ _mesa_hash_table_reserve(struct hash_table *ht, unsigned size);
  * This foreach function destroys the table as it iterates.
  * It is not safe to use when inserting or removing entries.
  */
+#ifdef HASH_TABLE_GROUPS
+#define hash_table_foreach_remove(ht, entry)                                      \
+   for (struct hash_entry *entry = _mesa_hash_table_next_entry_unsafe(ht, NULL);  \
+        (ht)->entries;                                                     \
+        _mesa_hash_table_clear_entry_unsafe(ht, entry),                    \
+        entry = _mesa_hash_table_next_entry_unsafe(ht, entry))
+#else
 #define hash_table_foreach_remove(ht, entry)                                      \
    for (struct hash_entry *entry = _mesa_hash_table_next_entry_unsafe(ht, NULL);  \
         (ht)->entries;                                                     \
         entry->hash = 0, entry->key = (void*)NULL, entry->data = NULL,      \
         (ht)->entries--, entry = _mesa_hash_table_next_entry_unsafe(ht, entry))
+#endif
 
 static inline void
 hash_table_call_foreach(struct hash_table *ht,
@@ -0,0 +1,235 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Control bytes shared by the hash_table and set implementations.
+ *
+ * Next to its array of entries, a table keeps one control byte per entry:
+ * HASH_CTRL_EMPTY for entries which were never used, HASH_CTRL_DELETED for
+ * removed ones and 7 bits of the hash of the key for the others.  Probing
+ * looks at a group of HASH_GROUP_WIDTH consecutive control bytes at once,
+ * with SSE2 or NEON when available, so most lookups compare a single key.
+ *
+ * The first HASH_GROUP_WIDTH - 1 control bytes are repeated after the last
+ * one, so that the groups starting near the end of the table wrap around
+ * without special cases.
+ */
+
+#ifndef _HASH_TABLE_GROUP_H
+#define _HASH_TABLE_GROUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitscan.h"
+#include "fast_urem_by_const.h"
+#include "macros.h"
+#include "u_math.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HASH_GROUP_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define HASH_GROUP_NEON 1
+#endif
+
+#define HASH_CTRL_EMPTY   0x80
+#define HASH_CTRL_DELETED 0xfe
+
+/* A mask of the control bytes of a group matching some condition.  With
+ * SSE2, bit i is set if byte i matches.  Otherwise bit 8 * i + 7 is set
+ * for the matching bytes of a 64-bit word.
+ */
+typedef uint64_t hash_group_mask;
+
+#ifdef HASH_GROUP_SSE2
+
+#define HASH_GROUP_WIDTH 16
+#define HASH_GROUP_SHIFT 0
+
+static inline hash_group_mask
+hash_group_match(const uint8_t *ctrl, uint8_t tag)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+}
+
+static inline hash_group_mask
+hash_group_match_empty(const uint8_t *ctrl)
+{
+   return hash_group_match(ctrl, HASH_CTRL_EMPTY);
+}
+
+/* Empty or deleted control bytes. */
+static inline hash_group_mask
+hash_group_match_available(const uint8_t *ctrl)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(group);
+}
+
+static inline hash_group_mask
+hash_group_match_full(const uint8_t *ctrl)
+{
+   return hash_group_match_available(ctrl) ^ 0xffff;
+}
+
+#else /* !HASH_GROUP_SSE2 */
+
+#define HASH_GROUP_WIDTH 8
+#define HASH_GROUP_SHIFT 3
+
+#define HASH_GROUP_LSB 0x0101010101010101ull
+#define HASH_GROUP_MSB 0x8080808080808080ull
+
+static inline uint64_t
+hash_group_load(const uint8_t *ctrl)
+{
+   uint64_t group;
+   memcpy(&group, ctrl, sizeof(group));
+   return util_le64_to_cpu(group);
+}
+
+static inline hash_group_mask
+hash_group_match(const uint8_t *ctrl, uint8_t tag)
+{
+#ifdef HASH_GROUP_NEON
+   uint8x8_t eq = vceq_u8(vld1_u8(ctrl), vdup_n_u8(tag));
+   return vget_lane_u64(vreinterpret_u64_u8(eq), 0) & HASH_GROUP_MSB;
+#else
+   /* This may report bytes after a matching one as matching too, which is
+    * fine as the entries are compared anyway.
+    */
+   uint64_t x = hash_group_load(ctrl) ^ (HASH_GROUP_LSB * tag);
+   return (x - HASH_GROUP_LSB) & ~x & HASH_GROUP_MSB;
+#endif
+}
+
+static inline hash_group_mask
+hash_group_match_empty(const uint8_t *ctrl)
+{
+   /* Only HASH_CTRL_EMPTY has the top bit set and bit 1 clear. */
+   uint64_t group = hash_group_load(ctrl);
+   return group & ~(group << 6) & HASH_GROUP_MSB;
+}
+
+/* Empty or deleted control bytes. */
+static inline hash_group_mask
+hash_group_match_available(const uint8_t *ctrl)
+{
+   return hash_group_load(ctrl) & HASH_GROUP_MSB;
+}
+
+static inline hash_group_mask
+hash_group_match_full(const uint8_t *ctrl)
+{
+   return ~hash_group_load(ctrl) & HASH_GROUP_MSB;
+}
+
+#endif /* HASH_GROUP_SSE2 */
+
+/** Index in the group of the first byte of a non-zero mask. */
+static inline unsigned
+hash_group_first(hash_group_mask mask)
+{
+   return (ffsll(mask) - 1) >> HASH_GROUP_SHIFT;
+}
+
+/** The control byte of a hash: 7 bits, mixed so pointer hashes differ. */
+static inline uint8_t
+hash_ctrl_tag(uint32_t hash)
+{
+   return (hash * 0x9e3779b1u) >> 25;
+}
+
+/**
+ * First entry of the probe sequence of a hash.  Probing is linear, so the
+ * hash is mixed first: nearby hashes, like those of consecutive pointers,
+ * would otherwise fill a single run that every failed lookup has to walk.
+ */
+static inline uint32_t
+hash_ctrl_start(uint32_t hash, uint32_t size, uint64_t size_magic)
+{
+   return util_fast_urem32(hash * 0x85ebca6bu, size, size_magic);
+}
+
+/** Number of control bytes to allocate for \p size entries. */
+static inline size_t
+hash_ctrl_size(uint32_t size)
+{
+   return size + HASH_GROUP_WIDTH - 1;
+}
+
+static inline void
+hash_ctrl_reset(uint8_t *ctrl, uint32_t size)
+{
+   memset(ctrl, HASH_CTRL_EMPTY, hash_ctrl_size(size));
+}
+
+static inline void
+hash_ctrl_set(uint8_t *ctrl, uint32_t size, uint32_t index, uint8_t value)
+{
+   ctrl[index] = value;
+
+   /* Tables smaller than a group are repeated several times. */
+   for (uint32_t i = index + size; i < hash_ctrl_size(size); i += size)
+      ctrl[i] = value;
+}
+
+/** Wrap an index which went past the end of the table. */
+static inline uint32_t
+hash_ctrl_wrap(uint32_t index, uint32_t size)
+{
+   while (index >= size)
+      index -= size;
+   return index;
+}
+
+/**
+ * Index of the first empty entry of the probe sequence starting at \p index,
+ * for tables without deleted entries.  There must be one.
+ */
+static inline uint32_t
+hash_ctrl_find_empty(const uint8_t *ctrl, uint32_t size, uint32_t index)
+{
+   /* Check the first byte alone, as it is usually empty while filling a new
+    * table and a group load right after storing into it is slow.
+    */
+   if (ctrl[index] == HASH_CTRL_EMPTY)
+      return index;
+
+   while (true) {
+      hash_group_mask empty = hash_group_match_empty(ctrl + index);
+      if (likely(empty))
+         return hash_ctrl_wrap(index + hash_group_first(empty), size);
+
+      index = hash_ctrl_wrap(index + HASH_GROUP_WIDTH, size);
+   }
+}
+
+/**
+ * Index of the first used entry at or after \p index, or \p size if there
+ * are none.
+ */
+static inline uint32_t
+hash_ctrl_next_full(const uint8_t *ctrl, uint32_t size, uint32_t index)
+{
+   /* Most tables are dense.  Checking the byte itself first lets the CPU
+    * predict the next entry instead of waiting for the group mask.
+    */
+   if (index < size && !(ctrl[index] & HASH_CTRL_EMPTY))
+      return index;
+
+   for (; index < size; index += HASH_GROUP_WIDTH) {
+      hash_group_mask full = hash_group_match_full(ctrl + index);
+      if (full)
+         return MIN2(index + hash_group_first(full), size);
+   }
+
+   return size;
+}
+
+#endif /* _HASH_TABLE_GROUP_H */
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "crc32.h"
@@ -56,6 +57,7 @@ struct mesa_index_db_hash_entry {
    uint64_t last_access_time;
    uint32_t size;
    bool evicted;
+   bool dirty;
 };
 
 static inline bool mesa_db_seek_end(FILE *file)
@@ -90,12 +92,20 @@ static inline bool mesa_db_truncate(FILE *file, long pos)
    return !ftruncate(fileno(file), pos);
 }
 
+static inline bool mesa_db_pread(int fd, void *data, size_t size, off_t pos)
+{
+   return pread(fd, data, size, pos) == (ssize_t)size;
+}
+
 static bool
 mesa_db_reopen_file(struct mesa_cache_db_file *db_file);
 
 static void
 mesa_db_close_file(struct mesa_cache_db_file *db_file);
 
+static void
+mesa_db_flush_access_times(struct mesa_cache_db *db);
+
 static int
 mesa_db_flock(FILE *file, int op)
 {
@@ -108,6 +118,27 @@ mesa_db_flock(FILE *file, int op)
    return ret;
 }
 
+/* The file may have been deleted and recreated by another process, make
+ * sure that the lockless reads use the same file as the locked operations.
+ */
+static void
+mesa_db_sync_read_fd(struct mesa_cache_db_file *db_file)
+{
+   struct stat locked_stat, read_stat;
+
+   if (db_file->read_fd < 0)
+      return;
+
+   if (!fstat(fileno(db_file->file), &locked_stat) &&
+       !fstat(db_file->read_fd, &read_stat) &&
+       locked_stat.st_dev == read_stat.st_dev &&
+       locked_stat.st_ino == read_stat.st_ino)
+      return;
+
+   close(db_file->read_fd);
+   db_file->read_fd = open(db_file->path, O_CLOEXEC | O_RDONLY);
+}
+
 static bool
 mesa_db_lock(struct mesa_cache_db *db)
 {
@@ -123,6 +154,11 @@ mesa_db_lock(struct mesa_cache_db *db)
    if (mesa_db_flock(db->index.file, LOCK_EX) < 0)
       goto unlock_cache;
 
+   mesa_db_sync_read_fd(&db->cache);
+   mesa_db_sync_read_fd(&db->index);
+
+   mesa_db_flush_access_times(db);
+
    return true;
 
 unlock_cache:
@@ -275,55 +311,72 @@ mesa_db_cache_entry_valid(struct mesa_cache_db_file_entry *entry)
    return entry->size && entry->crc;
 }
 
+/* Add the entries read at the current index file offset to the index hash
+ * table. Returns false if some of them are invalid.
+ */
 static bool
-mesa_db_update_index(struct mesa_cache_db *db)
+mesa_db_add_index_entries(struct mesa_cache_db *db,
+                          struct mesa_index_db_file_entry *index_entries,
+                          size_t new_entries)
 {
    struct mesa_index_db_hash_entry *hash_entry;
-   struct mesa_index_db_file_entry *index_entries, *index_entry;
-   size_t file_length;
-   size_t old_entries, new_entries;
-   size_t new_index_size;
-   bool ret = false;
+   struct mesa_index_db_file_entry *index_entry;
+   size_t old_entries;
    int i;
 
-   if (!mesa_db_seek_end(db->index.file))
-      return false;
-
-   file_length = ftell(db->index.file);
-   if (file_length < db->index.offset)
-      return false;
-
-   if (!mesa_db_seek(db->index.file, db->index.offset))
-      return false;
-
    old_entries = _mesa_hash_table_num_entries(db->index_db->table);
-   new_entries = (file_length - db->index.offset) / sizeof(*index_entries);
    _mesa_hash_table_reserve(db->index_db->table, old_entries + new_entries);
 
-   new_index_size = new_entries * sizeof(*index_entries);
-   index_entries = malloc(new_index_size);
-   if (!mesa_db_read_data(db->index.file, index_entries, new_index_size))
-      goto error;
-
    for (i = 0, index_entry = index_entries; i < new_entries; i++, index_entry++) {
       /* Check whether the index entry looks valid or we have a corrupted DB */
       if (!mesa_db_index_entry_valid(index_entry))
-         break;
+         return false;
 
       hash_entry = ralloc(db->mem_ctx, struct mesa_index_db_hash_entry);
       if (!hash_entry)
-         break;
+         return false;
 
       hash_entry->cache_db_file_offset = index_entry->cache_db_file_offset;
       hash_entry->index_db_file_offset = db->index.offset;
       hash_entry->last_access_time = index_entry->last_access_time;
       hash_entry->size = index_entry->size;
+      hash_entry->dirty = false;
 
       _mesa_hash_table_u64_insert(db->index_db, index_entry->hash, hash_entry);
 
       db->index.offset += sizeof(*index_entry);
    }
 
+   return true;
+}
+
+static bool
+mesa_db_update_index(struct mesa_cache_db *db)
+{
+   struct mesa_index_db_file_entry *index_entries;
+   size_t file_length;
+   size_t new_entries;
+   size_t new_index_size;
+   bool ret = false;
+
+   if (!mesa_db_seek_end(db->index.file))
+      return false;
+
+   file_length = ftell(db->index.file);
+   if (file_length < db->index.offset)
+      return false;
+
+   if (!mesa_db_seek(db->index.file, db->index.offset))
+      return false;
+
+   new_entries = (file_length - db->index.offset) / sizeof(*index_entries);
+   new_index_size = new_entries * sizeof(*index_entries);
+   index_entries = malloc(new_index_size);
+   if (!mesa_db_read_data(db->index.file, index_entries, new_index_size))
+      goto error;
+
+   mesa_db_add_index_entries(db, index_entries, new_entries);
+
    if (mesa_db_seek(db->index.file, db->index.offset) &&
        db->index.offset == file_length)
       ret = true;
@@ -333,9 +386,86 @@ error:
    return ret;
 }
 
+/* Same as mesa_db_update_index() for the lockless reads. Another process may
+ * be appending an entry to the index file, hence the incomplete entry at the
+ * end of the file is skipped.
+ */
+static bool
+mesa_db_update_index_lockless(struct mesa_cache_db *db)
+{
+   struct mesa_index_db_file_entry *index_entries;
+   size_t new_entries, new_index_size;
+   struct stat index_stat;
+   bool ret;
+
+   if (fstat(db->index.read_fd, &index_stat) < 0 ||
+       index_stat.st_size < db->index.offset)
+      return false;
+
+   new_entries = (index_stat.st_size - db->index.offset) / sizeof(*index_entries);
+   if (!new_entries)
+      return true;
+
+   new_index_size = new_entries * sizeof(*index_entries);
+   index_entries = malloc(new_index_size);
+   if (!index_entries)
+      return false;
+
+   ret = mesa_db_pread(db->index.read_fd, index_entries, new_index_size,
+                       db->index.offset) &&
+         mesa_db_add_index_entries(db, index_entries, new_entries);
+
+   free(index_entries);
+   return ret;
+}
+
+/* Write the last access times updated by the lockless reads to the index
+ * file. Called with the files locked. The times are dropped if another
+ * process has changed the database meanwhile, the file offsets of the
+ * entries are stale then.
+ */
+static void
+mesa_db_flush_access_times(struct mesa_cache_db *db)
+{
+   struct mesa_index_db_file_entry index_entry;
+
+   if (!util_dynarray_num_elements(&db->dirty_entries,
+                                   struct mesa_index_db_hash_entry *))
+      return;
+
+   if (db->alive && !mesa_db_uuid_changed(db)) {
+      util_dynarray_foreach(&db->dirty_entries,
+                            struct mesa_index_db_hash_entry *, entry) {
+         struct mesa_index_db_hash_entry *hash_entry = *entry;
+
+         if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
+             !mesa_db_read(db->index.file, &index_entry) ||
+             !mesa_db_index_entry_valid(&index_entry) ||
+             index_entry.cache_db_file_offset != hash_entry->cache_db_file_offset ||
+             index_entry.size != hash_entry->size)
+            break;
+
+         index_entry.last_access_time = hash_entry->last_access_time;
+
+         if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
+             !mesa_db_write(db->index.file, &index_entry))
+            break;
+      }
+
+      fflush(db->index.file);
+   }
+
+   util_dynarray_foreach(&db->dirty_entries,
+                         struct mesa_index_db_hash_entry *, entry)
+      (*entry)->dirty = false;
+
+   util_dynarray_clear(&db->dirty_entries);
+}
+
 static void
 mesa_db_hash_table_reset(struct mesa_cache_db *db)
 {
+   util_dynarray_clear(&db->dirty_entries);
    _mesa_hash_table_u64_clear(db->index_db);
    ralloc_free(db->mem_ctx);
    db->mem_ctx = ralloc_context(NULL);
@@ -443,9 +573,17 @@ mesa_db_open_file(struct mesa_cache_db_file *db_file,
       return false;
    }
 
+   db_file->read_fd = -1;
+
    return true;
 }
 
+static void
+mesa_db_open_read_fd(struct mesa_cache_db_file *db_file)
+{
+   db_file->read_fd = open(db_file->path, O_CLOEXEC | O_RDONLY);
+}
+
 static bool
 mesa_db_reopen_file(struct mesa_cache_db_file *db_file)
 {
@@ -474,6 +612,9 @@ mesa_db_free_file(struct mesa_cache_db_file *db_file)
    if (db_file->file)
       fclose(db_file->file);
 
+   if (db_file->read_fd >= 0)
+      close(db_file->read_fd);
+
    free(db_file->path);
 }
 
@@ -691,6 +832,13 @@ mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
    if (!mesa_db_open_file(&db->index, cache_path, "mesa_cache.idx"))
       goto close_cache;
 
+   if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE_LOCKLESS_READS", true)) {
+      mesa_db_open_read_fd(&db->cache);
+      mesa_db_open_read_fd(&db->index);
+   }
+
+   util_dynarray_init(&db->dirty_entries, NULL);
+
    db->mem_ctx = ralloc_context(NULL);
    if (!db->mem_ctx)
       goto close_index;
@@ -713,6 +861,8 @@ destroy_mtx:
 
    ralloc_free(db->mem_ctx);
 close_index:
+   util_dynarray_fini(&db->dirty_entries);
+
    mesa_db_free_file(&db->index);
 close_cache:
    mesa_db_free_file(&db->cache);
@@ -739,6 +889,13 @@ mesa_db_wipe_path(const char *cache_path)
 void
 mesa_cache_db_close(struct mesa_cache_db *db)
 {
+   /* Locking writes the access times of the lockless reads. */
+   if (util_dynarray_num_elements(&db->dirty_entries,
+                                  struct mesa_index_db_hash_entry *) &&
+       mesa_db_lock(db))
+      mesa_db_unlock(db);
+
+   util_dynarray_fini(&db->dirty_entries);
    _mesa_hash_table_u64_destroy(db->index_db);
    simple_mtx_destroy(&db->flock_mtx);
    ralloc_free(db->mem_ctx);
@@ -760,6 +917,79 @@ mesa_cache_db_file_entry_size(void)
    return sizeof(struct mesa_cache_db_file_entry);
 }
 
+static bool
+mesa_db_header_uuid_matches(int fd, uint64_t uuid)
+{
+   struct mesa_db_file_header header;
+
+   return mesa_db_pread(fd, &header, sizeof(header), 0) &&
+          header.uuid == uuid;
+}
+
+/* Read an entry without locking the database files.
+ *
+ * Writers only append to the files, and the compaction sets a zero UUID in
+ * the cache file header before it moves any data. Hence the entry is intact
+ * if the header UUID didn't change while it was read, and its CRC matches.
+ * The last access time is only updated in memory, it's written to the index
+ * file the next time the files are locked.
+ *
+ * Returns false if the entry has to be read with the files locked, e.g.
+ * because another process has compacted or recreated the database.
+ */
+static bool
+mesa_db_read_entry_lockless(struct mesa_cache_db *db,
+                            const uint8_t *cache_key_160bit,
+                            void **data, size_t *size)
+{
+   uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
+   struct mesa_cache_db_file_entry *cache_entry;
+   struct mesa_index_db_hash_entry *hash_entry;
+   uint32_t entry_size;
+   bool valid;
+
+   if (!mesa_db_header_uuid_matches(db->cache.read_fd, db->uuid) ||
+       !mesa_db_update_index_lockless(db))
+      return false;
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (!hash_entry)
+      return true;
+
+   entry_size = blob_file_size(hash_entry->size);
+   cache_entry = malloc(entry_size);
+   if (!cache_entry)
+      return true;
+
+   valid = mesa_db_pread(db->cache.read_fd, cache_entry, entry_size,
+                         hash_entry->cache_db_file_offset) &&
+           mesa_db_cache_entry_valid(cache_entry) &&
+           cache_entry->size == hash_entry->size &&
+           util_hash_crc32(cache_entry + 1, cache_entry->size) == cache_entry->crc;
+
+   if (!valid || !mesa_db_header_uuid_matches(db->cache.read_fd, db->uuid)) {
+      free(cache_entry);
+      return false;
+   }
+
+   if (memcmp(cache_entry->key, cache_key_160bit, sizeof(cache_entry->key))) {
+      free(cache_entry);
+      return true;
+   }
+
+   hash_entry->last_access_time = os_time_get_nano();
+   if (!hash_entry->dirty) {
+      hash_entry->dirty = true;
+      util_dynarray_append(&db->dirty_entries,
+                           struct mesa_index_db_hash_entry *, hash_entry);
+   }
+
+   *size = hash_entry->size;
+   *data = memmove(cache_entry, cache_entry + 1, *size);
+
+   return true;
+}
+
 void *
 mesa_cache_db_read_entry(struct mesa_cache_db *db,
                          const uint8_t *cache_key_160bit,
@@ -770,6 +1000,15 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    struct mesa_index_db_file_entry index_entry;
    struct mesa_index_db_hash_entry *hash_entry;
    void *data = NULL;
+   bool done = false;
+
+   simple_mtx_lock(&db->flock_mtx);
+   if (db->alive && db->cache.read_fd >= 0 && db->index.read_fd >= 0)
+      done = mesa_db_read_entry_lockless(db, cache_key_160bit, &data, size);
+   simple_mtx_unlock(&db->flock_mtx);
+
+   if (done)
+      return data;
 
    if (!mesa_db_lock(db))
       return NULL;
@@ -906,6 +1145,7 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    hash_entry->index_db_file_offset = ftell(db->index.file);
    hash_entry->last_access_time = index_entry.last_access_time;
    hash_entry->size = index_entry.size;
+   hash_entry->dirty = false;
 
    if (!mesa_db_write(db->cache.file, &cache_entry) ||
        !mesa_db_write_data(db->cache.file, blob, blob_size) ||
@@ -16,6 +16,7 @@
 
 #include "detect_os.h"
 #include "simple_mtx.h"
+#include "u_dynarray.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,6 +27,10 @@ struct mesa_cache_db_file {
    char *path;
    off_t offset;
    uint64_t uuid;
+   /* Descriptor used by the reads that don't lock the file, -1 if they are
+    * disabled.
+    */
+   int read_fd;
 };
 
 struct mesa_cache_db {
@@ -37,6 +42,10 @@ struct mesa_cache_db {
    void *mem_ctx;
    uint64_t uuid;
    bool alive;
+   /* Index entries whose last access time was updated by the lockless reads
+    * and is not written to the index file yet.
+    */
+   struct util_dynarray dirty_entries;
 };
 
 #if DETECT_OS_WINDOWS == 0
@@ -984,6 +984,23 @@ gc_sweep_end(gc_ctx *ctx)
    ctx->rubbish = NULL;
 }
 
+size_t
+gc_get_usage(gc_ctx *ctx, size_t *used)
+{
+   size_t total = 0, live = 0;
+
+   for (unsigned i = 0; i < NUM_FREELIST_BUCKETS; i++) {
+      list_for_each_entry(gc_slab, slab, &ctx->slabs[i].slabs, link) {
+         total += get_slab_size(i);
+         live += (size_t)slab->num_allocated * gc_bucket_obj_size(i);
+      }
+   }
+
+   if (used)
+      *used = live;
+   return total;
+}
+
 /***************************************************************************
  * Linear allocator for short-lived allocations.
  ***************************************************************************
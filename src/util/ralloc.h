@@ -522,6 +522,14 @@ void gc_sweep_start(gc_ctx *ctx);
 void gc_mark_live(gc_ctx *ctx, const void *mem);
 void gc_sweep_end(gc_ctx *ctx);
 
+/**
+ * Return the number of bytes of slab memory held by a GC context.  If \p used
+ * is not NULL, it is set to the part of it taken by live objects, so that the
+ * difference measures fragmentation.  Objects too large for a slab are not
+ * counted.
+ */
+size_t gc_get_usage(gc_ctx *ctx, size_t *used);
+
 /**
  * Declare C++ new and delete operators which use ralloc.
  *
@@ -573,6 +573,12 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
                                  bitset_count);
    g->tmp.min_q_node = reralloc(g, g->tmp.min_q_node, unsigned int,
                                 bitset_count);
+   g->tmp.min_q_tree = reralloc(g, g->tmp.min_q_tree, unsigned int,
+                                2 * util_next_power_of_two(bitset_count));
+   g->tmp.pq_words = reralloc(g, g->tmp.pq_words, BITSET_WORD,
+                              BITSET_WORDS(bitset_count));
+   g->tmp.min_q_dirty = reralloc(g, g->tmp.min_q_dirty, BITSET_WORD,
+                                 BITSET_WORDS(bitset_count));
 
    g->alloc = alloc;
 }
@@ -585,6 +591,7 @@ ra_alloc_interference_graph(struct ra_regs *regs, unsigned int count)
    g = rzalloc(NULL, struct ra_graph);
    g->regs = regs;
    g->count = count;
+   g->tmp.select_regs = ralloc_array(g, BITSET_WORD, BITSET_WORDS(regs->count));
    ra_realloc_interference_graph(g, count);
 
    return g;
@@ -653,6 +660,72 @@ ra_reset_node_interference(struct ra_graph *g, unsigned int n)
    util_dynarray_clear(&g->nodes[n].adjacency_list);
 }
 
+static bool
+min_q_word_is_better(struct ra_graph *g, unsigned int w1, unsigned int w2)
+{
+   if (w2 == UINT_MAX)
+      return w1 != UINT_MAX;
+   if (w1 == UINT_MAX)
+      return false;
+
+   return g->tmp.min_q_total[w1] < g->tmp.min_q_total[w2] ||
+          (g->tmp.min_q_total[w1] == g->tmp.min_q_total[w2] && w1 > w2);
+}
+
+/* Propagates any change of min_q_total[i] up the tournament tree. */
+static void
+update_min_q_tree(struct ra_graph *g, unsigned int i)
+{
+   unsigned int *tree = g->tmp.min_q_tree;
+
+   for (unsigned int t = (g->tmp.min_q_tree_size + i) / 2; t > 0; t /= 2) {
+      tree[t] = min_q_word_is_better(g, tree[2 * t + 1], tree[2 * t]) ?
+                tree[2 * t + 1] : tree[2 * t];
+   }
+}
+
+/* Propagates a decrease of min_q_total[i] up the tournament tree, which
+ * can stop at the first match word i doesn't win.
+ */
+static void
+decrease_min_q_tree(struct ra_graph *g, unsigned int i)
+{
+   unsigned int *tree = g->tmp.min_q_tree;
+
+   for (unsigned int t = (g->tmp.min_q_tree_size + i) / 2; t > 0; t /= 2) {
+      if (tree[t] != i) {
+         if (!min_q_word_is_better(g, i, tree[t]))
+            break;
+         tree[t] = i;
+      }
+   }
+}
+
+/* Recomputes min_q_total[i] and min_q_node[i] from the nodes of word i
+ * which are neither in the stack nor pre-assigned.
+ */
+static void
+compute_min_q(struct ra_graph *g, unsigned int i)
+{
+   BITSET_WORD skip = g->tmp.in_stack[i] | g->tmp.reg_assigned[i];
+   int high_bit = MIN2(g->count - i * BITSET_WORDBITS, BITSET_WORDBITS) - 1;
+
+   g->tmp.min_q_total[i] = UINT_MAX;
+   g->tmp.min_q_node[i] = UINT_MAX;
+   for (int j = high_bit; j >= 0; j--) {
+      if (skip & BITSET_BIT(j))
+         continue;
+
+      unsigned int n = i * BITSET_WORDBITS + j;
+      if (g->nodes[n].tmp.q_total < g->tmp.min_q_total[i]) {
+         g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
+         g->tmp.min_q_node[i] = n;
+      }
+   }
+
+   update_min_q_tree(g, i);
+}
+
 static void
 update_pq_info(struct ra_graph *g, unsigned int n)
 {
@@ -660,6 +733,7 @@ update_pq_info(struct ra_graph *g, unsigned int n)
    int n_class = g->nodes[n].class;
    if (g->nodes[n].tmp.q_total < g->regs->classes[n_class]->p) {
       BITSET_SET(g->tmp.pq_test, n);
+      BITSET_SET(g->tmp.pq_words, i);
    } else if (g->tmp.min_q_total[i] != UINT_MAX) {
       /* Only update min_q_total and min_q_node if min_q_total != UINT_MAX so
        * that we don't update while we have stale data and accidentally mark
@@ -672,6 +746,7 @@ update_pq_info(struct ra_graph *g, unsigned int n)
            n > g->tmp.min_q_node[i])) {
          g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
          g->tmp.min_q_node[i] = n;
+         decrease_min_q_tree(g, i);
       }
    }
 }
@@ -701,6 +776,26 @@ add_node_to_stack(struct ra_graph *g, unsigned int n)
 
    /* Flag the min_q_total for n's block as dirty so it gets recalculated */
    g->tmp.min_q_total[n / BITSET_WORDBITS] = UINT_MAX;
+   BITSET_SET(g->tmp.min_q_dirty, n / BITSET_WORDBITS);
+}
+
+/**
+ * Returns the highest word at or below i which may have pq_test bits set for
+ * nodes not in the stack, or -1.
+ */
+static int
+prev_pq_word(struct ra_graph *g, int i)
+{
+   while (i >= 0) {
+      BITSET_WORD bits = g->tmp.pq_words[BITSET_BITWORD(i)] &
+                         BITSET_MASK(i + 1);
+      if (bits)
+         return BITSET_BITWORD(i) * BITSET_WORDBITS + util_last_bit(bits) - 1;
+
+      i = BITSET_BITWORD(i) * BITSET_WORDBITS - 1;
+   }
+
+   return -1;
 }
 
 /**
@@ -718,6 +813,7 @@ ra_simplify(struct ra_graph *g)
 {
    bool progress = true;
    unsigned int stack_optimistic_start = UINT_MAX;
+   const unsigned int words = BITSET_WORDS(g->count);
 
    /* Figure out the high bit and bit mask for the first iteration of a loop
     * over BITSET_WORDs.
@@ -726,13 +822,21 @@ ra_simplify(struct ra_graph *g)
 
    /* Do a quick pre-pass to set things up */
    g->tmp.stack_count = 0;
-   for (int i = BITSET_WORDS(g->count) - 1, high_bit = top_word_high_bit;
+   memset(g->tmp.pq_words, 0, BITSET_WORDS(words) * sizeof(BITSET_WORD));
+   memset(g->tmp.min_q_dirty, 0, BITSET_WORDS(words) * sizeof(BITSET_WORD));
+   g->tmp.min_q_tree_size = util_next_power_of_two(words);
+   for (unsigned int t = 0; t < 2 * g->tmp.min_q_tree_size; t++)
+      g->tmp.min_q_tree[t] = UINT_MAX;
+
+   for (int i = words - 1, high_bit = top_word_high_bit;
         i >= 0; i--, high_bit = BITSET_WORDBITS - 1) {
       g->tmp.in_stack[i] = 0;
       g->tmp.reg_assigned[i] = 0;
       g->tmp.pq_test[i] = 0;
       g->tmp.min_q_total[i] = UINT_MAX;
       g->tmp.min_q_node[i] = UINT_MAX;
+      g->tmp.min_q_tree[g->tmp.min_q_tree_size + i] = i;
+      BITSET_SET(g->tmp.min_q_dirty, i);
       for (int j = high_bit; j >= 0; j--) {
          unsigned int n = i * BITSET_WORDBITS + j;
          g->nodes[n].reg = g->nodes[n].forced_reg;
@@ -744,69 +848,63 @@ ra_simplify(struct ra_graph *g)
    }
 
    while (progress) {
-      unsigned int min_q_total = UINT_MAX;
-      unsigned int min_q_node = UINT_MAX;
-
       progress = false;
 
-      for (int i = BITSET_WORDS(g->count) - 1, high_bit = top_word_high_bit;
-           i >= 0; i--, high_bit = BITSET_WORDBITS - 1) {
-         BITSET_WORD mask = ~(BITSET_WORD)0 >> (31 - high_bit);
+      /* Only visit the words with nodes passing the pq test, from the top
+       * down.  Nodes of the words below the current one which pass the test
+       * after a push are taken off in the same pass.
+       */
+      for (int i = prev_pq_word(g, words - 1); i >= 0;
+           i = prev_pq_word(g, i - 1)) {
+         int high_bit = i == words - 1 ? top_word_high_bit :
+                                         BITSET_WORDBITS - 1;
 
          BITSET_WORD skip = g->tmp.in_stack[i] | g->tmp.reg_assigned[i];
-         if (skip == mask)
+         BITSET_WORD pq = g->tmp.pq_test[i] & ~skip;
+         if (!pq) {
+            BITSET_CLEAR(g->tmp.pq_words, i);
             continue;
+         }
 
-         BITSET_WORD pq = g->tmp.pq_test[i] & ~skip;
-         if (pq) {
-            /* In this case, we have stuff we can immediately take off the
-             * stack.  This also means that we're guaranteed to make progress
-             * and we don't need to bother updating lowest_q_total because we
-             * know we're going to loop again before attempting to do anything
-             * optimistic.
-             */
-            for (int j = high_bit; j >= 0; j--) {
-               if (pq & BITSET_BIT(j)) {
-                  unsigned int n = i * BITSET_WORDBITS + j;
-                  assert(n < g->count);
-                  add_node_to_stack(g, n);
-                  /* add_node_to_stack() may update pq_test for this word so
-                   * we need to update our local copy.
-                   */
-                  pq = g->tmp.pq_test[i] & ~skip;
-                  progress = true;
-               }
-            }
-         } else if (!progress) {
-            if (g->tmp.min_q_total[i] == UINT_MAX) {
-               /* The min_q_total and min_q_node are dirty because we added
-                * one of these nodes to the stack.  It needs to be
-                * recalculated.
+         /* In this case, we have stuff we can immediately take off the
+          * stack.  This also means that we're guaranteed to make progress
+          * and we don't need to bother looking for the lowest q_total
+          * because we know we're going to loop again before attempting to
+          * do anything optimistic.
+          */
+         for (int j = high_bit; j >= 0; j--) {
+            if (pq & BITSET_BIT(j)) {
+               unsigned int n = i * BITSET_WORDBITS + j;
+               assert(n < g->count);
+               add_node_to_stack(g, n);
+               /* add_node_to_stack() may update pq_test for this word so
+                * we need to update our local copy.
                 */
-               for (int j = high_bit; j >= 0; j--) {
-                  if (skip & BITSET_BIT(j))
-                     continue;
-
-                  unsigned int n = i * BITSET_WORDBITS + j;
-                  assert(n < g->count);
-                  if (g->nodes[n].tmp.q_total < g->tmp.min_q_total[i]) {
-                     g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
-                     g->tmp.min_q_node[i] = n;
-                  }
-               }
-            }
-            if (g->tmp.min_q_total[i] < min_q_total) {
-               min_q_node = g->tmp.min_q_node[i];
-               min_q_total = g->tmp.min_q_total[i];
+               pq = g->tmp.pq_test[i] & ~skip;
+               progress = true;
             }
          }
       }
 
-      if (!progress && min_q_total != UINT_MAX) {
+      if (progress)
+         continue;
+
+      /* Otherwise, optimistically push the node with the lowest q_total,
+       * which the tournament tree has at its root once the words with nodes
+       * pushed since the last time are recalculated.
+       */
+      unsigned int i;
+      BITSET_FOREACH_SET(i, g->tmp.min_q_dirty, words)
+         compute_min_q(g, i);
+      memset(g->tmp.min_q_dirty, 0, BITSET_WORDS(words) * sizeof(BITSET_WORD));
+
+      unsigned int min_q_word = g->tmp.min_q_tree[1];
+      if (min_q_word != UINT_MAX &&
+          g->tmp.min_q_total[min_q_word] != UINT_MAX) {
          if (stack_optimistic_start == UINT_MAX)
             stack_optimistic_start = g->tmp.stack_count;
 
-         add_node_to_stack(g, min_q_node);
+         add_node_to_stack(g, g->tmp.min_q_node[min_q_word]);
          progress = true;
       }
    }
@@ -871,8 +969,7 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
          if (c->contig_len) {
             int start = MAX2(0, (int)n2->reg - c->contig_len + 1);
             int end = MIN2(g->regs->count, n2->reg + n2c->contig_len);
-            for (unsigned i = start; i < end; i++)
-               BITSET_CLEAR(regs, i);
+            BITSET_CLEAR_RANGE(regs, start, end - 1);
          } else {
             for (int j = 0; j < BITSET_WORDS(g->regs->count); j++)
                regs[j] &= ~g->regs->regs[n2->reg].conflicts[j];
@@ -888,6 +985,33 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
    return false;
 }
 
+/**
+ * Returns the first register set in regs at or after start, wrapping around
+ * to 0, or NO_REG if there are none.
+ */
+static unsigned int
+ra_find_first_reg(const BITSET_WORD *regs, unsigned int start,
+                  unsigned int count)
+{
+   const unsigned int words = BITSET_WORDS(count);
+
+   if (start >= count)
+      start = 0;
+
+   unsigned int i = BITSET_BITWORD(start);
+   BITSET_WORD word = regs[i] & ~(BITSET_BIT(start) - 1);
+
+   for (unsigned int w = 0; w <= words; w++) {
+      if (word)
+         return i * BITSET_WORDBITS + ffs(word) - 1;
+
+      i = i + 1 < words ? i + 1 : 0;
+      word = regs[i];
+   }
+
+   return NO_REG;
+}
+
 /**
  * Pops nodes from the stack back into the graph, coloring them with
  * registers as they go.
@@ -899,10 +1023,7 @@ static bool
 ra_select(struct ra_graph *g)
 {
    int start_search_reg = 0;
-   BITSET_WORD *select_regs = NULL;
-
-   if (g->select_reg_callback)
-      select_regs = malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
+   BITSET_WORD *select_regs = g->tmp.select_regs;
 
    while (g->tmp.stack_count != 0) {
       unsigned int ri;
@@ -916,13 +1037,21 @@ ra_select(struct ra_graph *g)
       BITSET_CLEAR(g->tmp.in_stack, n);
 
       if (g->select_reg_callback) {
-         if (!ra_compute_available_regs(g, n, select_regs)) {
-            free(select_regs);
+         if (!ra_compute_available_regs(g, n, select_regs))
             return false;
-         }
 
          r = g->select_reg_callback(n, select_regs, g->select_reg_callback_data);
          assert(r < g->regs->count);
+      } else if (c->contig_len) {
+         /* With contiguous classes, the conflicts with each neighbor are a
+          * range of registers, so it is much cheaper to compute the whole set
+          * of available registers once than to walk the adjacency list for
+          * every register we try, which is quadratic on large graphs.
+          */
+         if (!ra_compute_available_regs(g, n, select_regs))
+            return false;
+
+         r = ra_find_first_reg(select_regs, start_search_reg, g->regs->count);
       } else {
          /* Find the lowest-numbered reg which is not used by a member
           * of the graph adjacent to us.
@@ -970,8 +1099,6 @@ ra_select(struct ra_graph *g)
          start_search_reg = r + 1;
    }
 
-   free(select_regs);
-
    return true;
 }
 
@@ -1013,22 +1140,18 @@ ra_set_node_reg(struct ra_graph *g, unsigned int n, unsigned int reg)
 static float
 ra_get_spill_benefit(struct ra_graph *g, unsigned int n)
 {
-   float benefit = 0;
    int n_class = g->nodes[n].class;
 
    /* Define the benefit of eliminating an interference between n, n2
     * through spilling as q(C, B) / p(C).  This is similar to the
     * "count number of edges" approach of traditional graph coloring,
     * but takes classes into account.
+    *
+    * The sum of q(C, B) over the neighbors is the q_total we maintain as
+    * interferences are added and removed, so this doesn't need to walk the
+    * adjacency list.
     */
-   util_dynarray_foreach(&g->nodes[n].adjacency_list, unsigned int, n2p) {
-      unsigned int n2 = *n2p;
-      unsigned int n2_class = g->nodes[n2].class;
-      benefit += ((float)g->regs->classes[n_class]->q[n2_class] /
-                  g->regs->classes[n_class]->p);
-   }
-
-   return benefit;
+   return (float)g->nodes[n].q_total / g->regs->classes[n_class]->p;
 }
 
 float
@@ -161,11 +161,28 @@ struct ra_graph {
        */
       unsigned int *min_q_node;
 
+      /**
+       * Tournament tree over the BITSET_WORDs: each inner node holds the
+       * index of the word with the lowest min_q_total below it, the highest
+       * index on ties.  The leaves start at min_q_tree_size.
+       */
+      unsigned int *min_q_tree;
+      unsigned int min_q_tree_size;
+
+      /** Bit-set of the BITSET_WORDs which may have pq_test bits set */
+      BITSET_WORD *pq_words;
+
+      /** Bit-set of the BITSET_WORDs whose min_q_total is to be recomputed */
+      BITSET_WORD *min_q_dirty;
+
       /**
        * Tracks the start of the set of optimistically-colored registers in the
        * stack.
        */
       unsigned int stack_optimistic_start;
+
+      /** Bit-set of the registers available to the node being colored */
+      BITSET_WORD *select_regs;
    } tmp;
 };
 
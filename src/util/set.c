@@ -37,6 +37,9 @@
 #include <string.h>
 
 #include "hash_table.h"
+#ifdef HASH_TABLE_GROUPS
+#include "hash_table_group.h"
+#endif
 #include "macros.h"
 #include "ralloc.h"
 #include "set.h"
@@ -98,6 +101,7 @@ key_pointer_is_reserved(const void *key)
    return key == NULL || key == deleted_key;
 }
 
+#ifndef HASH_TABLE_GROUPS
 static int
 entry_is_free(struct set_entry *entry)
 {
@@ -109,6 +113,7 @@ entry_is_deleted(struct set_entry *entry)
 {
    return entry->key == deleted_key;
 }
+#endif
 
 static int
 entry_is_present(struct set_entry *entry)
@@ -116,6 +121,28 @@ entry_is_present(struct set_entry *entry)
    return entry->key != NULL && entry->key != deleted_key;
 }
 
+#ifdef HASH_TABLE_GROUPS
+/**
+ * Allocates the entries of a set of the given size, followed by their
+ * control bytes.
+ */
+static struct set_entry *
+set_alloc(void *mem_ctx, uint32_t size, uint8_t **ctrl)
+{
+   struct set_entry *table =
+      ralloc_size(mem_ctx, size * sizeof(struct set_entry) +
+                           hash_ctrl_size(size));
+   if (table == NULL)
+      return NULL;
+
+   memset(table, 0, size * sizeof(struct set_entry));
+   *ctrl = (uint8_t *)(table + size);
+   hash_ctrl_reset(*ctrl, size);
+
+   return table;
+}
+#endif
+
 bool
 _mesa_set_init(struct set *ht, void *mem_ctx,
                  uint32_t (*key_hash_function)(const void *key),
@@ -130,7 +157,11 @@ _mesa_set_init(struct set *ht, void *mem_ctx,
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
+#ifdef HASH_TABLE_GROUPS
+   ht->table = set_alloc(mem_ctx, ht->size, &ht->ctrl);
+#else
    ht->table = rzalloc_array(mem_ctx, struct set_entry, ht->size);
+#endif
    ht->entries = 0;
    ht->deleted_entries = 0;
 
@@ -188,13 +219,22 @@ _mesa_set_clone(struct set *set, void *dst_mem_ctx)
 
    memcpy(clone, set, sizeof(struct set));
 
-   clone->table = ralloc_array(clone, struct set_entry, clone->size);
+#ifdef HASH_TABLE_GROUPS
+   const size_t table_size = clone->size * sizeof(struct set_entry) +
+                             hash_ctrl_size(clone->size);
+#else
+   const size_t table_size = clone->size * sizeof(struct set_entry);
+#endif
+   clone->table = ralloc_size(clone, table_size);
    if (clone->table == NULL) {
       ralloc_free(clone);
       return NULL;
    }
 
-   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry));
+   memcpy(clone->table, set->table, table_size);
+#ifdef HASH_TABLE_GROUPS
+   clone->ctrl = (uint8_t *)(clone->table + clone->size);
+#endif
 
    return clone;
 }
@@ -225,6 +265,9 @@ static void
 set_clear_fast(struct set *ht)
 {
    memset(ht->table, 0, sizeof(struct set_entry) * hash_sizes[ht->size_index].size);
+#ifdef HASH_TABLE_GROUPS
+   hash_ctrl_reset(ht->ctrl, ht->size);
+#endif
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -249,6 +292,9 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
 
          entry->key = NULL;
       }
+#ifdef HASH_TABLE_GROUPS
+      hash_ctrl_reset(set->ctrl, set->size);
+#endif
       set->entries = 0;
       set->deleted_entries = 0;
    } else
@@ -260,6 +306,38 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
  *
  * Returns NULL if no entry is found.
  */
+#ifdef HASH_TABLE_GROUPS
+static struct set_entry *
+set_search(const struct set *ht, uint32_t hash, const void *key)
+{
+   assert(!key_pointer_is_reserved(key));
+
+   const uint32_t size = ht->size;
+   const uint8_t tag = hash_ctrl_tag(hash);
+   uint32_t group = hash_ctrl_start(hash, size, ht->size_magic);
+
+   for (uint32_t i = 0; i < size; i += HASH_GROUP_WIDTH) {
+      const uint8_t *ctrl = ht->ctrl + group;
+
+      for (hash_group_mask match = hash_group_match(ctrl, tag); match;
+           match &= match - 1) {
+         struct set_entry *entry =
+            ht->table + hash_ctrl_wrap(group + hash_group_first(match), size);
+
+         if (entry->hash == hash && entry_is_present(entry) &&
+             ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      if (hash_group_match_empty(ctrl))
+         return NULL;
+
+      group = hash_ctrl_wrap(group + HASH_GROUP_WIDTH, size);
+   }
+
+   return NULL;
+}
+#else
 static struct set_entry *
 set_search(const struct set *ht, uint32_t hash, const void *key)
 {
@@ -288,6 +366,7 @@ set_search(const struct set *ht, uint32_t hash, const void *key)
 
    return NULL;
 }
+#endif
 
 struct set_entry *
 _mesa_set_search(const struct set *set, const void *key)
@@ -305,6 +384,21 @@ _mesa_set_search_pre_hashed(const struct set *set, uint32_t hash,
    return set_search(set, hash, key);
 }
 
+#ifdef HASH_TABLE_GROUPS
+static void
+set_add_rehash(struct set *ht, uint32_t hash, const void *key)
+{
+   const uint32_t size = ht->size;
+   const uint32_t index =
+      hash_ctrl_find_empty(ht->ctrl, size,
+                           hash_ctrl_start(hash, size, ht->size_magic));
+   struct set_entry *entry = ht->table + index;
+
+   hash_ctrl_set(ht->ctrl, size, index, hash_ctrl_tag(hash));
+   entry->hash = hash;
+   entry->key = key;
+}
+#else
 static void
 set_add_rehash(struct set *ht, uint32_t hash, const void *key)
 {
@@ -326,6 +420,7 @@ set_add_rehash(struct set *ht, uint32_t hash, const void *key)
          hash_address -= size;
    } while (true);
 }
+#endif
 
 static void
 set_rehash(struct set *ht, unsigned new_size_index)
@@ -342,14 +437,23 @@ set_rehash(struct set *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
+#ifdef HASH_TABLE_GROUPS
+   uint8_t *ctrl;
+   table = set_alloc(ralloc_parent(ht->table),
+                     hash_sizes[new_size_index].size, &ctrl);
+#else
    table = rzalloc_array(ralloc_parent(ht->table), struct set_entry,
                          hash_sizes[new_size_index].size);
+#endif
    if (table == NULL)
       return;
 
    old_ht = *ht;
 
    ht->table = table;
+#ifdef HASH_TABLE_GROUPS
+   ht->ctrl = ctrl;
+#endif
    ht->size_index = new_size_index;
    ht->size = hash_sizes[ht->size_index].size;
    ht->rehash = hash_sizes[ht->size_index].rehash;
@@ -389,6 +493,95 @@ _mesa_set_resize(struct set *set, uint32_t entries)
  * Note that insertion may rearrange the table on a resize or rehash,
  * so previously found hash_entries are no longer valid after this function.
  */
+#ifdef HASH_TABLE_GROUPS
+/* Claims the available entry at index for a new key with the given hash. */
+static struct set_entry *
+set_use_entry(struct set *ht, uint32_t index, uint32_t hash, uint8_t tag,
+              const void *key)
+{
+   struct set_entry *entry = ht->table + index;
+
+   if (ht->ctrl[index] == HASH_CTRL_DELETED)
+      ht->deleted_entries--;
+   hash_ctrl_set(ht->ctrl, ht->size, index, tag);
+   entry->hash = hash;
+   entry->key = key;
+   ht->entries++;
+   return entry;
+}
+
+static struct set_entry *
+set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
+{
+   struct set_entry *available_entry = NULL;
+
+   assert(!key_pointer_is_reserved(key));
+
+   if (ht->entries >= ht->max_entries) {
+      set_rehash(ht, ht->size_index + 1);
+   } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
+      set_rehash(ht, ht->size_index);
+   }
+
+   const uint32_t size = ht->size;
+   const uint8_t tag = hash_ctrl_tag(hash);
+   uint32_t group = hash_ctrl_start(hash, size, ht->size_magic);
+
+   /* A key with this hash would have been put at the start of its probe
+    * sequence if that entry was empty then, and it still is.  Checking that
+    * byte alone also avoids reloading a group of control bytes which the
+    * previous insertion may have just written to.
+    */
+   if (ht->ctrl[group] == HASH_CTRL_EMPTY) {
+      if (found)
+         *found = false;
+      return set_use_entry(ht, group, hash, tag, key);
+   }
+
+   for (uint32_t i = 0; i < size; i += HASH_GROUP_WIDTH) {
+      const uint8_t *ctrl = ht->ctrl + group;
+
+      for (hash_group_mask match = hash_group_match(ctrl, tag); match;
+           match &= match - 1) {
+         struct set_entry *entry =
+            ht->table + hash_ctrl_wrap(group + hash_group_first(match), size);
+
+         if (entry->hash == hash && entry_is_present(entry) &&
+             ht->key_equals_function(key, entry->key)) {
+            if (found)
+               *found = true;
+            return entry;
+         }
+      }
+
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         hash_group_mask available = hash_group_match_available(ctrl);
+         if (available) {
+            available_entry = ht->table +
+               hash_ctrl_wrap(group + hash_group_first(available), size);
+         }
+      }
+
+      if (hash_group_match_empty(ctrl))
+         break;
+
+      group = hash_ctrl_wrap(group + HASH_GROUP_WIDTH, size);
+   }
+
+   if (available_entry) {
+      /* There is no matching entry, create it. */
+      if (found)
+         *found = false;
+      return set_use_entry(ht, available_entry - ht->table, hash, tag, key);
+   }
+
+   /* We could hit here if a required resize failed. An unchecked-malloc
+    * application could ignore this result.
+    */
+   return NULL;
+}
+#else
 static struct set_entry *
 set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
 {
@@ -448,6 +641,7 @@ set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
     */
    return NULL;
 }
+#endif
 
 /**
  * Inserts the key with the given hash into the table.
@@ -547,6 +741,9 @@ _mesa_set_remove(struct set *ht, struct set_entry *entry)
       return;
 
    entry->key = deleted_key;
+#ifdef HASH_TABLE_GROUPS
+   hash_ctrl_set(ht->ctrl, ht->size, entry - ht->table, HASH_CTRL_DELETED);
+#endif
    ht->entries--;
    ht->deleted_entries++;
 }
@@ -560,6 +757,22 @@ _mesa_set_remove_key(struct set *set, const void *key)
    _mesa_set_remove(set, _mesa_set_search(set, key));
 }
 
+#ifdef HASH_TABLE_GROUPS
+/**
+ * Empties an entry without leaving a deleted entry behind, for
+ * set_foreach_remove.  This breaks the probing of the entries which are
+ * left, so it can only be used to remove all of them.
+ */
+void
+_mesa_set_clear_entry_unsafe(struct set *ht, struct set_entry *entry)
+{
+   entry->hash = 0;
+   entry->key = NULL;
+   hash_ctrl_set(ht->ctrl, ht->size, entry - ht->table, HASH_CTRL_EMPTY);
+   ht->entries--;
+}
+#endif
+
 /**
  * This function is an iterator over the set when no deleted entries are present.
  *
@@ -587,6 +800,20 @@ _mesa_set_next_entry_unsafe(const struct set *ht, struct set_entry *entry)
  * Pass in NULL for the first entry, as in the start of a for loop.  Note that
  * an iteration over the table is O(table_size) not O(entries).
  */
+#ifdef HASH_TABLE_GROUPS
+struct set_entry *
+_mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
+{
+   uint32_t index = entry ? entry - ht->table + 1 : 0;
+
+   index = hash_ctrl_next_full(ht->ctrl, ht->size, index);
+   if (index == ht->size)
+      return NULL;
+
+   assert(entry_is_present(ht->table + index));
+   return ht->table + index;
+}
+#else
 struct set_entry *
 _mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
 {
@@ -603,6 +830,7 @@ _mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
 
    return NULL;
 }
+#endif
 
 /**
  * Helper to create a set with pointer keys.
@@ -43,6 +43,9 @@ struct set_entry {
 struct set {
    void *mem_ctx;
    struct set_entry *table;
+#ifdef HASH_TABLE_GROUPS
+   uint8_t *ctrl;
+#endif
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    uint32_t size;
@@ -113,6 +116,10 @@ struct set_entry *
 _mesa_set_next_entry(const struct set *set, struct set_entry *entry);
 struct set_entry *
 _mesa_set_next_entry_unsafe(const struct set *set, struct set_entry *entry);
+#ifdef HASH_TABLE_GROUPS
+void
+_mesa_set_clear_entry_unsafe(struct set *set, struct set_entry *entry);
+#endif
 
 struct set *
 _mesa_pointer_set_create(void *mem_ctx);
@@ -134,10 +141,17 @@ _mesa_set_intersects(struct set *a, struct set *b);
  * This foreach function destroys the table as it iterates.
  * It is not safe to use when inserting or removing entries.
  */
+#ifdef HASH_TABLE_GROUPS
+#define set_foreach_remove(set, entry)                              \
+   for (struct set_entry *entry = _mesa_set_next_entry_unsafe(set, NULL);  \
+        (set)->entries;                                              \
+        _mesa_set_clear_entry_unsafe(set, entry), entry = _mesa_set_next_entry_unsafe(set, entry))
+#else
 #define set_foreach_remove(set, entry)                              \
    for (struct set_entry *entry = _mesa_set_next_entry_unsafe(set, NULL);  \
         (set)->entries;                                              \
         entry->hash = 0, entry->key = (void*)NULL, (set)->entries--, entry = _mesa_set_next_entry_unsafe(set, entry))
+#endif
 
 #ifdef __cplusplus
 } /* extern C */
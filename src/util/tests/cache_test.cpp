@@ -37,11 +37,14 @@
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
+#include <sys/wait.h>
 
+#include "util/compress.h"
 #include "util/detect_os.h"
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
 #include "util/disk_cache_os.h"
+#include "util/os_time.h"
 #include "util/ralloc.h"
 
 #ifdef ENABLE_SHADER_CACHE
@@ -1307,6 +1310,445 @@ TEST_F(Cache, DatabaseMultipartEviction)
 #endif
 }
 
+#define CONTENTION_DB_DIR CACHE_TEST_TMP "/db-contention"
+#define CONTENTION_ENTRIES 64
+#define CONTENTION_ENTRY_SIZE 4096
+
+static void
+contention_entry(unsigned i, uint8_t *key, uint8_t *data)
+{
+   memset(data, i & 0xff, CONTENTION_ENTRY_SIZE);
+   memcpy(data, &i, sizeof(i));
+   _mesa_sha1_compute(data, CONTENTION_ENTRY_SIZE, key);
+}
+
+/* Reads the entries over and over, returns the exit status of the process:
+ * 1 if an entry has wrong data, or if an entry is missing and there is no
+ * writer that may evict it.
+ */
+static int
+contention_reader(unsigned num_reads, bool with_writer)
+{
+   static uint8_t expected[CONTENTION_ENTRIES][CONTENTION_ENTRY_SIZE];
+   uint8_t keys[CONTENTION_ENTRIES][20];
+   struct mesa_cache_db db = {};
+   size_t size;
+   int status = 0;
+
+   for (unsigned i = 0; i < CONTENTION_ENTRIES; i++)
+      contention_entry(i, keys[i], expected[i]);
+
+   if (!mesa_cache_db_open(&db, CONTENTION_DB_DIR))
+      return 1;
+
+   for (unsigned i = 0; i < num_reads; i++) {
+      unsigned entry = i % CONTENTION_ENTRIES;
+
+      void *data = mesa_cache_db_read_entry(&db, keys[entry], &size);
+      if (data) {
+         if (size != CONTENTION_ENTRY_SIZE ||
+             memcmp(data, expected[entry], size))
+            status = 1;
+      } else if (!with_writer) {
+         status = 1;
+      }
+      free(data);
+   }
+
+   mesa_cache_db_close(&db);
+
+   return status;
+}
+
+/* Appends new entries, which makes the database compact itself. */
+static int
+contention_writer(unsigned num_writes)
+{
+   static uint8_t data[CONTENTION_ENTRY_SIZE];
+   struct mesa_cache_db db = {};
+   uint8_t key[20];
+
+   if (!mesa_cache_db_open(&db, CONTENTION_DB_DIR))
+      return 1;
+
+   mesa_cache_db_set_size_limit(&db, CONTENTION_ENTRIES * CONTENTION_ENTRY_SIZE * 2);
+
+   for (unsigned i = 0; i < num_writes; i++) {
+      contention_entry(CONTENTION_ENTRIES + i, key, data);
+      mesa_cache_db_entry_write(&db, key, data, sizeof(data));
+   }
+
+   mesa_cache_db_close(&db);
+
+   return 0;
+}
+
+/* Runs the readers and the optional writer in separate processes, returns
+ * the wall time in milliseconds.
+ */
+static double
+test_database_contention(bool lockless, unsigned num_procs,
+                         unsigned num_reads, bool with_writer)
+{
+   static uint8_t data[CONTENTION_ENTRY_SIZE];
+   struct mesa_cache_db db = {};
+   uint8_t key[20];
+   pid_t pids[16];
+
+   setenv("MESA_DISK_CACHE_DATABASE_LOCKLESS_READS", lockless ? "1" : "0", 1);
+
+   rmrf_local(CONTENTION_DB_DIR);
+   mkdir(CACHE_TEST_TMP, 0755);
+   EXPECT_EQ(mkdir(CONTENTION_DB_DIR, 0755), 0);
+
+   EXPECT_TRUE(mesa_cache_db_open(&db, CONTENTION_DB_DIR));
+   mesa_cache_db_set_size_limit(&db, CONTENTION_ENTRIES * CONTENTION_ENTRY_SIZE * 2);
+
+   for (unsigned i = 0; i < CONTENTION_ENTRIES; i++) {
+      contention_entry(i, key, data);
+      EXPECT_TRUE(mesa_cache_db_entry_write(&db, key, data, sizeof(data)));
+   }
+
+   mesa_cache_db_close(&db);
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_procs; i++) {
+      pids[i] = fork();
+      if (pids[i] == 0) {
+         if (with_writer && i == 0)
+            _exit(contention_writer(num_reads / 8));
+         _exit(contention_reader(num_reads, with_writer));
+      }
+      EXPECT_GT(pids[i], 0) << "fork";
+   }
+
+   for (unsigned i = 0; i < num_procs; i++) {
+      int status = -1;
+
+      if (pids[i] > 0)
+         waitpid(pids[i], &status, 0);
+
+      EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+         << "process " << i << " of the contention test";
+   }
+
+   double ms = (os_time_get_nano() - start) / 1000000.0;
+
+   unsetenv("MESA_DISK_CACHE_DATABASE_LOCKLESS_READS");
+
+   return ms;
+}
+
+TEST_F(Cache, DatabaseContention)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   const unsigned num_procs = 8, num_reads = 2000;
+
+   /* Many processes reading the same database at once, like a bunch of
+    * applications started together. Only the readers' results are checked,
+    * the timings are informational.
+    */
+   for (unsigned lockless = 0; lockless < 2; lockless++) {
+      double ms = test_database_contention(lockless, num_procs, num_reads,
+                                           false);
+
+      printf("%s reads: %u processes x %u reads in %.1f ms\n",
+             lockless ? "lockless" : "locked", num_procs, num_reads, ms);
+   }
+
+   /* The data read must stay correct while another process compacts the
+    * database.
+    */
+   test_database_contention(true, num_procs, num_reads, true);
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
+static void
+test_put_and_get_memory(const char *driver_id)
+{
+   struct disk_cache *cache;
+   uint8_t items[8][512];
+   uint8_t keys[8][20];
+   char *result;
+   size_t size;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+   setenv("MESA_SHADER_CACHE_MEMORY_SIZE", "4K", 1);
+
+   cache = disk_cache_create("test", driver_id, 0);
+   EXPECT_EQ(cache->mem.max_size, 4096);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(items); i++) {
+      memset(items[i], i, sizeof(items[i]));
+      disk_cache_compute_key(cache, items[i], sizeof(items[i]), keys[i]);
+      disk_cache_put(cache, keys[i], items[i], sizeof(items[i]), NULL);
+   }
+
+   /* disk_cache_put() hands things off to a thread so wait for it. */
+   disk_cache_wait_for_idle(cache);
+
+   /* Loading the items keeps the last ones in memory. */
+   for (unsigned i = 0; i < ARRAY_SIZE(items); i++) {
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      EXPECT_EQ(size, sizeof(items[i])) << "disk_cache_get from disk (size)";
+      EXPECT_EQ(memcmp(result, items[i], sizeof(items[i])), 0)
+         << "disk_cache_get from disk (data)";
+      free(result);
+   }
+
+   EXPECT_GT(cache->stats.mem_evictions, 0u) << "memory cache evictions";
+   EXPECT_LE(cache->mem.size, cache->mem.max_size) << "memory cache size";
+
+   /* Remove the files behind the cache's back, the last item is still in
+    * memory but the first one was evicted.
+    */
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP;
+
+   result = (char *) disk_cache_get(cache, keys[7], &size);
+   EXPECT_EQ(size, sizeof(items[7])) << "disk_cache_get from memory (size)";
+   EXPECT_NE(result, nullptr) << "disk_cache_get from memory (pointer)";
+   if (result) {
+      EXPECT_EQ(memcmp(result, items[7], sizeof(items[7])), 0);
+   }
+   free(result);
+
+   EXPECT_FALSE(does_cache_contain(cache, keys[0]))
+      << "disk_cache_get of an evicted item";
+
+   /* Removing an entry removes it from memory too. */
+   disk_cache_remove(cache, keys[7]);
+   EXPECT_FALSE(does_cache_contain(cache, keys[7]))
+      << "disk_cache_get of a removed item";
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_SHADER_CACHE_MEMORY_SIZE");
+}
+
+TEST_F(Cache, Memory)
+{
+   const char *driver_id = "make_check";
+
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME, driver_id);
+
+   test_put_and_get_memory(driver_id);
+
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
+
+   rmrf_local(CACHE_TEST_TMP);
+#endif
+}
+
+#if defined(ENABLE_SHADER_CACHE) && defined(HAVE_ZSTD)
+/* Similar entries, like the serialized shaders are. */
+static size_t
+dictionary_test_entry(unsigned i, char *buf, size_t buf_size)
+{
+   size_t len = 0;
+
+   for (unsigned j = 0; j < 16; j++) {
+      len += snprintf(buf + len, buf_size - len,
+                      "vec4 t%u = texture(s%u, uv%u.xy) * %u.0 + c[%u];\n",
+                      (i * 7 + j) % 31, j % 5, (i + j) % 3, i * j % 97, i % 13);
+   }
+
+   return len;
+}
+
+static void
+test_put_and_get_dictionary(const char *driver_id)
+{
+   const unsigned num_entries = 600;
+   struct disk_cache *cache;
+   uint8_t (*keys)[20] = (uint8_t (*)[20])calloc(num_entries, 20);
+   char buf[2048], *result;
+   size_t len, size;
+   struct stat sb;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "16M", 1);
+   setenv("MESA_SHADER_CACHE_DICTIONARY", "true", 1);
+
+   cache = disk_cache_create("test", driver_id, 0);
+   EXPECT_EQ(cache->compression.dict, nullptr) << "no dictionary yet";
+
+   /* The first entries are used to train the dictionary. */
+   for (unsigned i = 0; i < num_entries; i++) {
+      len = dictionary_test_entry(i, buf, sizeof(buf));
+      disk_cache_compute_key(cache, buf, len, keys[i]);
+      disk_cache_put(cache, keys[i], buf, len, NULL);
+   }
+
+   /* disk_cache_put() hands things off to a thread so wait for it. */
+   disk_cache_wait_for_idle(cache);
+
+   ASSERT_NE(cache->compression.dict, nullptr) << "trained dictionary";
+   EXPECT_EQ(stat(cache->compression.dict_path, &sb), 0)
+      << "dictionary stored in the cache directory";
+
+   /* The dictionary makes the entries smaller. */
+   uint8_t compressed[4096];
+   len = dictionary_test_entry(num_entries, buf, sizeof(buf));
+   EXPECT_LT(util_compress_deflate_dict(cache->compression.dict, 0,
+                                        (uint8_t *)buf, len,
+                                        compressed, sizeof(compressed)),
+             util_compress_deflate((uint8_t *)buf, len,
+                                   compressed, sizeof(compressed)));
+
+   disk_cache_destroy(cache);
+
+   /* Another instance needs the stored dictionary to read the entries, even
+    * if it doesn't use it for compressing.
+    */
+   unsetenv("MESA_SHADER_CACHE_DICTIONARY");
+   setenv("MESA_SHADER_CACHE_COMPRESSION_LEVEL", "multi_file:9,blob:-1", 1);
+
+   cache = disk_cache_create("test", driver_id, 0);
+   EXPECT_NE(cache->compression.dict, nullptr) << "loaded dictionary";
+   EXPECT_FALSE(cache->compression.use_dict);
+   EXPECT_EQ(cache->compression.level, 9);
+   EXPECT_EQ(cache->compression.blob_level, -1);
+
+   for (unsigned i = 0; i < num_entries; i++) {
+      len = dictionary_test_entry(i, buf, sizeof(buf));
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      EXPECT_NE(result, nullptr) << "disk_cache_get of entry " << i;
+      if (result) {
+         EXPECT_EQ(size, len);
+         EXPECT_EQ(memcmp(result, buf, len), 0);
+      }
+      free(result);
+   }
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_SHADER_CACHE_COMPRESSION_LEVEL");
+   free(keys);
+}
+
+#endif /* ENABLE_SHADER_CACHE && HAVE_ZSTD */
+
+TEST_F(Cache, Dictionary)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+#ifndef HAVE_ZSTD
+   GTEST_SKIP() << "Dictionaries need zstd";
+#else
+   const char *driver_id = "make_check";
+
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME, driver_id);
+
+   test_put_and_get_dictionary(driver_id);
+
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif /* HAVE_ZSTD */
+#endif /* ENABLE_SHADER_CACHE */
+}
+
+static void
+test_prefetch(const char *driver_id)
+{
+   struct disk_cache *cache;
+   uint8_t items[16][512];
+   uint8_t keys[16][20];
+   char *result;
+   size_t size;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+   setenv("MESA_SHADER_CACHE_PREFETCH", "true", 1);
+
+   /* Prefetching needs the memory cache. */
+   cache = disk_cache_create("test", driver_id, 0);
+   EXPECT_FALSE(cache->prefetch.enabled);
+   disk_cache_destroy(cache);
+
+   setenv("MESA_SHADER_CACHE_MEMORY_SIZE", "64K", 1);
+
+   cache = disk_cache_create("test", driver_id, 0);
+   EXPECT_TRUE(cache->prefetch.enabled);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(items); i++) {
+      memset(items[i], i, sizeof(items[i]));
+      disk_cache_compute_key(cache, items[i], sizeof(items[i]), keys[i]);
+      disk_cache_put(cache, keys[i], items[i], sizeof(items[i]), NULL);
+   }
+
+   /* disk_cache_put() hands things off to a thread so wait for it. */
+   disk_cache_wait_for_idle(cache);
+
+   /* Record the accesses, the order is stored at destruction. */
+   for (unsigned i = 0; i < ARRAY_SIZE(items); i++)
+      free(disk_cache_get(cache, keys[i], &size));
+
+   char *order_path = strdup(cache->prefetch.path);
+   disk_cache_destroy(cache);
+
+   struct stat sb;
+   EXPECT_EQ(stat(order_path, &sb), 0) << "access order stored";
+   EXPECT_EQ(sb.st_size, (off_t)sizeof(keys)) << "access order size";
+   free(order_path);
+
+   /* The next instance prefetches the entries in the background. */
+   cache = disk_cache_create("test", driver_id, 0);
+   disk_cache_wait_for_idle(cache);
+   EXPECT_EQ(cache->stats.prefetched, ARRAY_SIZE(items)) << "prefetched";
+
+   for (unsigned i = 0; i < ARRAY_SIZE(items); i++) {
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      EXPECT_NE(result, nullptr) << "disk_cache_get of a prefetched item";
+      if (result) {
+         EXPECT_EQ(memcmp(result, items[i], sizeof(items[i])), 0);
+      }
+      free(result);
+   }
+
+   EXPECT_EQ(cache->stats.prefetch_hits, ARRAY_SIZE(items))
+      << "prefetched items loaded from memory";
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_SHADER_CACHE_PREFETCH");
+   unsetenv("MESA_SHADER_CACHE_MEMORY_SIZE");
+}
+
+TEST_F(Cache, Prefetch)
+{
+   const char *driver_id = "make_check";
+
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME, driver_id);
+
+   test_prefetch(driver_id);
+
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 static void
 test_put_and_get_disabled(const char *driver_id)
 {
@@ -46,3 +46,37 @@ TEST(gc_alloc, align)
       }
    }
 }
+
+TEST(gc_alloc, usage)
+{
+   gc_ctx *ctx = gc_context(NULL);
+   size_t used;
+
+   EXPECT_EQ(gc_get_usage(ctx, &used), 0);
+   EXPECT_EQ(used, 0);
+
+   void *ptrs[1024];
+   for (unsigned i = 0; i < ARRAY_SIZE(ptrs); i++)
+      ptrs[i] = gc_alloc_size(ctx, 48, 8);
+
+   size_t total = gc_get_usage(ctx, &used);
+   EXPECT_GE(used, 48 * ARRAY_SIZE(ptrs));
+   EXPECT_GE(total, used);
+
+   /* Freeing every other object keeps all the slabs alive. */
+   size_t full_used = used;
+   for (unsigned i = 0; i < ARRAY_SIZE(ptrs); i += 2)
+      gc_free(ptrs[i]);
+
+   EXPECT_EQ(gc_get_usage(ctx, &used), total);
+   EXPECT_EQ(used, full_used / 2);
+
+   for (unsigned i = 1; i < ARRAY_SIZE(ptrs); i += 2)
+      gc_free(ptrs[i]);
+
+   /* The last empty slab of a size is kept around for the next allocation. */
+   EXPECT_LT(gc_get_usage(ctx, &used), total);
+   EXPECT_EQ(used, 0);
+
+   ralloc_free(ctx);
+}
@@ -0,0 +1,191 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Times insertion, successful and failed lookups, iteration and removal of
+ * pointer keys in hash tables and sets of various sizes, in ns per entry.
+ * An optional argument multiplies the number of repetitions.  Build with
+ * -Dhash-table-groups=true to time the group probing implementation.
+ */
+
+#undef NDEBUG
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/set.h"
+
+/* Enough work per size to get stable numbers. */
+#define OPS_PER_SIZE (1 << 20)
+
+enum {
+   OP_INSERT,
+   OP_SEARCH,
+   OP_MISS,
+   OP_ITERATE,
+   OP_REMOVE,
+   NUM_OPS,
+};
+
+static const char *op_names[NUM_OPS] = {
+   "insert", "search", "miss", "iterate", "remove",
+};
+
+static void
+bench_hash_table(void **keys, void **missing, unsigned size,
+                 unsigned repeat, uint64_t *ns)
+{
+   for (unsigned r = 0; r < repeat; r++) {
+      struct hash_table *ht = _mesa_pointer_hash_table_create(NULL);
+      int64_t start = os_time_get_nano();
+
+      for (unsigned i = 0; i < size; i++)
+         _mesa_hash_table_insert(ht, keys[i], keys[i]);
+
+      int64_t t0 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++) {
+         struct hash_entry *entry = _mesa_hash_table_search(ht, keys[i]);
+         assert(entry && entry->data == keys[i]);
+      }
+
+      int64_t t1 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++)
+         assert(!_mesa_hash_table_search(ht, missing[i]));
+
+      int64_t t2 = os_time_get_nano();
+      unsigned count = 0;
+      hash_table_foreach(ht, entry)
+         count++;
+      assert(count == size);
+
+      int64_t t3 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++)
+         _mesa_hash_table_remove_key(ht, keys[i]);
+      assert(_mesa_hash_table_num_entries(ht) == 0);
+
+      int64_t t4 = os_time_get_nano();
+
+      ns[OP_INSERT] += t0 - start;
+      ns[OP_SEARCH] += t1 - t0;
+      ns[OP_MISS] += t2 - t1;
+      ns[OP_ITERATE] += t3 - t2;
+      ns[OP_REMOVE] += t4 - t3;
+
+      _mesa_hash_table_destroy(ht, NULL);
+   }
+}
+
+static void
+bench_set(void **keys, void **missing, unsigned size,
+          unsigned repeat, uint64_t *ns)
+{
+   for (unsigned r = 0; r < repeat; r++) {
+      struct set *set = _mesa_pointer_set_create(NULL);
+      int64_t start = os_time_get_nano();
+
+      for (unsigned i = 0; i < size; i++)
+         _mesa_set_add(set, keys[i]);
+
+      int64_t t0 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++)
+         assert(_mesa_set_search(set, keys[i]));
+
+      int64_t t1 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++)
+         assert(!_mesa_set_search(set, missing[i]));
+
+      int64_t t2 = os_time_get_nano();
+      unsigned count = 0;
+      set_foreach(set, entry)
+         count++;
+      assert(count == size);
+
+      int64_t t3 = os_time_get_nano();
+      for (unsigned i = 0; i < size; i++)
+         _mesa_set_remove_key(set, keys[i]);
+      assert(set->entries == 0);
+
+      int64_t t4 = os_time_get_nano();
+
+      ns[OP_INSERT] += t0 - start;
+      ns[OP_SEARCH] += t1 - t0;
+      ns[OP_MISS] += t2 - t1;
+      ns[OP_ITERATE] += t3 - t2;
+      ns[OP_REMOVE] += t4 - t3;
+
+      _mesa_set_destroy(set, NULL);
+   }
+}
+
+static void
+print_results(const char *name, unsigned size, unsigned repeat,
+              const uint64_t *ns)
+{
+   printf("%-10s %8u", name, size);
+   for (unsigned op = 0; op < NUM_OPS; op++)
+      printf(" %8.2f", (double)ns[op] / ((double)size * repeat));
+   printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned sizes[] = { 16, 256, 4096, 65536, 1 << 20 };
+   const unsigned max_size = sizes[ARRAY_SIZE(sizes) - 1];
+   unsigned scale = argc > 1 ? atoi(argv[1]) : 1;
+
+   /* Pointers into allocations, like most keys in the driver. */
+   uint64_t *storage = malloc(2 * max_size * sizeof(*storage));
+   void **keys = malloc(max_size * sizeof(*keys));
+   void **missing = malloc(max_size * sizeof(*missing));
+   assert(storage && keys && missing);
+
+   for (unsigned i = 0; i < max_size; i++) {
+      keys[i] = &storage[2 * i];
+      missing[i] = &storage[2 * i + 1];
+   }
+
+   /* The keys are looked up in the order they were inserted, but the
+    * missing ones in a random order, not next to the previous one.
+    */
+   srand(42);
+   for (unsigned i = max_size - 1; i > 0; i--) {
+      unsigned j = rand() % (i + 1);
+      void *tmp = missing[i];
+      missing[i] = missing[j];
+      missing[j] = tmp;
+   }
+
+   printf("%-10s %8s", "", "entries");
+   for (unsigned op = 0; op < NUM_OPS; op++)
+      printf(" %8s", op_names[op]);
+   printf("\n");
+
+   for (unsigned s = 0; s < ARRAY_SIZE(sizes); s++) {
+      unsigned size = sizes[s];
+      unsigned repeat = MAX2(OPS_PER_SIZE / size, 1) * MAX2(scale, 1);
+      uint64_t ns[NUM_OPS] = { 0 };
+
+      bench_hash_table(keys, missing, size, repeat, ns);
+      print_results("hash_table", size, repeat, ns);
+   }
+
+   for (unsigned s = 0; s < ARRAY_SIZE(sizes); s++) {
+      unsigned size = sizes[s];
+      unsigned repeat = MAX2(OPS_PER_SIZE / size, 1) * MAX2(scale, 1);
+      uint64_t ns[NUM_OPS] = { 0 };
+
+      bench_set(keys, missing, size, repeat, ns);
+      print_results("set", size, repeat, ns);
+   }
+
+   free(storage);
+   free(keys);
+   free(missing);
+
+   return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Times building and allocating interference graphs shaped like the ones of
+ * large compute kernels: values of 1 to 8 contiguous registers live over
+ * random ranges of a long program, in a 128 register file.  Nodes are
+ * spilled until the allocation succeeds, like the backends do.
+ *
+ * An optional argument multiplies the number of nodes and the length of the
+ * program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/register_allocate.h"
+
+/* A small deterministic generator, so the graphs are the same everywhere. */
+static unsigned
+lcg_next(uint32_t *state)
+{
+   *state = *state * 1103515245u + 12345u;
+   return *state >> 16;
+}
+
+static void
+bench_graph(unsigned node_count, unsigned program_len, unsigned max_live_len,
+            uint32_t seed)
+{
+   static const unsigned class_sizes[] = { 1, 2, 3, 4, 8 };
+   const unsigned reg_count = 128;
+   void *mem_ctx = ralloc_context(NULL);
+
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, reg_count, false);
+   struct ra_class *classes[ARRAY_SIZE(class_sizes)];
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++) {
+      classes[i] = ra_alloc_contig_reg_class(regs, class_sizes[i]);
+      for (unsigned r = 0; r + class_sizes[i] <= reg_count; r++)
+         ra_class_add_reg(classes[i], r);
+   }
+   ra_set_finalize(regs, NULL);
+
+   unsigned *start = ralloc_array(mem_ctx, unsigned, node_count);
+   unsigned *end = ralloc_array(mem_ctx, unsigned, node_count);
+   unsigned *size = ralloc_array(mem_ctx, unsigned, node_count);
+   for (unsigned n = 0; n < node_count; n++) {
+      start[n] = lcg_next(&seed) % program_len;
+      end[n] = start[n] + 1 + lcg_next(&seed) % max_live_len;
+      size[n] = lcg_next(&seed) % ARRAY_SIZE(class_sizes);
+   }
+
+   int64_t build_start = os_time_get_nano();
+
+   struct ra_graph *g = ra_alloc_interference_graph(regs, node_count);
+   unsigned interferences = 0;
+   for (unsigned n = 0; n < node_count; n++) {
+      ra_set_node_class(g, n, classes[size[n]]);
+      ra_set_node_spill_cost(g, n, 1.0f + end[n] - start[n]);
+      for (unsigned m = 0; m < n; m++) {
+         if (start[n] < end[m] && start[m] < end[n]) {
+            ra_add_node_interference(g, n, m);
+            interferences++;
+         }
+      }
+   }
+
+   int64_t alloc_start = os_time_get_nano();
+
+   unsigned spills = 0;
+   while (!ra_allocate(g)) {
+      int n = ra_get_best_spill_node(g);
+      if (n < 0) {
+         fprintf(stderr, "no node to spill\n");
+         exit(1);
+      }
+      ra_reset_node_interference(g, n);
+      ra_set_node_spill_cost(g, n, 0.0f);
+      spills++;
+   }
+
+   int64_t alloc_end = os_time_get_nano();
+
+   printf("%u nodes, %u interferences: build %.2f ms, "
+          "allocate %.2f ms with %u spills\n",
+          node_count, interferences, (alloc_start - build_start) / 1e6,
+          (alloc_end - alloc_start) / 1e6, spills);
+
+   ralloc_free(mem_ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned scale = argc > 1 ? MAX2(atoi(argv[1]), 1) : 1;
+
+   bench_graph(4000 * scale, 40000 * scale, 400, 1);
+   bench_graph(4000 * scale, 28000 * scale, 400, 2);
+
+   return 0;
+}
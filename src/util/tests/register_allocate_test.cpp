@@ -22,6 +22,8 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
 #include "ralloc.h"
 #include "register_allocate.h"
 #include "register_allocate_internal.h"
@@ -279,3 +281,100 @@ TEST_F(ra_test, serialization_roundtrip)
    blob_finish(&blob);
 }
 
+/* A small deterministic generator, so the graphs are the same everywhere. */
+static unsigned
+lcg_next(uint32_t *state)
+{
+   *state = *state * 1103515245u + 12345u;
+   return *state >> 16;
+}
+
+/**
+ * Allocates an interference graph shaped like the ones of large compute
+ * kernels: values of 1 to 8 contiguous registers live over random ranges of
+ * a long program, in a 128 register file.  Nodes are spilled until the
+ * allocation succeeds, like the backends do, and the result is checked.
+ * The number of spilled nodes is returned in \p spills.
+ */
+static void
+allocate_large_graph(void *mem_ctx, unsigned node_count, unsigned program_len,
+                     unsigned max_live_len, uint32_t seed, unsigned *spills)
+{
+   static const unsigned class_sizes[] = { 1, 2, 3, 4, 8 };
+   const unsigned reg_count = 128;
+
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, reg_count, false);
+   struct ra_class *classes[ARRAY_SIZE(class_sizes)];
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++) {
+      classes[i] = ra_alloc_contig_reg_class(regs, class_sizes[i]);
+      for (unsigned r = 0; r + class_sizes[i] <= reg_count; r++)
+         ra_class_add_reg(classes[i], r);
+   }
+   ra_set_finalize(regs, NULL);
+
+   struct live_range {
+      unsigned start, end, size;
+   };
+   std::vector<live_range> ranges(node_count);
+   for (unsigned n = 0; n < node_count; n++) {
+      ranges[n].start = lcg_next(&seed) % program_len;
+      ranges[n].end = ranges[n].start + 1 + lcg_next(&seed) % max_live_len;
+      ranges[n].size = lcg_next(&seed) % ARRAY_SIZE(class_sizes);
+   }
+
+   struct ra_graph *g = ra_alloc_interference_graph(regs, node_count);
+   std::vector<std::pair<unsigned, unsigned>> edges;
+   for (unsigned n = 0; n < node_count; n++) {
+      ra_set_node_class(g, n, classes[ranges[n].size]);
+      ra_set_node_spill_cost(g, n, 1.0f + ranges[n].end - ranges[n].start);
+      for (unsigned m = 0; m < n; m++) {
+         if (ranges[n].start < ranges[m].end &&
+             ranges[m].start < ranges[n].end) {
+            ra_add_node_interference(g, n, m);
+            edges.push_back(std::make_pair(n, m));
+         }
+      }
+   }
+
+   std::vector<bool> spilled(node_count, false);
+   *spills = 0;
+   while (!ra_allocate(g)) {
+      int n = ra_get_best_spill_node(g);
+      ASSERT_GE(n, 0);
+      ra_reset_node_interference(g, n);
+      ra_set_node_spill_cost(g, n, 0.0f);
+      spilled[n] = true;
+      (*spills)++;
+   }
+
+   for (unsigned n = 0; n < node_count; n++) {
+      unsigned reg = ra_get_node_reg(g, n);
+      ASSERT_TRUE(BITSET_TEST(classes[ranges[n].size]->regs, reg));
+   }
+
+   for (const auto &e : edges) {
+      if (spilled[e.first] || spilled[e.second])
+         continue;
+
+      unsigned r1 = ra_get_node_reg(g, e.first);
+      unsigned r2 = ra_get_node_reg(g, e.second);
+      ASSERT_TRUE(r1 + class_sizes[ranges[e.first].size] <= r2 ||
+                  r2 + class_sizes[ranges[e.second].size] <= r1)
+         << "nodes " << e.first << " and " << e.second << " overlap";
+   }
+
+   ralloc_free(g);
+}
+
+TEST_F(ra_test, allocate_large_graph)
+{
+   unsigned spills;
+   allocate_large_graph(mem_ctx, 1000, 10000, 400, 1, &spills);
+}
+
+TEST_F(ra_test, allocate_large_graph_spilling)
+{
+   unsigned spills;
+   allocate_large_graph(mem_ctx, 1000, 7000, 400, 2, &spills);
+   EXPECT_GT(spills, 0u);
+}
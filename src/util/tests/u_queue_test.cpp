@@ -0,0 +1,295 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+#define NUM_JOBS 64
+
+struct shared_test_state {
+   int running;
+   int max_running;
+   int slot_used[UTIL_QUEUE_MAX_SHARED_THREADS];
+   int bad_slot;
+   int done;
+};
+
+struct shared_test_job {
+   struct shared_test_state *state;
+   struct util_queue_fence fence;
+};
+
+static void
+shared_test_execute(void *data, void *gdata, int thread_index)
+{
+   struct shared_test_job *job = (struct shared_test_job *)data;
+   struct shared_test_state *state = job->state;
+
+   /* The index must not be used by another running job of the queue. */
+   if (p_atomic_xchg(&state->slot_used[thread_index], 1))
+      p_atomic_set(&state->bad_slot, 1);
+
+   int running = p_atomic_inc_return(&state->running);
+   int max = p_atomic_read(&state->max_running);
+   while (running > max) {
+      int old = p_atomic_cmpxchg(&state->max_running, max, running);
+      if (old == max)
+         break;
+      max = old;
+   }
+
+   os_time_sleep(100);
+
+   p_atomic_dec(&state->running);
+   p_atomic_set(&state->slot_used[thread_index], 0);
+   p_atomic_inc(&state->done);
+}
+
+TEST(UtilQueue, SharedLimitsRunningJobs)
+{
+   struct util_queue queue;
+   struct shared_test_state state = {};
+   struct shared_test_job jobs[NUM_JOBS];
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 8, 2, UTIL_QUEUE_INIT_SHARED,
+                               NULL));
+   EXPECT_EQ(queue.threads, nullptr);
+
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      jobs[i].state = &state;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence,
+                         shared_test_execute, NULL, 0);
+   }
+
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+
+   EXPECT_EQ(state.done, NUM_JOBS);
+   EXPECT_LE(state.max_running, 2);
+   EXPECT_EQ(state.bad_slot, 0);
+
+   util_queue_destroy(&queue);
+}
+
+TEST(UtilQueue, SharedFinish)
+{
+   struct util_queue queues[3];
+   struct shared_test_state state = {};
+   struct shared_test_job jobs[NUM_JOBS];
+   const unsigned flags[3] = {
+      UTIL_QUEUE_INIT_INTERACTIVE,
+      0,
+      UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY,
+   };
+
+   /* Small queues which have to wait for free space. */
+   for (unsigned i = 0; i < 3; i++) {
+      ASSERT_TRUE(util_queue_init(&queues[i], "test", 4, 4,
+                                  UTIL_QUEUE_INIT_SHARED | flags[i], NULL));
+   }
+
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      jobs[i].state = &state;
+      util_queue_add_job(&queues[i % 3], &jobs[i], NULL,
+                         shared_test_execute, NULL, 0);
+   }
+
+   for (unsigned i = 0; i < 3; i++)
+      util_queue_finish(&queues[i]);
+
+   EXPECT_EQ(state.done, NUM_JOBS);
+
+   for (unsigned i = 0; i < 3; i++)
+      util_queue_destroy(&queues[i]);
+}
+
+static void
+blocking_execute(void *data, void *gdata, int thread_index)
+{
+   while (!p_atomic_read((int *)data))
+      os_time_sleep(100);
+}
+
+TEST(UtilQueue, SharedDropJob)
+{
+   struct util_queue queue;
+   struct shared_test_state state = {};
+   struct shared_test_job job = { &state };
+   struct util_queue_fence blocking_fence;
+   int release = 0;
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 8, 1, UTIL_QUEUE_INIT_SHARED,
+                               NULL));
+
+   /* With a single slot, the second job can't start before the first. */
+   util_queue_fence_init(&blocking_fence);
+   util_queue_fence_init(&job.fence);
+   util_queue_add_job(&queue, &release, &blocking_fence, blocking_execute,
+                      NULL, 0);
+   util_queue_add_job(&queue, &job, &job.fence, shared_test_execute, NULL, 0);
+
+   util_queue_drop_job(&queue, &job.fence);
+   EXPECT_TRUE(util_queue_fence_is_signalled(&job.fence));
+
+   p_atomic_set(&release, 1);
+   util_queue_finish(&queue);
+   EXPECT_TRUE(util_queue_fence_is_signalled(&blocking_fence));
+   EXPECT_EQ(state.done, 0);
+
+   util_queue_fence_destroy(&blocking_fence);
+   util_queue_fence_destroy(&job.fence);
+   util_queue_destroy(&queue);
+}
+
+struct priority_test_job {
+   enum util_queue_priority priority;
+   int *num_started;
+   enum util_queue_priority *order;
+};
+
+static void
+priority_test_execute(void *data, void *gdata, int thread_index)
+{
+   struct priority_test_job *job = (struct priority_test_job *)data;
+
+   job->order[p_atomic_inc_return(job->num_started) - 1] = job->priority;
+}
+
+struct priority_blocking_job {
+   int *started;
+   int *release;
+};
+
+static void
+priority_blocking_execute(void *data, void *gdata, int thread_index)
+{
+   struct priority_blocking_job *job = (struct priority_blocking_job *)data;
+
+   p_atomic_inc(job->started);
+   blocking_execute(job->release, gdata, thread_index);
+}
+
+TEST(UtilQueue, SharedPriorityOrder)
+{
+   /* Queued from the lowest priority to the highest. */
+   const unsigned flags[UTIL_QUEUE_NUM_PRIORITIES] = {
+      UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY,
+      0,
+      UTIL_QUEUE_INIT_INTERACTIVE,
+   };
+   const enum util_queue_priority priorities[UTIL_QUEUE_NUM_PRIORITIES] = {
+      UTIL_QUEUE_PRIORITY_BACKGROUND,
+      UTIL_QUEUE_PRIORITY_NORMAL,
+      UTIL_QUEUE_PRIORITY_INTERACTIVE,
+   };
+   const unsigned jobs_per_queue = 4;
+   struct util_queue queues[UTIL_QUEUE_NUM_PRIORITIES];
+   struct priority_test_job jobs[UTIL_QUEUE_NUM_PRIORITIES][jobs_per_queue];
+   enum util_queue_priority order[UTIL_QUEUE_NUM_PRIORITIES * jobs_per_queue];
+   int num_started = 0;
+
+   /* There is one shared thread per CPU.  All of them but one are kept busy
+    * so that the jobs start one after the other.
+    */
+   const unsigned num_threads = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+   std::vector<struct util_queue> blocking_queues(
+      DIV_ROUND_UP(num_threads, UTIL_QUEUE_MAX_SHARED_THREADS));
+   std::vector<struct priority_blocking_job> blocking_jobs(num_threads);
+   int started = 0, release_one = 0, release_all = 0;
+
+   for (unsigned q = 0; q < UTIL_QUEUE_NUM_PRIORITIES; q++) {
+      ASSERT_TRUE(util_queue_init(&queues[q], "test", 8, 1,
+                                  UTIL_QUEUE_INIT_SHARED | flags[q], NULL));
+   }
+   for (struct util_queue &queue : blocking_queues) {
+      ASSERT_TRUE(util_queue_init(&queue, "block", 4,
+                                  UTIL_QUEUE_MAX_SHARED_THREADS,
+                                  UTIL_QUEUE_INIT_SHARED, NULL));
+   }
+
+   /* Wait for each job to start before adding the next one, so that every
+    * job gets a thread of its own.
+    */
+   for (unsigned i = 0; i < num_threads; i++) {
+      blocking_jobs[i].started = &started;
+      blocking_jobs[i].release = i == 0 ? &release_one : &release_all;
+      util_queue_add_job(&blocking_queues[i / UTIL_QUEUE_MAX_SHARED_THREADS],
+                         &blocking_jobs[i], NULL, priority_blocking_execute,
+                         NULL, 0);
+      while (p_atomic_read(&started) <= (int)i)
+         os_time_sleep(100);
+   }
+
+   for (unsigned q = 0; q < UTIL_QUEUE_NUM_PRIORITIES; q++) {
+      for (unsigned i = 0; i < jobs_per_queue; i++) {
+         jobs[q][i].priority = priorities[q];
+         jobs[q][i].num_started = &num_started;
+         jobs[q][i].order = order;
+         util_queue_add_job(&queues[q], &jobs[q][i], NULL,
+                            priority_test_execute, NULL, 0);
+      }
+   }
+
+   /* Nothing can start before a thread is free. */
+   EXPECT_EQ(p_atomic_read(&num_started), 0);
+
+   p_atomic_set(&release_one, 1);
+   for (unsigned q = 0; q < UTIL_QUEUE_NUM_PRIORITIES; q++)
+      util_queue_finish(&queues[q]);
+
+   EXPECT_EQ(num_started, (int)ARRAY_SIZE(order));
+   for (unsigned i = 0; i < ARRAY_SIZE(order); i++) {
+      EXPECT_EQ(order[i], (enum util_queue_priority)(i / jobs_per_queue))
+         << "job " << i;
+   }
+
+   p_atomic_set(&release_all, 1);
+   for (unsigned q = 0; q < UTIL_QUEUE_NUM_PRIORITIES; q++)
+      util_queue_destroy(&queues[q]);
+   for (struct util_queue &queue : blocking_queues) {
+      util_queue_finish(&queue);
+      util_queue_destroy(&queue);
+   }
+}
+
+TEST(UtilQueue, Stats)
+{
+   for (unsigned shared = 0; shared < 2; shared++) {
+      struct util_queue queue;
+      struct shared_test_state state = {};
+      struct shared_test_job jobs[NUM_JOBS];
+      struct util_queue_stats stats;
+
+      ASSERT_TRUE(util_queue_init(&queue, "test", NUM_JOBS, 2,
+                                  shared ? UTIL_QUEUE_INIT_SHARED : 0, NULL));
+
+      for (unsigned i = 0; i < NUM_JOBS; i++) {
+         jobs[i].state = &state;
+         util_queue_add_job(&queue, &jobs[i], NULL, shared_test_execute,
+                            NULL, 0);
+      }
+      util_queue_finish(&queue);
+      util_queue_get_stats(&queue, &stats);
+
+      /* The barrier jobs of util_queue_finish are not counted. */
+      EXPECT_EQ(stats.num_jobs, (uint64_t)NUM_JOBS);
+      EXPECT_GE(stats.busy_time_ns, NUM_JOBS * 100000ull);
+      EXPECT_GE(stats.max_queued, 1u);
+      EXPECT_LE(stats.max_queued, (unsigned)NUM_JOBS);
+      EXPECT_GE(stats.wait_time_ns, stats.max_wait_ns);
+      EXPECT_GE(stats.elapsed_ns, stats.busy_time_ns / 2);
+      EXPECT_GE(stats.num_threads, 1u);
+      EXPECT_LE(stats.num_threads, 2u);
+
+      util_queue_destroy(&queue);
+   }
+}
@@ -27,6 +27,7 @@
 #include "u_queue.h"
 
 #include "c11/threads.h"
+#include "util/bitscan.h"
 #include "util/u_cpu_detect.h"
 #include "util/os_time.h"
 #include "util/u_string.h"
@@ -47,6 +48,8 @@
 static void
 util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
                         bool locked);
+static void
+shared_stop_threads(void);
 
 /****************************************************************************
  * Wait for all queues to assert idle when exit() is called.
@@ -73,6 +76,9 @@ atexit_handler(void)
       util_queue_kill_threads(iter, 0, false);
    }
    mtx_unlock(&exit_mutex);
+
+   /* The shared queues are idle now. */
+   shared_stop_threads();
 }
 
 static void
@@ -231,6 +237,79 @@ struct thread_input {
    int thread_index;
 };
 
+static void
+util_queue_finish_execute(void *data, void *gdata, int num_thread)
+{
+   util_barrier *barrier = data;
+   if (util_barrier_wait(barrier))
+      util_barrier_destroy(barrier);
+}
+
+/* Take the oldest queued job. The queue lock must be held. */
+static void
+util_queue_pop_job_locked(struct util_queue *queue, struct util_queue_job *job)
+{
+   *job = queue->jobs[queue->read_idx];
+   memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
+   queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
+
+   queue->num_queued--;
+   queue->num_started++;
+   cnd_signal(&queue->has_space_cond);
+
+   if (job->job) {
+      queue->total_jobs_size -= job->job_size;
+
+      if (job->execute != util_queue_finish_execute) {
+         uint64_t wait = os_time_get_nano() - job->submit_time;
+
+         queue->stats.num_jobs++;
+         queue->stats.wait_time_ns += wait;
+         queue->stats.max_wait_ns = MAX2(queue->stats.max_wait_ns, wait);
+      }
+   }
+}
+
+static void
+util_queue_run_job(struct util_queue *queue, struct util_queue_job *job,
+                   int thread_index)
+{
+   if (!job->job)
+      return;
+
+   if (job->execute != util_queue_finish_execute) {
+      int64_t start = os_time_get_nano();
+      job->execute(job->job, job->global_data, thread_index);
+      p_atomic_add(&queue->stats.busy_time_ns, os_time_get_nano() - start);
+   } else {
+      job->execute(job->job, job->global_data, thread_index);
+   }
+
+   if (job->fence)
+      util_queue_fence_signal(job->fence);
+   if (job->cleanup)
+      job->cleanup(job->job, job->global_data, thread_index);
+}
+
+/* Signal the jobs which will never be executed because all threads are
+ * being terminated. The queue lock must be held.
+ */
+static void
+util_queue_signal_remaining_jobs_locked(struct util_queue *queue)
+{
+   for (unsigned i = queue->read_idx; i != queue->write_idx;
+        i = (i + 1) % queue->max_jobs) {
+      if (queue->jobs[i].job) {
+         if (queue->jobs[i].fence)
+            util_queue_fence_signal(queue->jobs[i].fence);
+         queue->jobs[i].job = NULL;
+      }
+   }
+   queue->read_idx = queue->write_idx;
+   queue->num_queued = 0;
+   queue->num_started = queue->num_added;
+}
+
 static int
 util_queue_thread_func(void *input)
 {
@@ -280,39 +359,16 @@ util_queue_thread_func(void *input)
          break;
       }
 
-      job = queue->jobs[queue->read_idx];
-      memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
-      queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
-
-      queue->num_queued--;
-      cnd_signal(&queue->has_space_cond);
-      if (job.job)
-         queue->total_jobs_size -= job.job_size;
+      util_queue_pop_job_locked(queue, &job);
       mtx_unlock(&queue->lock);
 
-      if (job.job) {
-         job.execute(job.job, job.global_data, thread_index);
-         if (job.fence)
-            util_queue_fence_signal(job.fence);
-         if (job.cleanup)
-            job.cleanup(job.job, job.global_data, thread_index);
-      }
+      util_queue_run_job(queue, &job, thread_index);
    }
 
    /* signal remaining jobs if all threads are being terminated */
    mtx_lock(&queue->lock);
-   if (queue->num_threads == 0) {
-      for (unsigned i = queue->read_idx; i != queue->write_idx;
-           i = (i + 1) % queue->max_jobs) {
-         if (queue->jobs[i].job) {
-            if (queue->jobs[i].fence)
-               util_queue_fence_signal(queue->jobs[i].fence);
-            queue->jobs[i].job = NULL;
-         }
-      }
-      queue->read_idx = queue->write_idx;
-      queue->num_queued = 0;
-   }
+   if (queue->num_threads == 0)
+      util_queue_signal_remaining_jobs_locked(queue);
    mtx_unlock(&queue->lock);
    return 0;
 }
@@ -347,6 +403,244 @@ util_queue_create_thread(struct util_queue *queue, unsigned index)
    return true;
 }
 
+/****************************************************************************
+ * Threads shared by the UTIL_QUEUE_INIT_SHARED queues
+ *
+ * When every queue creates its own threads, a process with several contexts
+ * ends up with many more threads than CPUs. Shared queues only keep their
+ * list of jobs, and a common set of threads takes the oldest job of the
+ * first queue which has queued jobs and a free slot, looking at the queues
+ * by priority and in round-robin order within a priority. Jobs aren't
+ * assigned to a thread before they start, so an idle thread never has to
+ * steal work from a busy one.
+ *
+ * The threads are created on demand, up to one per CPU. They all run at the
+ * normal OS priority, because Linux doesn't allow restoring the priority of
+ * a thread once it has been lowered. They exit when the last shared queue is
+ * destroyed, so that none of them outlives the driver.
+ *
+ * The shared lock must be taken before the lock of a queue.
+ */
+
+struct shared_thread_input {
+   unsigned thread_index;
+   unsigned generation;
+};
+
+static struct {
+   mtx_t lock;
+   cnd_t has_queued_cond;
+   struct list_head queues[UTIL_QUEUE_NUM_PRIORITIES];
+   unsigned num_queues;
+   thrd_t *threads;
+   unsigned num_threads;
+   unsigned max_threads;
+   unsigned num_idle;
+   unsigned generation; /* threads of an older generation exit */
+} shared;
+
+static once_flag shared_once_flag = ONCE_FLAG_INIT;
+
+static void
+shared_init(void)
+{
+   (void) mtx_init(&shared.lock, mtx_plain);
+   cnd_init(&shared.has_queued_cond);
+
+   for (unsigned i = 0; i < UTIL_QUEUE_NUM_PRIORITIES; i++)
+      list_inithead(&shared.queues[i]);
+
+   shared.max_threads = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+}
+
+static int
+util_queue_shared_thread_func(void *data)
+{
+   struct shared_thread_input input = *(struct shared_thread_input *)data;
+
+   free(data);
+
+   /* Don't inherit the thread affinity of whichever thread created it. */
+   uint32_t mask[UTIL_MAX_CPUS / 32];
+
+   memset(mask, 0xff, sizeof(mask));
+   util_set_current_thread_affinity(mask, NULL,
+                                    util_get_cpu_caps()->num_cpu_mask_bits);
+
+   char name[16];
+   snprintf(name, sizeof(name), "mesa:shared%u", input.thread_index);
+   u_thread_setname(name);
+
+   mtx_lock(&shared.lock);
+   while (input.generation == shared.generation) {
+      struct util_queue *queue = NULL;
+      struct util_queue_job job;
+      unsigned slot = 0;
+
+      for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES && !queue; p++) {
+         list_for_each_entry(struct util_queue, iter, &shared.queues[p],
+                             shared_head) {
+            mtx_lock(&iter->lock);
+
+            uint32_t free_slots = ~iter->busy_slots &
+                                  BITFIELD_MASK(iter->num_threads);
+            if (iter->num_queued && free_slots) {
+               slot = ffs(free_slots) - 1;
+               iter->busy_slots |= BITFIELD_BIT(slot);
+               iter->slot_seq[slot] = iter->num_started;
+               util_queue_pop_job_locked(iter, &job);
+               queue = iter;
+            }
+
+            mtx_unlock(&iter->lock);
+
+            if (queue)
+               break;
+         }
+      }
+
+      if (!queue) {
+         shared.num_idle++;
+         cnd_wait(&shared.has_queued_cond, &shared.lock);
+         shared.num_idle--;
+         continue;
+      }
+
+      /* Let the other queues of this priority go first next time. */
+      list_del(&queue->shared_head);
+      list_addtail(&queue->shared_head, &shared.queues[queue->priority]);
+      mtx_unlock(&shared.lock);
+
+      util_queue_run_job(queue, &job, slot);
+
+      mtx_lock(&queue->lock);
+      queue->busy_slots &= ~BITFIELD_BIT(slot);
+      /* for util_queue_finish and util_queue_kill_threads */
+      cnd_broadcast(&queue->has_space_cond);
+      mtx_unlock(&queue->lock);
+
+      mtx_lock(&shared.lock);
+   }
+   mtx_unlock(&shared.lock);
+   return 0;
+}
+
+/* The shared lock must be held. */
+static bool
+shared_create_thread_locked(void)
+{
+   struct shared_thread_input *input =
+      (struct shared_thread_input *) malloc(sizeof(*input));
+   if (!input)
+      return false;
+
+   input->thread_index = shared.num_threads;
+   input->generation = shared.generation;
+
+   if (thrd_success != u_thread_create(shared.threads + shared.num_threads,
+                                       util_queue_shared_thread_func, input)) {
+      free(input);
+      return false;
+   }
+
+   shared.num_threads++;
+   return true;
+}
+
+/* Make the threads exit and wait for them. The shared lock must be held,
+ * it's released while waiting.
+ */
+static void
+shared_stop_threads_locked(void)
+{
+   thrd_t *threads = shared.threads;
+   unsigned num_threads = shared.num_threads;
+
+   shared.generation++;
+   shared.threads = NULL;
+   shared.num_threads = 0;
+   cnd_broadcast(&shared.has_queued_cond);
+
+   mtx_unlock(&shared.lock);
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_join(threads[i], NULL);
+   free(threads);
+   mtx_lock(&shared.lock);
+}
+
+static void
+shared_stop_threads(void)
+{
+   call_once(&shared_once_flag, shared_init);
+
+   mtx_lock(&shared.lock);
+   shared_stop_threads_locked();
+   mtx_unlock(&shared.lock);
+}
+
+static bool
+shared_add_queue(struct util_queue *queue)
+{
+   call_once(&shared_once_flag, shared_init);
+
+   mtx_lock(&shared.lock);
+   if (!shared.threads)
+      shared.threads = (thrd_t*) calloc(shared.max_threads, sizeof(thrd_t));
+
+   /* Make sure that there is a thread to execute the jobs. */
+   if (!shared.threads ||
+       (!shared.num_threads && !shared_create_thread_locked())) {
+      mtx_unlock(&shared.lock);
+      return false;
+   }
+
+   list_addtail(&queue->shared_head, &shared.queues[queue->priority]);
+   shared.num_queues++;
+   mtx_unlock(&shared.lock);
+   return true;
+}
+
+static void
+shared_remove_queue(struct util_queue *queue)
+{
+   mtx_lock(&shared.lock);
+   list_del(&queue->shared_head);
+   if (--shared.num_queues == 0)
+      shared_stop_threads_locked();
+   mtx_unlock(&shared.lock);
+}
+
+/* Called after adding a job to a shared queue, without holding its lock. */
+static void
+shared_wake_thread(void)
+{
+   mtx_lock(&shared.lock);
+   /* Scale the number of threads up if they are all busy. */
+   if (shared.num_idle ||
+       shared.num_threads == shared.max_threads ||
+       !shared.threads ||
+       !shared_create_thread_locked())
+      cnd_signal(&shared.has_queued_cond);
+   mtx_unlock(&shared.lock);
+}
+
+/* Whether jobs added before the job with sequence number \p seq are still
+ * running. The queue lock must be held.
+ */
+static bool
+util_queue_running_before_locked(struct util_queue *queue, uint64_t seq)
+{
+   u_foreach_bit(slot, queue->busy_slots) {
+      if (queue->slot_seq[slot] < seq)
+         return true;
+   }
+   return false;
+}
+
+/****************************************************************************
+ * util_queue API
+ */
+
 void
 util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads,
                               bool locked)
@@ -372,6 +666,19 @@ util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads,
       return;
    }
 
+   /* Shared queues only have a limit to raise. The shared lock can't be
+    * taken while holding the queue lock, so when called with the lock held,
+    * the queued jobs are started when the next job is added or done.
+    */
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED) {
+      queue->num_threads = num_threads;
+      if (!locked) {
+         mtx_unlock(&queue->lock);
+         shared_wake_thread();
+      }
+      return;
+   }
+
    /* Create threads.
     *
     * We need to update num_threads first, because threads terminate
@@ -433,6 +740,7 @@ util_queue_init(struct util_queue *queue,
    queue->num_threads = 1;
    queue->max_jobs = max_jobs;
    queue->global_data = global_data;
+   queue->init_time = os_time_get_nano();
 
    (void) mtx_init(&queue->lock, mtx_plain);
 
@@ -445,6 +753,29 @@ util_queue_init(struct util_queue *queue,
    if (!queue->jobs)
       goto fail;
 
+   if (flags & UTIL_QUEUE_INIT_SHARED) {
+      /* The shared threads are used, num_threads is the number of jobs
+       * which can run at the same time.
+       */
+      queue->max_threads = CLAMP(num_threads, 1, UTIL_QUEUE_MAX_SHARED_THREADS);
+      queue->num_threads = queue->max_threads;
+      queue->create_threads_on_demand = false;
+
+      if (flags & UTIL_QUEUE_INIT_INTERACTIVE)
+         queue->priority = UTIL_QUEUE_PRIORITY_INTERACTIVE;
+      else if (flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY)
+         queue->priority = UTIL_QUEUE_PRIORITY_BACKGROUND;
+      else
+         queue->priority = UTIL_QUEUE_PRIORITY_NORMAL;
+
+      queue->slot_seq = (uint64_t*) calloc(queue->max_threads, sizeof(uint64_t));
+      if (!queue->slot_seq || !shared_add_queue(queue))
+         goto fail;
+
+      add_to_atexit_list(queue);
+      return true;
+   }
+
    queue->threads = (thrd_t*) calloc(queue->max_threads, sizeof(thrd_t));
    if (!queue->threads)
       goto fail;
@@ -468,6 +799,7 @@ util_queue_init(struct util_queue *queue,
 
 fail:
    free(queue->threads);
+   free(queue->slot_seq);
 
    if (queue->jobs) {
       cnd_destroy(&queue->has_space_cond);
@@ -494,6 +826,22 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
       return;
    }
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED) {
+      /* The shared threads don't start jobs in the slots above num_threads,
+       * wait for those which are running.
+       */
+      queue->num_threads = keep_num_threads;
+      while (queue->busy_slots & ~BITFIELD_MASK(keep_num_threads))
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+
+      if (keep_num_threads == 0)
+         util_queue_signal_remaining_jobs_locked(queue);
+
+      if (!locked)
+         mtx_unlock(&queue->lock);
+      return;
+   }
+
    unsigned old_num_threads = queue->num_threads;
    /* Setting num_threads is what causes the threads to terminate.
     * Then cnd_broadcast wakes them up and they will exit their function.
@@ -515,14 +863,6 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
    }
 }
 
-static void
-util_queue_finish_execute(void *data, void *gdata, int num_thread)
-{
-   util_barrier *barrier = data;
-   if (util_barrier_wait(barrier))
-      util_barrier_destroy(barrier);
-}
-
 void
 util_queue_destroy(struct util_queue *queue)
 {
@@ -532,11 +872,15 @@ util_queue_destroy(struct util_queue *queue)
    if (queue->head.next != NULL)
       remove_from_atexit_list(queue);
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED)
+      shared_remove_queue(queue);
+
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    mtx_destroy(&queue->lock);
    free(queue->jobs);
    free(queue->threads);
+   free(queue->slot_seq);
 }
 
 static void
@@ -617,14 +961,22 @@ util_queue_add_job_locked(struct util_queue *queue,
    ptr->execute = execute;
    ptr->cleanup = cleanup;
    ptr->job_size = job_size;
+   ptr->submit_time = os_time_get_nano();
 
    queue->write_idx = (queue->write_idx + 1) % queue->max_jobs;
    queue->total_jobs_size += ptr->job_size;
 
    queue->num_queued++;
+   queue->num_added++;
+   queue->stats.max_queued = MAX2(queue->stats.max_queued, queue->num_queued);
    cnd_signal(&queue->has_queued_cond);
    if (!locked)
       mtx_unlock(&queue->lock);
+
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED) {
+      assert(!locked);
+      shared_wake_thread();
+   }
 }
 
 void
@@ -687,6 +1039,20 @@ util_queue_finish(struct util_queue *queue)
    util_barrier barrier;
    struct util_queue_fence *fences;
 
+   /* Shared queues have no threads of their own to block with a barrier.
+    * Jobs start in order, so wait until all jobs added so far have started
+    * and none of them is still running.
+    */
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED) {
+      mtx_lock(&queue->lock);
+      uint64_t seq = queue->num_added;
+      while (queue->num_started < seq ||
+             util_queue_running_before_locked(queue, seq))
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+      mtx_unlock(&queue->lock);
+      return;
+   }
+
    /* If 2 threads were adding jobs for 2 different barries at the same time,
     * a deadlock would happen, because 1 barrier requires that all threads
     * wait for it exclusively.
@@ -730,8 +1096,20 @@ int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
    /* Allow some flexibility by not raising an error. */
-   if (thread_index >= queue->num_threads)
+   if (!queue->threads || thread_index >= queue->num_threads)
       return 0;
 
    return util_thread_get_time_nano(queue->threads[thread_index]);
 }
+
+void
+util_queue_get_stats(struct util_queue *queue, struct util_queue_stats *stats)
+{
+   mtx_lock(&queue->lock);
+   *stats = queue->stats;
+   stats->num_threads = queue->num_threads;
+   mtx_unlock(&queue->lock);
+
+   stats->busy_time_ns = p_atomic_read(&queue->stats.busy_time_ns);
+   stats->elapsed_ns = os_time_get_nano() - queue->init_time;
+}
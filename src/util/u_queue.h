@@ -51,6 +51,32 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+/* Run the jobs on the threads shared by all such queues of the process
+ * instead of creating threads for this queue.  num_threads then only limits
+ * how many jobs of the queue run at the same time.  The jobs are started in
+ * order of priority: UTIL_QUEUE_INIT_INTERACTIVE, then the default, then
+ * UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY.
+ *
+ * thread_index is still unique among the running jobs of the queue and
+ * lower than num_threads, but the jobs don't run on a thread of their own,
+ * so such queues can't be used with util_queue_get_thread_time_nano or
+ * queue->threads.
+ */
+#define UTIL_QUEUE_INIT_SHARED                    (1 << 3)
+/* For UTIL_QUEUE_INIT_SHARED: the jobs are waited for by the application,
+ * like shader compiles needed to draw.
+ */
+#define UTIL_QUEUE_INIT_INTERACTIVE               (1 << 4)
+
+/* Shared queues can't run more jobs than this at the same time. */
+#define UTIL_QUEUE_MAX_SHARED_THREADS             32
+
+enum util_queue_priority {
+   UTIL_QUEUE_PRIORITY_INTERACTIVE,
+   UTIL_QUEUE_PRIORITY_NORMAL,
+   UTIL_QUEUE_PRIORITY_BACKGROUND,
+   UTIL_QUEUE_NUM_PRIORITIES,
+};
 
 #if UTIL_FUTEX_SUPPORTED
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -218,6 +244,22 @@ struct util_queue_job {
    struct util_queue_fence *fence;
    util_queue_execute_func execute;
    util_queue_execute_func cleanup;
+   int64_t submit_time;
+};
+
+/* Statistics of a queue since util_queue_init. */
+struct util_queue_stats {
+   uint64_t num_jobs;      /* jobs which were started */
+   uint64_t wait_time_ns;  /* sum of the times between adding and starting jobs */
+   uint64_t max_wait_ns;
+   uint64_t busy_time_ns;  /* sum of the execution times of the jobs */
+   uint64_t elapsed_ns;    /* time since util_queue_init */
+   unsigned max_queued;    /* the most jobs which were waiting at once */
+   unsigned num_threads;
+
+   /* busy_time_ns / (elapsed_ns * num_threads) is the occupancy of the
+    * threads, and wait_time_ns / num_jobs the average latency.
+    */
 };
 
 /* Put this into your context. */
@@ -240,6 +282,20 @@ struct util_queue {
 
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
+
+   /* UTIL_QUEUE_INIT_SHARED: link in the list of its priority, protected by
+    * the lock of the shared threads.  The other fields are protected by
+    * \p lock.
+    */
+   struct list_head shared_head;
+   enum util_queue_priority priority;
+   uint32_t busy_slots;     /* thread indices of the running jobs */
+   uint64_t *slot_seq;      /* sequence number of the job of each slot */
+   uint64_t num_added;      /* sequence number of the next added job */
+   uint64_t num_started;    /* sequence number of the next started job */
+
+   int64_t init_time;
+   struct util_queue_stats stats;
 };
 
 bool util_queue_init(struct util_queue *queue,
@@ -273,11 +329,14 @@ util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads,
 int64_t util_queue_get_thread_time_nano(struct util_queue *queue,
                                         unsigned thread_index);
 
+void util_queue_get_stats(struct util_queue *queue,
+                          struct util_queue_stats *stats);
+
 /* util_queue needs to be cleared to zeroes for this to work */
 static inline bool
 util_queue_is_initialized(struct util_queue *queue)
 {
-   return queue->threads != NULL;
+   return queue->jobs != NULL;
 }
 
 /* Convenient structure for monitoring the queue externally and passing